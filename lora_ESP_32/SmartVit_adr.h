@@ -0,0 +1,202 @@
+#ifndef SMARTVIT_ADR_H
+#define SMARTVIT_ADR_H
+
+// Adaptive data rate of the gateway, see the SV_ADR_ defines in SmartVit_lora.h
+//  The SNR of every node is averaged as if it sent at SV_ADR_POWER_MAX, so it does not move when the
+//  node follows a power hint. The spreading factor of the network is the fastest one that keeps
+//  SV_ADR_MARGIN_DB for the weakest node at full power, then each node gets the lowest power
+//  that still keeps the margin at that spreading factor.
+//  SNR only comes from the frames that get through, so losses count too: the network starts at
+//  SV_ADR_SF_MAX while no node is heard, steps up when an active node near the floor loses frames or
+//  any node falls silent, and only steps down again one spreading factor at a time, SV_ADR_HOLD_MS
+//  after the last step up. A node heard well above the floor loses its frames to collisions, longer
+//  slots would only add to them.
+//  The beacon also carries the data slots of the active nodes without a fixed default slot.
+
+/* ******************** INCLUDES ******************** */
+// SmartVit Libraries (SV)
+#include "SmartVit_lora.h"
+#include "SmartVit_frame.h"
+#include "SmartVit_nodes.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/* ******************** DEFINES ******************** */
+// Extra margin needed to move to a faster spreading factor, avoids toggling between two
+#define SV_ADR_HYSTERESIS_DB  3
+// Losses of a node only step the spreading factor up when its frames arrive less than this above the floor
+#define SV_ADR_LOSS_MARGIN_DB 5
+// Nodes not heard for this long (ms) no longer hold the spreading factor of the network
+#ifndef SV_ADR_NODE_TIMEOUT_MS
+#define SV_ADR_NODE_TIMEOUT_MS 3600000UL
+#endif
+// An active node not heard for this long (ms) is taken as fading, three readings at the 300 s period
+#ifndef SV_ADR_SILENT_MS
+#define SV_ADR_SILENT_MS 900000UL
+#endif
+// No step down for this long (ms) after a step up, nor more than one step up
+#ifndef SV_ADR_HOLD_MS
+#define SV_ADR_HOLD_MS 600000UL
+#endif
+
+/* ******************** FUNCTIONS ******************** */
+
+static inline int sv_adr_active(const sv_node_stats_t *entry, uint32_t now){
+  return entry->used && now - entry->last_seen < SV_ADR_NODE_TIMEOUT_MS;
+}
+
+// Lowest SNR the SX127x demodulates for a spreading factor, 0.1 dB (-7.5 dB at SF7, -2.5 dB per step)
+static inline int16_t sv_adr_required_snr(uint8_t sf){
+  return (int16_t)(-75 - 25 * (sf - 7));
+}
+
+// Accounts the SNR (0.1 dB) of a frame sent by the node with tx_power (dBm)
+static inline void sv_adr_update(sv_node_stats_t *entry, int16_t snr, int8_t tx_power){
+  int16_t snr_max = (int16_t)(snr + 10 * (SV_ADR_POWER_MAX - tx_power));
+
+  entry->snr_max = entry->received <= 1 ? snr_max : (int16_t)((3 * entry->snr_max + snr_max) / 4);
+  entry->tx_power = tx_power;
+}
+
+// Margin of the node at full power over the floor of sf and SV_ADR_MARGIN_DB, 0.1 dB
+static inline int16_t sv_adr_margin(const sv_node_stats_t *entry, uint8_t sf){
+  return (int16_t)(entry->snr_max - sv_adr_required_snr(sf) - 10 * SV_ADR_MARGIN_DB);
+}
+
+// Fastest spreading factor every active node gets through with at full power
+static inline uint8_t sv_adr_fastest_sf(const sv_node_table_t *table, uint8_t current_sf, uint32_t now){
+  uint8_t sf;
+  uint8_t i;
+
+  for (sf = SV_ADR_SF_MIN; sf < SV_ADR_SF_MAX; sf++){
+    int16_t needed = sf < current_sf ? 10 * SV_ADR_HYSTERESIS_DB : 0;
+    int fits = 1;
+    for (i = 0; i < SV_NODE_TABLE_LEN && fits; i++){
+      if (sv_adr_active(&table->entry[i], now) && sv_adr_margin(&table->entry[i], sf) < needed){
+        fits = 0;
+      }
+    }
+    if (fits){
+      return sf;
+    }
+  }
+  return SV_ADR_SF_MAX;
+}
+
+// Spreading factor of the next superframe, *raised is the time of the last step up
+//  Remembers the losses of each node seen so far (adr_lost), only new ones count
+static inline uint8_t sv_adr_network_sf(sv_node_table_t *table, uint8_t current_sf, uint32_t *raised, uint32_t now){
+  int active = 0;
+  int trouble = 0;
+  uint8_t fastest;
+  uint8_t i;
+
+  for (i = 0; i < SV_NODE_TABLE_LEN; i++){
+    sv_node_stats_t *entry = &table->entry[i];
+    if (!sv_adr_active(entry, now)){
+      continue;
+    }
+    active = 1;
+    int16_t snr = (int16_t)(entry->snr_max - 10 * (SV_ADR_POWER_MAX - entry->tx_power));
+    int thin = snr - sv_adr_required_snr(current_sf) < 10 * SV_ADR_LOSS_MARGIN_DB;
+    if ((thin && entry->lost > entry->adr_lost) || now - entry->last_seen > SV_ADR_SILENT_MS){
+      trouble = 1;
+    }
+    entry->adr_lost = entry->lost;
+  }
+  if (!active){
+    return SV_ADR_SF_MAX;     // nobody heard: the slowest one reaches every node
+  }
+  fastest = sv_adr_fastest_sf(table, current_sf, now);
+  if (fastest > current_sf || (trouble && current_sf < SV_ADR_SF_MAX && now - *raised >= SV_ADR_HOLD_MS)){
+    *raised = now;
+    return fastest > current_sf ? fastest : current_sf + 1;
+  }
+  if (fastest < current_sf && !trouble && now - *raised >= SV_ADR_HOLD_MS){
+    return current_sf - 1;
+  }
+  return current_sf;
+}
+
+// Lowest TX power that keeps the margin of the node at sf, in SV_ADR_POWER_STEP steps
+static inline int8_t sv_adr_power(const sv_node_stats_t *entry, uint8_t sf){
+  int16_t margin = sv_adr_margin(entry, sf);
+  int16_t power = SV_ADR_POWER_MAX;
+
+  while (margin >= 10 * SV_ADR_POWER_STEP && power - SV_ADR_POWER_STEP >= SV_ADR_POWER_MIN){
+    power -= SV_ADR_POWER_STEP;
+    margin -= 10 * SV_ADR_POWER_STEP;
+  }
+  return (int8_t)power;
+}
+
+// Fills the hints of the beacon with the nodes whose power must change, at most SV_BEACON_MAX_HINTS
+//  A silent node goes back to full power: its SNR is only known again once it is heard
+static inline void sv_adr_hints(const sv_node_table_t *table, sv_beacon_t *beacon, uint32_t now){
+  uint8_t i;
+
+  beacon->hint_count = 0;
+  for (i = 0; i < SV_NODE_TABLE_LEN && beacon->hint_count < SV_BEACON_MAX_HINTS; i++){
+    const sv_node_stats_t *entry = &table->entry[i];
+    int8_t power;
+    if (!sv_adr_active(entry, now)){
+      continue;
+    }
+    power = now - entry->last_seen > SV_ADR_SILENT_MS ? SV_ADR_POWER_MAX : sv_adr_power(entry, beacon->sf);
+    if (power != entry->tx_power){
+      beacon->hint[beacon->hint_count].node = entry->node;
+      beacon->hint[beacon->hint_count].tx_power = power;
+      beacon->hint_count++;
+    }
+  }
+}
+
+// Slot assignments of the beacon: the active nodes below slots keep their fixed default slot, the
+//  others get a free slot, at most SV_BEACON_MAX_SLOTS of them
+//  Returns the number of active nodes left without a fixed slot (no free slot or assignment left)
+static inline uint8_t sv_adr_slots(const sv_node_table_t *table, sv_beacon_t *beacon, uint32_t now){
+  uint8_t used[32];     // bitmap of the slots 0..255
+  uint8_t moved[SV_NODE_TABLE_LEN];
+  uint8_t collisions = 0;
+  uint8_t next = 1;
+  uint8_t i;
+
+  beacon->slot_count = 0;
+  if (beacon->slots == 0){
+    return 0;
+  }
+  memset(used, 0, sizeof(used));
+  // fixed default slots first, so that a moved node never takes the slot of another one
+  for (i = 0; i < SV_NODE_TABLE_LEN; i++){
+    uint8_t slot = sv_tdma_default_slot(table->entry[i].node, beacon->slots, 0);
+    moved[i] = 0;
+    if (!sv_adr_active(&table->entry[i], now)){
+      continue;
+    }
+    if (table->entry[i].node >= beacon->slots || (used[slot >> 3] & (1 << (slot & 7)))){
+      moved[i] = 1;
+      continue;
+    }
+    used[slot >> 3] |= (uint8_t)(1 << (slot & 7));
+  }
+  for (i = 0; i < SV_NODE_TABLE_LEN; i++){
+    if (!moved[i]){
+      continue;
+    }
+    while (next <= beacon->slots && (used[next >> 3] & (1 << (next & 7)))){
+      next++;
+    }
+    if (next > beacon->slots || beacon->slot_count == SV_BEACON_MAX_SLOTS){
+      collisions++;
+      continue;
+    }
+    used[next >> 3] |= (uint8_t)(1 << (next & 7));
+    beacon->slot[beacon->slot_count].node = table->entry[i].node;
+    beacon->slot[beacon->slot_count].slot = next;
+    beacon->slot_count++;
+  }
+  return collisions;
+}
+
+#endif // SMARTVIT_ADR_H
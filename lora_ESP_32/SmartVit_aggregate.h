@@ -0,0 +1,204 @@
+#ifndef SMARTVIT_AGGREGATE_H
+#define SMARTVIT_AGGREGATE_H
+
+// Windowed statistics of the readings of the sender (Welford running mean and variance)
+//  Fixed state per field, readings are added as they arrive and one summary frame is sent per
+//  SV_AGGREGATE_WINDOW_MS. A reading above its SV_TRIGGER_<NAME> threshold is sent at once too.
+//  Wind direction sectors (SV_CAL_WINDSOCK) are averaged as unit vectors, their spread is the
+//  circular standard deviation in sectors. Counts per interval (SV_SOURCE_PULSE_SUM, rain) are
+//  summed: the mean of the summary carries the total of the window.
+
+/* ******************** INCLUDES ******************** */
+// SmartVit Libraries (SV)
+#include "SmartVit_lora.h"
+#include "SmartVit_frame.h"
+#include "SmartVit_windsock.h"
+
+#include <math.h>
+#include <stdint.h>
+
+/* ******************** DEFINES ******************** */
+// Length of a window in ms, 0 sends every reading in a data frame and no summary
+#ifndef SV_AGGREGATE_WINDOW_MS
+#define SV_AGGREGATE_WINDOW_MS 900000UL     // 15 min
+#endif
+
+// Reading above which a data frame is sent immediately, in the units of the field
+//  SV_TRIGGER_OFF disables it
+#define SV_TRIGGER_OFF 1e30f
+#ifndef SV_TRIGGER_WIND_SPEED
+#define SV_TRIGGER_WIND_SPEED   15.0f       // m/s, gust
+#endif
+#ifndef SV_TRIGGER_WIND_DIR
+#define SV_TRIGGER_WIND_DIR     SV_TRIGGER_OFF
+#endif
+#ifndef SV_TRIGGER_RAIN
+#define SV_TRIGGER_RAIN         2.0f        // mm in one reading, sudden rainfall
+#endif
+#ifndef SV_TRIGGER_AIR_TEMP
+#define SV_TRIGGER_AIR_TEMP     SV_TRIGGER_OFF
+#endif
+#ifndef SV_TRIGGER_AIR_HUMID
+#define SV_TRIGGER_AIR_HUMID    SV_TRIGGER_OFF
+#endif
+#ifndef SV_TRIGGER_AIR_PRES
+#define SV_TRIGGER_AIR_PRES     SV_TRIGGER_OFF
+#endif
+#ifndef SV_TRIGGER_SOIL_PH
+#define SV_TRIGGER_SOIL_PH      SV_TRIGGER_OFF
+#endif
+#ifndef SV_TRIGGER_SOIL_TEMP
+#define SV_TRIGGER_SOIL_TEMP    SV_TRIGGER_OFF
+#endif
+#ifndef SV_TRIGGER_MOIST_1
+#define SV_TRIGGER_MOIST_1      SV_TRIGGER_OFF
+#endif
+#ifndef SV_TRIGGER_MOIST_2
+#define SV_TRIGGER_MOIST_2      SV_TRIGGER_OFF
+#endif
+#ifndef SV_TRIGGER_MOIST_3
+#define SV_TRIGGER_MOIST_3      SV_TRIGGER_OFF
+#endif
+
+// How the readings of a field are summarized, from its source and calibration in SV_SENSOR_TABLE
+#define SV_AGGREGATE_MEAN       0
+#define SV_AGGREGATE_SUM        1   // count per interval
+#define SV_AGGREGATE_DIRECTION  2   // wind sector, SV_WINDSOCK_SECTORS per turn
+
+/* ******************** TYPES AND STRUCTS ******************** */
+
+typedef struct {
+  uint16_t n;
+  float mean;
+  float m2;             // sum of the squared differences to the mean
+  float min;
+  float max;
+  float x;              // SV_AGGREGATE_DIRECTION: sum of the unit vectors of the readings
+  float y;
+  float last;
+} sv_running_stats_t;
+
+typedef struct {
+  sv_running_stats_t field[SV_FIELD_COUNT];
+  uint32_t started;     // caller time of the first reading of the window
+} sv_aggregate_t;
+
+#define SV_SENSOR_TRIGGER(name, source, channel, width, is_signed, scale, cal, cal_scale, cal_offset, key) \
+  SV_TRIGGER_##name,
+static const float sv_field_trigger[SV_FIELD_COUNT] = {
+  SV_SENSOR_TABLE(SV_SENSOR_TRIGGER)
+};
+#undef SV_SENSOR_TRIGGER
+
+#define SV_SENSOR_AGGREGATE(name, source, channel, width, is_signed, scale, cal, cal_scale, cal_offset, key) \
+  (cal == SV_CAL_WINDSOCK ? SV_AGGREGATE_DIRECTION : source == SV_SOURCE_PULSE_SUM ? SV_AGGREGATE_SUM : SV_AGGREGATE_MEAN),
+static const uint8_t sv_field_aggregate[SV_FIELD_COUNT] = {
+  SV_SENSOR_TABLE(SV_SENSOR_AGGREGATE)
+};
+#undef SV_SENSOR_AGGREGATE
+
+/* ******************** FUNCTIONS ******************** */
+
+static inline void sv_aggregate_reset(sv_aggregate_t *aggregate){
+  uint8_t field;
+
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    aggregate->field[field].n = 0;
+  }
+}
+
+static inline int sv_aggregate_empty(const sv_aggregate_t *aggregate){
+  uint8_t field;
+
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    if (aggregate->field[field].n){
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Adds every present field of data, returns true if one of them crossed its trigger
+static inline int sv_aggregate_add(sv_aggregate_t *aggregate, const struct all_sensors_data *data, uint32_t now){
+  int triggered = 0;
+  uint8_t field;
+
+  if (sv_aggregate_empty(aggregate)){
+    aggregate->started = now;
+  }
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    sv_running_stats_t *stats = &aggregate->field[field];
+    float value;
+    float delta;
+
+    if (!(data->present & SV_FIELD_BIT(field))){
+      continue;
+    }
+    value = data->value[field];
+    if (stats->n == 0){
+      stats->mean = 0;
+      stats->m2 = 0;
+      stats->min = value;
+      stats->max = value;
+      stats->x = 0;
+      stats->y = 0;
+    }
+    if (sv_field_aggregate[field] == SV_AGGREGATE_DIRECTION){
+      stats->x += cosf(value * 6.2831853f / SV_WINDSOCK_SECTORS);
+      stats->y += sinf(value * 6.2831853f / SV_WINDSOCK_SECTORS);
+      stats->last = value;
+    }
+    if (stats->n < UINT16_MAX){
+      stats->n++;
+    }
+    delta = value - stats->mean;
+    stats->mean += delta / stats->n;
+    stats->m2 += delta * (value - stats->mean);
+    if (value < stats->min){
+      stats->min = value;
+    }
+    if (value > stats->max){
+      stats->max = value;
+    }
+    if (value > sv_field_trigger[field]){
+      triggered = 1;
+    }
+  }
+  return triggered;
+}
+
+static inline int sv_aggregate_window_over(const sv_aggregate_t *aggregate, uint32_t now){
+  return !sv_aggregate_empty(aggregate) && now - aggregate->started >= SV_AGGREGATE_WINDOW_MS;
+}
+
+// Fills the statistics of the window into summary (node, seq and power are left to the caller)
+static inline void sv_aggregate_summary(const sv_aggregate_t *aggregate, struct sensors_summary *summary){
+  uint8_t field;
+
+  summary->mean.present = 0;
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    const sv_running_stats_t *stats = &aggregate->field[field];
+    if (stats->n == 0){
+      continue;
+    }
+    summary->min[field] = stats->min;
+    summary->max[field] = stats->max;
+    summary->std_dev[field] = stats->n > 1 ? sqrtf(stats->m2 / (stats->n - 1)) : 0;
+    if (sv_field_aggregate[field] == SV_AGGREGATE_SUM){
+      sv_field_set(&summary->mean, (sv_field_t)field, stats->mean * stats->n);
+    }
+    else if (sv_field_aggregate[field] == SV_AGGREGATE_DIRECTION){
+      // mean resultant length r of the unit vectors, circular standard deviation sqrt(-2 ln r)
+      float r = sqrtf(stats->x * stats->x + stats->y * stats->y) / stats->n;
+      sv_field_set(&summary->mean, (sv_field_t)field,
+                   sv_windsock_vector_direction(stats->x, stats->y, SV_WINDSOCK_SECTORS, (uint8_t)stats->last));
+      summary->std_dev[field] = r > 1e-3f ? sqrtf(-2 * logf(r < 1 ? r : 1)) * SV_WINDSOCK_SECTORS / 6.2831853f : SV_WINDSOCK_SECTORS;
+    }
+    else{
+      sv_field_set(&summary->mean, (sv_field_t)field, stats->mean);
+    }
+    summary->samples[field] = stats->n > 255 ? 255 : (uint8_t)stats->n;
+  }
+}
+
+#endif // SMARTVIT_AGGREGATE_H
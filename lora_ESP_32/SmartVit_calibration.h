@@ -0,0 +1,35 @@
+#ifndef SMARTVIT_CALIBRATION_H
+#define SMARTVIT_CALIBRATION_H
+
+/* ******************** INCLUDES ******************** */
+// SmartVit Libraries (SV)
+#include "SmartVit_lora.h"
+#include "SmartVit_sensors.h"
+#include "SmartVit_windsock.h"
+
+#include <stdint.h>
+
+/* ******************** FUNCTIONS ******************** */
+
+// Converts a raw MSP430 reading (ADC counts or pulses) to physical units
+//  This is the only place where the MSP430 readings are calibrated, the cases are expanded
+//  from SV_SENSOR_TABLE
+static inline float sv_calibrate(sv_field_t field, uint16_t raw){
+  switch(field){
+#define SV_SENSOR_CALIBRATE(name, source, channel, width, is_signed, scale, cal, cal_scale, cal_offset, key) \
+    case SV_FIELD_##name: \
+      if ((cal) == SV_CAL_WINDSOCK){ \
+        return (float)sv_windsock_sector(raw); \
+      } \
+      if ((cal) == SV_CAL_LINEAR){ \
+        return (float)raw * (float)(cal_scale) + (float)(cal_offset); \
+      } \
+      return (float)raw;
+    SV_SENSOR_TABLE(SV_SENSOR_CALIBRATE)
+#undef SV_SENSOR_CALIBRATE
+    default:
+      return 0;
+  }
+}
+
+#endif // SMARTVIT_CALIBRATION_H
@@ -0,0 +1,41 @@
+#ifndef SMARTVIT_CRC_H
+#define SMARTVIT_CRC_H
+
+/* ******************** INCLUDES ******************** */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* ******************** DEFINES ******************** */
+// CRC16-CCITT (polynomial 0x1021, initial value 0xFFFF)
+//  Bitwise implementation, no table, so it also fits the MSP430 flash
+#define SV_CRC16_INIT 0xFFFF
+#define SV_CRC16_POLY 0x1021
+
+/* ******************** FUNCTIONS ******************** */
+
+static inline uint16_t sv_crc16_update(uint16_t crc, uint8_t byte){
+  uint8_t i;
+
+  crc ^= (uint16_t)byte << 8;
+  for (i = 0; i < 8; i++){
+    if (crc & 0x8000){
+      crc = (uint16_t)((crc << 1) ^ SV_CRC16_POLY);
+    }
+    else{
+      crc = (uint16_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+static inline uint16_t sv_crc16(const uint8_t *buf, size_t len){
+  uint16_t crc = SV_CRC16_INIT;
+
+  while (len--){
+    crc = sv_crc16_update(crc, *buf++);
+  }
+  return crc;
+}
+
+#endif // SMARTVIT_CRC_H
@@ -0,0 +1,79 @@
+#ifndef SMARTVIT_DIAG_H
+#define SMARTVIT_DIAG_H
+
+// Instrumentation build (SV_DIAG): where the time of every cycle goes
+//  MSP430: ACLK ticks spent in each FSM state and low power mode, sent after every data frame in a
+//  link frame of SV_LINK_DIAG_ID() records, each counter as two 16 bit halves.
+//  ESP32 sender: microseconds spent in get_data(), encoding and on air, sent with the MSP430 counters
+//  added up in a diagnostics frame every SV_DIAG_PERIOD_FRAMES LoRa frames. The gateway prints them
+//  per cycle, so two firmware builds can be compared.
+
+/* ******************** INCLUDES ******************** */
+
+#include <stdint.h>
+
+/* ******************** DEFINES ******************** */
+#ifndef SV_DIAG
+#define SV_DIAG 0
+#endif
+#define SV_DIAG_PERIOD_FRAMES 10      // LoRa frames between two diagnostics frames
+#define SV_DIAG_MSP_HZ        4096    // MSP430 counters: ACLK ticks, 32768 Hz / 8
+
+// Nominal MSP430G2553 supply current in uA (12 MHz DCO, 3 V), only used for the charge estimate
+#define SV_DIAG_UA_ACTIVE     3000
+#define SV_DIAG_UA_LPM0       500
+#define SV_DIAG_UA_LPM3       1
+
+// X(name, label), the counters of the MSP430 come first
+#define SV_DIAG_TABLE(X) \
+  X(MSP_CLEAR,  "clearOutput") \
+  X(MSP_COUNT,  "countPulses") \
+  X(MSP_SCAN,   "scanADC")     \
+  X(MSP_SEND,   "sendData")    \
+  X(MSP_SLEEP,  "sleepMode")   \
+  X(MSP_LPM0,   "LPM0")        \
+  X(MSP_LPM3,   "LPM3")        \
+  X(MSP_CYCLES, "cycles")      \
+  X(GET_DATA,   "get_data")    \
+  X(ENCODE,     "encoding")    \
+  X(AIRTIME,    "on air")      \
+  X(FRAMES,     "frames")
+#define SV_DIAG_MSP_COUNTERS  7       // sent by the MSP430, MSP_CYCLES is counted by the ESP32
+
+// Link record ids of the two halves of a MSP430 counter, out of the sv_field_t range
+#define SV_LINK_DIAG_ID(counter, high)  (0x80 | ((counter) << 1) | (high))
+#define SV_LINK_IS_DIAG(id)             ((id) & 0x80)
+
+/* ******************** TYPES AND STRUCTS ******************** */
+
+#define SV_DIAG_ENUM(name, label) SV_DIAG_##name,
+typedef enum {
+  SV_DIAG_TABLE(SV_DIAG_ENUM)
+  SV_DIAG_COUNT
+} sv_diag_t;
+#undef SV_DIAG_ENUM
+
+typedef struct {
+  uint32_t counter[SV_DIAG_COUNT];
+} sv_diag_counters_t;
+
+/* ******************** FUNCTIONS ******************** */
+
+static inline void sv_diag_reset(sv_diag_counters_t *diag){
+  uint8_t i;
+
+  for (i = 0; i < SV_DIAG_COUNT; i++){
+    diag->counter[i] = 0;
+  }
+}
+
+// Adds one link record of the MSP430 counters, halves add up like the whole value
+static inline void sv_diag_add_record(sv_diag_counters_t *diag, uint8_t id, uint16_t value){
+  uint8_t counter = (uint8_t)((id & 0x7F) >> 1);
+
+  if (counter < SV_DIAG_MSP_COUNTERS){
+    diag->counter[counter] += (id & 1) ? (uint32_t)value << 16 : value;
+  }
+}
+
+#endif // SMARTVIT_DIAG_H
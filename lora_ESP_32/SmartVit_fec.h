@@ -0,0 +1,138 @@
+#ifndef SMARTVIT_FEC_H
+#define SMARTVIT_FEC_H
+
+// Forward error correction across LoRa frames: XOR parity of each group of SV_FEC_GROUP frames
+//  A group is the frames of one node with the same sequence number / SV_FEC_GROUP, so the gateway
+//  finds the boundaries without any exchange. Both sides XOR the frames of the current group into
+//  an accumulator of SV_FRAME_MAX_LEN bytes, the node sends it as the parity frame and the gateway
+//  gets the one missing frame back as parity XOR accumulator.
+
+/* ******************** INCLUDES ******************** */
+// SmartVit Libraries (SV)
+#include "SmartVit_lora.h"
+#include "SmartVit_crc.h"
+#include "SmartVit_frame.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* ******************** DEFINES ******************** */
+#if SV_FEC_GROUP > 16 || (SV_FEC_GROUP & (SV_FEC_GROUP - 1))
+#error "SV_FEC_GROUP must be 0 or a power of 2 up to 16"
+#endif
+#define SV_FEC_GROUP_MASK ((uint16_t)(SV_FEC_GROUP ? SV_FEC_GROUP - 1 : 0))
+
+/* ******************** TYPES AND STRUCTS ******************** */
+
+typedef struct {
+  uint8_t  parity[SV_FRAME_MAX_LEN];    // XOR of the frames of the group
+  uint8_t  len_xor;                     // XOR of their lengths
+  uint8_t  max_len;                     // longest frame
+  uint16_t group;                       // sequence number of the first frame
+  uint16_t received;                    // bit n: frame group + n added, 0 before the first frame
+} sv_fec_group_t;
+
+/* ******************** FUNCTIONS ******************** */
+
+static inline void sv_fec_reset(sv_fec_group_t *fec, uint16_t group){
+  uint8_t i;
+
+  for (i = 0; i < SV_FRAME_MAX_LEN; i++){
+    fec->parity[i] = 0;
+  }
+  fec->len_xor = 0;
+  fec->max_len = 0;
+  fec->group = group;
+  fec->received = 0;
+}
+
+// Adds the frame with sequence number seq, a frame of another group starts a new one
+//  Returns true when it was the last frame of its group
+static inline int sv_fec_add(sv_fec_group_t *fec, const uint8_t *frame, size_t len, uint16_t seq){
+  uint16_t group = seq & (uint16_t)~SV_FEC_GROUP_MASK;
+  uint16_t bit = (uint16_t)1 << (seq & SV_FEC_GROUP_MASK);
+  size_t i;
+
+  if (len > SV_FRAME_MAX_LEN){
+    return 0;
+  }
+  if (fec->received == 0 || fec->group != group){
+    sv_fec_reset(fec, group);
+  }
+  if (fec->received & bit){
+    return 0;     // already in the parity, adding it again would take it out
+  }
+  for (i = 0; i < len; i++){
+    fec->parity[i] ^= frame[i];
+  }
+  fec->len_xor ^= (uint8_t)len;
+  if (len > fec->max_len){
+    fec->max_len = (uint8_t)len;
+  }
+  fec->received |= bit;
+  return (seq & SV_FEC_GROUP_MASK) == SV_FEC_GROUP_MASK;
+}
+
+// Encodes the parity frame of the group, returns its length or 0 if buf is too small
+static inline size_t sv_fec_parity_encode(const sv_fec_group_t *fec, uint8_t node, uint8_t *buf, size_t buf_len){
+  size_t pos = SV_PARITY_HEADER_LEN;
+  uint8_t i;
+
+  if (buf_len < (size_t)(SV_PARITY_HEADER_LEN + fec->max_len + SV_FRAME_CRC_LEN)){
+    return 0;
+  }
+  buf[0] = (SV_FRAME_VERSION << 4) | SV_FRAME_TYPE_PARITY;
+  buf[SV_FRAME_NODE_POS] = node;
+  sv_put_le(&buf[SV_PARITY_GROUP_POS], fec->group, 2);
+  buf[SV_PARITY_COUNT_POS] = SV_FEC_GROUP;
+  buf[SV_PARITY_LEN_POS] = fec->len_xor;
+  for (i = 0; i < fec->max_len; i++){
+    buf[pos++] = fec->parity[i];
+  }
+  sv_put_le(&buf[pos], sv_crc16(buf, pos), SV_FRAME_CRC_LEN);
+  return pos + SV_FRAME_CRC_LEN;
+}
+
+// Returns SV_FRAME_OK or one of the SV_FRAME_ERR_* values
+static inline int sv_fec_parity_check(const uint8_t *buf, size_t len){
+  if (len < SV_PARITY_HEADER_LEN + SV_FRAME_CRC_LEN || len > SV_PACKET_MAX_LEN){
+    return SV_FRAME_ERR_LENGTH;
+  }
+  if ((buf[0] >> 4) != SV_FRAME_VERSION){
+    return SV_FRAME_ERR_VERSION;
+  }
+  if ((buf[0] & 0x0F) != SV_FRAME_TYPE_PARITY || buf[SV_PARITY_COUNT_POS] != SV_FEC_GROUP){
+    return SV_FRAME_ERR_TYPE;
+  }
+  if (sv_crc16(buf, len - SV_FRAME_CRC_LEN) != (uint16_t)sv_get_le(&buf[len - SV_FRAME_CRC_LEN], SV_FRAME_CRC_LEN, 0)){
+    return SV_FRAME_ERR_CRC;
+  }
+  return SV_FRAME_OK;
+}
+
+// Rebuilds the lost frame of the group from a checked parity frame
+//  Returns its length, or 0 if the parity is of another group or not exactly one frame is missing.
+//  The CRC of the rebuilt frame is checked by its decoder like for a received one.
+static inline size_t sv_fec_recover(const sv_fec_group_t *fec, const uint8_t *parity, size_t parity_len, uint8_t *frame){
+  size_t payload_len = parity_len - SV_PARITY_HEADER_LEN - SV_FRAME_CRC_LEN;
+  uint16_t missing = (uint16_t)(~fec->received & (((uint32_t)1 << SV_FEC_GROUP) - 1));
+  size_t len;
+  size_t i;
+
+  if (fec->received == 0 || fec->group != (uint16_t)sv_get_le(&parity[SV_PARITY_GROUP_POS], 2, 0)){
+    return 0;
+  }
+  if (missing == 0 || (missing & (missing - 1))){
+    return 0;
+  }
+  len = parity[SV_PARITY_LEN_POS] ^ fec->len_xor;
+  if (len < SV_FRAME_HEADER_LEN + SV_FRAME_CRC_LEN || len > payload_len || payload_len > SV_FRAME_MAX_LEN){
+    return 0;
+  }
+  for (i = 0; i < len; i++){
+    frame[i] = parity[SV_PARITY_HEADER_LEN + i] ^ fec->parity[i];
+  }
+  return len;
+}
+
+#endif // SMARTVIT_FEC_H
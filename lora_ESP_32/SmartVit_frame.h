@@ -0,0 +1,654 @@
+#ifndef SMARTVIT_FRAME_H
+#define SMARTVIT_FRAME_H
+
+/* ******************** INCLUDES ******************** */
+// SmartVit Libraries (SV)
+#include "SmartVit_lora.h"
+#include "SmartVit_crc.h"
+#include "SmartVit_diag.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* ******************** DEFINES ******************** */
+// Errors returned by sv_frame_decode() and sv_beacon_decode()
+#define SV_FRAME_OK             0
+#define SV_FRAME_ERR_LENGTH    -1
+#define SV_FRAME_ERR_VERSION   -2
+#define SV_FRAME_ERR_TYPE      -3
+#define SV_FRAME_ERR_CRC       -4
+#define SV_FRAME_ERR_REF       -5      // delta frame without its keyframe
+
+// Longest varint of a 32 bits value
+#define SV_VARINT_MAX_LEN       5
+
+// LoRa modem settings used by the airtime estimation (LoRa library defaults)
+#define SV_LORA_PREAMBLE_LEN  8
+#define SV_LORA_BANDWIDTH     125E3
+#define SV_LORA_CODING_RATE   5       // 4/5
+
+/* ******************** TYPES AND STRUCTS ******************** */
+
+// Wire description of one frame field
+typedef struct {
+  uint8_t  width;       // bytes on the wire
+  uint8_t  is_signed;
+  uint16_t scale;       // value * scale is sent
+} sv_field_desc_t;
+
+#define SV_SENSOR_FIELD_DESC(name, source, channel, width, is_signed, scale, cal, cal_scale, cal_offset, key) \
+  {width, is_signed, scale},
+static const sv_field_desc_t sv_field_desc[SV_FIELD_COUNT] = {
+  SV_SENSOR_TABLE(SV_SENSOR_FIELD_DESC)
+};
+#undef SV_SENSOR_FIELD_DESC
+
+// Beacon received by the senders
+typedef struct {
+  uint8_t node;
+  int8_t  tx_power;     // dBm
+} sv_adr_hint_t;
+
+typedef struct {
+  uint8_t node;
+  uint8_t slot;         // 1..slots
+} sv_tdma_slot_t;
+
+typedef struct {
+  uint8_t  slots;
+  uint16_t slot_ms;
+  uint8_t  sf;
+  uint8_t  hint_count;
+  uint8_t  slot_count;
+  uint8_t  superframe;  // counter, moves the default slots of the nodes above slots
+  sv_adr_hint_t hint[SV_BEACON_MAX_HINTS];
+  sv_tdma_slot_t slot[SV_BEACON_MAX_SLOTS];
+} sv_beacon_t;
+
+// Keyframe the delta frames of a node refer to, scaled integers as on the wire
+typedef struct {
+  int32_t  raw[SV_FIELD_COUNT];
+  uint16_t present;     // fields of the keyframe, 0 when there is none
+  uint16_t seq;
+} sv_delta_ref_t;
+
+/* ******************** FUNCTIONS ******************** */
+
+// Field access on all_sensors_data
+
+static inline float sv_field_get(const struct all_sensors_data *data, sv_field_t field){
+  return data->value[field];
+}
+
+// Stores the value and marks the field as present
+static inline void sv_field_set(struct all_sensors_data *data, sv_field_t field, float value){
+  data->value[field] = value;
+  data->present |= SV_FIELD_BIT(field);
+}
+
+// Scaled integer conversion
+
+// Rounds value * scale and saturates it to the wire width of the field
+static inline int32_t sv_field_to_raw(sv_field_t field, float value){
+  const sv_field_desc_t *desc = &sv_field_desc[field];
+  int32_t max = desc->is_signed ? ((int32_t)1 << (8 * desc->width - 1)) - 1 : ((int32_t)1 << (8 * desc->width)) - 1;
+  int32_t min = desc->is_signed ? -max - 1 : 0;
+  float scaled = value * desc->scale;
+
+  if (scaled >= (float)max){
+    return max;
+  }
+  if (scaled <= (float)min){
+    return min;
+  }
+  return (int32_t)(scaled >= 0 ? scaled + 0.5f : scaled - 0.5f);
+}
+
+static inline float sv_field_from_raw(sv_field_t field, int32_t raw){
+  return (float)raw / sv_field_desc[field].scale;
+}
+
+// Little endian helpers
+
+static inline void sv_put_le(uint8_t *buf, uint32_t value, uint8_t width){
+  uint8_t i;
+
+  for (i = 0; i < width; i++){
+    buf[i] = (uint8_t)(value >> (8 * i));
+  }
+}
+
+static inline int32_t sv_get_le(const uint8_t *buf, uint8_t width, uint8_t is_signed){
+  uint32_t value = 0;
+  uint8_t i;
+
+  for (i = 0; i < width; i++){
+    value |= (uint32_t)buf[i] << (8 * i);
+  }
+  if (is_signed && width < 4 && (value & ((uint32_t)1 << (8 * width - 1)))){
+    value |= ~(uint32_t)0 << (8 * width);           // sign extension
+  }
+  return (int32_t)value;
+}
+
+// Frame length for a given present bitmap, CRC included
+static inline size_t sv_frame_len(uint16_t present){
+  size_t len = SV_FRAME_HEADER_LEN + SV_FRAME_CRC_LEN;
+  uint8_t field;
+
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    if (present & SV_FIELD_BIT(field)){
+      len += sv_field_desc[field].width;
+    }
+  }
+  return len;
+}
+
+// Encodes every present field of data into buf
+//  Returns the frame length or 0 if buf is too small
+static inline size_t sv_frame_encode(const struct all_sensors_data *data, uint8_t *buf, size_t buf_len){
+  uint16_t present = data->present & SV_ENABLED_FIELDS;
+  size_t pos = SV_FRAME_HEADER_LEN;
+  uint8_t field;
+  uint16_t crc;
+
+  if (buf_len < sv_frame_len(present)){
+    return 0;
+  }
+
+  buf[0] = (SV_FRAME_VERSION << 4) | SV_FRAME_TYPE_DATA;
+  buf[SV_FRAME_NODE_POS] = data->node;
+  sv_put_le(&buf[SV_FRAME_SEQ_POS], data->seq, 2);
+  sv_put_le(&buf[SV_FRAME_PRESENT_POS], present, 2);
+  buf[SV_FRAME_POWER_POS] = (uint8_t)data->tx_power;
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    if (present & SV_FIELD_BIT(field)){
+      sv_put_le(&buf[pos], (uint32_t)sv_field_to_raw((sv_field_t)field, sv_field_get(data, (sv_field_t)field)), sv_field_desc[field].width);
+      pos += sv_field_desc[field].width;
+    }
+  }
+  crc = sv_crc16(buf, pos);
+  sv_put_le(&buf[pos], crc, SV_FRAME_CRC_LEN);
+
+  return pos + SV_FRAME_CRC_LEN;
+}
+
+// Checks the frame header, returns SV_FRAME_OK or one of the SV_FRAME_ERR_* values
+static inline int sv_frame_check_header(const uint8_t *buf){
+  uint16_t present;
+
+  if ((buf[0] >> 4) != SV_FRAME_VERSION){
+    return SV_FRAME_ERR_VERSION;
+  }
+  if ((buf[0] & 0x0F) != SV_FRAME_TYPE_DATA){
+    return SV_FRAME_ERR_TYPE;
+  }
+  present = (uint16_t)sv_get_le(&buf[SV_FRAME_PRESENT_POS], 2, 0);
+  if (present & ~(SV_FIELD_BIT(SV_FIELD_COUNT) - 1)){
+    return SV_FRAME_ERR_LENGTH;
+  }
+  return SV_FRAME_OK;
+}
+
+// Writes the node, sequence number and fields of an already checked frame into data
+static inline void sv_frame_decode_fields(const uint8_t *buf, struct all_sensors_data *data){
+  uint16_t present = (uint16_t)sv_get_le(&buf[SV_FRAME_PRESENT_POS], 2, 0);
+  size_t pos = SV_FRAME_HEADER_LEN;
+  uint8_t field;
+
+  data->node = buf[SV_FRAME_NODE_POS];
+  data->seq = (uint16_t)sv_get_le(&buf[SV_FRAME_SEQ_POS], 2, 0);
+  data->tx_power = (int8_t)buf[SV_FRAME_POWER_POS];
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    if (present & SV_FIELD_BIT(field)){
+      const sv_field_desc_t *desc = &sv_field_desc[field];
+      sv_field_set(data, (sv_field_t)field, sv_field_from_raw((sv_field_t)field, sv_get_le(&buf[pos], desc->width, desc->is_signed)));
+      pos += desc->width;
+    }
+  }
+}
+
+// Decodes a frame into data, only the fields present in the frame are written
+//  Returns SV_FRAME_OK or one of the SV_FRAME_ERR_* values
+static inline int sv_frame_decode(const uint8_t *buf, size_t len, struct all_sensors_data *data){
+  int status;
+
+  if (len < SV_FRAME_HEADER_LEN + SV_FRAME_CRC_LEN){
+    return SV_FRAME_ERR_LENGTH;
+  }
+  status = sv_frame_check_header(buf);
+  if (status != SV_FRAME_OK){
+    return status;
+  }
+  if (sv_frame_len((uint16_t)sv_get_le(&buf[SV_FRAME_PRESENT_POS], 2, 0)) != len){
+    return SV_FRAME_ERR_LENGTH;
+  }
+  if (sv_crc16(buf, len - SV_FRAME_CRC_LEN) != (uint16_t)sv_get_le(&buf[len - SV_FRAME_CRC_LEN], SV_FRAME_CRC_LEN, 0)){
+    return SV_FRAME_ERR_CRC;
+  }
+
+  sv_frame_decode_fields(buf, data);
+  return SV_FRAME_OK;
+}
+
+// Summary frame
+
+// Summary frame length for a given present bitmap, CRC included
+static inline size_t sv_summary_len(uint16_t present){
+  size_t len = SV_FRAME_HEADER_LEN + SV_FRAME_CRC_LEN;
+  uint8_t field;
+
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    if (present & SV_FIELD_BIT(field)){
+      len += 1 + 4 * sv_field_desc[field].width;
+    }
+  }
+  return len;
+}
+
+// Encodes every present field of summary into buf
+//  Returns the frame length or 0 if buf is too small
+static inline size_t sv_summary_encode(const struct sensors_summary *summary, uint8_t *buf, size_t buf_len){
+  const struct all_sensors_data *head = &summary->mean;
+  uint16_t present = head->present & SV_ENABLED_FIELDS;
+  size_t pos = SV_FRAME_HEADER_LEN;
+  uint8_t field;
+
+  if (buf_len < sv_summary_len(present)){
+    return 0;
+  }
+
+  buf[0] = (SV_FRAME_VERSION << 4) | SV_FRAME_TYPE_SUMMARY;
+  buf[SV_FRAME_NODE_POS] = head->node;
+  sv_put_le(&buf[SV_FRAME_SEQ_POS], head->seq, 2);
+  sv_put_le(&buf[SV_FRAME_PRESENT_POS], present, 2);
+  buf[SV_FRAME_POWER_POS] = (uint8_t)head->tx_power;
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    if (present & SV_FIELD_BIT(field)){
+      uint8_t width = sv_field_desc[field].width;
+      buf[pos++] = summary->samples[field];
+      sv_put_le(&buf[pos], (uint32_t)sv_field_to_raw((sv_field_t)field, head->value[field]), width);
+      sv_put_le(&buf[pos + width], (uint32_t)sv_field_to_raw((sv_field_t)field, summary->min[field]), width);
+      sv_put_le(&buf[pos + 2 * width], (uint32_t)sv_field_to_raw((sv_field_t)field, summary->max[field]), width);
+      sv_put_le(&buf[pos + 3 * width], (uint32_t)sv_field_to_raw((sv_field_t)field, summary->std_dev[field]), width);
+      pos += 4 * width;
+    }
+  }
+  sv_put_le(&buf[pos], sv_crc16(buf, pos), SV_FRAME_CRC_LEN);
+
+  return pos + SV_FRAME_CRC_LEN;
+}
+
+// Decodes a summary frame, only the fields present in the frame are written
+//  Returns SV_FRAME_OK or one of the SV_FRAME_ERR_* values
+static inline int sv_summary_decode(const uint8_t *buf, size_t len, struct sensors_summary *summary){
+  struct all_sensors_data *head = &summary->mean;
+  size_t pos = SV_FRAME_HEADER_LEN;
+  uint16_t present;
+  uint8_t field;
+
+  if (len < SV_FRAME_HEADER_LEN + SV_FRAME_CRC_LEN){
+    return SV_FRAME_ERR_LENGTH;
+  }
+  if ((buf[0] >> 4) != SV_FRAME_VERSION){
+    return SV_FRAME_ERR_VERSION;
+  }
+  if ((buf[0] & 0x0F) != SV_FRAME_TYPE_SUMMARY){
+    return SV_FRAME_ERR_TYPE;
+  }
+  present = (uint16_t)sv_get_le(&buf[SV_FRAME_PRESENT_POS], 2, 0);
+  if ((present & ~(SV_FIELD_BIT(SV_FIELD_COUNT) - 1)) || sv_summary_len(present) != len){
+    return SV_FRAME_ERR_LENGTH;
+  }
+  if (sv_crc16(buf, len - SV_FRAME_CRC_LEN) != (uint16_t)sv_get_le(&buf[len - SV_FRAME_CRC_LEN], SV_FRAME_CRC_LEN, 0)){
+    return SV_FRAME_ERR_CRC;
+  }
+
+  head->node = buf[SV_FRAME_NODE_POS];
+  head->seq = (uint16_t)sv_get_le(&buf[SV_FRAME_SEQ_POS], 2, 0);
+  head->tx_power = (int8_t)buf[SV_FRAME_POWER_POS];
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    if (present & SV_FIELD_BIT(field)){
+      const sv_field_desc_t *desc = &sv_field_desc[field];
+      summary->samples[field] = buf[pos++];
+      sv_field_set(head, (sv_field_t)field, sv_field_from_raw((sv_field_t)field, sv_get_le(&buf[pos], desc->width, desc->is_signed)));
+      summary->min[field] = sv_field_from_raw((sv_field_t)field, sv_get_le(&buf[pos + desc->width], desc->width, desc->is_signed));
+      summary->max[field] = sv_field_from_raw((sv_field_t)field, sv_get_le(&buf[pos + 2 * desc->width], desc->width, desc->is_signed));
+      summary->std_dev[field] = sv_field_from_raw((sv_field_t)field, sv_get_le(&buf[pos + 3 * desc->width], desc->width, desc->is_signed));
+      pos += 4 * desc->width;
+    }
+  }
+  return SV_FRAME_OK;
+}
+
+// Delta frame
+
+static inline uint32_t sv_zigzag_encode(int32_t value){
+  return ((uint32_t)value << 1) ^ (value < 0 ? ~(uint32_t)0 : 0);
+}
+
+static inline int32_t sv_zigzag_decode(uint32_t value){
+  return (int32_t)((value >> 1) ^ ((uint32_t)0 - (value & 1)));
+}
+
+// Little endian base 128: 7 bits per byte, the high bit set on every byte but the last
+static inline size_t sv_varint_put(uint8_t *buf, uint32_t value){
+  size_t len = 0;
+
+  while (value >= 0x80){
+    buf[len++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  buf[len++] = (uint8_t)value;
+  return len;
+}
+
+// Returns the bytes read, or 0 if the varint does not end within len bytes
+static inline size_t sv_varint_get(const uint8_t *buf, size_t len, uint32_t *value){
+  size_t pos = 0;
+
+  *value = 0;
+  while (pos < len && pos < SV_VARINT_MAX_LEN){
+    uint8_t byte = buf[pos];
+    *value |= (uint32_t)(byte & 0x7F) << (7 * pos);
+    pos++;
+    if (!(byte & 0x80)){
+      return pos;
+    }
+  }
+  return 0;
+}
+
+// Keeps the fields of a valid data frame as the keyframe of the next delta frames
+static inline void sv_delta_ref_set(sv_delta_ref_t *ref, const uint8_t *buf){
+  size_t pos = SV_FRAME_HEADER_LEN;
+  uint8_t field;
+
+  ref->present = (uint16_t)sv_get_le(&buf[SV_FRAME_PRESENT_POS], 2, 0);
+  ref->seq = (uint16_t)sv_get_le(&buf[SV_FRAME_SEQ_POS], 2, 0);
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    if (ref->present & SV_FIELD_BIT(field)){
+      const sv_field_desc_t *desc = &sv_field_desc[field];
+      ref->raw[field] = sv_get_le(&buf[pos], desc->width, desc->is_signed);
+      pos += desc->width;
+    }
+  }
+}
+
+// Encodes every present field of data as its difference to the keyframe ref
+//  Returns the frame length, or 0 when a data frame has to be sent instead: a field is missing
+//  from the keyframe, or the delta frame would not be shorter
+static inline size_t sv_delta_encode(const struct all_sensors_data *data, const sv_delta_ref_t *ref, uint8_t *buf, size_t buf_len){
+  uint16_t present = data->present & SV_ENABLED_FIELDS;
+  size_t full_len = sv_frame_len(present);
+  size_t pos = SV_FRAME_DELTA_HEADER_LEN;
+  uint8_t field;
+
+  if (ref->present == 0 || (present & ~ref->present)){
+    return 0;
+  }
+
+  buf[0] = (SV_FRAME_VERSION << 4) | SV_FRAME_TYPE_DELTA;
+  buf[SV_FRAME_NODE_POS] = data->node;
+  sv_put_le(&buf[SV_FRAME_SEQ_POS], data->seq, 2);
+  sv_put_le(&buf[SV_FRAME_PRESENT_POS], present, 2);
+  buf[SV_FRAME_POWER_POS] = (uint8_t)data->tx_power;
+  buf[SV_FRAME_DELTA_REF_POS] = (uint8_t)ref->seq;
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    if (present & SV_FIELD_BIT(field)){
+      int32_t raw = sv_field_to_raw((sv_field_t)field, sv_field_get(data, (sv_field_t)field));
+      if (pos + SV_VARINT_MAX_LEN + SV_FRAME_CRC_LEN > buf_len){
+        return 0;
+      }
+      pos += sv_varint_put(&buf[pos], sv_zigzag_encode((int32_t)((uint32_t)raw - (uint32_t)ref->raw[field])));
+    }
+  }
+  if (pos + SV_FRAME_CRC_LEN >= full_len){
+    return 0;
+  }
+  sv_put_le(&buf[pos], sv_crc16(buf, pos), SV_FRAME_CRC_LEN);
+
+  return pos + SV_FRAME_CRC_LEN;
+}
+
+// Decodes a delta frame against the keyframe ref, only the fields present in the frame are written
+//  With ref NULL the frame is only checked and its header written, the fields need the keyframe
+//  Returns SV_FRAME_OK, SV_FRAME_ERR_REF when ref is not the keyframe of the frame, or one of the
+//  SV_FRAME_ERR_* values
+static inline int sv_delta_decode(const uint8_t *buf, size_t len, const sv_delta_ref_t *ref, struct all_sensors_data *data){
+  int32_t delta[SV_FIELD_COUNT];
+  size_t pos = SV_FRAME_DELTA_HEADER_LEN;
+  uint16_t present;
+  uint8_t field;
+
+  if (len < SV_FRAME_DELTA_HEADER_LEN + SV_FRAME_CRC_LEN){
+    return SV_FRAME_ERR_LENGTH;
+  }
+  if ((buf[0] >> 4) != SV_FRAME_VERSION){
+    return SV_FRAME_ERR_VERSION;
+  }
+  if ((buf[0] & 0x0F) != SV_FRAME_TYPE_DELTA){
+    return SV_FRAME_ERR_TYPE;
+  }
+  present = (uint16_t)sv_get_le(&buf[SV_FRAME_PRESENT_POS], 2, 0);
+  if (present & ~(SV_FIELD_BIT(SV_FIELD_COUNT) - 1)){
+    return SV_FRAME_ERR_LENGTH;
+  }
+  if (sv_crc16(buf, len - SV_FRAME_CRC_LEN) != (uint16_t)sv_get_le(&buf[len - SV_FRAME_CRC_LEN], SV_FRAME_CRC_LEN, 0)){
+    return SV_FRAME_ERR_CRC;
+  }
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    if (present & SV_FIELD_BIT(field)){
+      uint32_t value;
+      size_t read = sv_varint_get(&buf[pos], len - SV_FRAME_CRC_LEN - pos, &value);
+      if (read == 0){
+        return SV_FRAME_ERR_LENGTH;
+      }
+      delta[field] = sv_zigzag_decode(value);
+      pos += read;
+    }
+  }
+  if (pos != len - SV_FRAME_CRC_LEN){
+    return SV_FRAME_ERR_LENGTH;
+  }
+
+  data->node = buf[SV_FRAME_NODE_POS];
+  data->seq = (uint16_t)sv_get_le(&buf[SV_FRAME_SEQ_POS], 2, 0);
+  data->tx_power = (int8_t)buf[SV_FRAME_POWER_POS];
+  if (ref == NULL){
+    return SV_FRAME_OK;
+  }
+  if ((present & ~ref->present) || buf[SV_FRAME_DELTA_REF_POS] != (uint8_t)ref->seq){
+    return SV_FRAME_ERR_REF;
+  }
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    if (present & SV_FIELD_BIT(field)){
+      sv_field_set(data, (sv_field_t)field, sv_field_from_raw((sv_field_t)field, (int32_t)((uint32_t)ref->raw[field] + (uint32_t)delta[field])));
+    }
+  }
+  return SV_FRAME_OK;
+}
+
+// Diagnostics frame
+
+static inline size_t sv_diag_encode(const sv_diag_counters_t *diag, uint8_t node, uint8_t *buf, size_t buf_len){
+  size_t pos = SV_DIAG_HEADER_LEN;
+  uint8_t i;
+
+  if (buf_len < SV_DIAG_HEADER_LEN + 4 * SV_DIAG_COUNT + SV_FRAME_CRC_LEN){
+    return 0;
+  }
+  buf[0] = (SV_FRAME_VERSION << 4) | SV_FRAME_TYPE_DIAG;
+  buf[SV_FRAME_NODE_POS] = node;
+  buf[SV_DIAG_COUNT_POS] = SV_DIAG_COUNT;
+  for (i = 0; i < SV_DIAG_COUNT; i++){
+    sv_put_le(&buf[pos], diag->counter[i], 4);
+    pos += 4;
+  }
+  sv_put_le(&buf[pos], sv_crc16(buf, pos), SV_FRAME_CRC_LEN);
+  return pos + SV_FRAME_CRC_LEN;
+}
+
+// Returns SV_FRAME_OK, the node and the counters (those the frame does not carry are 0), or one of
+// the SV_FRAME_ERR_* values
+static inline int sv_diag_decode(const uint8_t *buf, size_t len, uint8_t *node, sv_diag_counters_t *diag){
+  uint8_t count;
+  uint8_t i;
+
+  if (len < SV_DIAG_HEADER_LEN + SV_FRAME_CRC_LEN || len > SV_PACKET_MAX_LEN){
+    return SV_FRAME_ERR_LENGTH;
+  }
+  if ((buf[0] >> 4) != SV_FRAME_VERSION){
+    return SV_FRAME_ERR_VERSION;
+  }
+  if ((buf[0] & 0x0F) != SV_FRAME_TYPE_DIAG){
+    return SV_FRAME_ERR_TYPE;
+  }
+  count = buf[SV_DIAG_COUNT_POS];
+  if (count > SV_DIAG_COUNT || len != (size_t)(SV_DIAG_HEADER_LEN + 4 * count + SV_FRAME_CRC_LEN)){
+    return SV_FRAME_ERR_LENGTH;
+  }
+  if (sv_crc16(buf, len - SV_FRAME_CRC_LEN) != (uint16_t)sv_get_le(&buf[len - SV_FRAME_CRC_LEN], SV_FRAME_CRC_LEN, 0)){
+    return SV_FRAME_ERR_CRC;
+  }
+  *node = buf[SV_FRAME_NODE_POS];
+  sv_diag_reset(diag);
+  for (i = 0; i < count; i++){
+    diag->counter[i] = (uint32_t)sv_get_le(&buf[SV_DIAG_HEADER_LEN + 4 * i], 4, 0);
+  }
+  return SV_FRAME_OK;
+}
+
+// Frame type of a received packet, SV_FRAME_TYPE_*
+static inline uint8_t sv_frame_type(const uint8_t *buf){
+  return buf[0] & 0x0F;
+}
+
+// Beacon
+
+static inline size_t sv_beacon_encode(const sv_beacon_t *beacon, uint8_t *buf){
+  size_t pos = SV_BEACON_HEADER_LEN;
+  uint8_t i;
+
+  buf[0] = (SV_FRAME_VERSION << 4) | SV_FRAME_TYPE_BEACON;
+  buf[1] = beacon->slots;
+  sv_put_le(&buf[2], beacon->slot_ms, 2);
+  buf[4] = beacon->sf;
+  buf[5] = beacon->hint_count;
+  buf[6] = beacon->slot_count;
+  buf[7] = beacon->superframe;
+  for (i = 0; i < beacon->hint_count; i++){
+    buf[pos++] = beacon->hint[i].node;
+    buf[pos++] = (uint8_t)beacon->hint[i].tx_power;
+  }
+  for (i = 0; i < beacon->slot_count; i++){
+    buf[pos++] = beacon->slot[i].node;
+    buf[pos++] = beacon->slot[i].slot;
+  }
+  sv_put_le(&buf[pos], sv_crc16(buf, pos), SV_FRAME_CRC_LEN);
+  return pos + SV_FRAME_CRC_LEN;
+}
+
+// Returns SV_FRAME_OK and the beacon, or one of the SV_FRAME_ERR_* values
+static inline int sv_beacon_decode(const uint8_t *buf, size_t len, sv_beacon_t *beacon){
+  size_t pos = SV_BEACON_HEADER_LEN;
+  uint8_t i;
+
+  if (len < SV_BEACON_HEADER_LEN + SV_FRAME_CRC_LEN || len > SV_BEACON_MAX_LEN){
+    return SV_FRAME_ERR_LENGTH;
+  }
+  if ((buf[0] >> 4) != SV_FRAME_VERSION){
+    return SV_FRAME_ERR_VERSION;
+  }
+  if ((buf[0] & 0x0F) != SV_FRAME_TYPE_BEACON || buf[1] == 0){
+    return SV_FRAME_ERR_TYPE;
+  }
+  if (buf[5] > SV_BEACON_MAX_HINTS || buf[6] > SV_BEACON_MAX_SLOTS ||
+      len != (size_t)(SV_BEACON_HEADER_LEN + buf[5] * SV_BEACON_HINT_LEN + buf[6] * SV_BEACON_SLOT_LEN + SV_FRAME_CRC_LEN)){
+    return SV_FRAME_ERR_LENGTH;
+  }
+  if (sv_crc16(buf, len - SV_FRAME_CRC_LEN) != (uint16_t)sv_get_le(&buf[len - SV_FRAME_CRC_LEN], SV_FRAME_CRC_LEN, 0)){
+    return SV_FRAME_ERR_CRC;
+  }
+  beacon->slots = buf[1];
+  beacon->slot_ms = (uint16_t)sv_get_le(&buf[2], 2, 0);
+  beacon->sf = buf[4];
+  beacon->hint_count = buf[5];
+  beacon->slot_count = buf[6];
+  beacon->superframe = buf[7];
+  for (i = 0; i < beacon->hint_count; i++){
+    beacon->hint[i].node = buf[pos++];
+    beacon->hint[i].tx_power = (int8_t)buf[pos++];
+  }
+  for (i = 0; i < beacon->slot_count; i++){
+    beacon->slot[i].node = buf[pos++];
+    beacon->slot[i].slot = buf[pos++];
+  }
+  return SV_FRAME_OK;
+}
+
+// TX power hint of the beacon for node, returns false if there is none
+static inline int sv_beacon_hint(const sv_beacon_t *beacon, uint8_t node, int8_t *tx_power){
+  uint8_t i;
+
+  for (i = 0; i < beacon->hint_count; i++){
+    if (beacon->hint[i].node == node){
+      *tx_power = beacon->hint[i].tx_power;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Data slot of node when the beacon does not assign one
+//  Fixed below slots. Above, the nodes that share a slot (n, n + slots, ...) move by a different
+//  step at every superframe, so they only meet again once every slots superframes
+static inline uint8_t sv_tdma_default_slot(uint8_t node, uint8_t slots, uint8_t superframe){
+  uint32_t lap = node / slots;
+
+  return (uint8_t)(1 + (node + lap * superframe) % slots);
+}
+
+// Data slot of node in the superframe of the beacon, the assigned one if any
+static inline uint8_t sv_beacon_slot(const sv_beacon_t *beacon, uint8_t node){
+  uint8_t i;
+
+  for (i = 0; i < beacon->slot_count; i++){
+    if (beacon->slot[i].node == node && beacon->slot[i].slot >= 1 && beacon->slot[i].slot <= beacon->slots){
+      return beacon->slot[i].slot;
+    }
+  }
+  return sv_tdma_default_slot(node, beacon->slots, beacon->superframe);
+}
+
+// Delay in ms from the reception of a beacon to the slot of node
+static inline uint32_t sv_tdma_slot_offset_ms(const sv_beacon_t *beacon, uint8_t node){
+  return (uint32_t)sv_beacon_slot(beacon, node) * beacon->slot_ms;
+}
+
+static inline uint32_t sv_tdma_superframe_ms(uint8_t slots, uint16_t slot_ms){
+  return (uint32_t)(slots + 1) * slot_ms;
+}
+
+// Estimated time on air of a LoRa packet in microseconds (Semtech AN1200.13)
+//  Explicit header and payload CRC on, low data rate optimization above 16 ms symbols
+static inline uint32_t sv_lora_airtime_us(size_t payload_len, uint8_t sf, uint32_t bandwidth, uint8_t coding_rate){
+  uint32_t symbol_us = (uint32_t)(((uint64_t)1000000 << sf) / bandwidth);
+  int32_t low_dr = symbol_us > 16000 ? 1 : 0;
+  int32_t numerator = 8 * (int32_t)payload_len - 4 * sf + 28 + 16;
+  int32_t denominator = 4 * (sf - 2 * low_dr);
+  uint32_t payload_symbols = 8;
+
+  if (numerator > 0){
+    payload_symbols += (uint32_t)((numerator + denominator - 1) / denominator) * coding_rate;
+  }
+  // preamble lasts SV_LORA_PREAMBLE_LEN + 4.25 symbols
+  return ((4 * SV_LORA_PREAMBLE_LEN + 17) * symbol_us) / 4 + payload_symbols * symbol_us;
+}
+
+// Slot length for a spreading factor, the longest packet plus the guard time
+static inline uint16_t sv_tdma_slot_ms(uint8_t sf){
+  return (uint16_t)(sv_lora_airtime_us(SV_FEC_GROUP ? SV_PACKET_MAX_LEN : SV_FRAME_MAX_LEN, sf, SV_LORA_BANDWIDTH, SV_LORA_CODING_RATE) / 1000 + SV_TDMA_GUARD_MS);
+}
+
+#endif // SMARTVIT_FRAME_H
@@ -0,0 +1,339 @@
+#ifndef SMARTVIT_JOURNAL_H
+#define SMARTVIT_JOURNAL_H
+
+// Store-and-forward journal of received LoRa frames on LittleFS
+//  Records ([len][frame]) are appended to segment files /svj_<id> of at most SV_JOURNAL_SEGMENT_SIZE
+//  bytes, the ids grow forever so the files of the ring are always the ids ack..head.
+//  The position of the first record not acknowledged by the server is kept in /svj_ack, it only
+//  moves after a 2xx answer. When the ring is full the oldest segment is overwritten (counted as lost).
+//  Records are buffered in RAM and written to flash in one commit when their segment is full or the
+//  oldest one is SV_JOURNAL_FLUSH_MS old: LittleFS copies the partial last block of a file on every
+//  commit, so one commit per record programmed about half a block for 31 bytes. Records acknowledged
+//  before their flush never reach flash, a reset loses the records still in RAM.
+//  LittleFS commits each flush atomically, and the frame CRC of each record is checked on read so a
+//  damaged segment only loses its own tail.
+
+/* ******************** INCLUDES ******************** */
+// SmartVit Libraries (SV)
+#include "SmartVit_lora.h"
+#include "SmartVit_crc.h"
+#include "SmartVit_frame.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <FS.h>
+#include <LittleFS.h>
+
+/* ******************** DEFINES ******************** */
+// Ring size on flash, SV_JOURNAL_SEGMENTS * SV_JOURNAL_SEGMENT_SIZE bytes
+#ifndef SV_JOURNAL_SEGMENTS
+#define SV_JOURNAL_SEGMENTS     8
+#endif
+#ifndef SV_JOURNAL_SEGMENT_SIZE
+#define SV_JOURNAL_SEGMENT_SIZE 4096
+#endif
+// Age of the oldest buffered record that flushes the buffer (ms), the records a reset may lose
+//  Well above UPLOAD_BATCH_AGE_MS of the receiver: while the server answers, nothing is written
+#ifndef SV_JOURNAL_FLUSH_MS
+#define SV_JOURNAL_FLUSH_MS     300000UL
+#endif
+
+#define SV_JOURNAL_PREFIX   "/svj_"
+#define SV_JOURNAL_ACK      "/svj_ack"
+#define SV_JOURNAL_ACK_TMP  "/svj_ack.tmp"
+#define SV_JOURNAL_PATH_LEN 20
+
+/* ******************** TYPES AND STRUCTS ******************** */
+
+typedef struct {
+  uint32_t segment;
+  uint32_t offset;
+} sv_journal_pos_t;
+
+typedef struct {
+  sv_journal_pos_t ack;     // first record not acknowledged
+  sv_journal_pos_t saved;   // ack position on flash, never past the flushed records
+  sv_journal_pos_t head;    // where the next record is appended
+  uint32_t flushed;         // bytes of the head segment on flash, the records after them are in buf
+  uint32_t buffered_at;     // time of the oldest record in buf (ms)
+  uint32_t pending;         // records between ack and head
+  uint32_t lost;            // records overwritten before being acknowledged
+  uint8_t  buf[SV_JOURNAL_SEGMENT_SIZE];
+} sv_journal_t;
+
+/* ******************** FUNCTIONS ******************** */
+
+static inline void sv_journal_path(char *path, uint32_t segment){
+  snprintf(path, SV_JOURNAL_PATH_LEN, SV_JOURNAL_PREFIX "%lu", (unsigned long)segment);
+}
+
+// Reads the record at the file position into frame
+//  Returns the frame length, or 0 at the end of the segment or on a damaged record
+static inline size_t sv_journal_read_record(fs::File &file, uint8_t *frame){
+  int len = file.read();
+
+  if (len < SV_FRAME_HEADER_LEN + SV_FRAME_CRC_LEN || len > SV_FRAME_MAX_LEN){
+    return 0;
+  }
+  if (file.read(frame, (size_t)len) != (size_t)len){
+    return 0;
+  }
+  if (sv_crc16(frame, (size_t)len - SV_FRAME_CRC_LEN) != (uint16_t)sv_get_le(&frame[len - SV_FRAME_CRC_LEN], SV_FRAME_CRC_LEN, 0)){
+    return 0;
+  }
+  return (size_t)len;
+}
+
+// Valid records of a segment from offset on, *end gets the offset after the last one
+static inline uint32_t sv_journal_count(uint32_t segment, uint32_t offset, uint32_t *end){
+  char path[SV_JOURNAL_PATH_LEN];
+  uint8_t frame[SV_FRAME_MAX_LEN];
+  uint32_t count = 0;
+  size_t len;
+
+  *end = offset;
+  sv_journal_path(path, segment);
+  fs::File file = LittleFS.open(path, "r");
+  if (!file){
+    return 0;
+  }
+  if (!file.seek(offset)){
+    file.close();
+    return 0;
+  }
+  while ((len = sv_journal_read_record(file, frame)) != 0){
+    *end += 1 + len;
+    count++;
+  }
+  file.close();
+  return count;
+}
+
+// Saves the ack position, up to the flushed records, and removes the segments it passed
+//  Nothing is written when the position on flash does not change
+static inline bool sv_journal_save_ack(sv_journal_t *journal){
+  char path[SV_JOURNAL_PATH_LEN];
+  sv_journal_pos_t pos = journal->ack;
+  uint8_t buf[10];
+
+  if (pos.segment == journal->head.segment && pos.offset > journal->flushed){
+    pos.offset = journal->flushed;
+  }
+  if (pos.segment == journal->saved.segment && pos.offset == journal->saved.offset){
+    return true;
+  }
+  sv_put_le(&buf[0], pos.segment, 4);
+  sv_put_le(&buf[4], pos.offset, 4);
+  sv_put_le(&buf[8], sv_crc16(buf, 8), 2);
+
+  fs::File file = LittleFS.open(SV_JOURNAL_ACK_TMP, "w");
+  if (!file){
+    return false;
+  }
+  bool ok = file.write(buf, sizeof(buf)) == sizeof(buf);
+  file.close();
+  if (!ok || !LittleFS.rename(SV_JOURNAL_ACK_TMP, SV_JOURNAL_ACK)){
+    return false;
+  }
+  // the acknowledged segments are only removed once the new position is on flash
+  for (; journal->saved.segment < pos.segment; journal->saved.segment++){
+    sv_journal_path(path, journal->saved.segment);
+    LittleFS.remove(path);
+  }
+  journal->saved = pos;
+  return true;
+}
+
+// Recovers the journal from flash, LittleFS must be mounted
+static inline void sv_journal_begin(sv_journal_t *journal){
+  char path[SV_JOURNAL_PATH_LEN];
+  uint8_t buf[10];
+  uint32_t segment;
+  uint32_t end;
+
+  journal->ack.segment = 0;
+  journal->ack.offset = 0;
+  journal->pending = 0;
+  journal->lost = 0;
+  journal->buffered_at = 0;
+
+  fs::File file = LittleFS.open(SV_JOURNAL_ACK, "r");
+  if (file){
+    if (file.read(buf, sizeof(buf)) == sizeof(buf) && sv_crc16(buf, 8) == (uint16_t)sv_get_le(&buf[8], 2, 0)){
+      journal->ack.segment = (uint32_t)sv_get_le(&buf[0], 4, 0);
+      journal->ack.offset = (uint32_t)sv_get_le(&buf[4], 4, 0);
+    }
+    file.close();
+  }
+  journal->saved = journal->ack;
+
+  // a reset between saving the ack and removing the segments it passed leaves them behind
+  for (segment = journal->ack.segment; segment > 0; segment--){
+    sv_journal_path(path, segment - 1);
+    if (!LittleFS.exists(path)){
+      break;
+    }
+    LittleFS.remove(path);
+  }
+
+  // the segments of the ring are contiguous from the acknowledged one
+  journal->head.segment = journal->ack.segment;
+  sv_journal_path(path, journal->head.segment + 1);
+  while (LittleFS.exists(path)){
+    journal->head.segment++;
+    sv_journal_path(path, journal->head.segment + 1);
+  }
+  for (segment = journal->ack.segment; segment <= journal->head.segment; segment++){
+    journal->pending += sv_journal_count(segment, segment == journal->ack.segment ? journal->ack.offset : 0, &end);
+  }
+
+  // append after the last valid record, never behind a damaged one
+  sv_journal_path(path, journal->head.segment);
+  file = LittleFS.open(path, "r");
+  journal->head.offset = 0;
+  if (file){
+    uint32_t size = file.size();
+    file.close();
+    sv_journal_count(journal->head.segment, 0, &end);
+    if (end != size){
+      journal->head.segment++;
+    }
+    else{
+      journal->head.offset = end;
+    }
+  }
+  journal->flushed = journal->head.offset;
+}
+
+// Writes the records buffered in RAM to the head segment, one commit for all of them
+//  On a failed write they stay in RAM and move to the next segment, never behind a partial write
+static inline bool sv_journal_flush(sv_journal_t *journal){
+  char path[SV_JOURNAL_PATH_LEN];
+  uint32_t len = journal->head.offset - journal->flushed;
+
+  if (len == 0){
+    return true;
+  }
+  sv_journal_path(path, journal->head.segment);
+  fs::File file = LittleFS.open(path, "a");
+  bool ok = file && file.write(journal->buf, len) == len;
+  if (file){
+    file.close();
+  }
+  if (!ok){
+    if (journal->ack.segment == journal->head.segment && journal->ack.offset >= journal->flushed){
+      journal->ack.segment++;
+      journal->ack.offset -= journal->flushed;
+    }
+    journal->head.segment++;
+    journal->head.offset = len;
+    journal->flushed = 0;
+    return false;
+  }
+  journal->flushed = journal->head.offset;
+  // an ack within the buffered records can go to flash now
+  return sv_journal_save_ack(journal);
+}
+
+// True when the oldest buffered record has waited SV_JOURNAL_FLUSH_MS
+static inline bool sv_journal_flush_due(const sv_journal_t *journal, uint32_t now){
+  return journal->head.offset != journal->flushed && now - journal->buffered_at >= SV_JOURNAL_FLUSH_MS;
+}
+
+// Appends a frame received at now (ms), overwriting the oldest segment if the ring is full
+//  The record stays in RAM until the next flush
+static inline bool sv_journal_append(sv_journal_t *journal, const uint8_t *frame, size_t len, uint32_t now){
+  char path[SV_JOURNAL_PATH_LEN];
+  uint32_t end;
+
+  if (len > SV_FRAME_MAX_LEN){
+    return false;
+  }
+  if (journal->head.offset + 1 + len > SV_JOURNAL_SEGMENT_SIZE){
+    if (!sv_journal_flush(journal)){
+      return false;
+    }
+    journal->head.segment++;
+    journal->head.offset = 0;
+    journal->flushed = 0;
+  }
+  if (journal->head.segment - journal->ack.segment >= SV_JOURNAL_SEGMENTS){
+    uint32_t dropped = sv_journal_count(journal->ack.segment, journal->ack.offset, &end);
+    journal->lost += dropped;
+    journal->pending = journal->pending > dropped ? journal->pending - dropped : 0;
+    sv_journal_path(path, journal->ack.segment);
+    LittleFS.remove(path);
+    journal->ack.segment++;
+    journal->ack.offset = 0;
+    sv_journal_save_ack(journal);
+  }
+
+  if (journal->head.offset == journal->flushed){
+    journal->buffered_at = now;
+  }
+  journal->buf[journal->head.offset - journal->flushed] = (uint8_t)len;
+  memcpy(&journal->buf[journal->head.offset - journal->flushed + 1], frame, len);
+  journal->head.offset += 1 + len;
+  journal->pending++;
+  return true;
+}
+
+// Reads the record at *pos into frame and moves *pos after it
+//  Returns the frame length, or 0 when the head is reached
+static inline size_t sv_journal_read(const sv_journal_t *journal, sv_journal_pos_t *pos, uint8_t *frame){
+  char path[SV_JOURNAL_PATH_LEN];
+  size_t len = 0;
+
+  while (len == 0){
+    if (pos->segment == journal->head.segment && pos->offset >= journal->head.offset){
+      return 0;
+    }
+    if (pos->segment > journal->head.segment){
+      return 0;
+    }
+    if (pos->segment == journal->head.segment && pos->offset >= journal->flushed){
+      // not flushed yet, written by sv_journal_append()
+      const uint8_t *record = &journal->buf[pos->offset - journal->flushed];
+      len = record[0];
+      memcpy(frame, &record[1], len);
+    }
+    else{
+      sv_journal_path(path, pos->segment);
+      fs::File file = LittleFS.open(path, "r");
+      if (file){
+        if (file.seek(pos->offset)){
+          len = sv_journal_read_record(file, frame);
+        }
+        file.close();
+      }
+    }
+    if (len == 0){
+      // end or damaged tail of a segment, continue with the next one
+      pos->segment++;
+      pos->offset = 0;
+    }
+    else{
+      pos->offset += 1 + len;
+    }
+  }
+  return len;
+}
+
+// Acknowledges the count records read before pos (uploaded or skipped), after the server accepted them
+static inline bool sv_journal_ack(sv_journal_t *journal, sv_journal_pos_t pos, uint32_t count){
+  journal->ack = pos;
+  journal->pending = journal->pending > count ? journal->pending - count : 0;
+  if (pos.segment > journal->head.segment || (pos.segment == journal->head.segment && pos.offset >= journal->head.offset)){
+    journal->pending = 0;       // the records lost in a damaged tail were never read
+    if (pos.segment == journal->head.segment){
+      // every buffered record acknowledged: dropped from RAM, never written
+      journal->head.offset = journal->flushed;
+      journal->ack = journal->head;
+    }
+  }
+  return sv_journal_save_ack(journal);
+}
+
+#endif // SMARTVIT_JOURNAL_H
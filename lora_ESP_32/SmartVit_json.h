@@ -0,0 +1,184 @@
+#ifndef SMARTVIT_JSON_H
+#define SMARTVIT_JSON_H
+
+/* ******************** INCLUDES ******************** */
+// SmartVit Libraries (SV)
+#include "SmartVit_lora.h"
+#include "SmartVit_frame.h"
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* ******************** DEFINES ******************** */
+// Size of a json object holding every field, of a data frame and of a summary frame
+#define SV_JSON_MAX_LEN 320
+#define SV_JSON_SUMMARY_MAX_LEN 768
+
+/* ******************** TYPES AND STRUCTS ******************** */
+
+// Json array of objects built in a caller buffer, sent to the server in one request
+typedef struct {
+  char *buf;
+  size_t size;
+  size_t len;           // without the closing bracket
+  uint16_t count;       // objects in the array
+} sv_json_batch_t;
+
+// Key used by the server for each field
+#define SV_SENSOR_JSON_KEY(name, source, channel, width, is_signed, scale, cal, cal_scale, cal_offset, key) key,
+static const char * const sv_field_json_key[SV_FIELD_COUNT] = {
+  SV_SENSOR_TABLE(SV_SENSOR_JSON_KEY)
+};
+#undef SV_SENSOR_JSON_KEY
+
+/* ******************** FUNCTIONS ******************** */
+
+// Prints a scaled integer as a decimal number (no float formatting needed)
+static inline int sv_json_put_fixed(char *buf, size_t len, int32_t raw, uint16_t scale){
+  const char *sign = raw < 0 ? "-" : "";
+  uint32_t value = raw < 0 ? (uint32_t)-raw : (uint32_t)raw;
+
+  if (scale >= 100){
+    return snprintf(buf, len, "%s%lu.%02lu", sign, (unsigned long)(value / scale), (unsigned long)(value % scale));
+  }
+  if (scale >= 10){
+    return snprintf(buf, len, "%s%lu.%lu", sign, (unsigned long)(value / scale), (unsigned long)(value % scale));
+  }
+  return snprintf(buf, len, "%s%lu", sign, (unsigned long)value);
+}
+
+// Serializes the node, sequence number and every present field of data as a json object into buf
+//  Returns the string length or 0 if buf is too small
+static inline size_t sv_json_write(const struct all_sensors_data *data, char *buf, size_t len){
+  size_t pos = 0;
+  uint8_t field;
+  int written;
+
+  written = snprintf(buf, len, "{\"node\":%u,\"seq\":%u", (unsigned)data->node, (unsigned)data->seq);
+  if (written < 0 || (size_t)written >= len){
+    return 0;
+  }
+  pos += written;
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    if (!(data->present & SV_FIELD_BIT(field))){
+      continue;
+    }
+    written = snprintf(&buf[pos], len - pos, ",\"%s\":", sv_field_json_key[field]);
+    if (written < 0 || (size_t)written >= len - pos){
+      return 0;
+    }
+    pos += written;
+    written = sv_json_put_fixed(&buf[pos], len - pos, sv_field_to_raw((sv_field_t)field, sv_field_get(data, (sv_field_t)field)), sv_field_desc[field].scale);
+    if (written < 0 || (size_t)written >= len - pos){
+      return 0;
+    }
+    pos += written;
+  }
+  if (pos + 2 > len){
+    return 0;
+  }
+  buf[pos++] = '}';
+  buf[pos] = '\0';
+  return pos;
+}
+
+// Serializes a summary as a json object into buf, each present field as "key":[mean,min,max,std_dev,samples]
+//  Returns the string length or 0 if buf is too small
+static inline size_t sv_json_write_summary(const struct sensors_summary *summary, char *buf, size_t len){
+  const struct all_sensors_data *head = &summary->mean;
+  size_t pos = 0;
+  uint8_t field;
+  int written;
+
+  written = snprintf(buf, len, "{\"node\":%u,\"seq\":%u,\"summary\":1", (unsigned)head->node, (unsigned)head->seq);
+  if (written < 0 || (size_t)written >= len){
+    return 0;
+  }
+  pos += written;
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    const float *stat[4];
+    uint8_t i;
+
+    if (!(head->present & SV_FIELD_BIT(field))){
+      continue;
+    }
+    stat[0] = &head->value[field];
+    stat[1] = &summary->min[field];
+    stat[2] = &summary->max[field];
+    stat[3] = &summary->std_dev[field];
+    written = snprintf(&buf[pos], len - pos, ",\"%s\":[", sv_field_json_key[field]);
+    if (written < 0 || (size_t)written >= len - pos){
+      return 0;
+    }
+    pos += written;
+    for (i = 0; i < 4; i++){
+      written = sv_json_put_fixed(&buf[pos], len - pos, sv_field_to_raw((sv_field_t)field, *stat[i]), sv_field_desc[field].scale);
+      if (written < 0 || (size_t)written + 1 >= len - pos){
+        return 0;
+      }
+      pos += written;
+      buf[pos++] = ',';
+    }
+    written = snprintf(&buf[pos], len - pos, "%u]", (unsigned)summary->samples[field]);
+    if (written < 0 || (size_t)written >= len - pos){
+      return 0;
+    }
+    pos += written;
+  }
+  if (pos + 2 > len){
+    return 0;
+  }
+  buf[pos++] = '}';
+  buf[pos] = '\0';
+  return pos;
+}
+
+// Json batch
+
+static inline void sv_json_batch_reset(sv_json_batch_t *batch){
+  batch->buf[0] = '[';
+  batch->len = 1;
+  batch->count = 0;
+}
+
+static inline void sv_json_batch_init(sv_json_batch_t *batch, char *buf, size_t size){
+  batch->buf = buf;
+  batch->size = size;
+  sv_json_batch_reset(batch);
+}
+
+// Appends data (or summary if it is not NULL) as one more object, room for "]" is always kept
+//  Returns false if it does not fit, the batch is left unchanged
+static inline int sv_json_batch_add(sv_json_batch_t *batch, const struct all_sensors_data *data, const struct sensors_summary *summary){
+  size_t pos = batch->len + (batch->count ? 1 : 0);
+  size_t written;
+
+  if (pos + 2 >= batch->size){
+    return 0;
+  }
+  if (summary != NULL){
+    written = sv_json_write_summary(summary, &batch->buf[pos], batch->size - pos - 1);
+  }
+  else{
+    written = sv_json_write(data, &batch->buf[pos], batch->size - pos - 1);
+  }
+  if (written == 0){
+    return 0;
+  }
+  if (batch->count){
+    batch->buf[batch->len] = ',';
+  }
+  batch->len = pos + written;
+  batch->count++;
+  return 1;
+}
+
+// Closes the array, returns the body length
+static inline size_t sv_json_batch_finish(sv_json_batch_t *batch){
+  batch->buf[batch->len] = ']';
+  batch->buf[batch->len + 1] = '\0';
+  return batch->len + 1;
+}
+
+#endif // SMARTVIT_JSON_H
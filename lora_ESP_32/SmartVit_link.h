@@ -0,0 +1,215 @@
+#ifndef SMARTVIT_LINK_H
+#define SMARTVIT_LINK_H
+
+// MSP430 -> ESP32 UART link protocol, shared by msp/main.c and the LoRa sender
+//  Payload: [seq] then one record per field: [sv_field_t][value, little endian]
+//           followed by the CRC16-CCITT of seq and records (little endian)
+//  The payload is COBS encoded and every frame ends with a 0x00 delimiter,
+//  so the receiver resynchronizes on the next delimiter after any error.
+//  The instrumentation build also sends frames of SV_LINK_DIAG_ID() records (SmartVit_diag.h).
+
+/* ******************** INCLUDES ******************** */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "SmartVit_crc.h"
+#include "SmartVit_sensors.h"
+#include "SmartVit_diag.h"
+
+/* ******************** DEFINES ******************** */
+
+#define SV_LINK_DELIMITER     0x00
+#define SV_LINK_SEQ_LEN       1
+#define SV_LINK_CRC_LEN       2
+#define SV_LINK_VALUE_LEN     sizeof(sv_link_value_t)
+#define SV_LINK_RECORD_LEN    (1 + SV_LINK_VALUE_LEN)
+// Largest frame: the readings, or the MSP430 counters of the instrumentation build
+#define SV_LINK_MAX_RECORDS   (SV_DIAG && 2 * SV_DIAG_MSP_COUNTERS > SV_FIELD_COUNT ? 2 * SV_DIAG_MSP_COUNTERS : SV_FIELD_COUNT)
+#define SV_LINK_MAX_PAYLOAD   (SV_LINK_SEQ_LEN + SV_LINK_MAX_RECORDS * SV_LINK_RECORD_LEN + SV_LINK_CRC_LEN)
+// COBS adds one byte every 254 bytes plus the first code byte, then the delimiter
+#define SV_LINK_MAX_ENCODED   (SV_LINK_MAX_PAYLOAD + SV_LINK_MAX_PAYLOAD / 254 + 2)
+
+// Results of sv_link_parser_push()
+#define SV_LINK_MORE           0      // frame not complete yet
+#define SV_LINK_FRAME          1      // valid frame available in the parser
+#define SV_LINK_ERR_FRAME     -1      // truncated, overlong or malformed frame
+#define SV_LINK_ERR_CRC       -2
+#define SV_LINK_ERR_REPLAY    -3      // same sequence number as the last valid frame
+
+/* ******************** TYPES AND STRUCTS ******************** */
+
+// Raw reading: ADC counts or pulses, the MSP430 has no FPU
+//  Conversion to physical units is done by the ESP32 (store_record() in the LoRa sender)
+typedef uint16_t sv_link_value_t;
+
+// Incremental parser, never blocks: feed it whatever bytes are available
+typedef struct {
+  uint8_t  buf[SV_LINK_MAX_PAYLOAD];  // decoded payload of the current frame
+  uint8_t  len;
+  uint8_t  code;                      // current COBS block code
+  uint8_t  remaining;                 // bytes left in the current COBS block
+  uint8_t  overflow;
+  uint8_t  complete;                  // buf holds a valid frame
+  uint8_t  seq;                       // sequence number of the last valid frame
+  uint8_t  synced;                    // a valid frame was already received
+  uint16_t frames;                    // statistics
+  uint16_t errors;
+  uint16_t lost;
+} sv_link_parser_t;
+
+/* ******************** FUNCTIONS ******************** */
+
+// Encoder
+
+// Writes one record at buf, returns the record length
+static inline size_t sv_link_put_record(uint8_t *buf, uint8_t id, sv_link_value_t value){
+  buf[0] = id;
+  memcpy(&buf[1], &value, SV_LINK_VALUE_LEN);       // both MCUs are little endian
+  return SV_LINK_RECORD_LEN;
+}
+
+// Appends the CRC to a payload of len bytes, returns the new length
+static inline size_t sv_link_put_crc(uint8_t *buf, size_t len){
+  uint16_t crc = sv_crc16(buf, len);
+
+  buf[len] = (uint8_t)crc;
+  buf[len + 1] = (uint8_t)(crc >> 8);
+  return len + SV_LINK_CRC_LEN;
+}
+
+// COBS encodes len bytes of in into out and appends the delimiter
+//  out must hold SV_LINK_MAX_ENCODED bytes, returns the encoded length
+static inline size_t sv_link_cobs_encode(const uint8_t *in, size_t len, uint8_t *out){
+  size_t code_pos = 0;
+  size_t pos = 1;
+  uint8_t code = 1;
+  size_t i;
+
+  for (i = 0; i < len; i++){
+    if (in[i] == SV_LINK_DELIMITER){
+      out[code_pos] = code;
+      code_pos = pos++;
+      code = 1;
+    }
+    else{
+      out[pos++] = in[i];
+      code++;
+      if (code == 0xFF){
+        out[code_pos] = code;
+        code_pos = pos++;
+        code = 1;
+      }
+    }
+  }
+  out[code_pos] = code;
+  out[pos++] = SV_LINK_DELIMITER;
+  return pos;
+}
+
+// Parser
+
+static inline void sv_link_parser_init(sv_link_parser_t *parser){
+  memset(parser, 0, sizeof(*parser));
+}
+
+static inline void sv_link_parser_restart(sv_link_parser_t *parser){
+  parser->len = 0;
+  parser->code = 0;
+  parser->remaining = 0;
+  parser->overflow = 0;
+  parser->complete = 0;
+}
+
+static inline void sv_link_parser_append(sv_link_parser_t *parser, uint8_t byte){
+  if (parser->len < SV_LINK_MAX_PAYLOAD){
+    parser->buf[parser->len++] = byte;
+  }
+  else{
+    parser->overflow = 1;
+  }
+}
+
+// Checks a complete decoded frame and updates the statistics
+static inline int sv_link_parser_end(sv_link_parser_t *parser){
+  uint8_t seq;
+
+  if (parser->overflow || parser->remaining != 0 || parser->len < SV_LINK_SEQ_LEN + SV_LINK_CRC_LEN
+      || (parser->len - SV_LINK_SEQ_LEN - SV_LINK_CRC_LEN) % SV_LINK_RECORD_LEN != 0){
+    parser->errors++;
+    return SV_LINK_ERR_FRAME;
+  }
+  if (sv_crc16(parser->buf, parser->len - SV_LINK_CRC_LEN)
+      != (uint16_t)(parser->buf[parser->len - 2] | (parser->buf[parser->len - 1] << 8))){
+    parser->errors++;
+    return SV_LINK_ERR_CRC;
+  }
+
+  seq = parser->buf[0];
+  if (parser->synced && seq == parser->seq){
+    // a repeated frame would add its pulse counts twice
+    parser->errors++;
+    return SV_LINK_ERR_REPLAY;
+  }
+  if (parser->synced){
+    parser->lost += (uint8_t)(seq - parser->seq - 1);
+  }
+  parser->seq = seq;
+  parser->synced = 1;
+  parser->frames++;
+  return SV_LINK_FRAME;
+}
+
+// Consumes one byte, returns SV_LINK_MORE, SV_LINK_FRAME or one of the SV_LINK_ERR_* values
+//  After SV_LINK_FRAME the records stay available until the next byte is pushed
+static inline int sv_link_parser_push(sv_link_parser_t *parser, uint8_t byte){
+  int result;
+
+  if (parser->complete){
+    sv_link_parser_restart(parser);
+  }
+
+  if (byte == SV_LINK_DELIMITER){
+    if (parser->len == 0 && parser->code == 0){
+      return SV_LINK_MORE;                          // delimiters in a row
+    }
+    result = sv_link_parser_end(parser);
+    if (result == SV_LINK_FRAME){
+      parser->complete = 1;
+    }
+    else{
+      sv_link_parser_restart(parser);
+    }
+    return result;
+  }
+
+  if (parser->remaining == 0){
+    // new block, the previous one ends with an implicit zero unless it was a full block
+    if (parser->code != 0 && parser->code != 0xFF){
+      sv_link_parser_append(parser, 0);
+    }
+    parser->code = byte;
+    parser->remaining = byte - 1;
+  }
+  else{
+    sv_link_parser_append(parser, byte);
+    parser->remaining--;
+  }
+  return SV_LINK_MORE;
+}
+
+// Number of records of the last valid frame
+static inline uint8_t sv_link_records(const sv_link_parser_t *parser){
+  return (uint8_t)((parser->len - SV_LINK_SEQ_LEN - SV_LINK_CRC_LEN) / SV_LINK_RECORD_LEN);
+}
+
+// Reads record index of the last valid frame
+static inline void sv_link_get_record(const sv_link_parser_t *parser, uint8_t index, uint8_t *id, sv_link_value_t *value){
+  const uint8_t *record = &parser->buf[SV_LINK_SEQ_LEN + index * SV_LINK_RECORD_LEN];
+
+  *id = record[0];
+  memcpy(value, &record[1], SV_LINK_VALUE_LEN);
+}
+
+#endif // SMARTVIT_LINK_H
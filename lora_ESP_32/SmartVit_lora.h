@@ -3,10 +3,18 @@
 
 /* ******************** INCLUDES ******************** */
 
+#include <stdint.h>
+
+// SmartVit Libraries (SV)
+#include "SmartVit_sensors.h"
+
 // Libraries for OLED Display
+// Only available on the boards, the frame definitions below are also used by host builds
+#ifdef ARDUINO
 #include <Wire.h>
 #include <Adafruit_GFX.h>
 #include <Adafruit_SSD1306.h>
+#endif
 
 /* ******************** DEFINES ******************** */
 // Wi-Fi defines
@@ -40,18 +48,34 @@
 // #define OLED_SCL       15 
 
 #define OLED_RST       16
+#define OLED_ADDRESS 0x3c
 #define SCREEN_WIDTH  128 // OLED display width, in pixels
 #define SCREEN_HEIGHT  64 // OLED display height, in pixels
 
 // pins to make connection by software serial with MSP430
 #define MSP430_TX 2
 #define MSP430_RX 3
+#define MSP430_BAUD_RATE 9600
+// MSP430 P2.0, high from one tick before a link frame until it is sent, wakes the ESP32 (RTC GPIO)
+#define MSP430_DATA_READY 13
 
 // General Defines
 #define SERIAL_BAUD_RATE 115200
 #define SEALEVELPRESSURE_HPA 1013.25
 #define LOOP_TIME     60000 // 60 sec.
 
+// Sender deep sleep: the ESP32 sleeps whenever it waits, woken by MSP430_DATA_READY or by the RTC
+// timer for the beacon, its slot or the end of the window. 0 keeps it awake
+#ifndef SV_DEEP_SLEEP
+#define SV_DEEP_SLEEP 0
+#endif
+#define SV_SLEEP_MIN_MS   1000    // shorter waits are spent awake
+#define SV_SLEEP_GUARD_MS 300     // woken this early, covers the boot, the radio start and the clock drift
+// Instrumentation build of the deep sleep: logs the wake to transmit latency and the awake time of every cycle
+#ifndef SV_SLEEP_STATS
+#define SV_SLEEP_STATS 0
+#endif
+
 // Sensors
 #define VREF  1.25
 #define RESOLUTION 1023
@@ -60,6 +84,118 @@
 #define PERIOD 60
 #define SAMPLES 6
 #define PLUV_RES 0.25
+#define SV_PH_CALIBRATION 0.00
+
+// Node ID of this sender, 1..255 and unique in the network (0 is the gateway)
+#ifndef SV_NODE_ID
+#define SV_NODE_ID 1
+#endif
+
+// LoRa frame
+//  Binary frame sent by the LoRa sender, encoded/decoded in SmartVit_frame.h
+//  [0] version << 4 | frame type
+//  [1] node ID of the sender
+//  [2..3] sequence number of the frame (little endian), +1 for every frame of the node
+//  [4..5] present fields bitmap (little endian, one bit per sv_field_t)
+//  [6] TX power of the sender in dBm, used by the gateway ADR
+//  [...] present fields in sv_field_t order, integers scaled and sized by SV_SENSOR_TABLE
+//  [n-2..n-1] CRC16-CCITT of all previous bytes (little endian)
+//  A summary frame has the same header, each present field is [samples][mean][min][max][std dev]
+//  with the samples in one byte and the rest sized and scaled as the field
+//  A delta frame has the same header, then [7] the low byte of the sequence number of its keyframe
+//  (the last data frame of the node) and each present field as the zigzag varint of its scaled
+//  integer minus the one of the keyframe
+#define SV_FRAME_VERSION      3
+#define SV_FRAME_TYPE_DATA    0
+#define SV_FRAME_TYPE_BEACON  1
+#define SV_FRAME_TYPE_SUMMARY 2
+#define SV_FRAME_TYPE_DELTA   3
+#define SV_FRAME_TYPE_PARITY  4
+#define SV_FRAME_TYPE_DIAG    5
+#define SV_FRAME_NODE_POS     1
+#define SV_FRAME_SEQ_POS      2
+#define SV_FRAME_PRESENT_POS  4
+#define SV_FRAME_POWER_POS    6
+#define SV_FRAME_HEADER_LEN   7
+#define SV_FRAME_CRC_LEN      2
+#define SV_FRAME_MAX_LEN      112     // a summary of every field
+#define SV_FRAME_DELTA_REF_POS    7
+#define SV_FRAME_DELTA_HEADER_LEN 8
+
+// Parity frame, sent by a node after the last frame of each group of SV_FEC_GROUP frames
+//  [0] version << 4 | SV_FRAME_TYPE_PARITY
+//  [1] node ID of the sender
+//  [2..3] sequence number of the first frame of the group (a multiple of SV_FEC_GROUP)
+//  [4] frames in the group
+//  [5] XOR of the lengths of the frames
+//  [...] XOR of the frames, each padded with zeros to the longest one
+//  [n-2..n-1] CRC16-CCITT
+//  The gateway rebuilds one lost frame per group from the parity and the frames it received
+#define SV_PARITY_GROUP_POS   2
+#define SV_PARITY_COUNT_POS   4
+#define SV_PARITY_LEN_POS     5
+#define SV_PARITY_HEADER_LEN  6
+#define SV_PACKET_MAX_LEN     (SV_PARITY_HEADER_LEN + SV_FRAME_MAX_LEN + SV_FRAME_CRC_LEN)  // longest LoRa packet
+
+// Diagnostics frame of the instrumentation build (SmartVit_diag.h)
+//  [0] version << 4 | SV_FRAME_TYPE_DIAG
+//  [1] node ID of the sender
+//  [2] number of counters
+//  [...] counters in sv_diag_t order, 4 bytes little endian each
+//  [n-2..n-1] CRC16-CCITT
+#define SV_DIAG_COUNT_POS     2
+#define SV_DIAG_HEADER_LEN    3
+
+// Frames per parity frame, a power of 2 up to 16 set alike on the nodes and the gateway
+//  It costs one more packet every SV_FEC_GROUP frames, 0 sends no parity
+#ifndef SV_FEC_GROUP
+#define SV_FEC_GROUP 0
+#endif
+
+// Data frames are sent in full (keyframe) once every SV_DELTA_KEYFRAME_INTERVAL frames and as delta
+// frames in between, a lost keyframe loses the data until the next one. 0 only sends full frames
+#ifndef SV_DELTA_KEYFRAME_INTERVAL
+#define SV_DELTA_KEYFRAME_INTERVAL 8
+#endif
+
+// Beacon sent by the gateway at the start of every superframe
+//  [0] version << 4 | SV_FRAME_TYPE_BEACON
+//  [1] number of data slots
+//  [2..3] slot length in ms (little endian)
+//  [4] spreading factor of the superframe, the beacon itself is sent with the previous one
+//  [5] number of ADR hints
+//  [6] number of slot assignments
+//  [7] superframe counter, +1 at every beacon
+//  [...] ADR hints: node ID, TX power in dBm the node must use
+//  [...] slot assignments: node ID, data slot (1..slots) the node must use
+//  [n-2..n-1] CRC16-CCITT
+//  The superframe is the beacon slot followed by the data slots. Node n below slots sends in slot
+//  1 + n, a higher one in a slot that moves with the counter (see sv_tdma_default_slot()) so two
+//  nodes sharing a slot do not collide at every frame, until the beacon assigns it a fixed one:
+//  the gateway assigns a free slot to every active node it cannot leave on its default slot.
+//  Limits: a beacon carries SV_BEACON_MAX_SLOTS assignments and the gateway tracks SV_NODE_TABLE_LEN
+//  nodes, so past 8 nodes above the slot count or sharing a slot, or past 32 nodes, the others stay
+//  on their moving default slots and collide now and then (see the node sweep of test_network)
+#define SV_BEACON_HEADER_LEN  8
+#define SV_BEACON_HINT_LEN    2
+#define SV_BEACON_MAX_HINTS   8
+#define SV_BEACON_SLOT_LEN    2
+#define SV_BEACON_MAX_SLOTS   8
+#define SV_BEACON_MAX_LEN     (SV_BEACON_HEADER_LEN + SV_BEACON_MAX_HINTS * SV_BEACON_HINT_LEN + \
+                               SV_BEACON_MAX_SLOTS * SV_BEACON_SLOT_LEN + SV_FRAME_CRC_LEN)
+#define SV_TDMA_SLOTS         32
+#define SV_TDMA_GUARD_MS      50      // added to the airtime of a full frame, covers the clock error
+
+// Adaptive data rate
+//  The gateway has a single SX127x that listens on one spreading factor, so the spreading factor is
+//  chosen for the whole network (the fastest one the weakest node gets through with) while the
+//  TX power is set node by node. Bandwidth stays at SV_LORA_BANDWIDTH.
+#define SV_ADR_SF_MIN         7
+#define SV_ADR_SF_MAX         12
+#define SV_ADR_POWER_MIN      2       // dBm, LoRa.setTxPower() range with PA_BOOST
+#define SV_ADR_POWER_MAX      17
+#define SV_ADR_POWER_STEP     3       // dB
+#define SV_ADR_MARGIN_DB      10      // link margin kept above the demodulation floor
 
 /* ******************** TYPES AND STRUCTS ******************** */
 
@@ -74,91 +210,22 @@ typedef enum {
   NORTHWEST
 }dv10_windsock_t;
 
-typedef struct {
-  int     temp_celsius;   // 0
-  float   humid_percent;
-  float   vento_MS;
-  float   pres_hpa;
-  float   qnt_chuva;
-  float   ph_sensor;
-  float   altitude;       // Optional
-  dv10_windsock_t vento_direcao;
-} data_t;
-
-typedef enum {
-  SV10_ANEMOMETER, // 0
-  CV10_WINDSOCK,
-  PLUVIOMETER_SENSOR,
-  BME280_SENSOR,
-  PH_SENSOR,
-  TEMP_SENSOR, 
-  MOIST_SENSOR,
-  BME280_TEMP_SENSOR, 
-  BME280_PRES_SENSOR,  
-  BME280_HUMID_SENSOR,
-  BME280_ALTIT_SENSOR,  
-  MOIST_SENSOR_1,
-  MOIST_SENSOR_2,
-  MOIST_SENSOR_3,
-}sensor_id_t;
-
-
-// Generic sensor
-// struct sensor_data{ 
-//     char sensor_id[20];
-//     float value;
-//     char date_time[50];
-// };
-
-// Sensors structs
-
-struct sensor_anemometro{
-    sensor_id_t sensor_id;
-    float vento_MS;
-};
-
-struct sensor_biruta{
-    sensor_id_t sensor_id;
-    dv10_windsock_t vento_direcao;
-};
-
-struct sensor_pluviometro{
-    sensor_id_t sensor_id;
-    float qtd_chuva;
-};
-
-struct sensor_bme{
-    sensor_id_t sensor_id;
-    int temp_celsius;
-    int humidity_percent;
-    float pressure_hPa;
-};
-
-struct sensor_ph{
-    sensor_id_t sensor_id;
-    float sensor_ph;
-};
-
-struct sensor_temperatura{
-    sensor_id_t sensor_id;
-    float temp_soil;
-};
-
-struct moist_percent{
-  sensor_id_t sensor_id;
-  float moist_percent_1;
-  float moist_percent_2;
-  float moist_percent_3;
+// Readings in physical units, indexed by sv_field_t (see SV_SENSOR_TABLE)
+struct all_sensors_data{
+  float value[SV_FIELD_COUNT];
+  uint16_t present;   // SV_FIELD_BIT() of every field filled since the last frame
+  uint8_t node;       // node ID and sequence number of the frame
+  uint16_t seq;
+  int8_t tx_power;    // dBm
 };
 
-struct all_sensors_data{
-  struct sensor_anemometro sensor_anemometro;
-  struct sensor_biruta sensor_biruta;
-  struct sensor_pluviometro sensor_pluviometro;
-  struct sensor_bme sensor_bme;
-  struct sensor_ph sensor_ph;
-  struct sensor_temperatura sensor_temperatura;
-  struct moist_percent moist_percent;
+// Statistics of the readings of a window, sent in a summary frame
+struct sensors_summary{
+  struct all_sensors_data mean;   // mean of each field, present fields, node, seq and power of the frame
+  float min[SV_FIELD_COUNT];
+  float max[SV_FIELD_COUNT];
+  float std_dev[SV_FIELD_COUNT];
+  uint8_t samples[SV_FIELD_COUNT];
 };
 
 #endif // SMARTVIT_LORA_H
@@ -0,0 +1,137 @@
+#ifndef SMARTVIT_NODES_H
+#define SMARTVIT_NODES_H
+
+// Per node table of the gateway: duplicate and loss detection from the frame sequence numbers
+//  Each node keeps the highest sequence number seen and a bitmap of the SV_NODE_WINDOW before it,
+//  so retransmitted or late frames inside the window are told apart from new ones.
+//  A node starts its sequence at 0 on every cold boot, so a 0 that does not follow the wrap of the
+//  sequence is taken as a restart, even from a low sequence number where 0 is still in the window.
+//  A replay of frame 0 that arrives after the next frames is taken as a restart too. A restart whose
+//  frame 0 is lost is only seen once the node is behind the window.
+
+/* ******************** INCLUDES ******************** */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* ******************** DEFINES ******************** */
+// Nodes tracked at the same time, the one heard least recently is replaced when full
+#ifndef SV_NODE_TABLE_LEN
+#define SV_NODE_TABLE_LEN 32
+#endif
+#define SV_NODE_WINDOW    32      // bits of the received bitmap
+
+// Results of sv_node_update()
+#define SV_NODE_NEW        0      // first time this frame is seen
+#define SV_NODE_DUPLICATE  1      // already received, drop it
+
+/* ******************** TYPES AND STRUCTS ******************** */
+
+typedef struct {
+  uint8_t  node;
+  uint8_t  used;
+  uint16_t last_seq;      // highest sequence number received
+  uint32_t window;        // bit n set: frame last_seq - n received
+  uint32_t received;      // frames accepted
+  uint32_t duplicates;
+  uint32_t lost;          // gaps in the sequence numbers, late frames are given back
+  uint32_t last_seen;     // caller time of the last frame
+  int16_t  last_rssi;
+  int16_t  snr_max;       // link state kept by SmartVit_adr.h: SNR at full power (0.1 dB)
+  int8_t   tx_power;      // and the TX power the node last reported (dBm)
+  uint32_t adr_lost;      // lost when the ADR last looked, its new losses step the spreading factor up
+} sv_node_stats_t;
+
+typedef struct {
+  sv_node_stats_t entry[SV_NODE_TABLE_LEN];
+} sv_node_table_t;
+
+/* ******************** FUNCTIONS ******************** */
+
+static inline void sv_node_table_init(sv_node_table_t *table){
+  uint8_t i;
+
+  for (i = 0; i < SV_NODE_TABLE_LEN; i++){
+    table->entry[i].used = 0;
+  }
+}
+
+// Entry of node, or NULL when it is not in the table
+static inline sv_node_stats_t *sv_node_find(sv_node_table_t *table, uint8_t node){
+  uint8_t i;
+
+  for (i = 0; i < SV_NODE_TABLE_LEN; i++){
+    if (table->entry[i].used && table->entry[i].node == node){
+      return &table->entry[i];
+    }
+  }
+  return NULL;
+}
+
+// Entry of node, created (replacing the stalest one if needed) when it is not in the table
+static inline sv_node_stats_t *sv_node_lookup(sv_node_table_t *table, uint8_t node, uint32_t now){
+  sv_node_stats_t *free_entry = NULL;
+  sv_node_stats_t *stalest = &table->entry[0];
+  uint8_t i;
+
+  for (i = 0; i < SV_NODE_TABLE_LEN; i++){
+    sv_node_stats_t *entry = &table->entry[i];
+    if (!entry->used){
+      if (free_entry == NULL){
+        free_entry = entry;
+      }
+    }
+    else if (entry->node == node){
+      return entry;
+    }
+    else if (now - entry->last_seen > now - stalest->last_seen){
+      stalest = entry;
+    }
+  }
+  if (free_entry == NULL){
+    free_entry = stalest;
+  }
+  free_entry->node = node;
+  free_entry->used = 0;           // sv_node_update() starts the sequence on the first frame
+  free_entry->received = 0;
+  free_entry->duplicates = 0;
+  free_entry->lost = 0;
+  free_entry->adr_lost = 0;
+  free_entry->last_seen = now;
+  return free_entry;
+}
+
+// Accounts a frame of the node, returns SV_NODE_NEW or SV_NODE_DUPLICATE
+static inline int sv_node_update(sv_node_stats_t *entry, uint16_t seq, int16_t rssi, uint32_t now){
+  uint16_t ahead = (uint16_t)(seq - entry->last_seq);
+  uint16_t behind = (uint16_t)(entry->last_seq - seq);
+
+  if (!entry->used || (ahead >= 0x8000 && behind >= SV_NODE_WINDOW) || (seq == 0 && ahead >= SV_NODE_WINDOW)){
+    // first frame, far behind the window or first frame after a boot: the node restarted its sequence
+    entry->used = 1;
+    entry->last_seq = seq;
+    entry->window = 1;
+  }
+  else if (ahead == 0 || (ahead >= 0x8000 && (entry->window & ((uint32_t)1 << behind)))){
+    entry->duplicates++;
+    return SV_NODE_DUPLICATE;
+  }
+  else if (ahead < 0x8000){
+    entry->lost += ahead - 1;
+    entry->window = ahead < SV_NODE_WINDOW ? (entry->window << ahead) | 1 : 1;
+    entry->last_seq = seq;
+  }
+  else{
+    // late frame inside the window, it was counted as lost
+    entry->window |= (uint32_t)1 << behind;
+    if (entry->lost){
+      entry->lost--;
+    }
+  }
+  entry->received++;
+  entry->last_seen = now;
+  entry->last_rssi = rssi;
+  return SV_NODE_NEW;
+}
+
+#endif // SMARTVIT_NODES_H
@@ -0,0 +1,83 @@
+#ifndef SMARTVIT_QUEUE_H
+#define SMARTVIT_QUEUE_H
+
+// Lock-free single producer / single consumer queue of received LoRa packets
+//  The producer is the LoRa receive callback (DIO0 interrupt), the consumer the uploader.
+//  Head is only written by the producer and tail only by the consumer, so no lock is needed,
+//  the acquire/release accesses order the slot contents between the two cores of the ESP32.
+
+/* ******************** INCLUDES ******************** */
+// SmartVit Libraries (SV)
+#include "SmartVit_lora.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* ******************** DEFINES ******************** */
+// Packets waiting for the uploader, power of 2 up to 128
+#ifndef SV_RX_QUEUE_LEN
+#define SV_RX_QUEUE_LEN 8
+#endif
+#define SV_RX_QUEUE_MASK (SV_RX_QUEUE_LEN - 1)
+
+/* ******************** TYPES AND STRUCTS ******************** */
+
+typedef struct {
+  uint8_t buf[SV_PACKET_MAX_LEN];
+  uint8_t len;          // packet size, bigger than SV_PACKET_MAX_LEN if it was truncated
+  int16_t rssi;
+  int16_t snr;          // 0.1 dB
+} sv_rx_packet_t;
+
+typedef struct {
+  sv_rx_packet_t slot[SV_RX_QUEUE_LEN];
+  uint8_t head;         // next slot written, free running, producer only
+  uint8_t tail;         // next slot read, free running, consumer only
+  uint32_t dropped;     // packets lost because the queue was full, producer only
+} sv_rx_queue_t;
+
+/* ******************** FUNCTIONS ******************** */
+
+static inline void sv_rx_queue_init(sv_rx_queue_t *queue){
+  queue->head = 0;
+  queue->tail = 0;
+  queue->dropped = 0;
+}
+
+// Producer: slot to fill, or NULL (and the packet counted as dropped) if the queue is full
+static inline sv_rx_packet_t *sv_rx_queue_reserve(sv_rx_queue_t *queue){
+  uint8_t head = queue->head;
+
+  if ((uint8_t)(head - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE)) >= SV_RX_QUEUE_LEN){
+    queue->dropped++;
+    return NULL;
+  }
+  return &queue->slot[head & SV_RX_QUEUE_MASK];
+}
+
+// Producer: publishes the slot returned by sv_rx_queue_reserve()
+static inline void sv_rx_queue_commit(sv_rx_queue_t *queue){
+  __atomic_store_n(&queue->head, (uint8_t)(queue->head + 1), __ATOMIC_RELEASE);
+}
+
+// Consumer: oldest packet, or NULL if the queue is empty
+static inline const sv_rx_packet_t *sv_rx_queue_peek(sv_rx_queue_t *queue){
+  uint8_t tail = queue->tail;
+
+  if (__atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == tail){
+    return NULL;
+  }
+  return &queue->slot[tail & SV_RX_QUEUE_MASK];
+}
+
+// Consumer: frees the slot returned by sv_rx_queue_peek()
+static inline void sv_rx_queue_release(sv_rx_queue_t *queue){
+  __atomic_store_n(&queue->tail, (uint8_t)(queue->tail + 1), __ATOMIC_RELEASE);
+}
+
+// Packets lost so far, readable from the consumer
+static inline uint32_t sv_rx_queue_dropped(sv_rx_queue_t *queue){
+  return __atomic_load_n(&queue->dropped, __ATOMIC_RELAXED);
+}
+
+#endif // SMARTVIT_QUEUE_H
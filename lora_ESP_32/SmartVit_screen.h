@@ -0,0 +1,249 @@
+#ifndef SMARTVIT_SCREEN_H
+#define SMARTVIT_SCREEN_H
+
+// Status screen on the SSD1306: text fields redrawn in the Adafruit framebuffer, only the changed
+//  columns of each page sent over I2C
+//  display() pushes the whole 1 KB buffer at every call. Here a field only redraws itself when its
+//  text changes, its columns are marked dirty on its page and sv_screen_flush() sends those windows
+//  with the column / page address commands, a few tens of bytes for a counter.
+//  Fields are one text line (size 1, 6x8 pixels per character) and sit on a page, 8 pixels high.
+
+/* ******************** INCLUDES ******************** */
+// SmartVit Libraries (SV)
+#include "SmartVit_lora.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/* ******************** DEFINES ******************** */
+// Minimum time between two flushes of sv_screen_refresh(), the changes wait in the framebuffer meanwhile
+#ifndef SV_SCREEN_REFRESH_MS
+#define SV_SCREEN_REFRESH_MS 500
+#endif
+
+#define SV_SCREEN_PAGES     (SCREEN_HEIGHT / 8)
+#define SV_SCREEN_CHAR_W    6       // pixels of a character, size 1 font
+#define SV_SCREEN_TEXT_LEN  (SCREEN_WIDTH / SV_SCREEN_CHAR_W + 1)
+#define SV_SCREEN_CLEAN     0xFF    // dirty_min of a page without changes
+
+// I2C clock while sending, and restored afterwards for the other devices of the bus (as Adafruit_SSD1306)
+#define SV_SCREEN_I2C_CLOCK       400000
+#define SV_SCREEN_I2C_CLOCK_AFTER 100000
+
+// Bytes of one I2C transaction, the control byte included (the Wire buffer of the board)
+#ifndef SV_SCREEN_WIRE_MAX
+#if defined(I2C_BUFFER_LENGTH)
+#define SV_SCREEN_WIRE_MAX  (I2C_BUFFER_LENGTH < 256 ? I2C_BUFFER_LENGTH : 256)
+#elif defined(BUFFER_LENGTH)
+#define SV_SCREEN_WIRE_MAX  (BUFFER_LENGTH < 256 ? BUFFER_LENGTH : 256)
+#else
+#define SV_SCREEN_WIRE_MAX  32
+#endif
+#endif
+
+// SSD1306 commands and I2C control bytes
+#define SV_SSD1306_COLUMNADDR 0x21
+#define SV_SSD1306_PAGEADDR   0x22
+#define SV_SSD1306_CONTROL_CMD  0x00
+#define SV_SSD1306_CONTROL_DATA 0x40
+
+// Initializer of a sv_screen_field_t: first column (pixels), page and width (characters)
+#define SV_SCREEN_FIELD(x, page, width) {(x), (page), (width), ""}
+
+/* ******************** TYPES AND STRUCTS ******************** */
+
+typedef struct {
+  uint8_t x;                          // first column, pixels
+  uint8_t page;                       // text line, 0 is the top one
+  uint8_t width;                      // characters, the rest of the field is blanked
+  char text[SV_SCREEN_TEXT_LEN];      // shown text
+} sv_screen_field_t;
+
+typedef struct {
+  Adafruit_SSD1306 *display;
+  TwoWire *wire;
+  uint8_t address;
+  uint8_t dirty_min[SV_SCREEN_PAGES]; // changed columns of each page, SV_SCREEN_CLEAN when none
+  uint8_t dirty_max[SV_SCREEN_PAGES];
+  unsigned long last_flush;
+} sv_screen_t;
+
+/* ******************** FUNCTIONS ******************** */
+
+static inline void sv_screen_mark(sv_screen_t *screen, uint8_t page, uint8_t first, uint8_t last){
+  if (page >= SV_SCREEN_PAGES){
+    return;
+  }
+  if (first < screen->dirty_min[page]){
+    screen->dirty_min[page] = first;
+  }
+  if (last > screen->dirty_max[page]){
+    screen->dirty_max[page] = last;
+  }
+}
+
+static inline void sv_screen_clean(sv_screen_t *screen){
+  uint8_t page;
+
+  for (page = 0; page < SV_SCREEN_PAGES; page++){
+    screen->dirty_min[page] = SV_SCREEN_CLEAN;
+    screen->dirty_max[page] = 0;
+  }
+}
+
+// Takes over a display already started with begin(), clears it; the first flush sends the whole screen
+static inline void sv_screen_begin(sv_screen_t *screen, Adafruit_SSD1306 *display, TwoWire *wire, uint8_t address){
+  uint8_t page;
+
+  screen->display = display;
+  screen->wire = wire;
+  screen->address = address;
+  screen->last_flush = 0;
+  sv_screen_clean(screen);
+  display->clearDisplay();
+  display->setTextColor(WHITE);
+  display->setTextSize(1);
+  display->setTextWrap(false);
+  for (page = 0; page < SV_SCREEN_PAGES; page++){
+    sv_screen_mark(screen, page, 0, SCREEN_WIDTH - 1);
+  }
+}
+
+// Draws a text that never changes (title, field names)
+static inline void sv_screen_label(sv_screen_t *screen, uint8_t x, uint8_t page, const char *text){
+  size_t len = strlen(text);
+  unsigned end = x + len * SV_SCREEN_CHAR_W;
+
+  screen->display->setCursor(x, page * 8);
+  screen->display->print(text);
+  sv_screen_mark(screen, page, x, (uint8_t)((end < SCREEN_WIDTH ? end : SCREEN_WIDTH) - 1));
+}
+
+// Shows text in the field, only the characters that differ from the shown text are redrawn
+//  Returns true when the field changed
+static inline bool sv_screen_set(sv_screen_t *screen, sv_screen_field_t *field, const char *text){
+  size_t len = strlen(text);
+  size_t shown = strlen(field->text);
+  size_t first;
+  size_t last;
+
+  if (len > field->width){
+    len = field->width;
+  }
+  if (len >= SV_SCREEN_TEXT_LEN){
+    len = SV_SCREEN_TEXT_LEN - 1;
+  }
+  // characters first..last change, a shorter text blanks the end of the old one
+  for (first = 0; first < len && first < shown && text[first] == field->text[first]; first++);
+  if (first == len && first == shown){
+    return false;
+  }
+  last = (len > shown ? len : shown) - 1;
+  while (last > first && last < len && last < shown && text[last] == field->text[last]){
+    last--;
+  }
+  memcpy(field->text, text, len);
+  field->text[len] = '\0';
+
+  unsigned x0 = field->x + first * SV_SCREEN_CHAR_W;
+  unsigned x1 = field->x + (last + 1) * SV_SCREEN_CHAR_W;
+  if (x1 > SCREEN_WIDTH){
+    x1 = SCREEN_WIDTH;
+  }
+  if (x0 >= x1){
+    return true;
+  }
+  screen->display->fillRect(x0, field->page * 8, x1 - x0, 8, BLACK);
+  screen->display->setCursor(x0, field->page * 8);
+  for (; first <= last && first < len; first++){
+    screen->display->write((uint8_t)field->text[first]);
+  }
+  sv_screen_mark(screen, field->page, (uint8_t)x0, (uint8_t)(x1 - 1));
+  return true;
+}
+
+static inline bool sv_screen_set_int(sv_screen_t *screen, sv_screen_field_t *field, long value){
+  char text[12];
+
+  snprintf(text, sizeof(text), "%ld", value);
+  return sv_screen_set(screen, field, text);
+}
+
+// Sends a window of the framebuffer, pages first..last and columns x0..x1 of each
+static inline void sv_screen_send(sv_screen_t *screen, uint8_t first, uint8_t last, uint8_t x0, uint8_t x1){
+  TwoWire *wire = screen->wire;
+  const uint8_t *buffer = screen->display->getBuffer();
+  uint8_t page;
+  uint8_t x;
+  uint16_t room;
+
+  wire->beginTransmission(screen->address);
+  wire->write((uint8_t)SV_SSD1306_CONTROL_CMD);
+  wire->write((uint8_t)SV_SSD1306_COLUMNADDR);
+  wire->write(x0);
+  wire->write(x1);
+  wire->write((uint8_t)SV_SSD1306_PAGEADDR);
+  wire->write(first);
+  wire->write(last);
+  wire->endTransmission();
+
+  // the controller moves to the next page after x1 (horizontal addressing, set by begin())
+  room = 0;
+  for (page = first; page <= last; page++){
+    for (x = x0; x <= x1; x++){
+      if (room == 0){
+        if (page != first || x != x0){
+          wire->endTransmission();
+        }
+        wire->beginTransmission(screen->address);
+        wire->write((uint8_t)SV_SSD1306_CONTROL_DATA);
+        room = SV_SCREEN_WIRE_MAX - 1;
+      }
+      wire->write(buffer[page * SCREEN_WIDTH + x]);
+      room--;
+    }
+  }
+  wire->endTransmission();
+}
+
+// Sends the changed windows now, consecutive pages with the same columns go together
+//  Returns true when something was sent
+static inline bool sv_screen_flush(sv_screen_t *screen, unsigned long now){
+  uint8_t first;
+  uint8_t last;
+  bool sent = false;
+
+  for (first = 0; first < SV_SCREEN_PAGES; first = last + 1){
+    last = first;
+    if (screen->dirty_min[first] == SV_SCREEN_CLEAN){
+      continue;
+    }
+    if (!sent){
+      screen->wire->setClock(SV_SCREEN_I2C_CLOCK);
+      sent = true;
+    }
+    while (last + 1 < SV_SCREEN_PAGES && screen->dirty_min[last + 1] == screen->dirty_min[first] &&
+           screen->dirty_max[last + 1] == screen->dirty_max[first]){
+      last++;
+    }
+    sv_screen_send(screen, first, last, screen->dirty_min[first], screen->dirty_max[first]);
+  }
+  if (!sent){
+    return false;
+  }
+  screen->wire->setClock(SV_SCREEN_I2C_CLOCK_AFTER);
+  sv_screen_clean(screen);
+  screen->last_flush = now;
+  return true;
+}
+
+// Rate limited flush, at most once every SV_SCREEN_REFRESH_MS
+static inline bool sv_screen_refresh(sv_screen_t *screen, unsigned long now){
+  if (now - screen->last_flush < SV_SCREEN_REFRESH_MS){
+    return false;
+  }
+  return sv_screen_flush(screen, now);
+}
+
+#endif // SMARTVIT_SCREEN_H
@@ -0,0 +1,130 @@
+#ifndef SMARTVIT_SENSORS_H
+#define SMARTVIT_SENSORS_H
+
+// Sensor registry shared by msp/main.c and the LoRa sketches
+//  Adding a sensor only takes a new line in SV_SENSOR_TABLE (and its SV_ENABLE_ and SV_PERIOD_ defaults),
+//  the MSP430 acquisition, the link records, the LoRa frame fields, the json keys and the
+//  calibration are all expanded from it. The line order is the bit order of the LoRa frame.
+
+/* ******************** INCLUDES ******************** */
+
+#include <stdint.h>
+
+/* ******************** DEFINES ******************** */
+
+// Where the raw value comes from
+#define SV_SOURCE_ADC       0   // MSP430 ADC10 channel, first sample of the scan
+#define SV_SOURCE_ADC_PH    1   // MSP430 ADC10 channel, sum of the filtered samples of the scan
+#define SV_SOURCE_PULSE     2   // MSP430 port 2 pin, pulses counted over the sample window
+#define SV_SOURCE_LOCAL     3   // sensor read by the ESP32 itself (BME280), not on the link
+#define SV_SOURCE_PULSE_SUM 4   // MSP430 port 2 pin, pulses counted all the time, even asleep, since the last frame
+
+// How the raw value is converted to physical units (ESP32 only, see SmartVit_calibration.h)
+#define SV_CAL_NONE         0   // already in physical units
+#define SV_CAL_LINEAR       1   // raw * cal_scale + cal_offset
+#define SV_CAL_WINDSOCK     2   // ADC counts to wind sector, see SmartVit_windsock.h
+
+// X(name, source, channel/pin, wire width, wire signed, wire scale, calibration, cal_scale, cal_offset, json key)
+//  cal_scale/cal_offset are only expanded on the ESP32, they may use the SmartVit_lora.h defines
+#define SV_SENSOR_TABLE(X) \
+  X(WIND_SPEED, SV_SOURCE_PULSE,     3, 2, 0, 100, SV_CAL_LINEAR,   (2 * PI * RADIUS / PERIOD),              0,                  "vento_MS")          \
+  X(WIND_DIR,   SV_SOURCE_ADC,       0, 1, 0, 1,   SV_CAL_WINDSOCK, 1,                                       0,                  "vento_direcao")     \
+  X(RAIN,       SV_SOURCE_PULSE_SUM, 4, 2, 0, 100, SV_CAL_LINEAR,   PLUV_RES,                                0,                  "qtd_chuva")         \
+  X(AIR_TEMP,   SV_SOURCE_LOCAL,     0, 2, 1, 100, SV_CAL_NONE,     1,                                       0,                  "temp_celsius")      \
+  X(AIR_HUMID,  SV_SOURCE_LOCAL,     0, 2, 0, 100, SV_CAL_NONE,     1,                                       0,                  "humidity_percent")  \
+  X(AIR_PRES,   SV_SOURCE_LOCAL,     0, 2, 0, 10,  SV_CAL_NONE,     1,                                       0,                  "pressure_hPa")      \
+  X(SOIL_PH,    SV_SOURCE_ADC_PH,    4, 2, 0, 100, SV_CAL_LINEAR,   (-5.70 * VREF / (RESOLUTION * SAMPLES)), SV_PH_CALIBRATION,  "sensor_ph")         \
+  X(SOIL_TEMP,  SV_SOURCE_ADC,       3, 2, 1, 100, SV_CAL_LINEAR,   ((float)VREF / RESOLUTION),              0,                  "temp_soil")         \
+  X(MOIST_1,    SV_SOURCE_ADC,       5, 2, 0, 100, SV_CAL_LINEAR,   ((float)VREF / RESOLUTION),              0,                  "moist_percent_1")   \
+  X(MOIST_2,    SV_SOURCE_ADC,       6, 2, 0, 100, SV_CAL_LINEAR,   ((float)VREF / RESOLUTION),              0,                  "moist_percent_2")   \
+  X(MOIST_3,    SV_SOURCE_ADC,       7, 2, 0, 100, SV_CAL_LINEAR,   ((float)VREF / RESOLUTION),              0,                  "moist_percent_3")
+
+// Installed sensors, define one as 0 to compile its acquisition, link record and frame field out
+#ifndef SV_ENABLE_WIND_SPEED
+#define SV_ENABLE_WIND_SPEED  1
+#endif
+#ifndef SV_ENABLE_WIND_DIR
+#define SV_ENABLE_WIND_DIR    1
+#endif
+#ifndef SV_ENABLE_RAIN
+#define SV_ENABLE_RAIN        1
+#endif
+#ifndef SV_ENABLE_AIR_TEMP
+#define SV_ENABLE_AIR_TEMP    1
+#endif
+#ifndef SV_ENABLE_AIR_HUMID
+#define SV_ENABLE_AIR_HUMID   1
+#endif
+#ifndef SV_ENABLE_AIR_PRES
+#define SV_ENABLE_AIR_PRES    1
+#endif
+#ifndef SV_ENABLE_SOIL_PH
+#define SV_ENABLE_SOIL_PH     1
+#endif
+#ifndef SV_ENABLE_SOIL_TEMP
+#define SV_ENABLE_SOIL_TEMP   1
+#endif
+#ifndef SV_ENABLE_MOIST_1
+#define SV_ENABLE_MOIST_1     1
+#endif
+#ifndef SV_ENABLE_MOIST_2
+#define SV_ENABLE_MOIST_2     1
+#endif
+#ifndef SV_ENABLE_MOIST_3
+#define SV_ENABLE_MOIST_3     1
+#endif
+
+// Sampling period of each sensor in seconds (1..65535), the MSP430 only wakes when one of them is due
+//  SV_SOURCE_LOCAL sensors are read by the ESP32 with every frame, their period is unused
+#ifndef SV_PERIOD_WIND_SPEED
+#define SV_PERIOD_WIND_SPEED  300
+#endif
+#ifndef SV_PERIOD_WIND_DIR
+#define SV_PERIOD_WIND_DIR    300
+#endif
+#ifndef SV_PERIOD_RAIN
+#define SV_PERIOD_RAIN        900
+#endif
+#ifndef SV_PERIOD_AIR_TEMP
+#define SV_PERIOD_AIR_TEMP    300
+#endif
+#ifndef SV_PERIOD_AIR_HUMID
+#define SV_PERIOD_AIR_HUMID   300
+#endif
+#ifndef SV_PERIOD_AIR_PRES
+#define SV_PERIOD_AIR_PRES    300
+#endif
+#ifndef SV_PERIOD_SOIL_PH
+#define SV_PERIOD_SOIL_PH     3600
+#endif
+#ifndef SV_PERIOD_SOIL_TEMP
+#define SV_PERIOD_SOIL_TEMP   900
+#endif
+#ifndef SV_PERIOD_MOIST_1
+#define SV_PERIOD_MOIST_1     3600
+#endif
+#ifndef SV_PERIOD_MOIST_2
+#define SV_PERIOD_MOIST_2     3600
+#endif
+#ifndef SV_PERIOD_MOIST_3
+#define SV_PERIOD_MOIST_3     3600
+#endif
+
+#define SV_FIELD_BIT(field) ((uint16_t)1 << (field))
+
+// Bitmap of the enabled sensors, constant
+#define SV_SENSOR_ENABLED_BIT(name, source, channel, width, is_signed, scale, cal, cal_scale, cal_offset, key) \
+  | (SV_ENABLE_##name ? SV_FIELD_BIT(SV_FIELD_##name) : 0)
+#define SV_ENABLED_FIELDS ((uint16_t)(0 SV_SENSOR_TABLE(SV_SENSOR_ENABLED_BIT)))
+
+/* ******************** TYPES AND STRUCTS ******************** */
+
+// Fields carried by the link and the LoRa frame, the value is the bit index in the present bitmap
+#define SV_SENSOR_FIELD(name, source, channel, width, is_signed, scale, cal, cal_scale, cal_offset, key) SV_FIELD_##name,
+typedef enum {
+  SV_SENSOR_TABLE(SV_SENSOR_FIELD)
+  SV_FIELD_COUNT
+}sv_field_t;
+#undef SV_SENSOR_FIELD
+
+#endif // SMARTVIT_SENSORS_H
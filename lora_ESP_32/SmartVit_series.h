@@ -0,0 +1,394 @@
+#ifndef SMARTVIT_SERIES_H
+#define SMARTVIT_SERIES_H
+
+// Time series store of the gateway: fixed memory, columnar ring buffers of every node and field
+//  Readings are aggregated (count, sum, min, max) in buckets of each tier as they arrive: 5 min buckets
+//  over the last hours, then 1 h and 6 h buckets for the last days. A row of a tier is reused when its
+//  bucket comes round again, the time column tells the rows of the current lap from the stale ones.
+//  Each column holds one value of every row of all the tiers, a query over a field only walks its own.
+//  Values are scaled integers as on the wire (wire widths up to 2 bytes), times are gateway seconds.
+//
+//  Local queries (SV_SERIES_PORT), times in seconds before now, "to" defaults to 0:
+//    GET /series?node=1&field=temp_celsius&from=3600&to=0      rows [age, mean, min, max, count]
+//    GET /aggregate?node=1&field=temp_celsius&from=86400       count, mean, min and max of the range
+//  The finest tier keeping the whole range answers, its buckets at the ends are counted whole.
+
+/* ******************** INCLUDES ******************** */
+// SmartVit Libraries (SV)
+#include "SmartVit_lora.h"
+#include "SmartVit_frame.h"
+#include "SmartVit_json.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* ******************** DEFINES ******************** */
+// Nodes kept, the first ones heard get a place. 0 leaves the store and its query server out
+//  One node takes sizeof(sv_series_node_t), about 14 KB of .bss with the default tiers. Off on the
+//  ESP8266: the BearSSL client alone keeps a ~17 KB receive buffer next to the upload batch, the
+//  node table and the keyframes; enable it there only with fewer rows and a free heap check.
+#ifndef SV_SERIES_NODES
+#ifdef ARDUINO_ARCH_ESP32
+#define SV_SERIES_NODES 4
+#else
+#define SV_SERIES_NODES 0
+#endif
+#endif
+
+// Tiers, bucket length (s) and buckets kept: 4 h, 2 days and 7 days with the defaults
+#define SV_SERIES_TIERS 3
+#ifndef SV_SERIES_STEP_0
+#define SV_SERIES_STEP_0  300
+#endif
+#ifndef SV_SERIES_ROWS_0
+#define SV_SERIES_ROWS_0  48
+#endif
+#ifndef SV_SERIES_STEP_1
+#define SV_SERIES_STEP_1  3600
+#endif
+#ifndef SV_SERIES_ROWS_1
+#define SV_SERIES_ROWS_1  48
+#endif
+#ifndef SV_SERIES_STEP_2
+#define SV_SERIES_STEP_2  21600
+#endif
+#ifndef SV_SERIES_ROWS_2
+#define SV_SERIES_ROWS_2  28
+#endif
+#define SV_SERIES_ROWS    (SV_SERIES_ROWS_0 + SV_SERIES_ROWS_1 + SV_SERIES_ROWS_2)
+
+// Query server
+#define SV_SERIES_PORT          80
+#define SV_SERIES_REQUEST_LEN   128     // request line kept, longer ones are cut
+#define SV_SERIES_LINE_LEN      96      // piece of the answer written at once
+
+// Kinds of sv_series_query_t
+#define SV_SERIES_QUERY_ROWS      0
+#define SV_SERIES_QUERY_AGGREGATE 1
+
+// Results of sv_series_query_parse(), HTTP status codes
+#define SV_SERIES_OK            200
+#define SV_SERIES_BAD_REQUEST   400
+#define SV_SERIES_NOT_FOUND     404
+
+/* ******************** TYPES AND STRUCTS ******************** */
+
+// Columns of one node, row r of tier t is sv_series_offset[t] + bucket % sv_series_len[t]
+typedef struct {
+  uint8_t  node;
+  uint8_t  used;
+  uint32_t bucket[SV_SERIES_ROWS];                  // time column: bucket number + 1, 0 for an unused row
+  uint16_t count[SV_FIELD_COUNT][SV_SERIES_ROWS];   // readings in the bucket, saturates
+  uint16_t min[SV_FIELD_COUNT][SV_SERIES_ROWS];     // scaled, two's complement for the signed fields
+  uint16_t max[SV_FIELD_COUNT][SV_SERIES_ROWS];
+  int32_t  sum[SV_FIELD_COUNT][SV_SERIES_ROWS];
+} sv_series_node_t;
+
+typedef struct {
+  sv_series_node_t entry[SV_SERIES_NODES];
+} sv_series_t;
+
+// Aggregate of one bucket or of a range, scaled values
+typedef struct {
+  uint32_t count;
+  int32_t  sum;
+  int32_t  min;
+  int32_t  max;
+} sv_series_cell_t;
+
+typedef struct {
+  uint8_t    kind;
+  uint8_t    node;
+  sv_field_t field;
+  uint32_t   from;      // seconds before now
+  uint32_t   to;
+} sv_series_query_t;
+
+static const uint32_t sv_series_step[SV_SERIES_TIERS] = {SV_SERIES_STEP_0, SV_SERIES_STEP_1, SV_SERIES_STEP_2};
+static const uint16_t sv_series_len[SV_SERIES_TIERS] = {SV_SERIES_ROWS_0, SV_SERIES_ROWS_1, SV_SERIES_ROWS_2};
+static const uint16_t sv_series_offset[SV_SERIES_TIERS] = {0, SV_SERIES_ROWS_0, SV_SERIES_ROWS_0 + SV_SERIES_ROWS_1};
+
+/* ******************** FUNCTIONS ******************** */
+
+static inline void sv_series_init(sv_series_t *series){
+  uint8_t i;
+
+  for (i = 0; i < SV_SERIES_NODES; i++){
+    series->entry[i].used = 0;
+  }
+}
+
+// Columns of node, a free entry is taken when it is new; NULL when the store is full
+static inline sv_series_node_t *sv_series_lookup(sv_series_t *series, uint8_t node, bool create){
+  sv_series_node_t *free_entry = NULL;
+  uint8_t i;
+
+  for (i = 0; i < SV_SERIES_NODES; i++){
+    sv_series_node_t *entry = &series->entry[i];
+    if (entry->used && entry->node == node){
+      return entry;
+    }
+    if (!entry->used && free_entry == NULL){
+      free_entry = entry;
+    }
+  }
+  if (!create || free_entry == NULL){
+    return NULL;
+  }
+  free_entry->node = node;
+  free_entry->used = 1;
+  memset(free_entry->bucket, 0, sizeof(free_entry->bucket));
+  return free_entry;
+}
+
+static inline int32_t sv_series_value(sv_field_t field, uint16_t stored){
+  return sv_field_desc[field].is_signed ? (int32_t)(int16_t)stored : (int32_t)stored;
+}
+
+// Row of bucket in tier, emptied first when it still holds an older bucket
+static inline uint16_t sv_series_row(sv_series_node_t *entry, uint8_t tier, uint32_t bucket){
+  uint16_t row = sv_series_offset[tier] + bucket % sv_series_len[tier];
+  uint8_t field;
+
+  if (entry->bucket[row] != bucket + 1){
+    entry->bucket[row] = bucket + 1;
+    for (field = 0; field < SV_FIELD_COUNT; field++){
+      entry->count[field][row] = 0;
+    }
+  }
+  return row;
+}
+
+// Adds the present fields of a frame received at now (s), with the window extremes of a summary frame
+//  A summary counts as the readings of its window, its mean weighted by their number, so the mean of
+//  a bucket or a range is the one of the readings and not of the frames
+static inline void sv_series_add(sv_series_t *series, const struct all_sensors_data *data, const struct sensors_summary *summary, uint32_t now){
+  sv_series_node_t *entry = sv_series_lookup(series, data->node, true);
+  uint8_t tier;
+  uint8_t field;
+
+  if (entry == NULL){
+    return;
+  }
+  for (tier = 0; tier < SV_SERIES_TIERS; tier++){
+    uint16_t row = sv_series_row(entry, tier, now / sv_series_step[tier]);
+    for (field = 0; field < SV_FIELD_COUNT; field++){
+      if (!(data->present & SV_FIELD_BIT(field))){
+        continue;
+      }
+      int32_t value = sv_field_to_raw((sv_field_t)field, data->value[field]);
+      int32_t min = summary ? sv_field_to_raw((sv_field_t)field, summary->min[field]) : value;
+      int32_t max = summary ? sv_field_to_raw((sv_field_t)field, summary->max[field]) : value;
+      uint16_t weight = summary && summary->samples[field] ? summary->samples[field] : 1;
+      uint16_t count = entry->count[field][row];
+
+      if (count == 0){
+        entry->sum[field][row] = 0;
+        entry->min[field][row] = (uint16_t)min;
+        entry->max[field][row] = (uint16_t)max;
+      }
+      if (count > UINT16_MAX - weight){
+        continue;
+      }
+      if (min < sv_series_value((sv_field_t)field, entry->min[field][row])){
+        entry->min[field][row] = (uint16_t)min;
+      }
+      if (max > sv_series_value((sv_field_t)field, entry->max[field][row])){
+        entry->max[field][row] = (uint16_t)max;
+      }
+      entry->sum[field][row] += value * weight;
+      entry->count[field][row] = count + weight;
+    }
+  }
+}
+
+// Finest tier still keeping the bucket of from seconds ago, the coarsest one otherwise
+static inline uint8_t sv_series_tier(uint32_t now, uint32_t from){
+  uint32_t start = from < now ? now - from : 0;
+  uint8_t tier;
+
+  for (tier = 0; tier + 1 < SV_SERIES_TIERS; tier++){
+    if (now / sv_series_step[tier] - start / sv_series_step[tier] < sv_series_len[tier]){
+      break;
+    }
+  }
+  return tier;
+}
+
+// Aggregate of field in a bucket of tier, false when nothing was received in it (or it is not kept)
+static inline bool sv_series_cell(const sv_series_node_t *entry, uint8_t tier, sv_field_t field, uint32_t bucket, sv_series_cell_t *cell){
+  uint16_t row = sv_series_offset[tier] + bucket % sv_series_len[tier];
+
+  if (entry->bucket[row] != bucket + 1 || entry->count[field][row] == 0){
+    return false;
+  }
+  cell->count = entry->count[field][row];
+  cell->sum = entry->sum[field][row];
+  cell->min = sv_series_value(field, entry->min[field][row]);
+  cell->max = sv_series_value(field, entry->max[field][row]);
+  return true;
+}
+
+// Buckets of tier covering from..to seconds ago, clipped to the ones kept
+static inline void sv_series_range(uint8_t tier, uint32_t now, uint32_t from, uint32_t to, uint32_t *first, uint32_t *last){
+  uint32_t step = sv_series_step[tier];
+  uint32_t oldest = now / step >= sv_series_len[tier] ? now / step - (sv_series_len[tier] - 1) : 0;
+
+  *first = (from < now ? now - from : 0) / step;
+  *last = (to < now ? now - to : 0) / step;
+  if (*first < oldest){
+    *first = oldest;
+  }
+}
+
+// Aggregate of field over from..to seconds ago, false when nothing was received in the range
+static inline bool sv_series_aggregate(const sv_series_node_t *entry, sv_field_t field, uint32_t now, uint32_t from, uint32_t to, sv_series_cell_t *total){
+  uint8_t tier = sv_series_tier(now, from);
+  sv_series_cell_t cell;
+  uint32_t bucket;
+  uint32_t last;
+
+  total->count = 0;
+  sv_series_range(tier, now, from, to, &bucket, &last);
+  for (; bucket <= last; bucket++){
+    if (!sv_series_cell(entry, tier, field, bucket, &cell)){
+      continue;
+    }
+    if (total->count == 0 || cell.min < total->min){
+      total->min = cell.min;
+    }
+    if (total->count == 0 || cell.max > total->max){
+      total->max = cell.max;
+    }
+    total->sum = total->count == 0 ? cell.sum : total->sum + cell.sum;
+    total->count += cell.count;
+  }
+  return total->count != 0;
+}
+
+// Query parsing
+
+// Value of the parameter key in the query string, false when it is missing
+static inline bool sv_series_param(const char *query, const char *key, char *value, size_t len){
+  size_t key_len = strlen(key);
+  const char *pos = query;
+
+  while (pos != NULL && *pos != '\0'){
+    if (strncmp(pos, key, key_len) == 0 && pos[key_len] == '='){
+      size_t i = 0;
+      pos += key_len + 1;
+      while (pos[i] != '\0' && pos[i] != '&' && pos[i] != ' ' && i + 1 < len){
+        value[i] = pos[i];
+        i++;
+      }
+      value[i] = '\0';
+      return true;
+    }
+    pos = strchr(pos, '&');
+    if (pos != NULL){
+      pos++;
+    }
+  }
+  return false;
+}
+
+static inline bool sv_series_param_u32(const char *query, const char *key, uint32_t *value){
+  char text[12];
+  char *end;
+
+  if (!sv_series_param(query, key, text, sizeof(text))){
+    return false;
+  }
+  *value = (uint32_t)strtoul(text, &end, 10);
+  return end != text && *end == '\0';
+}
+
+// Parses the request line ("GET /series?node=1&field=temp_celsius&from=3600 HTTP/1.1")
+//  Returns SV_SERIES_OK, SV_SERIES_BAD_REQUEST or SV_SERIES_NOT_FOUND
+static inline int sv_series_query_parse(const char *request, sv_series_query_t *query){
+  char key[24];
+  uint32_t node;
+  uint8_t field;
+  const char *params;
+
+  if (strncmp(request, "GET /series?", 12) == 0){
+    query->kind = SV_SERIES_QUERY_ROWS;
+    params = request + 12;
+  }
+  else if (strncmp(request, "GET /aggregate?", 15) == 0){
+    query->kind = SV_SERIES_QUERY_AGGREGATE;
+    params = request + 15;
+  }
+  else{
+    return SV_SERIES_NOT_FOUND;
+  }
+  if (!sv_series_param_u32(params, "node", &node) || node > 0xFF ||
+      !sv_series_param(params, "field", key, sizeof(key)) || !sv_series_param_u32(params, "from", &query->from)){
+    return SV_SERIES_BAD_REQUEST;
+  }
+  if (!sv_series_param_u32(params, "to", &query->to)){
+    query->to = 0;
+  }
+  if (query->to > query->from){
+    return SV_SERIES_BAD_REQUEST;
+  }
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    if (strcmp(key, sv_field_json_key[field]) == 0){
+      break;
+    }
+  }
+  if (field == SV_FIELD_COUNT){
+    return SV_SERIES_BAD_REQUEST;
+  }
+  query->node = (uint8_t)node;
+  query->field = (sv_field_t)field;
+  return SV_SERIES_OK;
+}
+
+// Answers, written piece by piece in a caller buffer
+
+// Mean of a cell, rounded
+static inline int32_t sv_series_mean(const sv_series_cell_t *cell){
+  int32_t half = (int32_t)cell->count / 2;
+  return (cell->sum >= 0 ? cell->sum + half : cell->sum - half) / (int32_t)cell->count;
+}
+
+// "mean":m,"min":a,"max":b,"count":n or the same values as a row [age,m,a,b,n]
+static inline size_t sv_series_json_cell(char *buf, size_t len, sv_field_t field, const sv_series_cell_t *cell, bool row){
+  uint16_t scale = sv_field_desc[field].scale;
+  int32_t value[3] = {sv_series_mean(cell), cell->min, cell->max};
+  static const char * const key[3] = {"\"mean\":", ",\"min\":", ",\"max\":"};
+  size_t pos = 0;
+  uint8_t i;
+  int written;
+
+  for (i = 0; i < 3; i++){
+    written = snprintf(&buf[pos], len - pos, "%s", row ? (i ? "," : "") : key[i]);
+    if (written < 0 || (size_t)written >= len - pos){
+      return 0;
+    }
+    pos += written;
+    written = sv_json_put_fixed(&buf[pos], len - pos, value[i], scale);
+    if (written < 0 || (size_t)written >= len - pos){
+      return 0;
+    }
+    pos += written;
+  }
+  written = snprintf(&buf[pos], len - pos, row ? ",%lu" : ",\"count\":%lu", (unsigned long)cell->count);
+  if (written < 0 || (size_t)written >= len - pos){
+    return 0;
+  }
+  return pos + written;
+}
+
+// Start of the answer, {"node":1,"field":"temp_celsius","now":123456,...
+static inline size_t sv_series_json_head(char *buf, size_t len, const sv_series_query_t *query, uint32_t now){
+  int written = snprintf(buf, len, "{\"node\":%u,\"field\":\"%s\",\"now\":%lu,", (unsigned)query->node,
+                         sv_field_json_key[query->field], (unsigned long)now);
+  return written < 0 || (size_t)written >= len ? 0 : (size_t)written;
+}
+
+#endif // SMARTVIT_SERIES_H
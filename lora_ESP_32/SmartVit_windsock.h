@@ -0,0 +1,166 @@
+#ifndef SMARTVIT_WINDSOCK_H
+#define SMARTVIT_WINDSOCK_H
+
+// Wind vane direction from the raw 10-bit ADC count
+//  A 1024-entry table maps every count straight to a direction. It is built once, on the first
+//  lookup, from the calibration table of the vane model: the nearest calibration point wins.
+//  The vane is a resistor divider fed by the MSP430 Vcc, which is also the ADC reference
+//  (SREF_0), so the calibration is ratiometric and only depends on the model supply voltage.
+
+/* ******************** INCLUDES ******************** */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* ******************** DEFINES ******************** */
+
+// Vane models
+#define SV_WINDSOCK_CV10        0   // 8 positions
+#define SV_WINDSOCK_SPARKFUN    1   // SparkFun/Argent weather meter vane, 16 positions, 10k pull-up
+
+#ifndef SV_WINDSOCK_MODEL
+#define SV_WINDSOCK_MODEL       SV_WINDSOCK_CV10
+#endif
+
+// Sectors sent in the frame: 8 (dv10_windsock_t) or 16 (N, NNE, NE, ... NNW)
+#ifndef SV_WINDSOCK_SECTORS
+#define SV_WINDSOCK_SECTORS     8
+#endif
+
+// Number of samples averaged as vectors, 1 disables the averaging
+#ifndef SV_WINDSOCK_AVERAGE
+#define SV_WINDSOCK_AVERAGE     1
+#endif
+
+#define SV_WINDSOCK_LUT_SIZE    1024
+#define SV_WINDSOCK_DIRECTIONS  16  // calibration and averaging resolution, 22.5 degrees
+#define SV_WINDSOCK_STEP_RAD    (6.2831853f / SV_WINDSOCK_DIRECTIONS)
+
+/* ******************** TYPES AND STRUCTS ******************** */
+
+// Calibration point: vane output at the model supply voltage and its direction
+typedef struct {
+  uint16_t millivolts;
+  uint8_t  direction;   // sixteenths of a turn clockwise from north
+} sv_windsock_cal_t;
+
+#if SV_WINDSOCK_MODEL == SV_WINDSOCK_CV10
+#define SV_WINDSOCK_SUPPLY_MV 3300
+// Centers of the CV10 voltage bands
+static const sv_windsock_cal_t sv_windsock_cal[] = {
+  {3100,  0},   // N
+  {2900,  2},   // NE
+  {2750,  4},   // E
+  {2600,  6},   // SE
+  {2400,  8},   // S
+  {2250, 10},   // SW
+  {2125, 12},   // W
+  {2000, 14},   // NW
+};
+#elif SV_WINDSOCK_MODEL == SV_WINDSOCK_SPARKFUN
+#define SV_WINDSOCK_SUPPLY_MV 5000
+// Datasheet voltages with the vane fed by 5 V through 10k
+static const sv_windsock_cal_t sv_windsock_cal[] = {
+  {3840,  0}, {1980,  1}, {2250,  2}, { 410,  3},
+  { 450,  4}, { 320,  5}, { 900,  6}, { 620,  7},
+  {1400,  8}, {1190,  9}, {3080, 10}, {2930, 11},
+  {4620, 12}, {4040, 13}, {4330, 14}, {3430, 15},
+};
+#else
+#error "Unknown SV_WINDSOCK_MODEL"
+#endif
+
+#define SV_WINDSOCK_CAL_LEN (sizeof(sv_windsock_cal) / sizeof(sv_windsock_cal[0]))
+
+/* ******************** GLOBAL DATA ******************** */
+
+static uint8_t sv_windsock_lut[SV_WINDSOCK_LUT_SIZE];  // direction in sixteenths for each count
+static uint8_t sv_windsock_lut_ready = 0;
+
+#if SV_WINDSOCK_AVERAGE > 1
+static uint8_t sv_windsock_history[SV_WINDSOCK_AVERAGE];
+static uint8_t sv_windsock_history_len = 0;
+static uint8_t sv_windsock_history_pos = 0;
+#endif
+
+/* ******************** FUNCTIONS ******************** */
+
+static inline void sv_windsock_init(void){
+  uint16_t count;
+  uint8_t i;
+
+  for (count = 0; count < SV_WINDSOCK_LUT_SIZE; count++){
+    int32_t millivolts = ((int32_t)count * SV_WINDSOCK_SUPPLY_MV) / (SV_WINDSOCK_LUT_SIZE - 1);
+    int32_t best_distance = INT32_MAX;
+
+    for (i = 0; i < SV_WINDSOCK_CAL_LEN; i++){
+      int32_t distance = labs(millivolts - (int32_t)sv_windsock_cal[i].millivolts);
+      if (distance < best_distance){
+        best_distance = distance;
+        sv_windsock_lut[count] = sv_windsock_cal[i].direction;
+      }
+    }
+  }
+  sv_windsock_lut_ready = 1;
+}
+
+// Direction in sixteenths of a turn for a raw ADC count
+static inline uint8_t sv_windsock_direction16(uint16_t raw){
+  if (!sv_windsock_lut_ready){
+    sv_windsock_init();
+  }
+  return sv_windsock_lut[raw & (SV_WINDSOCK_LUT_SIZE - 1)];
+}
+
+// Direction of a sum of unit vectors (x = cos, y = sin) in 1/directions of a turn, last when they cancel
+static inline uint8_t sv_windsock_vector_direction(float x, float y, uint8_t directions, uint8_t last){
+  float step = 6.2831853f / directions;
+  float angle;
+
+  if (fabsf(x) < 1e-3f && fabsf(y) < 1e-3f){
+    return last;                                      // opposite directions cancel, keep the last one
+  }
+  angle = atan2f(y, x);
+  if (angle < 0){
+    angle += step * directions;
+  }
+  return (uint8_t)((int)lroundf(angle / step) % directions);
+}
+
+// Vector average of the last SV_WINDSOCK_AVERAGE directions, so N and NNW average to N, not S
+static inline uint8_t sv_windsock_average(uint8_t direction16){
+#if SV_WINDSOCK_AVERAGE > 1
+  float x = 0, y = 0;
+  float angle;
+  uint8_t i;
+
+  sv_windsock_history[sv_windsock_history_pos] = direction16;
+  sv_windsock_history_pos = (sv_windsock_history_pos + 1) % SV_WINDSOCK_AVERAGE;
+  if (sv_windsock_history_len < SV_WINDSOCK_AVERAGE){
+    sv_windsock_history_len++;
+  }
+
+  for (i = 0; i < sv_windsock_history_len; i++){
+    angle = sv_windsock_history[i] * SV_WINDSOCK_STEP_RAD;
+    x += cosf(angle);
+    y += sinf(angle);
+  }
+  return sv_windsock_vector_direction(x, y, SV_WINDSOCK_DIRECTIONS, direction16);
+#else
+  return direction16;
+#endif
+}
+
+// Direction sent in the frame for a raw ADC count: lookup, averaging and sector reduction
+static inline uint8_t sv_windsock_sector(uint16_t raw){
+  uint8_t direction16 = sv_windsock_average(sv_windsock_direction16(raw));
+
+#if SV_WINDSOCK_SECTORS == 16
+  return direction16;
+#else
+  return (uint8_t)(((direction16 + 1) / 2) % 8);     // dv10_windsock_t
+#endif
+}
+
+#endif // SMARTVIT_WINDSOCK_H
@@ -1,26 +1,111 @@
 /* ******************** INCLUDES ******************** */
 // SmartVit Libraries (SV)
 #include "SmartVit_lora.h"
+#include "SmartVit_frame.h"
+#include "SmartVit_json.h"
+#include "SmartVit_queue.h"
+#include "SmartVit_journal.h"
+#include "SmartVit_nodes.h"
+#include "SmartVit_adr.h"
+#include "SmartVit_fec.h"
+#include "SmartVit_screen.h"
+#include "SmartVit_series.h"
 
 //Libraries for Server
+#ifdef ARDUINO_ARCH_ESP32
+#include <WiFi.h>
+#include <HTTPClient.h>
+#else
 #include <ESP8266WiFi.h> 
 #include <ESP8266HTTPClient.h> 
+#endif
 
 // LoRa library
 #include <SPI.h>
 #include <LoRa.h>
 
-// Additional Libraries
-#include <ArduinoJson.h>
+/* ******************** DEFINES ******************** */
+// ESP32: the radio interrupt stays on the loop core (1), the uploader runs next to the WiFi stack (0)
+#define UPLOADER_CORE       0
+#define UPLOADER_STACK      8192
+#define UPLOADER_PRIORITY   1
+
+// nodes is written by the uploader (frames) and by send_beacon() (adr_lost), on both cores on the ESP32
+//  The sections only walk the table, a spinlock keeps them short
+#ifdef ARDUINO_ARCH_ESP32
+#define NODES_LOCK()        portENTER_CRITICAL(&nodes_lock)
+#define NODES_UNLOCK()      portEXIT_CRITICAL(&nodes_lock)
+#else
+#define NODES_LOCK()
+#define NODES_UNLOCK()
+#endif
+
+// Measurements are sent together, when UPLOAD_BATCH_MAX are waiting or the oldest is UPLOAD_BATCH_AGE_MS old
+//  A batch stops earlier when the next object does not fit UPLOAD_BATCH_BYTES
+#define UPLOAD_BATCH_MAX    10
+#define UPLOAD_BATCH_BYTES  (4 * SV_JSON_SUMMARY_MAX_LEN)
+#define UPLOAD_BATCH_AGE_MS 30000
+#define UPLOAD_RETRY_MS     10000   // wait after a failed upload, the batch stays in the journal
+
+// Local queries of the time series store, served by the uploader between packets and uploads
+#define QUERY_POLL_MS       50      // ESP32: the uploader checks for a client this often
+#define QUERY_TIMEOUT_MS    200     // wait for the request line of a client
 
 /* ******************** GLOBAL DATA******************** */
 Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RST);
+// status screen, only the fields that changed are sent to the display
+sv_screen_t screen;
+sv_screen_field_t packets_field = SV_SCREEN_FIELD(54, 2, 12);
+sv_screen_field_t bytes_field = SV_SCREEN_FIELD(54, 3, 12);
+sv_screen_field_t rssi_field = SV_SCREEN_FIELD(54, 4, 12);
+sv_screen_field_t snr_field = SV_SCREEN_FIELD(54, 5, 12);
+sv_screen_field_t dropped_field = SV_SCREEN_FIELD(54, 6, 12);
+sv_screen_field_t pending_field = SV_SCREEN_FIELD(54, 7, 12);
+unsigned long packets_received = 0;
 
 // Variables used to general purposes
 // struct to storage data received from the LoRa sender. 
 // struct sensor_data data;
 struct all_sensors_data total_data;
-DynamicJsonBuffer jsonBuffer;
+struct sensors_summary total_summary;
+// packets received by the LoRa interrupt, waiting to be decoded and uploaded
+sv_rx_queue_t rx_queue;
+// sequence numbers and statistics of every node heard
+sv_node_table_t nodes;
+#ifdef ARDUINO_ARCH_ESP32
+portMUX_TYPE nodes_lock = portMUX_INITIALIZER_UNLOCKED;
+#endif
+// keyframe of the delta frames of each entry of nodes
+sv_delta_ref_t delta_refs[SV_NODE_TABLE_LEN];
+#if SV_FEC_GROUP
+// XOR of the frames received in the current group of each entry of nodes
+sv_fec_group_t fec_groups[SV_NODE_TABLE_LEN];
+#endif
+// start of the current TDMA superframe, a beacon is sent at the end of each one
+unsigned long last_beacon = 0;
+sv_beacon_t beacon = {SV_TDMA_SLOTS, 0, SV_ADR_SF_MAX, 0};
+uint32_t adr_raised = 0;            // millis() of the last step up of the spreading factor
+uint8_t slots_assigned = 0;         // nodes given a slot by the last beacon
+uint8_t slots_missing = 0;          // active nodes the last beacon had no slot left for
+uint8_t beacon_buffer[SV_BEACON_MAX_LEN];
+// frames kept on flash until the server acknowledges them
+sv_journal_t journal;
+unsigned long batch_started = 0;    // millis() of the oldest measurement waiting in the journal
+unsigned long upload_failed = 0;    // millis() of the last failed upload
+bool upload_retry = false;
+// json array sent to the server
+char batch_buffer[UPLOAD_BATCH_BYTES];
+sv_json_batch_t batch;
+
+#if SV_SERIES_NODES
+// readings of the last days, only written and read by the uploader
+sv_series_t series;
+WiFiServer query_server(SV_SERIES_PORT);
+#endif
+
+#ifdef ARDUINO_ARCH_ESP32
+TaskHandle_t uploader_handle = NULL;
+#endif
 
 int value = 0; 
 
@@ -31,6 +116,16 @@ const char* ssid = ESP_SSID;
 const char* password = PASSWORD; 
 const char* host = HOST; //edit the host adress, ip address etc. 
 
+// Connection kept open between requests (keep-alive), the TLS session is resumed on reconnection
+//  No CA is configured, as before the certificate is not verified
+#ifdef ARDUINO_ARCH_ESP32
+WiFiClientSecure tls_client;
+#else
+BearSSL::WiFiClientSecure tls_client;
+BearSSL::Session tls_session;
+#endif
+HTTPClient http;
+
 String url = METHOD; 
 
 
@@ -44,59 +139,488 @@ void setup() {
   init_wifi();
   init_oled();
   init_lora();
-
-  display.clearDisplay();
-  display.setTextColor(WHITE);
-  display.setTextSize(1);
-  display.setCursor(0,0);
-  display.print("LORA RECEIVER ");
-  display.display();
+  init_screen();
+  start_receiver();
 }
 
 void loop() {
+  // the radio is only driven from this core, the receive interrupt is attached here too
+  send_beacon();
+#ifdef ARDUINO_ARCH_ESP32
+  // uploader_task does the rest on the other core
+  delay(10);
+#else
+  // single core: upload here, the interrupt keeps queueing packets meanwhile
+  if (!process_packet()) {
+    upload_batch();
+    flush_journal();
+    update_screen();
+    serve_query();
+  }
+#endif
+}
+
+// LoRa DIO0 interrupt, copies the packet to the queue and returns
+//  Keep it short: no Serial, no display, no network
+void on_receive(int packet_size){
+  sv_rx_packet_t *packet = sv_rx_queue_reserve(&rx_queue);
+  int i = 0;
 
-  //try to parse packet
-  String str_data;
-  int packetSize = LoRa.parsePacket();
-  if (packetSize) {
-    //received a packet
-    Serial.print("Received packet ");
-
-    //read packet
-    while (LoRa.available()) {
-      str_data = (String)LoRa.read();
-      Serial.print(str_data);
+  if (packet == NULL) {
+    return;   // queue full, counted in rx_queue.dropped
+  }
+  packet->len = (uint8_t)packet_size;
+  while (LoRa.available()) {
+    uint8_t byte = (uint8_t)LoRa.read();
+    if (i < SV_PACKET_MAX_LEN) {
+      packet->buf[i++] = byte;
     }
-    
-    JsonObject& root = jsonBuffer.parseObject(str_data);
-
-    //print RSSI of packet
-    int rssi = LoRa.packetRssi();
-    Serial.print(" with RSSI ");    
-    Serial.println(rssi);
-
-   // Display information
-   display.clearDisplay();
-   display.setCursor(0,0);
-   display.print("LORA RECEIVER");
-   display.setCursor(0,20);
-   display.print("Received packet:");
-   display.setCursor(0,30);
-   display.print(str_data);
-   display.setCursor(0,40);
-   display.print("RSSI:");
-   display.setCursor(30,40);
-   display.print(rssi);
-   display.display(); 
-
-   // send to server
-  String output;
-  root.printTo(output);
- 
-   sendToServer(output);
   }
+  packet->rssi = (int16_t)LoRa.packetRssi();
+  packet->snr = (int16_t)(LoRa.packetSnr() * 10);
+  sv_rx_queue_commit(&rx_queue);
+
+#ifdef ARDUINO_ARCH_ESP32
+  if (uploader_handle != NULL) {
+    vTaskNotifyGiveFromISR(uploader_handle, NULL);
+  }
+#endif
+}
+
+// Starts a new superframe with a beacon when the current one is over
+//  The beacon announces the spreading factor chosen by the ADR, the power hints and the slots of the
+//  nodes without a fixed default slot. It is sent with the spreading factor the nodes already listen
+//  to, the radio switches to the new one afterwards.
+//  The receive interrupt is detached meanwhile, it would clear the TX done flag endPacket() waits for
+void send_beacon(){
+  if (beacon.slot_ms != 0 && millis() - last_beacon < sv_tdma_superframe_ms(beacon.slots, beacon.slot_ms)) {
+    return;
+  }
+  last_beacon = millis();
+  beacon.superframe++;
+  NODES_LOCK();
+  beacon.sf = sv_adr_network_sf(&nodes, beacon.sf, &adr_raised, millis());
+  beacon.slot_ms = sv_tdma_slot_ms(beacon.sf);
+  sv_adr_hints(&nodes, &beacon, millis());
+  uint8_t missing = sv_adr_slots(&nodes, &beacon, millis());
+  NODES_UNLOCK();
+  if (beacon.slot_count != slots_assigned || missing != slots_missing) {
+    // nodes left without a slot may collide with the others
+    slots_assigned = beacon.slot_count;
+    slots_missing = missing;
+    Serial.print("Slots assigned: ");
+    Serial.print(slots_assigned);
+    Serial.print(", nodes without a free slot: ");
+    Serial.println(slots_missing);
+  }
+  size_t len = sv_beacon_encode(&beacon, beacon_buffer);
+
+  LoRa.onReceive(NULL);
+  LoRa.beginPacket();
+  LoRa.write(beacon_buffer, len);
+  LoRa.endPacket();
+  LoRa.setSpreadingFactor(beacon.sf);
+  LoRa.onReceive(on_receive);
+  LoRa.receive();
+}
+
+#ifdef ARDUINO_ARCH_ESP32
+// Uploader, sleeps until the interrupt queues a packet and drains the queue
+void uploader_task(void *arg){
+  for (;;) {
+    // wakes at least once a second to check the batch age, more often to answer local queries
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SV_SERIES_NODES ? QUERY_POLL_MS : 1000));
+    while (process_packet() || upload_batch());
+    flush_journal();
+    update_screen();
+    serve_query();
+  }
+}
+#endif
+
+// Decodes a data or summary frame, the header (node, seq, power) always lands in data
+//  A delta frame is only checked, its fields are rebuilt from the keyframe of the node afterwards
+int decode_frame(const uint8_t *buf, size_t len, struct all_sensors_data *data, struct sensors_summary *summary){
+  if (len > SV_FRAME_MAX_LEN || len == 0) {
+    return SV_FRAME_ERR_LENGTH;
+  }
+  if (sv_frame_type(buf) == SV_FRAME_TYPE_DELTA) {
+    return sv_delta_decode(buf, len, NULL, data);
+  }
+  if (sv_frame_type(buf) == SV_FRAME_TYPE_SUMMARY) {
+    summary->mean.present = 0;
+    int status = sv_summary_decode(buf, len, summary);
+    *data = summary->mean;
+    return status;
+  }
+  return sv_frame_decode(buf, len, data);
+}
+
+// Checks the oldest queued packet and stores it in the journal, returns false if the queue was empty
+bool process_packet(){
+  uint8_t buf[SV_PACKET_MAX_LEN];
+  const sv_rx_packet_t *packet = sv_rx_queue_peek(&rx_queue);
+  if (packet == NULL) {
+    return false;
+  }
+
+  //received a packet
+  Serial.print("Received packet ");
+  int packet_size = packet->len;
+  int rssi = packet->rssi;
+  int snr = packet->snr;
+  memcpy(buf, packet->buf, packet_size < SV_PACKET_MAX_LEN ? packet_size : SV_PACKET_MAX_LEN);
+  sv_rx_queue_release(&rx_queue);   // the slot is free again, the rest only uses the copy
+
+  Serial.print(packet_size);
+  Serial.print(" bytes");
+
+  //print RSSI of packet
+  Serial.print(" with RSSI ");    
+  Serial.print(rssi);
+  Serial.print(", dropped ");
+  Serial.println(sv_rx_queue_dropped(&rx_queue));
+
+  // Display information, sent by update_screen() once the queue is drained
+  sv_screen_set_int(&screen, &packets_field, ++packets_received);
+  sv_screen_set_int(&screen, &bytes_field, packet_size);
+  sv_screen_set_int(&screen, &rssi_field, rssi);
+  sv_screen_set_int(&screen, &snr_field, snr / 10);
+
+  if (packet_size > SV_PACKET_MAX_LEN) {
+    Serial.println("Packet too long, dropped");   // only the first SV_PACKET_MAX_LEN bytes were kept
+    return true;
+  }
+  if (packet_size > 0 && sv_frame_type(buf) == SV_FRAME_TYPE_DIAG) {
+    print_diag(buf, packet_size);
+    return true;
+  }
+#if SV_FEC_GROUP
+  if (packet_size > 0 && sv_frame_type(buf) == SV_FRAME_TYPE_PARITY) {
+    process_parity(buf, packet_size, rssi, snr);
+    return true;
+  }
+#endif
+  process_frame(buf, packet_size, rssi, snr);
+  return true;
 }
 
+// Decodes a received or rebuilt frame, accounts it to its node and stores it in the journal
+void process_frame(const uint8_t *buf, size_t len, int rssi, int snr){
+  int frame_status = decode_frame(buf, len, &total_data, &total_summary);
+  uint8_t frame_type = len ? sv_frame_type(buf) : SV_FRAME_TYPE_DATA;
+  const uint8_t *frame = buf;
+  size_t frame_len = len;
+  uint8_t rebuilt[SV_FRAME_MAX_LEN];
+  sv_node_stats_t *node = NULL;
+  bool duplicate = false;
+  if (frame_status == SV_FRAME_OK) {
+    NODES_LOCK();
+    node = sv_node_lookup(&nodes, total_data.node, millis());
+    bool fresh = !node->used;
+    duplicate = sv_node_update(node, total_data.seq, (int16_t)rssi, millis()) == SV_NODE_DUPLICATE;
+    if (!duplicate) {
+      sv_adr_update(node, (int16_t)snr, total_data.tx_power);
+    }
+    NODES_UNLOCK();
+    // the keyframes and parity groups are only used by the uploader
+    sv_delta_ref_t *ref = &delta_refs[node - nodes.entry];
+    if (fresh) {
+      ref->present = 0;   // new entry, the keyframe was another node's
+#if SV_FEC_GROUP
+      fec_groups[node - nodes.entry].received = 0;
+#endif
+    }
+    if (!duplicate) {
+#if SV_FEC_GROUP
+      sv_fec_add(&fec_groups[node - nodes.entry], buf, len, total_data.seq);
+#endif
+      if (frame_type == SV_FRAME_TYPE_DATA) {
+        sv_delta_ref_set(ref, frame);
+      }
+      else if (frame_type == SV_FRAME_TYPE_DELTA) {
+        // journaled as the full data frame, the records stay independent of each other
+        frame_status = sv_delta_decode(frame, frame_len, ref, &total_data);
+        frame_len = sv_frame_encode(&total_data, rebuilt, sizeof(rebuilt));
+        frame = rebuilt;
+      }
+    }
+  }
+  if (frame_status == SV_FRAME_OK && !duplicate) {
+#if SV_SERIES_NODES
+    sv_series_add(&series, &total_data, frame_type == SV_FRAME_TYPE_SUMMARY ? &total_summary : NULL, uptime_s());
+#endif
+    if (journal.pending == 0) {
+      batch_started = millis();
+    }
+    if (!sv_journal_append(&journal, frame, frame_len, millis())) {
+      Serial.println("Journal write failed");
+    }
+  }
+
+  if (node != NULL) {
+    Serial.print("Node ");
+    Serial.print(total_data.node);
+    Serial.print(" seq ");
+    Serial.print(total_data.seq);
+    Serial.print(duplicate ? " duplicate" : "");
+    Serial.print(": received ");
+    Serial.print(node->received);
+    Serial.print(", lost ");
+    Serial.print(node->lost);
+    Serial.print(", duplicates ");
+    Serial.print(node->duplicates);
+    Serial.print(", power ");
+    Serial.print(node->tx_power);
+    Serial.print(" dBm, margin ");
+    Serial.print(sv_adr_margin(node, beacon.sf) / 10);
+    Serial.println(" dB at full power");
+  }
+  if (frame_status != SV_FRAME_OK) {
+    Serial.print("Invalid frame: ");
+    Serial.println(frame_status);
+  }
+  total_data.present = 0;
+}
+
+#if SV_FEC_GROUP
+// Rebuilds the lost frame of a group from its parity frame, then processes it like a received one
+void process_parity(const uint8_t *buf, size_t len, int rssi, int snr){
+  uint8_t frame[SV_FRAME_MAX_LEN];
+  size_t frame_len = 0;
+  int status = sv_fec_parity_check(buf, len);
+
+  if (status == SV_FRAME_OK) {
+    sv_node_stats_t *node = sv_node_find(&nodes, buf[SV_FRAME_NODE_POS]);
+    if (node != NULL) {
+      frame_len = sv_fec_recover(&fec_groups[node - nodes.entry], buf, len, frame);
+    }
+  }
+  if (status != SV_FRAME_OK) {
+    Serial.print("Invalid parity frame: ");
+    Serial.println(status);
+  }
+  else if (frame_len != 0) {
+    Serial.println("Lost frame rebuilt from the parity");
+    process_frame(frame, frame_len, rssi, snr);
+  }
+}
+#endif
+
+// Per cycle breakdown of a diagnostics frame: MSP430 time per FSM cycle, sender time per LoRa frame
+void print_diag(const uint8_t *buf, size_t len){
+  static const char *const label[SV_DIAG_COUNT] = {
+#define SV_DIAG_LABEL(name, text) text,
+    SV_DIAG_TABLE(SV_DIAG_LABEL)
+#undef SV_DIAG_LABEL
+  };
+  sv_diag_counters_t diag;
+  uint8_t node;
+  int status = sv_diag_decode(buf, len, &node, &diag);
+
+  if (status != SV_FRAME_OK) {
+    Serial.print("Invalid diagnostics frame: ");
+    Serial.println(status);
+    return;
+  }
+  uint32_t cycles = diag.counter[SV_DIAG_MSP_CYCLES] ? diag.counter[SV_DIAG_MSP_CYCLES] : 1;
+  uint32_t frames = diag.counter[SV_DIAG_FRAMES] ? diag.counter[SV_DIAG_FRAMES] : 1;
+  uint32_t total = 0;
+
+  Serial.print("Diagnostics of node ");
+  Serial.print(node);
+  Serial.print(": ");
+  Serial.print(diag.counter[SV_DIAG_MSP_CYCLES]);
+  Serial.print(" MSP430 cycles, ");
+  Serial.print(diag.counter[SV_DIAG_FRAMES]);
+  Serial.println(" LoRa frames");
+
+  // ms per MSP430 cycle, the low power modes are part of the states they were entered from
+  for (uint8_t i = 0; i < SV_DIAG_MSP_COUNTERS; i++) {
+    if (i <= SV_DIAG_MSP_SLEEP) {
+      total += diag.counter[i];
+    }
+    Serial.print("  ");
+    Serial.print(label[i]);
+    Serial.print(": ");
+    Serial.print(diag.counter[i] * 1000.0 / SV_DIAG_MSP_HZ / cycles, 1);
+    Serial.println(" ms");
+  }
+  uint32_t lpm = diag.counter[SV_DIAG_MSP_LPM0] + diag.counter[SV_DIAG_MSP_LPM3];
+  uint32_t active = total > lpm ? total - lpm : 0;
+  float charge = ((float)active * SV_DIAG_UA_ACTIVE + (float)diag.counter[SV_DIAG_MSP_LPM0] * SV_DIAG_UA_LPM0
+                  + (float)diag.counter[SV_DIAG_MSP_LPM3] * SV_DIAG_UA_LPM3) / SV_DIAG_MSP_HZ / cycles;
+  Serial.print("  active: ");
+  Serial.print(active * 1000.0 / SV_DIAG_MSP_HZ / cycles, 1);
+  Serial.print(" ms, about ");
+  Serial.print(charge, 1);
+  Serial.println(" uC");
+
+  // us per LoRa frame
+  for (uint8_t i = SV_DIAG_GET_DATA; i < SV_DIAG_FRAMES; i++) {
+    Serial.print("  ");
+    Serial.print(label[i]);
+    Serial.print(": ");
+    Serial.print(diag.counter[i] / frames);
+    Serial.println(" us");
+  }
+}
+
+// Sends the oldest journal records as one batch when UPLOAD_BATCH_MAX are waiting or the oldest is
+// old enough, they are acknowledged after a 2xx answer. Returns true if a batch was acknowledged.
+bool upload_batch(){
+  static struct sensors_summary upload_summary;
+  struct all_sensors_data data;
+  uint8_t frame[SV_FRAME_MAX_LEN];
+  sv_journal_pos_t pos = journal.ack;
+  uint32_t records = 0;               // read from the journal, the undecodable ones included
+  size_t frame_len;
+
+  if (journal.pending == 0 || WiFi.status() != WL_CONNECTED) {
+    return false;
+  }
+  if (journal.pending < UPLOAD_BATCH_MAX && millis() - batch_started < UPLOAD_BATCH_AGE_MS) {
+    return false;
+  }
+  if (upload_retry && millis() - upload_failed < UPLOAD_RETRY_MS) {
+    return false;
+  }
+
+  // oldest records first, replayed in order
+  sv_json_batch_reset(&batch);
+  sv_journal_pos_t next = pos;
+  while (batch.count < UPLOAD_BATCH_MAX && (frame_len = sv_journal_read(&journal, &next, frame)) != 0) {
+    data.present = 0;
+    if (decode_frame(frame, frame_len, &data, &upload_summary) == SV_FRAME_OK) {
+      bool is_summary = sv_frame_type(frame) == SV_FRAME_TYPE_SUMMARY;
+      if (!sv_json_batch_add(&batch, &data, is_summary ? &upload_summary : NULL)) {
+        break;    // full, this record goes in the next batch
+      }
+    }
+    pos = next;
+    records++;
+  }
+  uint16_t count = batch.count;
+  size_t len = sv_json_batch_finish(&batch);
+  Serial.print("Uploading ");
+  Serial.print(count);
+  Serial.print(" measurements, ");
+  Serial.print(len);
+  Serial.print(" bytes, ");
+  Serial.print(journal.pending);
+  Serial.println(" pending");
+
+#if SV_DIAG
+  unsigned long upload_start = millis();
+#endif
+  int httpCode = count ? sendToServer(batch.buf, len) : 200;
+#if SV_DIAG
+  Serial.print("Upload took ");
+  Serial.print(millis() - upload_start);
+  Serial.println(" ms");
+#endif
+  upload_retry = httpCode < 200 || httpCode >= 300;
+  if (upload_retry) {
+    upload_failed = millis();
+    return false;
+  }
+  sv_journal_ack(&journal, pos, records);
+  return true;
+}
+
+// Seconds since boot, millis() extended past its 49 day wrap; called at least every second
+uint32_t uptime_s(){
+  static uint32_t last_ms = 0;
+  static uint32_t wraps = 0;
+  uint32_t ms = millis();
+
+  if (ms < last_ms) {
+    wraps++;
+  }
+  last_ms = ms;
+  return (uint32_t)((((uint64_t)wraps << 32) | ms) / 1000);
+}
+
+// Answers the local query of a waiting client from the time series store, see SmartVit_series.h
+//  The request and the answer go through fixed buffers, nothing is allocated per query
+void serve_query(){
+#if SV_SERIES_NODES
+  char request[SV_SERIES_REQUEST_LEN];
+  char line[SV_SERIES_LINE_LEN];
+  size_t len = 0;
+  sv_series_query_t query;
+  sv_series_cell_t cell;
+  uint32_t now = uptime_s();
+
+  WiFiClient client = query_server.available();
+  if (!client) {
+    return;
+  }
+  // request line only, the headers are not needed
+  unsigned long start = millis();
+  while (client.connected() && millis() - start < QUERY_TIMEOUT_MS) {
+    int c = client.read();
+    if (c < 0) {
+      delay(1);
+      continue;
+    }
+    if (c == '\n') {
+      break;
+    }
+    if (len < sizeof(request) - 1) {
+      request[len++] = (char)c;
+    }
+  }
+  request[len] = '\0';
+
+  int status = sv_series_query_parse(request, &query);
+  const sv_series_node_t *entry = status == SV_SERIES_OK ? sv_series_lookup(&series, query.node, false) : NULL;
+  if (status == SV_SERIES_OK && entry == NULL) {
+    status = SV_SERIES_NOT_FOUND;
+  }
+  len = snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\nConnection: close\r\n\r\n",
+                 status, status == SV_SERIES_OK ? "OK" : status == SV_SERIES_NOT_FOUND ? "Not Found" : "Bad Request");
+  client.write((const uint8_t *)line, len);
+  if (status != SV_SERIES_OK) {
+    client.stop();
+    return;
+  }
+
+  client.write((const uint8_t *)line, sv_series_json_head(line, sizeof(line), &query, now));
+  if (query.kind == SV_SERIES_QUERY_AGGREGATE) {
+    if (sv_series_aggregate(entry, query.field, now, query.from, query.to, &cell)) {
+      client.write((const uint8_t *)line, sv_series_json_cell(line, sizeof(line), query.field, &cell, false));
+    }
+    else {
+      client.print("\"count\":0");
+    }
+  }
+  else {
+    uint8_t tier = sv_series_tier(now, query.from);
+    uint32_t step = sv_series_step[tier];
+    uint32_t bucket;
+    uint32_t last;
+    bool first = true;
+
+    len = snprintf(line, sizeof(line), "\"step\":%lu,\"rows\":[", (unsigned long)step);
+    client.write((const uint8_t *)line, len);
+    sv_series_range(tier, now, query.from, query.to, &bucket, &last);
+    for (; bucket <= last; bucket++) {
+      if (!sv_series_cell(entry, tier, query.field, bucket, &cell)) {
+        continue;
+      }
+      len = snprintf(line, sizeof(line), "%s[%lu,", first ? "" : ",", (unsigned long)(now - bucket * step));
+      len += sv_series_json_cell(&line[len], sizeof(line) - len - 1, query.field, &cell, true);
+      line[len++] = ']';
+      client.write((const uint8_t *)line, len);
+      first = false;
+    }
+    client.print("]");
+  }
+  client.print("}");
+  client.stop();
+#endif
+}
 
 void init_lora(){
   //SPI LoRa pins
@@ -115,7 +639,69 @@ void init_lora(){
   display.display();  
 }
 
+// Receives in the DIO0 interrupt from now on, the display belongs to the uploader afterwards
+void start_receiver(){
+  sv_rx_queue_init(&rx_queue);
+  sv_node_table_init(&nodes);
+  sv_json_batch_init(&batch, batch_buffer, sizeof(batch_buffer));
+  init_journal();
+#if SV_SERIES_NODES
+  sv_series_init(&series);
+  query_server.begin();
+#endif
+#ifdef ARDUINO_ARCH_ESP32
+  xTaskCreatePinnedToCore(uploader_task, "uploader", UPLOADER_STACK, NULL, UPLOADER_PRIORITY, &uploader_handle, UPLOADER_CORE);
+#endif
+  LoRa.setSpreadingFactor(beacon.sf);
+  LoRa.onReceive(on_receive);
+  LoRa.receive();
+}
+
 // ADDIOTIONAL FUNCTIONS
+void init_journal(){
+#ifdef ARDUINO_ARCH_ESP32
+  if (!LittleFS.begin(true)) {   // formats the partition on the first boot
+#else
+  if (!LittleFS.begin()) {
+#endif
+    Serial.println("LittleFS mount failed!");
+    while (1);
+  }
+  sv_journal_begin(&journal);
+  Serial.print("Journal: ");
+  Serial.print(journal.pending);
+  Serial.println(" measurements waiting for upload");
+}
+
+// Writes the journal records buffered in RAM to flash once the oldest has waited SV_JOURNAL_FLUSH_MS
+//  A batch the server accepts before is never written
+void flush_journal(){
+  if (sv_journal_flush_due(&journal, millis()) && !sv_journal_flush(&journal)) {
+    Serial.println("Journal write failed");
+  }
+}
+
+// Status screen: title and field names, drawn once
+void init_screen(){
+  sv_screen_begin(&screen, &display, &Wire, OLED_ADDRESS);
+  sv_screen_label(&screen, 0, 0, "LORA RECEIVER");
+  sv_screen_label(&screen, 0, 2, "Packets:");
+  sv_screen_label(&screen, 0, 3, "Bytes:");
+  sv_screen_label(&screen, 0, 4, "RSSI:");
+  sv_screen_label(&screen, 0, 5, "SNR:");
+  sv_screen_label(&screen, 0, 6, "Dropped:");
+  sv_screen_label(&screen, 0, 7, "Pending:");
+  sv_screen_flush(&screen, millis());
+}
+
+// Sends the changed fields to the display, at most every SV_SCREEN_REFRESH_MS
+//  Called by the uploader once the queue is drained
+void update_screen(){
+  sv_screen_set_int(&screen, &dropped_field, sv_rx_queue_dropped(&rx_queue));
+  sv_screen_set_int(&screen, &pending_field, journal.pending);
+  sv_screen_refresh(&screen, millis());
+}
+
 void init_oled(){
   //reset OLED display via software
   pinMode(OLED_RST, OUTPUT);
@@ -125,7 +711,7 @@ void init_oled(){
   
   //initialize OLED
   Wire.begin();
-  if(!display.begin(SSD1306_SWITCHCAPVCC, 0x3c, false, false)) { // Address 0x3C for 128x32
+  if(!display.begin(SSD1306_SWITCHCAPVCC, OLED_ADDRESS, false, false)) { // Address 0x3C for 128x32
     Serial.println(F("SSD1306 allocation failed"));
     for(;;); // Don't proceed, loop forever
   }
@@ -142,37 +728,35 @@ void init_wifi()
   
   /* Explicitly set the ESP8266 to be a WiFi-client, otherwise, it by default, would try to act as both a client and an access-point and could cause network-issues with your other WiFi-devices on your WiFi-network. */ 
   WiFi.mode(WIFI_STA); 
+  WiFi.setAutoReconnect(true);  // measurements wait in the journal while it is down, no need to block here
   WiFi.begin(ssid, password); 
-  while (WiFi.status() != WL_CONNECTED) { 
-    delay(500); 
-    Serial.print("."); 
-  } 
-  
-  Serial.println(""); 
-  Serial.println("WiFi connected"); 
-  Serial.println("IP address: "); 
+
+  tls_client.setInsecure();
+#ifndef ARDUINO_ARCH_ESP32
+  tls_client.setSession(&tls_session);
+#endif
+  http.setReuse(true);
 }
 
-void sendToServer(String dataToSend){
+// Returns the HTTP code, or a negative value if the request could not be made
+int sendToServer(const char *dataToSend, size_t len){
 
  if(WiFi.status() == WL_CONNECTED){   //Check WiFi connection status
  
-   HTTPClient http;    //Declare object of class HTTPClient
- 
-   http.begin(URL_ADDRESS);      //Specify request destination
+   http.begin(tls_client, URL_ADDRESS);      //Specify request destination, reuses the open connection
    http.addHeader("Content-Type", "application/json");  //Specify content-type header
  
-   int httpCode = http.POST(dataToSend);   //Send the request
-   String payload = http.getString();                  //Get the response payload
+   int httpCode = http.POST((uint8_t *)dataToSend, len);   //Send the request
  
    Serial.println(httpCode);   //Print HTTP return code
-   Serial.println(payload);    //Print request response payload
  
-   http.end();  //Close connection
+   http.end();  //Discards the response, the connection stays open
+   return httpCode;
  
  }else{
  
     Serial.println("Error in WiFi connection");   
+    return -1;
  
  }
 }
@@ -1,6 +1,12 @@
 /* ******************** INCLUDES ******************** */
 // SmartVit Libraries (SV)
 #include "SmartVit_lora.h"
+#include "SmartVit_frame.h"
+#include "SmartVit_link.h"
+#include "SmartVit_calibration.h"
+#include "SmartVit_aggregate.h"
+#include "SmartVit_fec.h"
+#include "SmartVit_screen.h"
 
 // LoRa library
 #include <SPI.h>
@@ -11,28 +17,101 @@
 #include <Adafruit_BME280.h>
 #include <Adafruit_Sensor.h>
 
+#include <sys/time.h>
+
+/* ******************** DEFINES ******************** */
+// Kept in RTC memory through deep sleep, only initialized at power up
+#if SV_DEEP_SLEEP
+#define RETAINED RTC_DATA_ATTR
+#else
+#define RETAINED
+#endif
+
+// Readings parsed while a frame waits for its slot, the oldest is dropped when a new one finds it full
+#define READING_QUEUE_LEN 4
+
 /* ******************** GLOBAL DATA******************** */
 // Packet counter
-int counter = 0;
-unsigned long loop_init_time = 0;
-
-float calibration = 0.00;
-float wind_dir = 0.00;
+RETAINED int counter = 0;
 
 Adafruit_BME280 bme; // I2C
 Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RST);
+// status screen, only the fields that changed are sent to the display
+sv_screen_t screen;
+sv_screen_field_t sent_field = SV_SCREEN_FIELD(54, 2, 12);
+sv_screen_field_t frame_field = SV_SCREEN_FIELD(54, 3, 12);
+sv_screen_field_t bytes_field = SV_SCREEN_FIELD(54, 4, 12);
+sv_screen_field_t radio_field = SV_SCREEN_FIELD(54, 5, 12);
 SoftwareSerial MSP430(MSP430_RX, MSP430_TX); // RX, TX
 
 // Variables used to general purposes
 // struct to storage data that will be sent to the LoRa receiver. 
-struct all_sensors_data total_data;
+RETAINED struct all_sensors_data total_data;
+// buffer where the LoRa frame is encoded
+uint8_t frame_buffer[SV_PACKET_MAX_LEN];
+// parser of the frames sent by the MSP430
+sv_link_parser_t link_parser;
+// readings of the MSP430 not taken into total_data yet, the serial port is drained in every loop
+//  because the SoftwareSerial buffer only holds 64 bytes
+RETAINED struct all_sensors_data reading_queue[READING_QUEUE_LEN];
+RETAINED uint8_t reading_first = 0;
+RETAINED uint8_t reading_count = 0;
+RETAINED unsigned long readings_dropped = 0;
+// sequence number of the next LoRa frame
+RETAINED uint16_t frame_seq = 0;
+// statistics of the readings of the current window, sent as a summary frame when it ends
+RETAINED sv_aggregate_t aggregate;
+RETAINED struct sensors_summary summary;
+RETAINED uint8_t frame_type = SV_FRAME_TYPE_DATA;    // type of the pending frame
+// last data frame sent in full, the next ones only carry their differences to it
+RETAINED sv_delta_ref_t keyframe = {{0}, 0, 0};
+RETAINED uint8_t delta_count = 0;                    // delta frames sent since the keyframe
+// XOR of the frames of the current group, sent as a parity frame after the last one
+RETAINED sv_fec_group_t fec;
+RETAINED bool parity_due = false;
+#if SV_DIAG
+// time spent by the MSP430 and here since the last diagnostics frame
+RETAINED sv_diag_counters_t diag;
+#endif
+
+// TDMA: a frame waits for the beacon of the gateway and is sent in the slot of this node
+//  Without a beacon for two superframes it is sent at full power after a random delay (ALOHA)
+//  and the next spreading factor is tried, the gateway may have moved to another one
+RETAINED bool frame_pending = false;
+RETAINED bool slot_known = false;
+RETAINED unsigned long pending_since = 0;
+RETAINED unsigned long send_at = 0;
+// radio settings of the last beacon, spreading factor of the network and TX power hinted by the ADR
+RETAINED sv_beacon_t beacon = {SV_TDMA_SLOTS, 0, SV_ADR_SF_MAX, 0};
+RETAINED int8_t tx_power = SV_ADR_POWER_MAX;
+// clock_ms() of the last beacon heard, the next ones are expected a superframe apart
+RETAINED unsigned long beacon_heard = 0;
+RETAINED bool beacon_known = false;
+
+#if SV_SLEEP_STATS
+// clock_ms() of the wake up and of the transmission of this cycle
+unsigned long woke_at = 0;
+unsigned long sent_at = 0;
+#endif
 
 /* ******************** FUNCTIONS ******************** */
 
 
 // Additional Functions
 
-void lora_init(){
+// Time base of the sender, unlike millis() it keeps counting through deep sleep
+unsigned long clock_ms(){
+#if SV_DEEP_SLEEP
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return (unsigned long)now.tv_sec * 1000 + now.tv_usec / 1000;
+#else
+  return millis();
+#endif
+}
+
+// Starts the radio with the spreading factor and TX power in use
+void lora_start(){
   //SPI LoRa pins
   SPI.begin();
   
@@ -43,6 +122,13 @@ void lora_init(){
     Serial.println("Starting LoRa failed!");
     while (1);
   }
+  beacon.slot_ms = sv_tdma_slot_ms(beacon.sf);
+  LoRa.setSpreadingFactor(beacon.sf);
+  LoRa.setTxPower(tx_power);
+}
+
+void lora_init(){
+  lora_start();
   Serial.println("LoRa Initializing OK!");
   display.setCursor(0,10);
   display.print("LoRa Initializing OK!");
@@ -59,117 +145,120 @@ void oled_init(){
 
   //initialize OLED
   Wire.begin();
-  if(!display.begin(SSD1306_SWITCHCAPVCC, 0x3c, false, false)) { // Address 0x3C for 128x32
+  if(!display.begin(SSD1306_SWITCHCAPVCC, OLED_ADDRESS, false, false)) { // Address 0x3C for 128x32
     Serial.println(F("SSD1306 allocation failed"));
     for(;;); // Don't proceed, loop forever
   }
 }
 
+// Status screen: title and field names, drawn once
+void screen_init(){
+  sv_screen_begin(&screen, &display, &Wire, OLED_ADDRESS);
+  sv_screen_label(&screen, 0, 0, "LORA SENDER");
+  sv_screen_label(&screen, 0, 2, "Sent:");
+  sv_screen_label(&screen, 0, 3, "Frame:");
+  sv_screen_label(&screen, 0, 4, "Bytes:");
+  sv_screen_label(&screen, 0, 5, "Radio:");
+  sv_screen_flush(&screen, millis());
+}
 
-void get_data(all_sensors_data *total_data){
-  // First read the sensor identifier to let us know what is being sent 
-  sensor_id_t data_id = (sensor_id_t) MSP430.read();
-  
+
+// Stores one raw record received from the MSP430, calibrated to physical units
+void store_record(all_sensors_data *total_data, uint8_t data_id, sv_link_value_t value){
+  if (data_id >= SV_FIELD_COUNT || !(SV_ENABLED_FIELDS & SV_FIELD_BIT(data_id))){
+    return;
+  }
+  sv_field_set(total_data, (sv_field_t)data_id, sv_calibrate((sv_field_t)data_id, value));
+}
+
+// Reads the sensors connected to the ESP32
+void get_local_data(all_sensors_data *total_data){
+  if (SV_ENABLE_AIR_TEMP){
+    // reads temperature in Celsius
+    sv_field_set(total_data, SV_FIELD_AIR_TEMP, bme.readTemperature());
+  }
+  if (SV_ENABLE_AIR_HUMID){
+    // reads absolute humidity
+    sv_field_set(total_data, SV_FIELD_AIR_HUMID, bme.readHumidity());
+  }
+  if (SV_ENABLE_AIR_PRES){
+    // reads pressure in hPa (hectoPascal = millibar)
+    sv_field_set(total_data, SV_FIELD_AIR_PRES, bme.readPressure() / 100.0F);
+  }
+}
+
+// Feeds the bytes already received from the MSP430 to the link parser, never blocks
+//  Returns true when a complete frame of readings was received and stored
+bool get_data(all_sensors_data *total_data){
   while(MSP430.available()){
-    switch(data_id){
-      case PH_SENSOR:
-        total_data->sensor_ph.sensor_id = PH_SENSOR;
-        total_data->sensor_ph.sensor_ph = MSP430.parseFloat(); 
-        total_data->sensor_ph.sensor_ph = (total_data->sensor_ph.sensor_ph * VREF) / (RESOLUTION * SAMPLES); 
-        total_data->sensor_ph.sensor_ph = -5.70 * total_data->sensor_ph.sensor_ph + calibration ;
-        break;
-
-      case TEMP_SENSOR:
-        total_data->sensor_temperatura.sensor_id = TEMP_SENSOR;
-        total_data->sensor_temperatura.temp_soil = MSP430.parseFloat(); 
-        total_data->sensor_temperatura.temp_soil = (total_data->sensor_temperatura.temp_soil * VREF) / RESOLUTION; 
-        break;
-      
-      case SV10_ANEMOMETER:      
-        total_data->sensor_biruta.sensor_id = SV10_ANEMOMETER;
-        total_data->sensor_anemometro.vento_MS = MSP430.parseFloat();
-        total_data->sensor_anemometro.vento_MS = (2 * PI * RADIUS * total_data->sensor_anemometro.vento_MS)/PERIOD;
-        break;
-      
-      case CV10_WINDSOCK:
-        total_data->sensor_biruta.sensor_id = CV10_WINDSOCK;
-        wind_dir = (dv10_windsock_t)MSP430.read();
-        wind_dir = (wind_dir * VREF) / RESOLUTION;
-        if (wind_dir > 3.00){
-          total_data->sensor_biruta.vento_direcao  = NORTH;
-        }
-        else if (wind_dir > 2.80){
-          total_data->sensor_biruta.vento_direcao = NORTHEAST;
-        }
-        else if (wind_dir > 2.70){
-          total_data->sensor_biruta.vento_direcao = EAST;
-        }
-        else if (wind_dir > 2.50){
-          total_data->sensor_biruta.vento_direcao = SOUTHEAST;
-        }
-        else if (wind_dir > 2.30){
-          total_data->sensor_biruta.vento_direcao = SOUTH;
-        }
-        else if (wind_dir > 2.20){
-          total_data->sensor_biruta.vento_direcao = SOUTHWEST;
-        }
-        else if (wind_dir > 2.05){
-          total_data->sensor_biruta.vento_direcao = WEST;
-        }
-        else if (wind_dir > 1.95){
-          total_data->sensor_biruta.vento_direcao = NORTHWEST;
-        }
-        else{
-          total_data->sensor_biruta.vento_direcao = NORTHEAST;
+    int result = sv_link_parser_push(&link_parser, (uint8_t)MSP430.read());
+
+    if (result == SV_LINK_FRAME){
+      bool readings = false;
+      for (uint8_t i = 0; i < sv_link_records(&link_parser); i++){
+        uint8_t data_id;
+        sv_link_value_t value;
+        sv_link_get_record(&link_parser, i, &data_id, &value);
+#if SV_DIAG
+        if (SV_LINK_IS_DIAG(data_id)){
+          sv_diag_add_record(&diag, data_id, value);
+          continue;
         }
-        break;
-
-      case PLUVIOMETER_SENSOR:
-        total_data->sensor_pluviometro.sensor_id = PLUVIOMETER_SENSOR;
-        total_data->sensor_pluviometro.qtd_chuva= (total_data->sensor_pluviometro.qtd_chuva *PLUV_RES) * PERIOD;
-        total_data->sensor_pluviometro.qtd_chuva = MSP430.read();
-        break;
-      
-      case BME280_TEMP_SENSOR:
-        // reads temperature in Celsius
-        total_data->sensor_bme.sensor_id = BME280_SENSOR;
-        total_data->sensor_bme.temp_celsius = bme.readTemperature();
-        break;
-      
-      case BME280_HUMID_SENSOR:
-        // reads absolute humidity
-        total_data->sensor_bme.sensor_id = BME280_SENSOR;
-        total_data->sensor_bme.humidity_percent = bme.readHumidity();
-        break;
-      
-      case BME280_PRES_SENSOR:
-        // reads pressure in hPa (hectoPascal = millibar)
-        total_data->sensor_bme.sensor_id = BME280_SENSOR;
-        total_data->sensor_bme.pressure_hPa = bme.readPressure() / 100.0F;
-        break;
-      
-      case MOIST_SENSOR_1:
-        // reads absolute humidity
-        total_data->moist_percent.sensor_id = MOIST_SENSOR;
-        total_data->moist_percent.moist_percent_1 = MSP430.parseFloat();
-        total_data->moist_percent.moist_percent_1 = (total_data->moist_percent.moist_percent_1 * VREF) / RESOLUTION;
-        break;
-
-      case MOIST_SENSOR_2:
-        // reads absolute humidity
-        total_data->moist_percent.sensor_id = MOIST_SENSOR;
-        total_data->moist_percent.moist_percent_2 = MSP430.parseFloat();
-        total_data->moist_percent.moist_percent_2 = (total_data->moist_percent.moist_percent_2 * VREF) / RESOLUTION;
-        break;
-
-      case MOIST_SENSOR_3:
-        // reads absolute humidity
-        total_data->moist_percent.sensor_id = MOIST_SENSOR;
-        total_data->moist_percent.moist_percent_3 = MSP430.parseFloat();
-        total_data->moist_percent.moist_percent_3 = (total_data->moist_percent.moist_percent_3 * VREF) / RESOLUTION;
-        break;
+#endif
+        store_record(total_data, data_id, value);
+        readings = true;
+      }
+      if (!readings){
+#if SV_DIAG
+        diag.counter[SV_DIAG_MSP_CYCLES]++;
+#endif
+        continue;
+      }
+      get_local_data(total_data);
+      return true;
+    }
+    if (result != SV_LINK_MORE){
+      Serial.print("Invalid MSP430 frame: ");
+      Serial.println(result);
+    }
+  }
+  return false;
+}
+
+// Parses every byte received from the MSP430 into the reading queue, the frame pending or not
+void poll_msp430(){
+  struct all_sensors_data reading;
+
+  reading.present = 0;
+  while (get_data(&reading)) {
+    if (reading_count == READING_QUEUE_LEN) {
+      reading_first = (reading_first + 1) % READING_QUEUE_LEN;
+      reading_count--;
+      readings_dropped++;
+      Serial.print("Reading queue full, dropped: ");
+      Serial.println(readings_dropped);
+    }
+    reading_queue[(reading_first + reading_count) % READING_QUEUE_LEN] = reading;
+    reading_count++;
+    reading.present = 0;
+  }
+}
+
+// Moves the oldest queued reading into total_data, returns false when the queue is empty
+bool take_reading(all_sensors_data *total_data){
+  const struct all_sensors_data *reading = &reading_queue[reading_first];
+
+  if (reading_count == 0) {
+    return false;
+  }
+  for (uint8_t field = 0; field < SV_FIELD_COUNT; field++) {
+    if (reading->present & SV_FIELD_BIT(field)) {
+      sv_field_set(total_data, (sv_field_t)field, sv_field_get(reading, (sv_field_t)field));
     }
   }
+  reading_first = (reading_first + 1) % READING_QUEUE_LEN;
+  reading_count--;
+  return true;
 }
 
 // SETUP AND LOOP
@@ -177,85 +266,322 @@ void get_data(all_sensors_data *total_data){
 void setup() {
   // Init 
   Serial.begin(SERIAL_BAUD_RATE);
+  MSP430.begin(MSP430_BAUD_RATE);
+  sv_link_parser_init(&link_parser);
+#if SV_DEEP_SLEEP
+  pinMode(MSP430_DATA_READY, INPUT);
+#if SV_SLEEP_STATS
+  woke_at = clock_ms() - millis();
+#endif
+  if (esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_UNDEFINED) {
+    // woken from deep sleep, the state is in RTC memory: only restart the peripherals
+    oled_init();
+    screen_init();
+    lora_start();
+    return;
+  }
+#endif
+  sv_aggregate_reset(&aggregate);
+  sv_fec_reset(&fec, 0);
+#if SV_DIAG
+  sv_diag_reset(&diag);
+#endif
   oled_init();
   lora_init();
+  screen_init();
+}
 
-  display.clearDisplay();
-  display.setTextColor(WHITE);
-  display.setTextSize(1);
-  display.setCursor(0,0);
-  display.print("LORA SENDER ");
-  display.display();
+// Listens for the gateway beacon, returns true and the time of the slot of this node when one is heard
+//  Applies the spreading factor and the TX power hint it carries
+bool get_beacon(unsigned long *slot_time){
+  uint8_t buf[SV_BEACON_MAX_LEN];
+  sv_beacon_t heard_beacon;
+  int len = 0;
+
+  int packet_size = LoRa.parsePacket();
+  if (!packet_size) {
+    return false;
+  }
+  unsigned long heard = clock_ms();
+  while (LoRa.available()) {
+    uint8_t byte = (uint8_t)LoRa.read();
+    if (len < SV_BEACON_MAX_LEN) {
+      buf[len] = byte;
+    }
+    len++;
+  }
+  if (len > SV_BEACON_MAX_LEN || sv_beacon_decode(buf, len, &heard_beacon) != SV_FRAME_OK) {
+    return false;
+  }
+  beacon = heard_beacon;
+  beacon_heard = heard;
+  beacon_known = true;
+  *slot_time = heard + sv_tdma_slot_offset_ms(&beacon, SV_NODE_ID);
+
+  if (beacon.sf >= SV_ADR_SF_MIN && beacon.sf <= SV_ADR_SF_MAX) {
+    LoRa.setSpreadingFactor(beacon.sf);
+  }
+  if (sv_beacon_hint(&beacon, SV_NODE_ID, &tx_power)) {
+    tx_power = constrain(tx_power, SV_ADR_POWER_MIN, SV_ADR_POWER_MAX);
+    LoRa.setTxPower(tx_power);
+  }
+  return true;
 }
 
+#if SV_DEEP_SLEEP
+// Time the loop waits for: the next beacon, the slot of this node or the end of the window
+//  Returns false when nothing is waited for but a reading
+bool wake_time(unsigned long now, unsigned long *wake_at){
+  if (frame_pending && slot_known) {
+    *wake_at = send_at;
+    return true;
+  }
+  if (frame_pending) {
+    // the beacon expected last is still listened for during the guard time after it
+    unsigned long superframe = sv_tdma_superframe_ms(beacon.slots, beacon.slot_ms);
+    unsigned long elapsed = now - beacon_heard;
+    if (!beacon_known || elapsed < SV_SLEEP_GUARD_MS) {
+      *wake_at = now;
+      return true;
+    }
+    *wake_at = beacon_heard + ((elapsed - SV_SLEEP_GUARD_MS) / superframe + 1) * superframe;
+    return true;
+  }
+  if (reading_count > 0) {
+    *wake_at = now;
+    return true;
+  }
+  if (!sv_aggregate_empty(&aggregate)) {
+    *wake_at = aggregate.started + SV_AGGREGATE_WINDOW_MS;
+    return true;
+  }
+  return false;
+}
+
+// Deep sleeps when the loop has nothing to do for a while, the next wake restarts setup()
+//  Never while the MSP430 is sending, its bytes only live in the SoftwareSerial buffer
+void sleep_when_idle(){
+  unsigned long now = clock_ms();
+  unsigned long wake_at;
+  bool timed = wake_time(now, &wake_at);
+
+  if (digitalRead(MSP430_DATA_READY) == HIGH || MSP430.available()) {
+    return;
+  }
+  if (timed && (long)(wake_at - now) < (long)(SV_SLEEP_GUARD_MS + SV_SLEEP_MIN_MS)) {
+    return;
+  }
+
+#if SV_SLEEP_STATS
+  Serial.print("Cycle: awake ");
+  Serial.print(now - woke_at);
+  Serial.print(" ms, wake to transmit ");
+  if (sent_at != 0) {
+    Serial.print(sent_at - woke_at);
+    Serial.print(" ms, woken by ");
+  }
+  else {
+    Serial.print("none, woken by ");
+  }
+  Serial.println((int)esp_sleep_get_wakeup_cause());
+#endif
+  LoRa.sleep();
+  display.ssd1306_command(SSD1306_DISPLAYOFF);
+  if (timed) {
+    esp_sleep_enable_timer_wakeup((uint64_t)(wake_at - SV_SLEEP_GUARD_MS - now) * 1000);
+  }
+  esp_sleep_enable_ext0_wakeup((gpio_num_t)MSP430_DATA_READY, HIGH);
+  Serial.flush();
+  esp_deep_sleep_start();
+}
+#endif
+
 void loop() {
-  loop_init_time = millis();  
-  
+#if SV_DIAG
+  unsigned long get_data_start = micros();
+#endif
+  poll_msp430();
+#if SV_DIAG
+  diag.counter[SV_DIAG_GET_DATA] += micros() - get_data_start;
+#endif
+  // The screen is only sent while no frame waits for its slot
+  if (!frame_pending) {
+    sv_screen_refresh(&screen, millis());
+  }
+#if SV_DEEP_SLEEP
+  sleep_when_idle();
+#endif
+  // The MSP430 sets the pace, a packet is sent for each frame it sends
+  // Readings only feed the window, unless one of them crosses its trigger or there is no window
+  if (!frame_pending) {
+    bool got_data = take_reading(&total_data);
+    if (got_data) {
+      if (SV_AGGREGATE_WINDOW_MS == 0 || sv_aggregate_add(&aggregate, &total_data, clock_ms())) {
+        frame_type = SV_FRAME_TYPE_DATA;
+        frame_pending = true;
+      }
+      else {
+        total_data.present = 0;
+      }
+    }
+    if (!frame_pending && sv_aggregate_window_over(&aggregate, clock_ms())) {
+      sv_aggregate_summary(&aggregate, &summary);
+      sv_aggregate_reset(&aggregate);
+      frame_type = SV_FRAME_TYPE_SUMMARY;
+      frame_pending = true;
+    }
+    if (!frame_pending) {
+      return;
+    }
+    slot_known = false;
+    pending_since = clock_ms();
+  }
+
+  // Wait for the slot of this node
+  if (!slot_known) {
+    if (get_beacon(&send_at)) {
+      slot_known = true;
+    }
+    else if (clock_ms() - pending_since >= 2 * sv_tdma_superframe_ms(beacon.slots, beacon.slot_ms)) {
+      Serial.println("No beacon, sending at random");
+      send_at = clock_ms() + random(sv_tdma_superframe_ms(beacon.slots, beacon.slot_ms));
+      slot_known = true;
+      tx_power = SV_ADR_POWER_MAX;
+      LoRa.setTxPower(tx_power);
+      beacon.sf = beacon.sf < SV_ADR_SF_MAX ? beacon.sf + 1 : SV_ADR_SF_MIN;   // try the next one
+      beacon.slot_ms = sv_tdma_slot_ms(beacon.sf);
+      LoRa.setSpreadingFactor(beacon.sf);
+    }
+    else {
+      return;
+    }
+  }
+  if ((long)(clock_ms() - send_at) < 0) {
+    return;
+  }
+  frame_pending = false;
+
   Serial.print("Sending packet: ");
-  Serial.println(counter);
+  Serial.println(counter++);
 
-  get_data(&total_data);
-  
   LoRa.idle();
   
   //Send LoRa packet to receiver
   LoRaSendPacket();
   
   LoRa.sleep();
-  delay(LOOP_TIME - loop_init_time);
-  
-  LoRa.begin(BAND);
+
+  // The parity and diagnostics frames go in the next slots, before new readings
+  if (parity_due) {
+    parity_due = false;
+    queue_frame(SV_FRAME_TYPE_PARITY);
+  }
+#if SV_DIAG
+  else if (diag.counter[SV_DIAG_FRAMES] >= SV_DIAG_PERIOD_FRAMES) {
+    queue_frame(SV_FRAME_TYPE_DIAG);
+  }
+#endif
+}
+
+// Makes a frame of type pending, it waits for the next slot
+void queue_frame(uint8_t type){
+  frame_type = type;
+  frame_pending = true;
+  slot_known = false;
+  pending_since = clock_ms();
 }
 
 
 void LoRaSendPacket(){
+  struct all_sensors_data *head = frame_type == SV_FRAME_TYPE_SUMMARY ? &summary.mean : &total_data;
+  size_t frame_len;
+  const char *type_name = "Data";
+  char radio[SV_SCREEN_TEXT_LEN];
+#if SV_DIAG
+  unsigned long encode_start = micros();
+#endif
+
+  if (frame_type == SV_FRAME_TYPE_PARITY) {
+    frame_len = sv_fec_parity_encode(&fec, SV_NODE_ID, frame_buffer, sizeof(frame_buffer));
+  }
+#if SV_DIAG
+  else if (frame_type == SV_FRAME_TYPE_DIAG) {
+    frame_len = sv_diag_encode(&diag, SV_NODE_ID, frame_buffer, sizeof(frame_buffer));
+    sv_diag_reset(&diag);
+  }
+#endif
+  else {
+    head->node = SV_NODE_ID;
+    head->seq = frame_seq++;
+    head->tx_power = tx_power;
+    if (frame_type == SV_FRAME_TYPE_SUMMARY) {
+      frame_len = sv_summary_encode(&summary, frame_buffer, sizeof(frame_buffer));
+    }
+    else {
+      frame_len = 0;
+      if (delta_count + 1 < SV_DELTA_KEYFRAME_INTERVAL) {
+        frame_len = sv_delta_encode(&total_data, &keyframe, frame_buffer, sizeof(frame_buffer));
+      }
+      if (frame_len != 0) {
+        delta_count++;
+      }
+      else {
+        frame_len = sv_frame_encode(&total_data, frame_buffer, sizeof(frame_buffer));
+        sv_delta_ref_set(&keyframe, frame_buffer);
+        delta_count = 0;
+      }
+    }
+    if (SV_FEC_GROUP && sv_fec_add(&fec, frame_buffer, frame_len, head->seq)) {
+      parity_due = true;
+    }
+  }
+
+#if SV_DIAG
+  unsigned long airtime_start = micros();
+  diag.counter[SV_DIAG_ENCODE] += airtime_start - encode_start;
+#endif
   LoRa.beginPacket();
-    LoRa.print("{\"data\": {");
-    LoRa.write((unsigned char *)&total_data.sensor_anemometro.sensor_id, sizeof(sensor_id_t));
-    LoRa.print(": {\"vento_MS\": ");
-    LoRa.write((unsigned char *)&total_data.sensor_anemometro.vento_MS, sizeof(total_data.sensor_anemometro.vento_MS));
-    LoRa.print("}, ");
-    LoRa.write((unsigned char *)&total_data.sensor_biruta.sensor_id, sizeof(sensor_id_t));
-    LoRa.print(": {\"vento_direcao\": ");
-    LoRa.write((unsigned char *)&total_data.sensor_biruta.vento_direcao, sizeof(total_data.sensor_biruta.vento_direcao));
-    LoRa.print("}, ");
-    LoRa.write((unsigned char *)&total_data.sensor_pluviometro.sensor_id, sizeof(sensor_id_t));
-    LoRa.print(": {\"qtd_chuva\": ");
-    LoRa.write((unsigned char *)&total_data.sensor_pluviometro.qtd_chuva, sizeof(total_data.sensor_pluviometro.qtd_chuva));
-    LoRa.print("}, ");
-    LoRa.write((unsigned char *)&total_data.sensor_bme.sensor_id, sizeof(sensor_id_t));
-    LoRa.print(": {\"temp_celsius\": ");
-    LoRa.write((unsigned char *)&total_data.sensor_bme.temp_celsius, sizeof(total_data.sensor_bme.temp_celsius));
-    LoRa.print(", \"humidity_percent\": ");
-    LoRa.write((unsigned char *)&total_data.sensor_bme.humidity_percent, sizeof(total_data.sensor_bme.humidity_percent));
-    LoRa.print(", \"pressure_hPa\": ");
-    LoRa.write((unsigned char *)&total_data.sensor_bme.pressure_hPa, sizeof(total_data.sensor_bme.pressure_hPa));
-    LoRa.print("}, ");
-    LoRa.write((unsigned char *)&total_data.sensor_ph.sensor_id, sizeof(sensor_id_t));
-    LoRa.print(": {\"sensor_ph\": ");
-    LoRa.write((unsigned char *)&total_data.sensor_ph.sensor_ph, sizeof(total_data.sensor_ph.sensor_ph));
-    LoRa.print("}, ");
-    LoRa.write((unsigned char *)&total_data.sensor_temperatura.sensor_id, sizeof(sensor_id_t));
-    LoRa.print(": {\"sensor_ph\": ");
-    LoRa.write((unsigned char *)&total_data.sensor_temperatura.temp_soil, sizeof(total_data.sensor_temperatura.temp_soil));
-    LoRa.print("}, ");
-    LoRa.write((unsigned char *)&total_data.moist_percent.sensor_id, sizeof(sensor_id_t));
-    LoRa.print(": {\"moist_percent_1\": ");
-    LoRa.write((unsigned char *)&total_data.moist_percent.moist_percent_1, sizeof(total_data.moist_percent.moist_percent_1));
-    LoRa.print(", \"moist_percent_2\": ");
-    LoRa.write((unsigned char *)&total_data.moist_percent.moist_percent_2, sizeof(total_data.moist_percent.moist_percent_2));
-    LoRa.print(", \"moist_percent_3\": ");
-    LoRa.write((unsigned char *)&total_data.moist_percent.moist_percent_3, sizeof(total_data.moist_percent.moist_percent_3));    
-    LoRa.print("}}}");
+  LoRa.write(frame_buffer, frame_len);
   LoRa.endPacket();
-  
-  display.clearDisplay();
-  display.setCursor(0,0);
-  display.println("LORA SENDER");
-  display.setCursor(0,20);
-  display.setTextSize(1);
-  display.print("LoRa packet sent.");
-  display.setCursor(0,30);    
-  display.display();
-  
+#if SV_DIAG
+  diag.counter[SV_DIAG_AIRTIME] += micros() - airtime_start;
+  diag.counter[SV_DIAG_FRAMES]++;
+#endif
+#if SV_SLEEP_STATS
+  if (sent_at == 0) {
+    sent_at = clock_ms();
+  }
+#endif
+
+  // Fields are only sent again after being refreshed by a reading
+  head->present = 0;
+
+  if (frame_type == SV_FRAME_TYPE_SUMMARY) {
+    type_name = "Summary";
+  }
+  else if (frame_type == SV_FRAME_TYPE_PARITY) {
+    type_name = "Parity";
+  }
+  else if (frame_type == SV_FRAME_TYPE_DIAG) {
+    type_name = "Diagnostics";
+  }
+  else if (delta_count != 0) {
+    type_name = "Delta";
+  }
+  Serial.print(type_name);
+  Serial.print(" frame bytes: ");
+  Serial.print(frame_len);
+  Serial.print(" airtime (us, SF");
+  Serial.print(beacon.sf);
+  Serial.print(", ");
+  Serial.print(tx_power);
+  Serial.print(" dBm): ");
+  Serial.println(sv_lora_airtime_us(frame_len, beacon.sf, SV_LORA_BANDWIDTH, SV_LORA_CODING_RATE));
+
+  // Display information, sent by loop() once no frame waits for its slot
+  snprintf(radio, sizeof(radio), "SF%d %d dBm", beacon.sf, tx_power);
+  sv_screen_set_int(&screen, &sent_field, counter);
+  sv_screen_set(&screen, &frame_field, type_name);
+  sv_screen_set_int(&screen, &bytes_field, frame_len);
+  sv_screen_set(&screen, &radio_field, radio);
 }
@@ -1,75 +1,166 @@
 // Includes
 #include <msp430.h> 
+#include "SmartVit_link.h"                              // MSP430 -> ESP32 link protocol
+#include "SmartVit_sensors.h"                           // Sensor registry, SV_SENSOR_TABLE
 
 // Constant values along the code
-#define sleepTime 460799
-#define getSample 30719
+#define tickCounts 512                                  // Timer counts per 1 s tick, 32768 Hz ACLK / 8 / 8
+#define maxSleepTicks 127                               // Longest sleep that fits the 16 bit TACCR0
+#define pulseWindowTicks 60                             // Windowed pulse sensors count for 60 s
+#define getSample (pulseWindowTicks * tickCounts - 1)
 #define resetValue 0
-
-// Pins
-#define anemometer BIT3
-#define pluviometer BIT4
+#define txBufferSize 64                                 // UART TX ring size, power of 2 bigger than a link frame
+#define txBufferMask (txBufferSize - 1)
+#define dataReadyPin BIT0                               // P2.0 to the ESP32, high while a link frame is coming
+#define dataReadyTicks 1                                // Lead time for the ESP32 to wake up from deep sleep
+#define adcChannels 8                                   // Sequence converts A7 down to A0
+#define phSamples 10                                    // Sequences per scan, pH uses all of them
 
 // Error values
 #define digitalPortError 401
-#define adcPortError 402
+
+// Code expanded from SV_SENSOR_TABLE, disabled sensors (SV_ENABLE_x 0) are constant false and compile out
+#define isADCSource(source) ((source) == SV_SOURCE_ADC || (source) == SV_SOURCE_ADC_PH)
+
+// ADC pins of the enabled analog sensors (index in a sequence is adcChannels - 1 - channel)
+#define adcInputPin(name, source, channel, width, is_signed, scale, cal, cal_scale, cal_offset, key) \
+    | ((SV_ENABLE_##name && isADCSource(source)) ? (1 << (channel)) : 0)
+#define adcInputs (0 SV_SENSOR_TABLE(adcInputPin))
+
+// Port 2 pins of the enabled pulse sensors
+#define pulsePin(name, source, channel, width, is_signed, scale, cal, cal_scale, cal_offset, key) \
+    | ((SV_ENABLE_##name && (source) == SV_SOURCE_PULSE) ? (1 << (channel)) : 0)
+#define pulseSumPin(name, source, channel, width, is_signed, scale, cal, cal_scale, cal_offset, key) \
+    | ((SV_ENABLE_##name && (source) == SV_SOURCE_PULSE_SUM) ? (1 << (channel)) : 0)
+#define windowPins (0 SV_SENSOR_TABLE(pulsePin))     // Counted during the sample window only
+#define sumPins (0 SV_SENSOR_TABLE(pulseSumPin))     // Counted all the time, rain tips are never lost
+
+// Fields of the enabled sensors of each kind
+#define fieldOf(name, kind) \
+    ((SV_ENABLE_##name && (kind)) ? SV_FIELD_BIT(SV_FIELD_##name) : 0)
+#define windowField(name, source, channel, width, is_signed, scale, cal, cal_scale, cal_offset, key) \
+    | fieldOf(name, (source) == SV_SOURCE_PULSE)
+#define adcField(name, source, channel, width, is_signed, scale, cal, cal_scale, cal_offset, key) \
+    | fieldOf(name, isADCSource(source))
+#define mspField(name, source, channel, width, is_signed, scale, cal, cal_scale, cal_offset, key) \
+    | fieldOf(name, (source) != SV_SOURCE_LOCAL)
+#define windowFields (0 SV_SENSOR_TABLE(windowField))
+#define adcFields (0 SV_SENSOR_TABLE(adcField))
+#define mspFields (0 SV_SENSOR_TABLE(mspField))        // Sensors scheduled by the MSP430
+
+// Scheduler, a sensor is due when its countdown reaches zero, then it restarts from its period
+#define takeDueField(name, source, channel, width, is_signed, scale, cal, cal_scale, cal_offset, key) \
+    if (SV_ENABLE_##name && (source) != SV_SOURCE_LOCAL && dueIn[SV_FIELD_##name] == 0){ \
+        dueFields |= SV_FIELD_BIT(SV_FIELD_##name); \
+        dueIn[SV_FIELD_##name] = SV_PERIOD_##name; \
+    }
+#define isDue(name) (dueFields & SV_FIELD_BIT(SV_FIELD_##name))
+
+// Pulse sensors acquisition, counts of the last window or since the last frame
+#define acquirePulses(name, source, channel, width, is_signed, scale, cal, cal_scale, cal_offset, key) \
+    if (isDue(name) && ((source) == SV_SOURCE_PULSE || (source) == SV_SOURCE_PULSE_SUM)){ \
+        data.value[SV_FIELD_##name] = takePulses(channel); \
+    }
+
+// Analog sensors acquisition, from the block of the last scan
+#define acquireADC(name, source, channel, width, is_signed, scale, cal, cal_scale, cal_offset, key) \
+    if (isDue(name) && (source) == SV_SOURCE_ADC){ \
+        data.value[SV_FIELD_##name] = getADCSample(0, channel); \
+    } \
+    else if (isDue(name) && (source) == SV_SOURCE_ADC_PH){ \
+        data.value[SV_FIELD_##name] = collectPhData(channel); \
+    }
+
+// Link records of the sensors refreshed in this wake
+#define putLinkRecord(name, source, channel, width, is_signed, scale, cal, cal_scale, cal_offset, key) \
+    if (isDue(name)){ \
+        len += sv_link_put_record(&linkPayload[len], SV_FIELD_##name, data->value[SV_FIELD_##name]); \
+    }
+
+// Low power mode entry, the instrumentation build counts the ACLK ticks spent in it
+#if SV_DIAG
+#define enterLPM(bits, counter) \
+    { \
+        unsigned long lpmStart = diagNow(); \
+        __bis_SR_register((bits) + GIE); \
+        diagTicks[counter] += diagNow() - lpmStart; \
+    }
+#else
+#define enterLPM(bits, counter) __bis_SR_register((bits) + GIE)
+#endif
 
 // Different state of FSM
 typedef enum{
     setup,
     clearOutput,
-    getAnemometer,
-    getPluviometer,
-    getWindVane,
-    getTemperature,
-    getPh,
-    getMoisture1,
-    getMoisture2,
-    getMoisture3,
+    countPulses,
+    scanADC,
     sendData,
     sleepMode
 }eSystemState;
 
-// Output variables
+// Output variables, raw counts (ADC counts, pulses) indexed by sv_field_t, calibrated by the ESP32
 typedef struct{
-    char wind_dir_id;
-    float wind_dir;
-    char wind_speed_id;
-    float wind_speed;
-    char rain_quantity_id;
-    float rain_quantity;
-    char soil_temperature_id;
-    float soil_temperature;
-    char soil_moisture1_id;
-    float soil_moisture1;
-    char soil_moisture2_id;
-    float soil_moisture2;
-    char soil_moisture3_id;
-    float soil_moisture3;
-    char soil_ph_id;
-    float soil_ph;
+    unsigned int value[SV_FIELD_COUNT];
 } data_t;
 
 // Struct
 data_t data;
 
 
+// Link frame buffers
+unsigned char linkPayload[SV_LINK_MAX_PAYLOAD];         // Sequence number, records and CRC
+unsigned char linkFrame[SV_LINK_MAX_ENCODED];           // COBS encoded frame sent by UART
+unsigned char linkSeq = 0;                              // Sequence number of the next frame
+
+// UART TX ring buffer, filled by uartWrite and drained by USCI0TX_ISR
+volatile unsigned char txBuffer[txBufferSize];
+volatile unsigned char txHead = 0;                      // Next free position
+volatile unsigned char txTail = 0;                      // Next byte to send
+
+// ADC10 DTC block, phSamples sequences of A7..A0
+unsigned int adcBlock[phSamples * adcChannels];
+
+// Scheduler
+unsigned int dueIn[SV_FIELD_COUNT];                     // Ticks until each sensor is due, 0 at power up
+unsigned int dueFields = 0;                             // Bitmap of the sensors read in this wake
+
 // Intern variables
-volatile int timerCounter = 0;                          // Declare variable to control timer
-volatile int pulseCounter = 0;                          // Declare variable to control number of pulses
+volatile unsigned int pulseCounter[8];                  // Number of pulses of each port 2 pin
+
+#if SV_DIAG
+// Instrumentation, ACLK ticks per FSM state and low power mode since the last diagnostics frame
+unsigned long diagTicks[SV_DIAG_MSP_COUNTERS];
+volatile unsigned int diagOverflows = 0;                // High word of the Timer1 time stamp
+unsigned long diagMark = 0;                             // Time stamp of the last state change
+eSystemState diagState = setup;                         // State the time since diagMark belongs to
+#endif
 
 // Functions calls
 void setADC();
 void setUART();
 void setTimer();
 void setOtherPins();
-void setIds();
+void setPulsePins();
 void resetVariables();
-float getDigitalData(int bit);
-float getADCData(int bit);
-float collectPhData();
+void takeDueFields();
+void elapseTicks(unsigned int ticks);
+unsigned int nextDueTicks();
+void countPulseWindow();
+unsigned int takePulses(int bit);
+void scanADCData();
+unsigned int getADCSample(unsigned int sample, unsigned int channel);
+unsigned int collectPhData(unsigned int channel);
 void sendUART(data_t *data);
-void countTime();
+void uartWrite(const unsigned char *buf, unsigned int len);
+void uartFlush();
+void sleepTicks(unsigned int ticks);
+#if SV_DIAG
+void setDiagTimer();
+unsigned long diagNow();
+void diagEnter(eSystemState state);
+void sendDiag();
+#endif
 
 /**
  * main.c
@@ -85,6 +176,9 @@ int main(void)
     {
 
         eCurrentState = eNextState;                     // Declares variable that handles state changes
+#if SV_DIAG
+        diagEnter(eCurrentState);                       // Account the time of the previous state
+#endif
         //FSM
         switch(eCurrentState)
         {
@@ -94,74 +188,58 @@ int main(void)
                 setUART();                              // Set UART basic configuration
                 setTimer();                             // Set timer configuration
                 setOtherPins();                         // Configure unused pins to reduce consume
-                setIds();
+                setPulsePins();                         // Configure pulse inputs, start counting the rain
+#if SV_DIAG
+                setDiagTimer();                         // Free running time stamps for the instrumentation
+#endif
                 eNextState = clearOutput;               // Change to next state
                 break;
             }
             case clearOutput:
             {
                 resetVariables();                       // Calll function to reset variables
-                eNextState = getAnemometer;             // Change to next state
-                break;
-            }
-            case getAnemometer:
-            {
-                data.wind_speed = getDigitalData(3);    // Call function to acquire digital data form anemometer
-                eNextState = getPluviometer;            // Change to next state
-                break;
-            }
-            case getPluviometer:
-            {
-                data.rain_quantity = getDigitalData(4); // Call function to acquire digital data from pluviometer
-                eNextState = getWindVane;               // Change to next state
-                break;
-            }
-            case getWindVane:
-            {
-                data.wind_dir = getADCData(0);          // Call function to acquire adc data from wind vane
-                eNextState = getTemperature;            // Change to next state
-                break;
-            }
-            case getTemperature:
-            {
-                data.soil_temperature = getADCData(3);  // Call function to acquire adc data from wind vane
-                eNextState = getPh;                     // Change to next state
-                break;
-            }
-            case getPh:
-            {
-                data.soil_ph = collectPhData();         // Call function to acquire data from ph sensor
-                eNextState = getMoisture1;              // Change to next state
-                break;
-            }
-            case getMoisture1:
-            {
-                data.soil_moisture1 = getADCData(5);    // Call function to acquire adc data from 1 soil moisture sensor
-                eNextState = getMoisture2;              // Change to next state
+                takeDueFields();                        // Select the sensors due in this wake
+                eNextState = countPulses;               // Change to next state
                 break;
             }
-            case getMoisture2:
+            case countPulses:
             {
-                data.soil_moisture2 = getADCData(6);    // Call function to acquire adc data from 3 soil moisture sensor
-                eNextState = getMoisture3;              // Change to next state
+                if (dueFields & windowFields){
+                    countPulseWindow();                 // Count every windowed pulse sensor at once
+                    elapseTicks(pulseWindowTicks);      // The window counts as time spent
+                }
+                SV_SENSOR_TABLE(acquirePulses)          // Take the count of every due pulse sensor
+                eNextState = scanADC;                   // Change to next state
                 break;
             }
-            case getMoisture3:
+            case scanADC:
             {
-                data.soil_moisture3 = getADCData(7);    // Call function to acquire adc data from 2 soil moisture sensor
+                if (dueFields & adcFields){
+                    scanADCData();                      // Convert every analog channel in a single wake
+                }
+                SV_SENSOR_TABLE(acquireADC)             // Store the samples of every due analog sensor
                 eNextState = sendData;                  // Change to next state
                 break;
             }
             case sendData:
             {
-                sendUART(&data);                        // Send wind direction data using UART
+                if (dueFields){
+                    P2OUT |= dataReadyPin;              // Wake the ESP32 and let it boot
+                    sleepTicks(dataReadyTicks);
+                    sendUART(&data);                    // Send the refreshed sensors using UART
+#if SV_DIAG
+                    sendDiag();                         // Then the time spent since the last frame
+#endif
+                }
 
                 eNextState = sleepMode;                 // Change to next state
                 break;
             }
             case sleepMode:
             {
-                countTime();                            // Start counted sleep mode
+                uartFlush();                            // Wait in LPM0 until the frame left, USCI needs SMCLK
+                P2OUT &= ~dataReadyPin;                 // Frame sent, the ESP32 may sleep again
+                sleepTicks(nextDueTicks());             // Sleep in LPM3 until the next sensor is due
                 eNextState = clearOutput;               // Change to next state
                 break;
             }
@@ -176,9 +254,13 @@ int main(void)
 //############################################################################################################################
 // Functions
 
-// Function setADC -> select clock division and voltage reference
+// Function setADC -> select clock, voltage reference and sequence of channels written by the DTC
 void setADC(){
-    ADC10CTL0 = SREF_0 + ADC10SHT_3 + REFON;            // Ref -> Vcc reference, 64 CLK S&H
+    ADC10CTL0 = SREF_0 + ADC10SHT_3 + MSC;              // Ref -> Vcc reference, 64 CLK S&H, automatic sampling
+    ADC10CTL1 = INCH_7 + CONSEQ_3 + ADC10SSEL_0;        // A7 down to A0, repeat sequence, ADC10OSC runs in LPM3
+    ADC10AE0 = adcInputs;                               // Analog function on the sensor pins
+    ADC10DTC0 = 0;                                      // One block transfer
+    ADC10DTC1 = phSamples * adcChannels;                // Conversions per block
 }
 
 // Function setUART -> select clock frequency, baud rate and pins
@@ -191,8 +273,8 @@ void setUART(){
     BCSCTL1 = CALBC1_12MHZ;                             // Set DCO to 12 MHz
     DCOCTL = CALDCO_12MHZ;                              // Set DCO to 12 MHz
     UCA0CTL1 |= UCSSEL_2;                               // UART Clock -> SMCLK
-    UCA0BR0 = 1250;                                     // Baud Rate Setting for 12MHz 9600
-    UCA0BR1 = 0;                                        // Baud Rate Setting for 12MHz 9600
+    UCA0BR0 = 1250 & 0xFF;                              // Baud Rate Setting for 12MHz 9600
+    UCA0BR1 = 1250 >> 8;                                // Baud Rate Setting for 12MHz 9600
     UCA0MCTL = UCBRS_0;                                 // Modulation Setting for 12MHz 9600
     P1SEL |= BIT1 + BIT2 ;                              // Select UART RX/TX function on P1.1,P1.2
     P1SEL2 |= BIT1 + BIT2;                              // Secondary peripheral module function is selected (P1SEL = P1SEL2 = 1)
@@ -202,114 +284,124 @@ void setUART(){
 // Function setTimer -> select clock, mode, divisions and stop clock from ticking
 void setTimer(){
     BCSCTL1 |= DIVA_3;                                  // ACLK/8
-    BCSCTL1 |= ~XTS;                                    // LF mode
+    BCSCTL1 &= ~XTS;                                    // LF mode
     TACTL = TASSEL_1 + ID_3 + MC_1;                     // Select ACLK, ACLK/8, Up Mode
     TACCR0 = 0;                                         //Initially, Stop the Timer
 }
 
 // Function setOtherPins -> grant that unused pins don't waste power
 void setOtherPins(){
-    P2OUT |= BIT0 + BIT1 + BIT5 + BIT6 + BIT7;          // Set unused pins as output to reduce power consumption
-}
-
-void setIds(){
-    data.wind_dir_id = 'a';                             //Set id for wind vane sensor
-    data.wind_speed_id = 'b';                           //Set id for anemometer sensor
-    data.rain_quantity_id = 'c';                        //Set id for pluviometersensor
-    data.soil_temperature_id = 'd';                     //Set id for temperature sensor
-    data.soil_moisture1_id = 'e';                       //Set id for 1 soil moisture sensor
-    data.soil_moisture2_id = 'f';                       //Set id for 2 soil moisture sensor
-    data.soil_moisture3_id = 'g';                       //Set id for 3 soil moisture sensor
-    data.soil_ph_id = 'h';                              //Set id for ph sensor
+    P2OUT |= BIT1 + BIT5 + BIT6 + BIT7;                 // Set unused pins as output to reduce power consumption
+    P2OUT &= ~dataReadyPin;                             // Data ready output, low while idle
+    P2DIR |= dataReadyPin;
 }
 
 // Function resetVariables -> reset all sending variables to a predetermined value
 void resetVariables(){
-    data.wind_dir = resetValue;                         // Reset wind_dir variable
-    data.wind_speed = resetValue;                       // Reset wind_speed variable
-    data.rain_quantity = resetValue;                    // Reset rain_quantity variable
-    data.soil_temperature = resetValue;                 // Reset soil_temperature variable
-    data.soil_moisture1 = resetValue;                   // Reset soil_moisture1 variable
-    data.soil_moisture2 = resetValue;                   // Reset soil_moisture2 variable
-    data.soil_moisture3 = resetValue;                   // Reset soil_moisture3 variable
-    data.soil_ph = resetValue;                          // Reset soil_ph variable
+    unsigned int i;                                     // Auxiliary variable to control loop
+
+    for (i = 0; i < SV_FIELD_COUNT; i++){
+        data.value[i] = resetValue;                     // Reset every reading
+    }
 }
 
-// Function getDigitalData -> Enables pins and interruptions, gets data, disable interruptions and return it
-float getDigitalData(int bit){
+// Function takeDueFields -> Mark the sensors whose countdown ended and restart their countdown
+void takeDueFields(){
+    dueFields = 0;
+    SV_SENSOR_TABLE(takeDueField)
+}
 
-    if (bit == 3){
-        P2DIR |= anemometer;                            // P2.3 as input
-        P2IE |= anemometer;                             // P2.3 enable interruption
-        P2IES |= anemometer;                            // P2.3 low-to-high interruption
-        TACCTL0 |= CCIE;                                // Enable interrupt for CCR0.
-        TACCR0 = getSample;                             // Set timer as getSample
-        __bis_SR_register(LPM3_bits + GIE);             // Enable interrupt and set MSP to LPM3
-        P2IE &= ~anemometer;                            // P2.3 disable interruption
+// Function elapseTicks -> Advance every countdown by ticks, stopping at zero
+void elapseTicks(unsigned int ticks){
+    unsigned int i;                                     // Auxiliary variable to control loop
 
-        return pulseCounter;                            // Return number of pulses
+    for (i = 0; i < SV_FIELD_COUNT; i++){
+        dueIn[i] = (dueIn[i] > ticks) ? dueIn[i] - ticks : 0;
     }
-    else if (bit == 4){
-        P2DIR |= pluviometer;                           // P2.4 as input
-        P2IE |= pluviometer;                            // P2.4 enable interruption
-        P2IES |= pluviometer;                           // P2.4 low-to-high interruption
-        TACCTL0 |= CCIE;                                // Enable interrupt for CCR0.
-        TACCR0 = getSample;                             // Set timer as getSample
-        __bis_SR_register(LPM3_bits + GIE);             // Enable interrupt and set MSP to LPM3
-        P2IE &= ~pluviometer;                           // P2.3 disable interruption
+}
 
-        return pulseCounter;                            // Return number of pulses
-    }
-    else{
-        return digitalPortError;                        // Return portError if installed at wrong pin
+// Function nextDueTicks -> Ticks until the first sensor is due
+unsigned int nextDueTicks(){
+    unsigned int i;                                     // Auxiliary variable to control loop
+    unsigned int ticks = 0xFFFF;                        // Return variable
+
+    for (i = 0; i < SV_FIELD_COUNT; i++){
+        if ((mspFields & SV_FIELD_BIT(i)) && dueIn[i] < ticks){
+            ticks = dueIn[i];
+        }
     }
+    return ticks;
 }
 
-// Function getADCData -> Enables pins and interruptions, gets data, disable interruptions and return it
-float getADCData(int bit){
-    if (bit == 0){
-        ADC10CTL1 |= INCH_0 + ADC10SSEL1;               // ADC Channel -> A0 P1.0 - Wind Vane, ACLK
-    }
-    else if (bit == 3){
-        ADC10CTL1 |= INCH_3 + ADC10SSEL1;               // ADC Channel -> A0 P1.3 - Soil temperature, ACLK
-    }
-    else if (bit == 4){
-        ADC10CTL1 |= INCH_4 + ADC10SSEL1;               // ADC Channel -> A0 P1.4 - Soil PH, ACLK
-    }
-    else if (bit == 5){
-        ADC10CTL1 |= INCH_5 + ADC10SSEL1;               // ADC Channel -> A0 P1.5 - 1 Soil Moisture, ACLK
-    }
-    else if (bit == 6){
-        ADC10CTL1 |= INCH_6 + ADC10SSEL1;               // ADC Channel -> A0 P1.6 - 2 Soil Moisture, ACLK
-    }
-    else if (bit == 7){
-        ADC10CTL1 |= INCH_7 + ADC10SSEL1;               // ADC Channel -> A0 P1.7 - 3 Soil Moisture, ACLK
+// Function setPulsePins -> Configure pulse inputs, the accumulated ones count from now on, even in sleep
+void setPulsePins(){
+    P2DIR &= ~(windowPins | sumPins);                   // Pulse pins as input
+    P2IES |= windowPins | sumPins;                      // High-to-low interruption
+    P2IFG &= ~(windowPins | sumPins);                   // Clear pending flags
+    P2IE |= sumPins;                                    // Accumulated pins always enabled
+}
+
+// Function countPulseWindow -> Counts every windowed pulse pin simultaneously over one getSample window
+void countPulseWindow(){
+    unsigned int i;                                     // Auxiliary variable to control loop
+
+    for (i = 0; i < 8; i++){
+        if (windowPins & (1 << i)){
+            pulseCounter[i] = 0;                        // Start the window from zero
+        }
     }
-    else{
-        return adcPortError;                            // Return portError if installed at wrong pin
+    P2IFG &= ~windowPins;                               // Clear pending flags
+    P2IE |= windowPins;                                 // Enable interruption of the windowed pins
+    TACCTL0 |= CCIE;                                    // Enable interrupt for CCR0.
+    TACCR0 = getSample;                                 // Set timer as getSample
+    enterLPM(LPM3_bits, SV_DIAG_MSP_LPM3);              // Enable interrupt and set MSP to LPM3
+    P2IE &= ~windowPins;                                // Disable interruption of the windowed pins
+    TACCR0 = 0;                                         // Stop the timer
+}
+
+// Function takePulses -> Return the pulses counted on P2.bit and restart its count
+unsigned int takePulses(int bit){
+    unsigned int pulses;                                // Return variable
+
+    if (bit < 0 || bit > 7){
+        return digitalPortError;                        // Return portError if installed at wrong pin
     }
+    __disable_interrupt();                              // PORT2_ISR must not count between read and reset
+    pulses = pulseCounter[bit];
+    pulseCounter[bit] = 0;
+    __enable_interrupt();
+
+    return pulses;                                      // Return number of pulses
+}
 
+// Function scanADCData -> Converts phSamples sequences of all channels into adcBlock in a single wake
+void scanADCData(){
+    ADC10CTL1 |= CONSEQ_3;                              // Repeat sequence
     ADC10CTL0 |= ADC10ON + ADC10IE;                     // ADC On, Enable Interruption
+    ADC10SA = (unsigned int) adcBlock;                  // DTC start address, starts the transfers
     ADC10CTL0 |= ENC + ADC10SC;                         // Sampling and conversion started
-    __bis_SR_register(LPM3_bits + GIE);                 // Enable interrupt and set MSP to LPM3
-    ADC10CTL0 = ENC + ADC10SC;                          // Sampling and conversion ended
-    ADC10CTL0 &= ~ADC10ON + ~ADC10IE;                   // ADC Off, Disable Interruption
-
-    return ADC10MEM;                                    // Return value stored at ADC memory
+    enterLPM(LPM3_bits, SV_DIAG_MSP_LPM3);              // Enable interrupt and set MSP to LPM3 until block is full
+    ADC10CTL1 &= ~CONSEQ_3;                             // Stop the sequence immediately
+    ADC10CTL0 &= ~ENC;                                  // Sampling and conversion ended
+    ADC10CTL0 &= ~(ADC10ON + ADC10IE);                  // ADC Off, Disable Interruption
+}
 
+// Function getADCSample -> Return the conversion of channel in sequence sample
+unsigned int getADCSample(unsigned int sample, unsigned int channel){
+    return adcBlock[sample * adcChannels + (adcChannels - 1 - channel)];
 }
 
-float collectPhData(){
-    int buf[10];                                        // Declare variable to store 10 measures
-    int temp;                                           // Auxiliary variable
+unsigned int collectPhData(unsigned int channel){
+    unsigned int buf[phSamples];                        // Declare variable to store 10 measures
+    unsigned int temp;                                  // Auxiliary variable
     unsigned int i, j;                                  // Loop control variables
-    float value;                                        // Return variable
+    unsigned int value = 0;                             // Return variable, sum of 6 samples fits 16 bits
 
-    for (i = 0; i < 10; i++){
-        buf[i] = getADCData(4);                         // Collect ph data ten times
+    for (i = 0; i < phSamples; i++){
+        buf[i] = getADCSample(i, channel);              // Collect ph data of every sequence
     }
-    for (i = 0; i < 9; i++){
-        for (j = i+1; j < 10; j++){
+    for (i = 0; i < phSamples - 1; i++){
+        for (j = i+1; j < phSamples; j++){
             if (buf[j] > buf[i]){                       // Compare neighbor data, see if rightmost is bigger,change places with leftmost
                 temp = buf[i];
                 buf[i] = buf[j];
@@ -317,86 +409,187 @@ float collectPhData(){
             }
         }
     }
-    for (i = 2; i < 8; i++){
+    for (i = 2; i < phSamples - 2; i++){
         value += buf[i];                                // Get sum of intermediary values
     }
     return value;
 }
 
-// Function countTime -> Enables pins and interruptions, put msp to sleep for predetermined time
-void countTime(){
-    timerCounter = 0;                                   // Reset variable
+// Function sleepTicks -> Put msp to sleep in LPM3 for ticks, in chunks that fit TACCR0
+void sleepTicks(unsigned int ticks){
+    unsigned int chunk;                                 // Ticks of the current timer period
 
-    TACCTL0 |= CCIE;                                    // Enable interrupt for CCR0.
-    TACCR0 = sleepTime;                                 // Set time as sleepTime
-    __bis_SR_register(LPM3_bits + GIE);                 // Enable interrupt and set MSP to LPM3
+    while (ticks > 0){
+        chunk = (ticks > maxSleepTicks) ? maxSleepTicks : ticks;
+        TACCTL0 |= CCIE;                                // Enable interrupt for CCR0.
+        TACCR0 = chunk * tickCounts - 1;                // Set timer as chunk
+        enterLPM(LPM3_bits, SV_DIAG_MSP_LPM3);          // Enable interrupt and set MSP to LPM3
+        TACCR0 = 0;                                     // Stop the timer
+        elapseTicks(chunk);
+        ticks -= chunk;
+    }
 }
 
 
-// Function sendUART -> Receive variable and id, segment into bits and send it
+// Function sendUART -> Build link frame (sequence, id/value records, CRC), COBS encode and send it
 void sendUART(data_t *data){
-    unsigned char *c;                                   // Create temporary variable to point to float data
-    unsigned int i, j;                                  // Auxiliary variables to control loop
-
-    IE2 |= UCA0TXIE;                                    // Enable TX interrupt
-    for (i = 0; i < 16; i+=2){
-        __bis_SR_register(LPM0_bits + GIE);             // Enable interrupt and set MSP to LPM0
-        UCA0TXBUF = (unsigned char *) (data+i);                          // Send id
-
-        c = (unsigned char *) (data+i+1);                                  // Get pointer to first byte
-        for (j = 0; j <3; j++){
-            __bis_SR_register(LPM0_bits + GIE);         // Enable interrupt and set MSP to LPM0
-            UCA0TXBUF = *c++;                           // Send first to third bit
+    unsigned int len = 0;                               // Payload length
+    unsigned int frameLen;                              // Encoded frame length
+
+    linkPayload[len++] = linkSeq++;                     // Sequence number
+    SV_SENSOR_TABLE(putLinkRecord)                      // One record per sensor read by the MSP430
+    len = sv_link_put_crc(linkPayload, len);            // Append CRC16
+    frameLen = sv_link_cobs_encode(linkPayload, len, linkFrame);
+
+    uartWrite(linkFrame, frameLen);                     // Hand the frame to the ISR, returns immediately
+}
+
+// Function uartWrite -> Copy bytes to the TX ring buffer and start the transmission
+void uartWrite(const unsigned char *buf, unsigned int len){
+    unsigned int i;                                     // Auxiliary variable to control loop
+
+    for (i = 0; i < len; i++){
+        __disable_interrupt();
+        while (((txHead + 1) & txBufferMask) == txTail){
+            enterLPM(LPM0_bits, SV_DIAG_MSP_LPM0);      // Buffer full, wait in LPM0 for the ISR to free space
+            __disable_interrupt();
         }
-        __bis_SR_register(LPM0_bits + GIE);             // Enable interrupt and set MSP to LPM0
-        UCA0TXBUF = *c;                                 // Send last bit
+        txBuffer[txHead] = buf[i];                      // Queue byte
+        txHead = (txHead + 1) & txBufferMask;
+        IE2 |= UCA0TXIE;                                // Enable TX interrupt, fires at once if USCI is idle
+        __enable_interrupt();
+    }
+}
 
+// Function uartFlush -> Sleep in LPM0 until the TX ring buffer is empty, then wait for the last byte to leave
+void uartFlush(){
+    __disable_interrupt();
+    while (txHead != txTail){
+        enterLPM(LPM0_bits, SV_DIAG_MSP_LPM0);          // Enable interrupt and set MSP to LPM0
+        __disable_interrupt();
     }
-    IE2 &= ~UCA0TXIE;                                   // Disable TX interrupt
+    __enable_interrupt();
+    while (UCA0STAT & UCBUSY);                          // Last bytes still in UCA0TXBUF and the shift register
 }
 
+#if SV_DIAG
+// Function setDiagTimer -> Timer1 counts ACLK continuously, its overflows extend it to 32 bits
+void setDiagTimer(){
+    TA1CTL = TASSEL_1 + MC_2 + TAIE;                    // ACLK, continuous mode, overflow interrupt
+    diagMark = diagNow();
+}
+
+// Function diagNow -> 32 bit time stamp in ACLK ticks
+unsigned long diagNow(){
+    unsigned int sr = __get_SR_register();              // Interrupts may be disabled by the caller
+    unsigned int high;
+    unsigned int low;
+
+    __disable_interrupt();
+    do{
+        low = TA1R;                                     // TA1R runs on ACLK, read it until it is stable
+    }while (low != TA1R);
+    high = diagOverflows;
+    if ((TA1CTL & TAIFG) && low < 0x8000){
+        high++;                                         // Overflow not serviced yet
+    }
+    __bis_SR_register(sr & GIE);
+    return ((unsigned long)high << 16) | low;
+}
+
+// Function diagEnter -> Account the time since the last change to the state left, then enter state
+void diagEnter(eSystemState state){
+    static const unsigned char stateCounter[] = {       // Counter of each eSystemState, setup is not counted
+        SV_DIAG_MSP_COUNTERS, SV_DIAG_MSP_CLEAR, SV_DIAG_MSP_COUNT, SV_DIAG_MSP_SCAN, SV_DIAG_MSP_SEND, SV_DIAG_MSP_SLEEP
+    };
+    unsigned long now = diagNow();
+
+    if (stateCounter[diagState] < SV_DIAG_MSP_COUNTERS){
+        diagTicks[stateCounter[diagState]] += now - diagMark;
+    }
+    diagMark = now;
+    diagState = state;
+}
+
+// Function sendDiag -> Send the counters in a link frame and restart them
+void sendDiag(){
+    unsigned int len = 0;                               // Payload length
+    unsigned int i;                                     // Auxiliary variable to control loop
+
+    diagEnter(diagState);                               // Include the current state up to now
+    linkPayload[len++] = linkSeq++;                     // Sequence number
+    for (i = 0; i < SV_DIAG_MSP_COUNTERS; i++){
+        len += sv_link_put_record(&linkPayload[len], SV_LINK_DIAG_ID(i, 0), (sv_link_value_t)diagTicks[i]);
+        len += sv_link_put_record(&linkPayload[len], SV_LINK_DIAG_ID(i, 1), (sv_link_value_t)(diagTicks[i] >> 16));
+        diagTicks[i] = 0;
+    }
+    len = sv_link_put_crc(linkPayload, len);            // Append CRC16
+    uartWrite(linkFrame, sv_link_cobs_encode(linkPayload, len, linkFrame));
+}
+#endif
+
 
 //############################################################################################################################
 //Interrupts
 
-// ADC ISR -> Wait for ADC collect data and exit sleep mode
+// ADC ISR -> DTC block is full, exit sleep mode
 #pragma vector=ADC10_VECTOR
 __interrupt void ADC10_ISR (void)
 {
     __bic_SR_register_on_exit(LPM3_bits + GIE);         // Exit LMP3 and disable interruption
 }
 
-//Timer ISR -> counts until reaches value, stop timer and exit sleep mode
+//Timer ISR -> period of TACCR0 ended, exit sleep mode
 #pragma vector = TIMER0_A0_VECTOR
 __interrupt void Timer_A_CCR0_ISR(void)
 {
-    if (TACCR0 == sleepTime)
-    {
-        timerCounter++;                                 // Increase counter
-        if(timerCounter >= sleepTime)
-        {
-            TACCR0 = 0;                                 // Stop timer
-            __bic_SR_register_on_exit(LPM3_bits + GIE); // Exit LMP3 and disable interruption
-        }
-    }
-    else{
-        __bic_SR_register_on_exit(LPM3_bits + GIE);     // Exit LMP3 and disable interruption
-    }
-
+    __bic_SR_register_on_exit(LPM3_bits + GIE);         // Exit LMP3 and disable interruption
 }
 
-//Pulse ISR -> Increase counter and enables new interruption to occur
+//Pulse ISR -> Increase the counter of every pin that pulsed, stays in the current low power mode
 #pragma vector = PORT2_VECTOR
 __interrupt void PORT2_ISR(void)
 {
-    pulseCounter++;                                     // Increase counter
-    P2IFG = 0;                                          // Reset interrupt flag
+    unsigned char flags = P2IFG & P2IE;                 // Pins that pulsed
+    unsigned char i;
+
+    P2IFG &= ~flags;                                    // Reset interrupt flags
+    for (i = 0; flags; i++, flags >>= 1){
+        if (flags & 1){
+            pulseCounter[i]++;                          // Increase counter of the pin
+        }
+    }
+}
+
+#if SV_DIAG
+// Timer1 ISR -> Overflow of the instrumentation time stamps, stays in the current low power mode
+#pragma vector = TIMER1_A1_VECTOR
+__interrupt void Timer1_A1_ISR(void)
+{
+    if (TA1IV == TA1IV_TAIFG){                          // Reading TA1IV clears the flag
+        diagOverflows++;
+    }
 }
+#endif
 
-// UART ISR -> Waits till transmission is completed
+// UART ISR -> Sends the next byte of the TX ring buffer, only wakes the CPU when it gets empty or has space
 #pragma vector=USCIAB0TX_VECTOR
 __interrupt void USCI0TX_ISR(void)
 {
-    while (!(IFG2&UCA0TXIFG));                          // Check if TX is ongoing
-    __bic_SR_register_on_exit(LPM0_bits + GIE);         // Exit LMP3 and disable interruption
+    unsigned char wasFull = ((txHead + 1) & txBufferMask) == txTail;
+
+    if (txHead != txTail)
+    {
+        UCA0TXBUF = txBuffer[txTail];                   // TXIFG is set, TXBUF is free
+        txTail = (txTail + 1) & txBufferMask;
+    }
+    if (txHead == txTail)
+    {
+        IE2 &= ~UCA0TXIE;                               // Nothing left, disable TX interrupt
+        __bic_SR_register_on_exit(LPM0_bits);           // Exit LPM0, uartFlush may be waiting
+    }
+    else if (wasFull)
+    {
+        __bic_SR_register_on_exit(LPM0_bits);           // Exit LPM0, uartWrite may be waiting for space
+    }
 }
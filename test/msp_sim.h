@@ -0,0 +1,633 @@
+#ifndef SV_MSP_SIM_H
+#define SV_MSP_SIM_H
+
+// MSP430G2553 on the host: msp/main.c runs as a coroutine on models of the peripherals it uses
+//  Code runs in zero time, the simulated clock only advances while the CPU sleeps in a low power mode
+//  or busy waits on UCA0STAT. A peripheral only progresses while its clock runs in the current power
+//  mode, as on the device: the USCI on SMCLK stops in LPM3, an ADC10 on MCLK stops once the CPU sleeps.
+//  Models: DCO at the 12 MHz calibration (RSEL changes are not modeled), LFXT1 32768 Hz with DIVA,
+//  Timer0_A3 CCR0 in up mode, USCI_A0 UART TX (TXBUF and shift register, 10 bits per byte), ADC10
+//  single channel and sequences with the one block DTC, port 2 edges from pulse trains.
+//  ISR bodies take no time, the CPU cost of an interrupt is its entry and RETI (SV_SIM_ISR_CYCLES).
+
+/* ******************** INCLUDES ******************** */
+
+#include <msp430.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+
+/* ******************** DEFINES ******************** */
+
+#define SV_SIM_NS           1000000000ULL
+#define SV_SIM_MS           1000000ULL
+#define SV_SIM_LFXT1_HZ     32768ULL
+#define SV_SIM_DCO_HZ       12000000ULL   // calibrated DCO, MCLK and SMCLK
+#define SV_SIM_PUC_DCO_HZ   1100000ULL    // DCO after reset, before the calibration is loaded
+#define SV_SIM_ADC10OSC_HZ  5000000ULL    // typical, 3.7 to 6.3 MHz in the datasheet
+#define SV_SIM_ISR_CYCLES   11            // interrupt acceptance 6 cycles + RETI 5 cycles
+#define SV_SIM_TXBUF_EMPTY  0xFFFF
+#define SV_SIM_PINS         8
+#define SV_SIM_STACK        (256 * 1024)
+#define SV_SIM_NEVER        UINT64_MAX
+
+/* ******************** TYPES AND STRUCTS ******************** */
+
+typedef void (*sv_sim_isr_t)(void);
+
+// Pulse train on a port 2 pin: idle high, falls at next_fall, rises width later, every period
+typedef struct {
+  uint64_t next_fall;
+  uint64_t period;
+  uint64_t width;
+  unsigned long left;                 // pulses still to come
+  int low;
+  unsigned long pulses;               // falling edges produced
+} sv_sim_pulses_t;
+
+typedef struct {
+  uint64_t now;                       // ns since power up
+  uint64_t deadline;
+  int stop;
+  unsigned short sr;
+  unsigned short exit_clear;          // __bic_SR_register_on_exit() of the running ISR
+  int last_wake;                      // vector whose ISR ended the last low power mode
+
+  sv_sim_isr_t vector[SV_MSP_VECTORS];
+  int (*firmware)(void);
+
+  // Timer0_A3, TAR counts base_count from LFXT1 cycle base_cycle, one count every div cycles
+  int t0_running;
+  unsigned short t0_ccr0;
+  unsigned short t0_base_count;
+  uint64_t t0_base_cycle;
+  uint64_t t0_div;
+
+  // USCI_A0 TX
+  int tx_full;
+  unsigned char tx_byte;
+  int tx_shifting;
+  unsigned char tx_shift;
+  uint64_t tx_left;                   // SMCLK time left on the byte in the shift register
+  void (*uart_sink)(unsigned char byte);
+  void (*lpm_entry)(void);            // called when the firmware enters a low power mode
+  unsigned long tx_overruns;
+
+  // ADC10
+  int adc_converting;
+  int adc_channel;
+  uint64_t adc_left;                  // ADC10CLK time left on the current conversion
+  unsigned int *dtc_block;
+  unsigned int dtc_count;
+  unsigned short adc[16];             // input of each channel, 10 bit counts
+  unsigned short (*adc_input)(int channel);
+
+  // Port 2
+  sv_sim_pulses_t pulses[SV_SIM_PINS];
+
+  // Statistics
+  uint64_t ns_active;                 // CPU on (busy waits, code takes no time)
+  uint64_t ns_lpm0;
+  uint64_t ns_lpm3;
+  uint64_t ns_other;
+  unsigned long isr[SV_MSP_VECTORS];
+  unsigned long wakes[SV_MSP_VECTORS];
+  unsigned long uart_bytes;
+  unsigned long adc_conversions;
+  unsigned long lpm_entries;
+} sv_sim_t;
+
+/* ******************** REGISTERS ******************** */
+
+volatile unsigned short WDTCTL;
+
+volatile unsigned char DCOCTL;
+volatile unsigned char BCSCTL1;
+volatile unsigned char CALBC1_1MHZ;
+volatile unsigned char CALBC1_12MHZ;
+volatile unsigned char CALDCO_12MHZ;
+
+volatile unsigned short TACTL;
+volatile unsigned short TACCTL0;
+volatile unsigned short sv_sim_taccr0_reg;        // TACCR0, accessed through sv_sim_taccr0()
+
+volatile unsigned short ADC10CTL0;
+volatile unsigned short ADC10CTL1;
+volatile unsigned short ADC10MEM;
+volatile unsigned char ADC10AE0;
+volatile unsigned char ADC10DTC0;
+volatile unsigned char ADC10DTC1;
+volatile unsigned int ADC10SA;
+
+volatile unsigned char P1SEL;
+volatile unsigned char P1SEL2;
+volatile unsigned char P2DIR;
+volatile unsigned char P2OUT;
+volatile unsigned char P2IE;
+volatile unsigned char P2IES;
+volatile unsigned char P2IFG;
+
+volatile unsigned char UCA0CTL1;
+volatile unsigned char UCA0BR0;
+volatile unsigned char UCA0BR1;
+volatile unsigned char UCA0MCTL;
+volatile unsigned short UCA0TXBUF;
+volatile unsigned char IE2;
+volatile unsigned char IFG2;
+
+/* ******************** STATE ******************** */
+
+static sv_sim_t sv_sim;
+static ucontext_t sv_sim_test_context;
+static ucontext_t sv_sim_firmware_context;
+static char sv_sim_stack[SV_SIM_STACK];
+static int sv_sim_started = 0;
+
+/* ******************** CLOCKS ******************** */
+
+static inline void sv_sim_fail(const char *what){
+  printf("msp_sim: %s at %.6f s\n", what, (double)sv_sim.now / SV_SIM_NS);
+  exit(1);
+}
+
+static inline uint64_t sv_sim_dco_hz(void){
+  return DCOCTL == CALDCO_12MHZ ? SV_SIM_DCO_HZ : SV_SIM_PUC_DCO_HZ;
+}
+
+// LFXT1 cycles elapsed at time t, and the time of cycle n
+static inline uint64_t sv_sim_lfxt1_cycle(uint64_t t){
+  return t * SV_SIM_LFXT1_HZ / SV_SIM_NS;
+}
+
+static inline uint64_t sv_sim_lfxt1_time(uint64_t cycle){
+  return (cycle * SV_SIM_NS + SV_SIM_LFXT1_HZ - 1) / SV_SIM_LFXT1_HZ;
+}
+
+static inline int sv_sim_mclk_on(void){ return !(sv_sim.sr & CPUOFF); }
+static inline int sv_sim_smclk_on(void){ return !(sv_sim.sr & SCG1); }
+static inline int sv_sim_aclk_on(void){ return !(sv_sim.sr & OSCOFF); }
+
+/* ******************** TIMER0_A3 ******************** */
+
+// TAR, it stays at TACCR0 for one count after a match
+static inline unsigned short sv_sim_timer0_count(void){
+  uint64_t cycle = sv_sim_lfxt1_cycle(sv_sim.now);
+
+  if (cycle < sv_sim.t0_base_cycle){
+    return sv_sim.t0_ccr0;
+  }
+  return (unsigned short)(sv_sim.t0_base_count + (cycle - sv_sim.t0_base_cycle) / sv_sim.t0_div);
+}
+
+// Up mode only, writing TACCR0 = 0 stops the timer and a non zero value restarts it from zero
+static inline void sv_sim_timer0_sync(void){
+  int running = (TACTL & MC_3) == MC_1 && sv_sim_taccr0_reg != 0;
+
+  if ((TACTL & MC_3) != MC_0 && (TACTL & MC_3) != MC_1){
+    sv_sim_fail("Timer0 mode not modeled");
+  }
+  if (running && (TACTL & (TASSEL_1 | TASSEL_2)) != TASSEL_1){
+    sv_sim_fail("Timer0 clock not modeled");
+  }
+  if (running && !sv_sim.t0_running){
+    sv_sim.t0_base_count = 0;
+    sv_sim.t0_base_cycle = sv_sim_lfxt1_cycle(sv_sim.now);
+    sv_sim.t0_div = (1ULL << ((BCSCTL1 >> 4) & 3)) * (1ULL << ((TACTL >> 6) & 3));
+    sv_sim.t0_ccr0 = sv_sim_taccr0_reg;
+  }
+  else if (running && sv_sim_taccr0_reg != sv_sim.t0_ccr0){
+    sv_sim.t0_base_count = sv_sim_timer0_count();
+    sv_sim.t0_base_cycle = sv_sim_lfxt1_cycle(sv_sim.now);
+    sv_sim.t0_ccr0 = sv_sim_taccr0_reg;
+  }
+  sv_sim.t0_running = running;
+}
+
+// CCIFG is set when TAR counts to TACCR0, TAR above TACCR0 counts to 0xFFFF first
+static inline uint64_t sv_sim_timer0_next(void){
+  uint64_t ticks;
+
+  if (!sv_sim.t0_running || !sv_sim_aclk_on()){
+    return SV_SIM_NEVER;
+  }
+  ticks = (unsigned short)(sv_sim.t0_ccr0 - sv_sim.t0_base_count);
+  if (ticks == 0){
+    ticks = 0x10000;
+  }
+  return sv_sim_lfxt1_time(sv_sim.t0_base_cycle + ticks * sv_sim.t0_div);
+}
+
+static inline void sv_sim_timer0_match(void){
+  uint64_t ticks = (unsigned short)(sv_sim.t0_ccr0 - sv_sim.t0_base_count);
+
+  TACCTL0 |= CCIFG;
+  sv_sim.t0_base_cycle += (ticks + 1) * sv_sim.t0_div;    // TAR is 0 one count after the match
+  sv_sim.t0_base_count = 0;
+}
+
+/* ******************** USCI_A0 ******************** */
+
+static inline uint64_t sv_sim_uart_byte_ns(void){
+  uint64_t divider = UCA0BR0 | ((uint64_t)UCA0BR1 << 8);
+
+  if ((UCA0CTL1 & UCSSEL_3) != UCSSEL_2){
+    sv_sim_fail("USCI clock not modeled");
+  }
+  return (10 * divider * SV_SIM_NS + sv_sim_dco_hz() / 2) / sv_sim_dco_hz();
+}
+
+static inline void sv_sim_uart_sync(void){
+  unsigned char byte;
+
+  if (UCA0TXBUF == SV_SIM_TXBUF_EMPTY){
+    return;
+  }
+  byte = (unsigned char)UCA0TXBUF;
+  UCA0TXBUF = SV_SIM_TXBUF_EMPTY;
+  if (UCA0CTL1 & UCSWRST){
+    return;
+  }
+  if (!sv_sim.tx_shifting){
+    sv_sim.tx_shift = byte;
+    sv_sim.tx_shifting = 1;
+    sv_sim.tx_left = sv_sim_uart_byte_ns();
+    IFG2 |= UCA0TXIFG;
+  }
+  else{
+    if (sv_sim.tx_full){
+      sv_sim.tx_overruns++;
+    }
+    sv_sim.tx_byte = byte;
+    sv_sim.tx_full = 1;
+    IFG2 &= ~UCA0TXIFG;
+  }
+}
+
+static inline void sv_sim_uart_done(void){
+  sv_sim.uart_bytes++;
+  if (sv_sim.uart_sink != NULL){
+    sv_sim.uart_sink(sv_sim.tx_shift);
+  }
+  if (sv_sim.tx_full){
+    sv_sim.tx_shift = sv_sim.tx_byte;
+    sv_sim.tx_full = 0;
+    sv_sim.tx_left = sv_sim_uart_byte_ns();
+    IFG2 |= UCA0TXIFG;
+  }
+  else{
+    sv_sim.tx_shifting = 0;
+  }
+}
+
+unsigned char sv_sim_uca0stat(void);
+
+/* ******************** ADC10 ******************** */
+
+static inline int sv_sim_adc_clock_on(void){
+  switch ((ADC10CTL1 >> 3) & 3){
+    case 0: return 1;
+    case 1: return sv_sim_aclk_on();
+    case 2: return sv_sim_mclk_on();
+    default: return sv_sim_smclk_on();
+  }
+}
+
+// Sample and hold of ADC10SHTx plus 13 conversion clocks
+static inline uint64_t sv_sim_adc_conversion_ns(void){
+  static const uint64_t sample[4] = {4, 8, 16, 64};
+  uint64_t clocks = (sample[(ADC10CTL0 >> 11) & 3] + 13) * (((ADC10CTL1 >> 5) & 7) + 1);
+  uint64_t hz;
+
+  switch ((ADC10CTL1 >> 3) & 3){
+    case 0: hz = SV_SIM_ADC10OSC_HZ; break;
+    case 1: hz = SV_SIM_LFXT1_HZ >> ((BCSCTL1 >> 4) & 3); break;
+    default: hz = sv_sim_dco_hz(); break;
+  }
+  return (clocks * SV_SIM_NS + hz - 1) / hz;
+}
+
+// Writing ADC10SA restarts the DTC block, the register is cleared once the address is taken
+static inline void sv_sim_adc_sync(void){
+  if (ADC10SA != 0){
+    sv_sim.dtc_block = (unsigned int *)(uintptr_t)ADC10SA;
+    sv_sim.dtc_count = 0;
+    ADC10SA = 0;
+  }
+  if (sv_sim.adc_converting && (!(ADC10CTL0 & ADC10ON) || !(ADC10CTL0 & ENC))){
+    sv_sim.adc_converting = 0;
+  }
+  if (!sv_sim.adc_converting && (ADC10CTL0 & (ADC10ON | ENC | ADC10SC)) == (ADC10ON | ENC | ADC10SC)){
+    ADC10CTL0 &= ~ADC10SC;
+    sv_sim.adc_converting = 1;
+    sv_sim.adc_channel = ADC10CTL1 >> 12;
+    sv_sim.adc_left = sv_sim_adc_conversion_ns();
+  }
+}
+
+static inline void sv_sim_adc_done(void){
+  int channel = sv_sim.adc_channel;
+  unsigned short value = sv_sim.adc_input != NULL ? sv_sim.adc_input(channel) : sv_sim.adc[channel];
+
+  ADC10MEM = value & 0x3FF;
+  sv_sim.adc_conversions++;
+  if (ADC10DTC1 == 0){
+    ADC10CTL0 |= ADC10IFG;
+  }
+  else if (sv_sim.dtc_block != NULL && sv_sim.dtc_count < ADC10DTC1){
+    sv_sim.dtc_block[sv_sim.dtc_count++] = ADC10MEM;
+    if (sv_sim.dtc_count == ADC10DTC1){
+      ADC10CTL0 |= ADC10IFG;          // one block mode, the DTC stops
+    }
+  }
+
+  switch ((ADC10CTL1 >> 1) & 3){
+    case 0:
+      sv_sim.adc_converting = 0;
+      return;
+    case 1:
+      if (channel == 0){
+        sv_sim.adc_converting = 0;
+        return;
+      }
+      sv_sim.adc_channel = channel - 1;
+      break;
+    case 2:
+      break;
+    default:
+      sv_sim.adc_channel = channel == 0 ? (ADC10CTL1 >> 12) : channel - 1;
+      break;
+  }
+  sv_sim.adc_left = sv_sim_adc_conversion_ns();
+}
+
+/* ******************** PORT 2 ******************** */
+
+static inline uint64_t sv_sim_pulse_next(const sv_sim_pulses_t *train){
+  if (train->low){
+    return train->next_fall + train->width;
+  }
+  return train->left > 0 ? train->next_fall : SV_SIM_NEVER;
+}
+
+// An edge sets P2IFG on the edge selected by P2IES, an output pin does not see the sensor
+static inline void sv_sim_pulse_edge(int pin){
+  sv_sim_pulses_t *train = &sv_sim.pulses[pin];
+  unsigned char bit = (unsigned char)(1 << pin);
+
+  if (!train->low){
+    train->low = 1;
+    train->pulses++;
+    train->left--;
+    if (!(P2DIR & bit) && (P2IES & bit)){
+      P2IFG |= bit;
+    }
+  }
+  else{
+    train->low = 0;
+    train->next_fall += train->period;
+    if (!(P2DIR & bit) && !(P2IES & bit)){
+      P2IFG |= bit;
+    }
+  }
+}
+
+/* ******************** SCHEDULER ******************** */
+
+// Applies the register writes of the code that just ran
+static inline void sv_sim_sync(void){
+  sv_sim_timer0_sync();
+  sv_sim_uart_sync();
+  sv_sim_adc_sync();
+}
+
+static inline void sv_sim_yield(void){
+  swapcontext(&sv_sim_firmware_context, &sv_sim_test_context);
+}
+
+// Advances the time to the next event, or to the deadline where the test takes over
+static inline void sv_sim_step(void){
+  uint64_t next = SV_SIM_NEVER;
+  uint64_t at;
+  uint64_t dt;
+  int pin;
+
+  while (sv_sim.stop || sv_sim.now >= sv_sim.deadline){
+    sv_sim_yield();
+  }
+  if ((at = sv_sim_timer0_next()) < next) next = at;
+  if (sv_sim.tx_shifting && sv_sim_smclk_on() && (at = sv_sim.now + sv_sim.tx_left) < next) next = at;
+  if (sv_sim.adc_converting && sv_sim_adc_clock_on() && (at = sv_sim.now + sv_sim.adc_left) < next) next = at;
+  for (pin = 0; pin < SV_SIM_PINS; pin++){
+    if ((at = sv_sim_pulse_next(&sv_sim.pulses[pin])) < next) next = at;
+  }
+  if (next > sv_sim.deadline){
+    next = sv_sim.deadline;
+  }
+
+  dt = next - sv_sim.now;
+  if (!(sv_sim.sr & CPUOFF)){
+    sv_sim.ns_active += dt;
+  }
+  else if ((sv_sim.sr & LPM4_bits) == LPM0_bits){
+    sv_sim.ns_lpm0 += dt;
+  }
+  else if ((sv_sim.sr & LPM4_bits) == LPM3_bits){
+    sv_sim.ns_lpm3 += dt;
+  }
+  else{
+    sv_sim.ns_other += dt;
+  }
+  if (sv_sim.tx_shifting && sv_sim_smclk_on()){
+    sv_sim.tx_left -= dt;
+  }
+  if (sv_sim.adc_converting && sv_sim_adc_clock_on()){
+    sv_sim.adc_left -= dt;
+  }
+  sv_sim.now = next;
+
+  if (sv_sim_timer0_next() == sv_sim.now){
+    sv_sim_timer0_match();
+  }
+  if (sv_sim.tx_shifting && sv_sim_smclk_on() && sv_sim.tx_left == 0){
+    sv_sim_uart_done();
+  }
+  if (sv_sim.adc_converting && sv_sim_adc_clock_on() && sv_sim.adc_left == 0){
+    sv_sim_adc_done();
+  }
+  for (pin = 0; pin < SV_SIM_PINS; pin++){
+    while (sv_sim_pulse_next(&sv_sim.pulses[pin]) == sv_sim.now){
+      sv_sim_pulse_edge(pin);
+    }
+  }
+}
+
+// Highest priority interrupt requested and enabled, 0 if none
+static inline int sv_sim_pending(void){
+  if ((TACCTL0 & (CCIFG | CCIE)) == (CCIFG | CCIE)) return TIMER0_A0_VECTOR;
+  if ((IFG2 & UCA0TXIFG) && (IE2 & UCA0TXIE)) return USCIAB0TX_VECTOR;
+  if ((ADC10CTL0 & (ADC10IFG | ADC10IE)) == (ADC10IFG | ADC10IE)) return ADC10_VECTOR;
+  if (P2IFG & P2IE) return PORT2_VECTOR;
+  return 0;
+}
+
+// Runs the ISRs while interrupts are enabled and requested, RETI restores SR minus the bits cleared on exit
+static inline void sv_sim_service(void){
+  unsigned long nested = 0;
+  int vector;
+
+  while ((sv_sim.sr & GIE) && (vector = sv_sim_pending()) != 0){
+    unsigned short saved = sv_sim.sr;
+
+    if (sv_sim.vector[vector] == NULL){
+      sv_sim_fail("interrupt without ISR");
+    }
+    if (++nested > 100000){
+      sv_sim_fail("ISR does not clear its flag");
+    }
+    if (vector == TIMER0_A0_VECTOR){
+      TACCTL0 &= ~CCIFG;              // single source vectors clear their flag
+    }
+    else if (vector == ADC10_VECTOR){
+      ADC10CTL0 &= ~ADC10IFG;
+    }
+    sv_sim.isr[vector]++;
+    sv_sim.sr &= SCG0;
+    sv_sim.exit_clear = 0;
+    sv_sim.vector[vector]();
+    sv_sim.sr = saved & ~sv_sim.exit_clear;
+    if ((saved & CPUOFF) && !(sv_sim.sr & CPUOFF)){
+      sv_sim.last_wake = vector;
+    }
+    sv_sim_sync();
+  }
+}
+
+/* ******************** INTRINSICS ******************** */
+
+// Entering a low power mode runs the peripherals until an ISR clears CPUOFF on exit
+void __bis_SR_register(unsigned short bits){
+  int sleeping = (bits & CPUOFF) && !(sv_sim.sr & CPUOFF);
+
+  sv_sim_sync();
+  sv_sim.sr |= bits;
+  if (sleeping){
+    sv_sim.lpm_entries++;
+    if (sv_sim.lpm_entry){
+      sv_sim.lpm_entry();
+    }
+  }
+  sv_sim_service();
+  while (sv_sim.sr & CPUOFF){
+    sv_sim_step();
+    sv_sim_service();
+  }
+  if (sleeping){
+    sv_sim.wakes[sv_sim.last_wake]++;
+  }
+}
+
+void __bic_SR_register_on_exit(unsigned short bits){
+  sv_sim.exit_clear |= bits;
+}
+
+void __enable_interrupt(void){
+  sv_sim_sync();
+  sv_sim.sr |= GIE;
+  sv_sim_service();
+}
+
+void __disable_interrupt(void){
+  sv_sim_sync();
+  sv_sim.sr &= ~GIE;
+}
+
+unsigned short __get_SR_register(void){
+  return sv_sim.sr;
+}
+
+// A busy wait on UCBUSY keeps the CPU awake until the next event
+unsigned char sv_sim_uca0stat(void){
+  sv_sim_sync();
+  if (sv_sim.tx_shifting || sv_sim.tx_full){
+    sv_sim_step();
+    sv_sim_service();
+    return UCBUSY;
+  }
+  return 0;
+}
+
+// Every access applies the previous write first, a stop (TACCR0 = 0) right before a new period is
+//  seen even without a low power mode in between, and the timer restarts from zero
+volatile unsigned short *sv_sim_taccr0(void){
+  sv_sim_timer0_sync();
+  return &sv_sim_taccr0_reg;
+}
+
+/* ******************** CONTROL ******************** */
+
+static void sv_sim_entry(void){
+  sv_sim.firmware();
+  sv_sim_fail("main() returned");
+}
+
+// Power up, registers at their PUC values, the firmware starts on the first sv_sim_run()
+static inline void sv_sim_init(int (*firmware)(void)){
+  memset(&sv_sim, 0, sizeof(sv_sim));
+  sv_sim.firmware = firmware;
+  CALBC1_1MHZ = 0x86;
+  CALBC1_12MHZ = 0x8E;
+  CALDCO_12MHZ = 0x9B;
+  DCOCTL = 0x60;
+  BCSCTL1 = 0x87;
+  UCA0CTL1 = UCSWRST;
+  UCA0TXBUF = SV_SIM_TXBUF_EMPTY;
+  IFG2 = UCA0TXIFG;
+  sv_sim_started = 0;
+}
+
+// Runs the firmware for ns of simulated time or until sv_sim_stop()
+static inline void sv_sim_run(uint64_t ns){
+  sv_sim.deadline = sv_sim.now + ns;
+  sv_sim.stop = 0;
+  if (!sv_sim_started){
+    sv_sim_started = 1;
+    getcontext(&sv_sim_firmware_context);
+    sv_sim_firmware_context.uc_stack.ss_sp = sv_sim_stack;
+    sv_sim_firmware_context.uc_stack.ss_size = sizeof(sv_sim_stack);
+    sv_sim_firmware_context.uc_link = NULL;
+    makecontext(&sv_sim_firmware_context, sv_sim_entry, 0);
+  }
+  swapcontext(&sv_sim_test_context, &sv_sim_firmware_context);
+}
+
+// Called from a sink or input callback, the run returns at the next event
+static inline void sv_sim_stop(void){
+  sv_sim.stop = 1;
+}
+
+// Falling edges on P2.pin from first, every period, count pulses
+static inline void sv_sim_pulses(int pin, uint64_t first, uint64_t period, unsigned long count){
+  sv_sim_pulses_t *train = &sv_sim.pulses[pin];
+
+  train->next_fall = first;
+  train->period = period;
+  train->width = period / 2;
+  train->left = count;
+  train->low = 0;
+}
+
+// CPU cycles: busy waits at MCLK plus the entry and RETI of every interrupt
+static inline uint64_t sv_sim_cpu_cycles(void){
+  uint64_t isr = 0;
+  int vector;
+
+  for (vector = 0; vector < SV_MSP_VECTORS; vector++){
+    isr += sv_sim.isr[vector];
+  }
+  return sv_sim.ns_active * SV_SIM_DCO_HZ / SV_SIM_NS + isr * SV_SIM_ISR_CYCLES;
+}
+
+#endif // SV_MSP_SIM_H
@@ -0,0 +1,6 @@
+#ifndef SV_STUB_ADAFRUIT_GFX_H
+#define SV_STUB_ADAFRUIT_GFX_H
+
+// Host stand-in for Adafruit_GFX, everything is in the Adafruit_SSD1306 stand-in
+
+#endif // SV_STUB_ADAFRUIT_GFX_H
@@ -0,0 +1,139 @@
+#ifndef SV_STUB_ADAFRUIT_SSD1306_H
+#define SV_STUB_ADAFRUIT_SSD1306_H
+
+// Host stand-in for Adafruit_SSD1306: the 1 bit framebuffer of the library (one byte = 8 pixels
+//  of a page column), text of size 1 drawn as 6x8 cells with a made up 5 column glyph per
+//  character, and display() sending the buffer with the same I2C transactions as the library
+
+/* ******************** INCLUDES ******************** */
+
+#include "Adafruit_GFX.h"
+#include "Wire.h"
+
+#include <string.h>
+
+/* ******************** DEFINES ******************** */
+
+#define SSD1306_BLACK       0
+#define SSD1306_WHITE       1
+#define BLACK               SSD1306_BLACK
+#define WHITE               SSD1306_WHITE
+#define SSD1306_SWITCHCAPVCC 0x02
+#define SSD1306_PAGEADDR    0x22
+#define SSD1306_COLUMNADDR  0x21
+
+/* ******************** TYPES AND STRUCTS ******************** */
+
+class Adafruit_SSD1306 {
+public:
+  Adafruit_SSD1306(uint8_t w, uint8_t h, TwoWire *twi, int8_t rst_pin = -1)
+    : width_(w), height_(h), wire_(twi), address_(0x3C), cursor_x_(0), cursor_y_(0) {
+    (void)rst_pin;
+    memset(buffer_, 0, sizeof(buffer_));
+  }
+
+  bool begin(uint8_t vcs, uint8_t address, bool reset = true, bool periph_begin = true){
+    (void)vcs;
+    (void)reset;
+    (void)periph_begin;
+    address_ = address;
+    return true;
+  }
+
+  void clearDisplay(){ memset(buffer_, 0, sizeof(buffer_)); }
+  void setTextColor(uint16_t color){ (void)color; }
+  void setTextSize(uint8_t size){ (void)size; }
+  void setTextWrap(bool wrap){ (void)wrap; }
+  void setCursor(int16_t x, int16_t y){ cursor_x_ = x; cursor_y_ = y; }
+  uint8_t *getBuffer(){ return buffer_; }
+
+  void drawPixel(int16_t x, int16_t y, uint16_t color){
+    if (x < 0 || y < 0 || x >= width_ || y >= height_){
+      return;
+    }
+    if (color == WHITE){
+      buffer_[x + (y / 8) * width_] |= (uint8_t)(1 << (y & 7));
+    }
+    else{
+      buffer_[x + (y / 8) * width_] &= (uint8_t)~(1 << (y & 7));
+    }
+  }
+
+  void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color){
+    int16_t i;
+    int16_t j;
+    for (i = x; i < x + w; i++){
+      for (j = y; j < y + h; j++){
+        drawPixel(i, j, color);
+      }
+    }
+  }
+
+  // Foreground pixels only, as the library with a transparent background
+  size_t write(uint8_t c){
+    int16_t i;
+    int16_t j;
+    for (i = 0; i < 5; i++){
+      uint8_t column = (uint8_t)(c * 37 + i * 11) | 0x01;
+      for (j = 0; j < 8; j++){
+        if (column & (1 << j)){
+          drawPixel(cursor_x_ + i, cursor_y_ + j, WHITE);
+        }
+      }
+    }
+    cursor_x_ += 6;
+    return 1;
+  }
+
+  size_t print(const char *text){
+    size_t n = 0;
+    while (*text){
+      n += write((uint8_t)*text++);
+    }
+    return n;
+  }
+
+  // Whole buffer: page and column range commands, then the data in chunks of the Wire buffer
+  void display(){
+    static const uint8_t dlist1[] = {SSD1306_PAGEADDR, 0, 0xFF, SSD1306_COLUMNADDR, 0};
+    size_t count = (size_t)width_ * ((height_ + 7) / 8);
+    size_t bytes_out = 1;
+    size_t i;
+
+    wire_->beginTransmission(address_);
+    wire_->write((uint8_t)0x00);
+    for (i = 0; i < sizeof(dlist1); i++){
+      wire_->write(dlist1[i]);
+    }
+    wire_->endTransmission();
+    wire_->beginTransmission(address_);
+    wire_->write((uint8_t)0x00);
+    wire_->write((uint8_t)(width_ - 1));
+    wire_->endTransmission();
+
+    wire_->beginTransmission(address_);
+    wire_->write((uint8_t)0x40);
+    for (i = 0; i < count; i++){
+      if (bytes_out >= I2C_BUFFER_LENGTH){
+        wire_->endTransmission();
+        wire_->beginTransmission(address_);
+        wire_->write((uint8_t)0x40);
+        bytes_out = 1;
+      }
+      wire_->write(buffer_[i]);
+      bytes_out++;
+    }
+    wire_->endTransmission();
+  }
+
+private:
+  uint8_t width_;
+  uint8_t height_;
+  TwoWire *wire_;
+  uint8_t address_;
+  int16_t cursor_x_;
+  int16_t cursor_y_;
+  uint8_t buffer_[128 * 64 / 8];
+};
+
+#endif // SV_STUB_ADAFRUIT_SSD1306_H
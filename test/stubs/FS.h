@@ -0,0 +1,228 @@
+#ifndef SV_STUB_FS_H
+#define SV_STUB_FS_H
+
+// Host stand-in for the Arduino fs::FS / fs::File of the ESP32 core, files kept in memory
+//  Behaves as LittleFS: creating, removing and renaming a file are atomic, written data only
+//  reaches the file when it is closed (commit). A power cut can be injected after a number of these
+//  operations, nothing is committed after it until reboot().
+//  Every operation is counted; the flash programmed by a commit follows the copy on write of
+//  LittleFS: the partial last block of the file is copied into a new block with the new data.
+//  Metadata commits are counted, not sized; inline files are not modelled.
+
+/* ******************** INCLUDES ******************** */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+/* ******************** DEFINES ******************** */
+
+#define SV_STUB_BLOCK_SIZE 4096
+
+/* ******************** TYPES AND STRUCTS ******************** */
+
+typedef struct {
+  unsigned long opens;
+  unsigned long closes;
+  unsigned long commits;        // closes that wrote data
+  unsigned long meta_commits;   // create, commit, remove and rename
+  unsigned long written;        // bytes given to write()
+  unsigned long programmed;     // bytes programmed on flash by the commits
+} sv_stub_fs_stats_t;
+
+namespace fs {
+
+class FS;
+
+class File {
+public:
+  File() : fs_(NULL), pos_(0), base_size_(0), boot_(0), writing_(false), truncate_(false), dirty_(false) {}
+
+  explicit operator bool() const { return fs_ != NULL; }
+
+  int read(){
+    if (fs_ == NULL || pos_ >= data_.size()){
+      return -1;
+    }
+    return data_[pos_++];
+  }
+
+  size_t read(uint8_t *buf, size_t len){
+    size_t count = 0;
+    while (count < len && fs_ != NULL && pos_ < data_.size()){
+      buf[count++] = data_[pos_++];
+    }
+    return count;
+  }
+
+  size_t write(const uint8_t *buf, size_t len);
+
+  bool seek(uint32_t pos){
+    if (fs_ == NULL || pos > data_.size()){
+      return false;
+    }
+    pos_ = pos;
+    return true;
+  }
+
+  size_t size() const { return data_.size(); }
+
+  void close();
+
+private:
+  friend class FS;
+
+  FS *fs_;
+  std::string path_;
+  std::vector<uint8_t> data_;
+  size_t pos_;
+  size_t base_size_;    // committed size when opened
+  unsigned boot_;
+  bool writing_;
+  bool truncate_;
+  bool dirty_;
+};
+
+class FS {
+public:
+  FS() : ops_left_(-1), boot_(0) { reset_stats(); }
+
+  File open(const char *path, const char *mode){
+    File file;
+    bool exists = files_.count(path) != 0;
+
+    stats.opens++;
+    if (mode[0] == 'r'){
+      if (!exists){
+        return file;
+      }
+    }
+    else{
+      if (!exists){
+        if (!operation()){
+          return file;
+        }
+        files_[path];
+      }
+      file.writing_ = true;
+      file.truncate_ = mode[0] == 'w';
+      file.dirty_ = file.truncate_;
+    }
+    file.fs_ = this;
+    file.path_ = path;
+    file.boot_ = boot_;
+    if (!file.truncate_){
+      file.data_ = files_[path];
+    }
+    file.base_size_ = files_[path].size();
+    file.pos_ = mode[0] == 'a' ? file.data_.size() : 0;
+    return file;
+  }
+
+  bool exists(const char *path){
+    return files_.count(path) != 0;
+  }
+
+  bool remove(const char *path){
+    if (files_.count(path) == 0 || !operation()){
+      return false;
+    }
+    files_.erase(path);
+    return true;
+  }
+
+  bool rename(const char *from, const char *to){
+    if (files_.count(from) == 0 || !operation()){
+      return false;
+    }
+    files_[to] = files_[from];
+    files_.erase(from);
+    return true;
+  }
+
+  /* ****** TEST CONTROL ****** */
+
+  // Power cut after count more create / commit / remove / rename operations
+  void cut_after(long count){ ops_left_ = count; }
+  bool powered() const { return ops_left_ != 0; }
+
+  // Power back: files opened before are gone, what was committed stays
+  void reboot(){
+    ops_left_ = -1;
+    boot_++;
+  }
+
+  void format(){
+    files_.clear();
+    reboot();
+    reset_stats();
+  }
+
+  void reset_stats(){ memset(&stats, 0, sizeof(stats)); }
+
+  // Committed content of a file, to check or damage it
+  std::vector<uint8_t> *content(const char *path){
+    return files_.count(path) != 0 ? &files_[path] : NULL;
+  }
+
+  sv_stub_fs_stats_t stats;
+
+private:
+  friend class File;
+
+  // Counts a metadata operation, false once the power is cut
+  bool operation(){
+    if (ops_left_ == 0){
+      return false;
+    }
+    if (ops_left_ > 0){
+      ops_left_--;
+    }
+    stats.meta_commits++;
+    return true;
+  }
+
+  void commit(File *file){
+    if (file->boot_ != boot_ || files_.count(file->path_) == 0 || !operation()){
+      return;
+    }
+    size_t kept = file->truncate_ ? 0 : file->base_size_ - file->base_size_ % SV_STUB_BLOCK_SIZE;
+    stats.commits++;
+    stats.programmed += file->data_.size() - kept;
+    files_[file->path_] = file->data_;
+  }
+
+  std::map<std::string, std::vector<uint8_t> > files_;
+  long ops_left_;       // -1: no power cut planned
+  unsigned boot_;
+};
+
+inline size_t File::write(const uint8_t *buf, size_t len){
+  if (fs_ == NULL || !writing_){
+    return 0;
+  }
+  fs_->stats.written += len;
+  data_.insert(data_.end(), buf, buf + len);
+  pos_ = data_.size();
+  dirty_ = true;
+  return len;
+}
+
+inline void File::close(){
+  if (fs_ == NULL){
+    return;
+  }
+  fs_->stats.closes++;
+  if (writing_ && dirty_){
+    fs_->commit(this);
+  }
+  fs_ = NULL;
+}
+
+} // namespace fs
+
+#endif // SV_STUB_FS_H
@@ -0,0 +1,10 @@
+#ifndef SV_STUB_LITTLEFS_H
+#define SV_STUB_LITTLEFS_H
+
+// Host stand-in for the LittleFS instance of the ESP32 core, one per test program
+
+#include "FS.h"
+
+static fs::FS LittleFS;
+
+#endif // SV_STUB_LITTLEFS_H
@@ -0,0 +1,71 @@
+#ifndef SV_STUB_WIRE_H
+#define SV_STUB_WIRE_H
+
+// Host stand-in for the Arduino TwoWire of the ESP32 core
+//  Counts the bytes on the bus (address byte included) and hands each finished transaction to an
+//  optional device model
+
+/* ******************** INCLUDES ******************** */
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* ******************** DEFINES ******************** */
+
+#define I2C_BUFFER_LENGTH 128     // as the ESP32 core
+
+/* ******************** TYPES AND STRUCTS ******************** */
+
+typedef void (*sv_stub_wire_device_t)(void *context, const uint8_t *data, size_t len);
+
+class TwoWire {
+public:
+  TwoWire() : bytes(0), transactions(0), overflows(0), clock(100000), device(NULL), context(NULL), len_(0), open_(false) {}
+
+  void begin(){}
+
+  void setClock(uint32_t frequency){ clock = frequency; }
+
+  void beginTransmission(uint8_t address){
+    (void)address;
+    len_ = 0;
+    open_ = true;
+    bytes++;
+    transactions++;
+  }
+
+  size_t write(uint8_t data){
+    if (!open_ || len_ >= I2C_BUFFER_LENGTH){
+      overflows++;
+      return 0;
+    }
+    buffer_[len_++] = data;
+    bytes++;
+    return 1;
+  }
+
+  uint8_t endTransmission(bool stop = true){
+    (void)stop;
+    if (open_ && device != NULL){
+      device(context, buffer_, len_);
+    }
+    open_ = false;
+    return 0;
+  }
+
+  unsigned long bytes;          // on the bus, address bytes included
+  unsigned long transactions;
+  unsigned long overflows;      // bytes that did not fit the buffer, lost as on the board
+  uint32_t clock;
+  sv_stub_wire_device_t device;
+  void *context;
+
+private:
+  uint8_t buffer_[I2C_BUFFER_LENGTH];
+  size_t len_;
+  bool open_;
+};
+
+static TwoWire Wire;
+
+#endif // SV_STUB_WIRE_H
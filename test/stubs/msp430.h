@@ -0,0 +1,184 @@
+#ifndef SV_STUB_MSP430_H
+#define SV_STUB_MSP430_H
+
+// Host stand-in for the MSP430G2553 device header, for msp/main.c built by test_msp.c
+//  Same names and bit values as TI's msp430g2553.h for the registers the firmware uses. The registers
+//  are plain variables defined and driven by msp_sim.h, the few ones with side effects on access are
+//  function-like macros. 16 bit registers keep the 16 bit truncation of the device.
+
+/* ******************** DEFINES ******************** */
+
+// Status register
+#define GIE          0x0008
+#define CPUOFF       0x0010
+#define OSCOFF       0x0020
+#define SCG0         0x0040
+#define SCG1         0x0080
+#define LPM0_bits    (CPUOFF)
+#define LPM1_bits    (SCG0 + CPUOFF)
+#define LPM2_bits    (SCG1 + CPUOFF)
+#define LPM3_bits    (SCG1 + SCG0 + CPUOFF)
+#define LPM4_bits    (SCG1 + SCG0 + OSCOFF + CPUOFF)
+
+#define BIT0         0x0001
+#define BIT1         0x0002
+#define BIT2         0x0004
+#define BIT3         0x0008
+#define BIT4         0x0010
+#define BIT5         0x0020
+#define BIT6         0x0040
+#define BIT7         0x0080
+
+// Watchdog
+#define WDTPW        0x5A00
+#define WDTHOLD      0x0080
+
+// Basic clock
+#define XT2OFF       0x80
+#define XTS          0x40
+#define RSEL0        0x01
+#define RSEL1        0x02
+#define RSEL2        0x04
+#define RSEL3        0x08
+#define DIVA_0       0x00
+#define DIVA_1       0x10
+#define DIVA_2       0x20
+#define DIVA_3       0x30
+
+// Timer_A
+#define TAIFG        0x0001
+#define TAIE         0x0002
+#define TACLR        0x0004
+#define MC_0         0x0000
+#define MC_1         0x0010
+#define MC_2         0x0020
+#define MC_3         0x0030
+#define ID_0         0x0000
+#define ID_1         0x0040
+#define ID_2         0x0080
+#define ID_3         0x00C0
+#define TASSEL_0     0x0000
+#define TASSEL_1     0x0100
+#define TASSEL_2     0x0200
+#define CCIFG        0x0001
+#define CCIE         0x0010
+#define TA1IV_TAIFG  0x000A
+
+// ADC10
+#define ADC10SC      0x0001
+#define ENC          0x0002
+#define ADC10IFG     0x0004
+#define ADC10IE      0x0008
+#define ADC10ON      0x0010
+#define REFON        0x0020
+#define MSC          0x0080
+#define SREF_0       0x0000
+#define ADC10SHT_0   0x0000
+#define ADC10SHT_1   0x0800
+#define ADC10SHT_2   0x1000
+#define ADC10SHT_3   0x1800
+#define ADC10BUSY    0x0001
+#define CONSEQ_0     0x0000
+#define CONSEQ_1     0x0002
+#define CONSEQ_2     0x0004
+#define CONSEQ_3     0x0006
+#define ADC10SSEL0   0x0008
+#define ADC10SSEL1   0x0010
+#define ADC10SSEL_0  0x0000
+#define ADC10SSEL_1  0x0008
+#define ADC10SSEL_2  0x0010
+#define ADC10SSEL_3  0x0018
+#define INCH_0       0x0000
+#define INCH_1       0x1000
+#define INCH_2       0x2000
+#define INCH_3       0x3000
+#define INCH_4       0x4000
+#define INCH_5       0x5000
+#define INCH_6       0x6000
+#define INCH_7       0x7000
+
+// USCI_A0 UART
+#define UCSWRST      0x01
+#define UCSSEL_0     0x00
+#define UCSSEL_1     0x40
+#define UCSSEL_2     0x80
+#define UCSSEL_3     0xC0
+#define UCBRS_0      0x00
+#define UCBUSY       0x01
+#define UCA0RXIE     0x01
+#define UCA0TXIE     0x02
+#define UCA0RXIFG    0x01
+#define UCA0TXIFG    0x02
+
+// Interrupt vectors, (address - 0xFFE0) / 2, a higher one has priority
+#define PORT1_VECTOR        2
+#define PORT2_VECTOR        3
+#define ADC10_VECTOR        5
+#define USCIAB0TX_VECTOR    6
+#define USCIAB0RX_VECTOR    7
+#define TIMER0_A1_VECTOR    8
+#define TIMER0_A0_VECTOR    9
+#define WDT_VECTOR          10
+#define COMPARATORA_VECTOR  11
+#define TIMER1_A1_VECTOR    12
+#define TIMER1_A0_VECTOR    13
+#define NMI_VECTOR          14
+#define SV_MSP_VECTORS      16
+
+// ISRs are plain functions, msp_sim.h calls them from its vector table
+#define __interrupt
+
+// Registers with side effects on access
+#define UCA0STAT     (sv_sim_uca0stat())
+#define TACCR0       (*sv_sim_taccr0())
+
+/* ******************** REGISTERS ******************** */
+
+extern volatile unsigned short WDTCTL;
+
+extern volatile unsigned char DCOCTL;
+extern volatile unsigned char BCSCTL1;
+extern volatile unsigned char CALBC1_1MHZ;
+extern volatile unsigned char CALBC1_12MHZ;
+extern volatile unsigned char CALDCO_12MHZ;
+
+extern volatile unsigned short TACTL;
+extern volatile unsigned short TACCTL0;
+
+extern volatile unsigned short ADC10CTL0;
+extern volatile unsigned short ADC10CTL1;
+extern volatile unsigned short ADC10MEM;
+extern volatile unsigned char ADC10AE0;
+extern volatile unsigned char ADC10DTC0;
+extern volatile unsigned char ADC10DTC1;
+extern volatile unsigned int ADC10SA;           // 32 bit, holds the host address of the DTC block
+
+extern volatile unsigned char P1SEL;
+extern volatile unsigned char P1SEL2;
+extern volatile unsigned char P2DIR;
+extern volatile unsigned char P2OUT;
+extern volatile unsigned char P2IE;
+extern volatile unsigned char P2IES;
+extern volatile unsigned char P2IFG;
+
+extern volatile unsigned char UCA0CTL1;
+extern volatile unsigned char UCA0BR0;
+extern volatile unsigned char UCA0BR1;
+extern volatile unsigned char UCA0MCTL;
+extern volatile unsigned short UCA0TXBUF;       // 16 bit, msp_sim.h marks it empty with a value above 0xFF
+extern volatile unsigned char IE2;
+extern volatile unsigned char IFG2;
+
+/* ******************** FUNCTIONS ******************** */
+
+// Intrinsics
+void __bis_SR_register(unsigned short bits);
+void __bic_SR_register_on_exit(unsigned short bits);
+void __enable_interrupt(void);
+void __disable_interrupt(void);
+unsigned short __get_SR_register(void);
+
+unsigned char sv_sim_uca0stat(void);
+volatile unsigned short *sv_sim_taccr0(void);
+
+#endif // SV_STUB_MSP430_H
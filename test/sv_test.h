@@ -0,0 +1,57 @@
+#ifndef SV_TEST_H
+#define SV_TEST_H
+
+// Minimal checks for the host tests: every failed check is printed, sv_test_end() gives the exit code
+
+/* ******************** INCLUDES ******************** */
+
+#include <stdio.h>
+#include <string.h>
+
+/* ******************** DEFINES ******************** */
+
+#define SV_CHECK(cond) \
+  sv_test_check((cond) ? 1 : 0, __FILE__, __LINE__, #cond)
+
+#define SV_CHECK_EQ(actual, expected) \
+  sv_test_check_eq((long)(actual), (long)(expected), __FILE__, __LINE__, #actual)
+
+#define SV_CHECK_STR(actual, expected) \
+  sv_test_check_str((actual), (expected), __FILE__, __LINE__, #actual)
+
+/* ******************** FUNCTIONS ******************** */
+
+static int sv_test_checks = 0;
+static int sv_test_failures = 0;
+
+static inline void sv_test_check(int ok, const char *file, int line, const char *what){
+  sv_test_checks++;
+  if (!ok){
+    sv_test_failures++;
+    printf("%s:%d: check failed: %s\n", file, line, what);
+  }
+}
+
+static inline void sv_test_check_eq(long actual, long expected, const char *file, int line, const char *what){
+  sv_test_checks++;
+  if (actual != expected){
+    sv_test_failures++;
+    printf("%s:%d: %s is %ld, expected %ld\n", file, line, what, actual, expected);
+  }
+}
+
+static inline void sv_test_check_str(const char *actual, const char *expected, const char *file, int line, const char *what){
+  sv_test_checks++;
+  if (strcmp(actual, expected) != 0){
+    sv_test_failures++;
+    printf("%s:%d: %s is\n  %s\nexpected\n  %s\n", file, line, what, actual, expected);
+  }
+}
+
+// Prints the result of the test program, returns its exit code
+static inline int sv_test_end(const char *name){
+  printf("%s: %d checks, %d failed\n", name, sv_test_checks, sv_test_failures);
+  return sv_test_failures ? 1 : 0;
+}
+
+#endif // SV_TEST_H
@@ -0,0 +1,443 @@
+// Windowed summaries and delta frames of the sender on the host: days of readings on the MSP430
+//  schedule through sv_aggregate and the keyframe / delta encoding as lora_sender.ino does them,
+//  every summary against a two-pass reference of its window, every delta frame rebuilt by the
+//  gateway against the reading sent, then the frames and airtime against one data frame per reading
+
+#include "sv_test.h"
+#include "SmartVit_aggregate.h"
+
+#include <math.h>
+
+/* ******************** DEFINES ******************** */
+
+#define TRACE_STEP_S    300                     // one MSP430 frame every 5 min, the shortest period
+#define TRACE_DAY_S     (24 * 3600UL)
+#define TRACE_DAYS      3
+#define TRACE_READINGS  (TRACE_DAYS * TRACE_DAY_S / TRACE_STEP_S)
+#define TRACE_SF        7
+
+/* ******************** TYPES AND STRUCTS ******************** */
+
+// Readings of one window kept for the reference
+typedef struct {
+  float value[SV_AGGREGATE_WINDOW_MS / 1000 / TRACE_STEP_S + 1][SV_FIELD_COUNT];
+  uint16_t present[SV_AGGREGATE_WINDOW_MS / 1000 / TRACE_STEP_S + 1];
+  int count;
+} window_t;
+
+// What the sender puts on the air in a day
+typedef struct {
+  uint32_t frames;
+  uint32_t bytes;
+  uint32_t airtime_us;
+} air_t;
+
+// Keyframe and delta encoding of LoRaSendPacket(), and the gateway side of process_packet()
+typedef struct {
+  sv_delta_ref_t keyframe;
+  uint8_t  delta_count;
+  uint16_t seq;
+  sv_delta_ref_t gateway_ref;
+  uint32_t deltas;          // delta frames sent
+  uint32_t rebuilt;         // delta frames the gateway rebuilt into the reading sent
+  uint32_t lost;            // delta frames the gateway could not rebuild, their keyframe was lost
+} link_t;
+
+#define SV_SENSOR_PERIOD(name, source, channel, width, is_signed, scale, cal, cal_scale, cal_offset, key) \
+  SV_PERIOD_##name,
+static const uint32_t period_s[SV_FIELD_COUNT] = {
+  SV_SENSOR_TABLE(SV_SENSOR_PERIOD)
+};
+#undef SV_SENSOR_PERIOD
+
+/* ******************** HELPERS ******************** */
+
+static uint32_t trace_random(uint32_t *state){
+  *state = *state * 1103515245u + 12345u;
+  return (*state >> 8) & 0xFFFF;
+}
+
+// Uniform in [-1, 1]
+static float trace_noise(uint32_t *state){
+  return trace_random(state) / 32767.5f - 1.0f;
+}
+
+// Reading of a field at t, in the units the sender gets from the calibration, on the wire scale
+//  A diurnal cycle plus noise, two gusts above SV_TRIGGER_WIND_SPEED and an afternoon shower with
+//  one reading above SV_TRIGGER_RAIN
+static float trace_value(sv_field_t field, uint32_t t, uint32_t *state){
+  float day = sinf(2 * (float)M_PI * (t - 6 * 3600.0f) / TRACE_DAY_S);
+  uint32_t hour = t % TRACE_DAY_S;
+  float value = 0;
+
+  switch (field){
+  case SV_FIELD_WIND_SPEED:
+    value = 3.0f + 2.0f * day + 1.5f * trace_noise(state);
+    if (hour == 11 * 3600 || hour == 16 * 3600 + 600){
+      value = 17.5f;
+    }
+    break;
+  case SV_FIELD_WIND_DIR:
+    value = (float)((t / 3600 + trace_random(state) % 2) % 8);
+    break;
+  case SV_FIELD_RAIN:
+    value = hour >= 14 * 3600 && hour < 16 * 3600 ? 0.25f * (1 + trace_random(state) % 4) : 0;
+    if (hour == 15 * 3600){
+      value = 2.5f;
+    }
+    break;
+  case SV_FIELD_AIR_TEMP:
+    value = 12.0f + 6.0f * day + 0.3f * trace_noise(state);
+    break;
+  case SV_FIELD_AIR_HUMID:
+    value = 80.0f - 15.0f * day + 2.0f * trace_noise(state);
+    break;
+  case SV_FIELD_AIR_PRES:
+    value = 1013.0f - 4.0f * t / TRACE_DAY_S + 0.2f * trace_noise(state);
+    break;
+  case SV_FIELD_SOIL_PH:
+    value = 6.4f + 0.05f * trace_noise(state);
+    break;
+  case SV_FIELD_SOIL_TEMP:
+    value = 10.0f + 2.0f * sinf(2 * (float)M_PI * (t - 9 * 3600.0f) / TRACE_DAY_S) + 0.1f * trace_noise(state);
+    break;
+  default:
+    value = 1.2f + 0.02f * field + 0.01f * trace_noise(state);
+    break;
+  }
+  return sv_field_from_raw(field, sv_field_to_raw(field, value));
+}
+
+static void air_add(air_t *air, size_t len){
+  air->frames++;
+  air->bytes += (uint32_t)len;
+  air->airtime_us += sv_lora_airtime_us(len, TRACE_SF, SV_LORA_BANDWIDTH, SV_LORA_CODING_RATE);
+}
+
+// Sends data as LoRaSendPacket() does, a keyframe every SV_DELTA_KEYFRAME_INTERVAL frames or when a
+//  delta frame is not shorter. The gateway keeps data frames as keyframe and rebuilds delta frames,
+//  unless the frame is dropped on the air.
+static void link_send(link_t *link, air_t *air, struct all_sensors_data *data, int dropped){
+  uint8_t buf[SV_FRAME_MAX_LEN];
+  struct all_sensors_data rebuilt;
+  size_t len = 0;
+  uint8_t field;
+
+  data->node = 7;
+  data->seq = link->seq++;
+  data->tx_power = 14;
+  if (link->delta_count + 1 < SV_DELTA_KEYFRAME_INTERVAL){
+    len = sv_delta_encode(data, &link->keyframe, buf, sizeof(buf));
+  }
+  if (len != 0){
+    link->delta_count++;
+    link->deltas++;
+  }
+  else{
+    len = sv_frame_encode(data, buf, sizeof(buf));
+    sv_delta_ref_set(&link->keyframe, buf);
+    link->delta_count = 0;
+  }
+  air_add(air, len);
+  if (dropped){
+    return;
+  }
+
+  if (sv_frame_type(buf) == SV_FRAME_TYPE_DATA){
+    sv_delta_ref_set(&link->gateway_ref, buf);
+    return;
+  }
+  memset(&rebuilt, 0, sizeof(rebuilt));
+  int status = sv_delta_decode(buf, len, &link->gateway_ref, &rebuilt);
+  if (status == SV_FRAME_ERR_REF){
+    link->lost++;
+    return;
+  }
+  SV_CHECK_EQ(status, SV_FRAME_OK);
+  SV_CHECK_EQ(rebuilt.present, data->present);
+  SV_CHECK_EQ(rebuilt.seq, data->seq);
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    if (data->present & SV_FIELD_BIT(field)){
+      SV_CHECK_EQ(sv_field_to_raw((sv_field_t)field, sv_field_get(&rebuilt, (sv_field_t)field)),
+                  sv_field_to_raw((sv_field_t)field, sv_field_get(data, (sv_field_t)field)));
+    }
+  }
+  link->rebuilt++;
+}
+
+// Readings due at t on the SV_PERIOD_* schedule
+static void trace_reading(struct all_sensors_data *data, uint32_t t, uint32_t *state){
+  uint8_t field;
+
+  memset(data, 0, sizeof(*data));
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    if (t % period_s[field] == 0){
+      sv_field_set(data, (sv_field_t)field, trace_value((sv_field_t)field, t, state));
+    }
+  }
+}
+
+// The summary frame of a window, decoded, against the readings it was built from
+static void check_summary(const struct sensors_summary *summary, const window_t *window){
+  uint8_t field;
+  int i;
+
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    sv_field_t id = (sv_field_t)field;
+    double step = 1.0 / sv_field_desc[field].scale;
+    double sum = 0;
+    double squares = 0;
+    double x = 0;
+    double y = 0;
+    double min = INFINITY;
+    double max = -INFINITY;
+    int n = 0;
+
+    for (i = 0; i < window->count; i++){
+      if (window->present[i] & SV_FIELD_BIT(field)){
+        double value = window->value[i][field];
+        sum += value;
+        x += cos(2 * M_PI * value / SV_WINDSOCK_SECTORS);
+        y += sin(2 * M_PI * value / SV_WINDSOCK_SECTORS);
+        min = value < min ? value : min;
+        max = value > max ? value : max;
+        n++;
+      }
+    }
+    SV_CHECK_EQ(!!(summary->mean.present & SV_FIELD_BIT(field)), n > 0);
+    if (n == 0){
+      continue;
+    }
+    double mean = sum / n;
+    for (i = 0; i < window->count; i++){
+      if (window->present[i] & SV_FIELD_BIT(field)){
+        squares += (window->value[i][field] - mean) * (window->value[i][field] - mean);
+      }
+    }
+    double std_dev = n > 1 ? sqrt(squares / (n - 1)) : 0;
+    SV_CHECK_EQ(summary->samples[field], n);
+    SV_CHECK(fabs(summary->min[field] - min) <= step / 2);
+    SV_CHECK(fabs(summary->max[field] - max) <= step / 2);
+
+    // rain: the total of the window
+    if (sv_field_aggregate[field] == SV_AGGREGATE_SUM){
+      SV_CHECK(fabs(sv_field_get(&summary->mean, id) - sum) <= step / 2 + 1e-5 * sum);
+      SV_CHECK(fabs(summary->std_dev[field] - std_dev) <= step / 2 + 1e-3 * fabs(mean));
+    }
+    // wind direction: the nearest sector to the vector mean, circular standard deviation in sectors
+    else if (sv_field_aggregate[field] == SV_AGGREGATE_DIRECTION){
+      double r = sqrt(x * x + y * y) / n;
+      double direction = fmod(atan2(y, x) * SV_WINDSOCK_SECTORS / (2 * M_PI) + SV_WINDSOCK_SECTORS, SV_WINDSOCK_SECTORS);
+      double off = fabs(sv_field_get(&summary->mean, id) - direction);
+      off = off > SV_WINDSOCK_SECTORS / 2 ? SV_WINDSOCK_SECTORS - off : off;
+      SV_CHECK(r < 1e-3 || off <= 0.5 + 1e-3);
+      SV_CHECK(fabs(summary->std_dev[field] - sqrt(-2 * log(r < 1 ? r : 1)) * SV_WINDSOCK_SECTORS / (2 * M_PI)) <= step / 2 + 1e-3);
+    }
+    // half a step of the wire scale, and float rounding of the running sums
+    else{
+      SV_CHECK(fabs(sv_field_get(&summary->mean, id) - mean) <= step / 2 + 1e-5 * fabs(mean));
+      SV_CHECK(fabs(summary->std_dev[field] - std_dev) <= step / 2 + 1e-3 * fabs(mean));
+    }
+  }
+}
+
+/* ******************** TESTS ******************** */
+
+// The shipped defaults: SV_AGGREGATE_WINDOW_MS windows, only the triggered readings go out as data
+//  frames, so they are the only ones delta encoded. The window is checked on every loop() pass, it
+//  closes before the reading due at its end.
+static void test_aggregate_days(void){
+  static window_t window;
+  struct sensors_summary summary;
+  struct sensors_summary decoded;
+  struct all_sensors_data data;
+  sv_aggregate_t aggregate;
+  uint8_t buf[SV_FRAME_MAX_LEN];
+  link_t link;
+  air_t every;
+  air_t sent;
+  uint32_t state = 11;
+  uint32_t triggers = 0;
+  uint32_t summaries = 0;
+  uint32_t end = TRACE_DAYS * TRACE_DAY_S;
+  uint32_t t;
+
+  memset(&link, 0, sizeof(link));
+  memset(&every, 0, sizeof(every));
+  memset(&sent, 0, sizeof(sent));
+  memset(&window, 0, sizeof(window));
+  memset(&aggregate, 0, sizeof(aggregate));
+  sv_aggregate_reset(&aggregate);
+  for (t = 0; t <= end; t += TRACE_STEP_S){
+    if (sv_aggregate_window_over(&aggregate, t * 1000)){
+      memset(&summary, 0, sizeof(summary));
+      sv_aggregate_summary(&aggregate, &summary);
+      sv_aggregate_reset(&aggregate);
+      summary.mean.seq = link.seq++;
+      size_t len = sv_summary_encode(&summary, buf, sizeof(buf));
+      memset(&decoded, 0, sizeof(decoded));
+      SV_CHECK_EQ(sv_summary_decode(buf, len, &decoded), SV_FRAME_OK);
+      check_summary(&decoded, &window);
+      air_add(&sent, len);
+      window.count = 0;
+      summaries++;
+    }
+    if (t == end){
+      break;
+    }
+
+    trace_reading(&data, t, &state);
+    memcpy(window.value[window.count], data.value, sizeof(data.value));
+    window.present[window.count++] = data.present;
+    air_add(&every, sv_frame_len(data.present));
+    if (sv_aggregate_add(&aggregate, &data, t * 1000)){
+      link_send(&link, &sent, &data, 0);
+      triggers++;
+    }
+  }
+
+  // two gusts and a burst of rain a day, one summary per window
+  SV_CHECK_EQ(triggers, 3 * TRACE_DAYS);
+  SV_CHECK_EQ(summaries, end / (SV_AGGREGATE_WINDOW_MS / 1000));
+  SV_CHECK_EQ(every.frames, TRACE_READINGS);
+  SV_CHECK_EQ(sent.frames, summaries + triggers);
+  SV_CHECK_EQ(link.rebuilt, link.deltas);
+  printf("aggregate: %d days at SF%d, %lu data frames (%lu bytes, %.1f s on air) become %lu summaries and %lu"
+         " triggered data frames, %lu of them delta (%lu bytes, %.1f s on air)\n",
+         TRACE_DAYS, TRACE_SF, (unsigned long)every.frames, (unsigned long)every.bytes, every.airtime_us / 1e6,
+         (unsigned long)summaries, (unsigned long)triggers, (unsigned long)link.deltas, (unsigned long)sent.bytes,
+         sent.airtime_us / 1e6);
+}
+
+// Every reading in a data frame, as with SV_AGGREGATE_WINDOW_MS 0: keyframes and delta frames against
+//  full frames only, then the same readings with one keyframe lost
+static void test_delta_days(void){
+  struct all_sensors_data data;
+  link_t link;
+  air_t full;
+  air_t sent;
+  uint32_t state = 11;
+  uint32_t end = TRACE_DAYS * TRACE_DAY_S;
+  uint32_t keyframes = 0;
+  uint32_t keyframe_at = 0;
+  uint32_t t;
+
+  memset(&link, 0, sizeof(link));
+  memset(&full, 0, sizeof(full));
+  memset(&sent, 0, sizeof(sent));
+  for (t = 0; t < end; t += TRACE_STEP_S){
+    uint32_t deltas = link.deltas;
+    int keyframe = link.delta_count == 0 && link.seq != 0;
+    trace_reading(&data, t, &state);
+    air_add(&full, sv_frame_len(data.present));
+    link_send(&link, &sent, &data, 0);
+    // the first keyframe after a day with a delta frame against it, lost on the second run
+    if (keyframe_at == 0 && t > TRACE_DAY_S && keyframe && link.deltas != deltas){
+      keyframe_at = t - TRACE_STEP_S;
+    }
+  }
+  keyframes = sent.frames - link.deltas;
+  SV_CHECK_EQ(sent.frames, TRACE_READINGS);
+  SV_CHECK_EQ(link.rebuilt, link.deltas);
+  SV_CHECK(keyframes >= TRACE_READINGS / SV_DELTA_KEYFRAME_INTERVAL);
+  SV_CHECK(sent.bytes < full.bytes);
+  printf("delta: %d days of every reading, %lu keyframes and %lu delta frames, %.1f bytes a frame instead of %.1f,"
+         " %.1f s on air at SF%d instead of %.1f s, every value rebuilt exactly\n",
+         TRACE_DAYS, (unsigned long)keyframes, (unsigned long)link.deltas, (double)sent.bytes / sent.frames,
+         (double)full.bytes / full.frames, sent.airtime_us / 1e6, TRACE_SF, full.airtime_us / 1e6);
+
+  // that keyframe lost on the air: the gateway drops its delta frames until the next keyframe
+  SV_CHECK(keyframe_at != 0);
+  memset(&link, 0, sizeof(link));
+  memset(&sent, 0, sizeof(sent));
+  state = 11;
+  for (t = 0; t < end; t += TRACE_STEP_S){
+    trace_reading(&data, t, &state);
+    link_send(&link, &sent, &data, t == keyframe_at);
+  }
+  SV_CHECK(link.lost > 0 && link.lost < SV_DELTA_KEYFRAME_INTERVAL);
+  SV_CHECK_EQ(link.rebuilt + link.lost, link.deltas);
+  printf("delta: one keyframe lost, %lu delta frames after it dropped by the gateway\n", (unsigned long)link.lost);
+}
+
+// Welford over a long window stays with the two-pass reference, and the sample count saturates
+static void test_running_stats(void){
+  struct all_sensors_data data;
+  struct sensors_summary summary;
+  sv_aggregate_t aggregate;
+  double sum = 0;
+  double squares = 0;
+  uint32_t i;
+
+  memset(&aggregate, 0, sizeof(aggregate));
+  sv_aggregate_reset(&aggregate);
+  SV_CHECK(sv_aggregate_empty(&aggregate));
+  SV_CHECK(!sv_aggregate_window_over(&aggregate, SV_AGGREGATE_WINDOW_MS));
+  memset(&data, 0, sizeof(data));
+  for (i = 0; i < 1000; i++){
+    float value = 1013.0f + (float)(i % 7) * 0.1f;
+    sv_field_set(&data, SV_FIELD_AIR_PRES, value);
+    SV_CHECK(!sv_aggregate_add(&aggregate, &data, 5 + i));
+    sum += value;
+  }
+  for (i = 0; i < 1000; i++){
+    double delta = 1013.0 + (i % 7) * 0.1 - sum / 1000;
+    squares += delta * delta;
+  }
+  SV_CHECK(!sv_aggregate_window_over(&aggregate, 5 + SV_AGGREGATE_WINDOW_MS - 1));
+  SV_CHECK(sv_aggregate_window_over(&aggregate, 5 + SV_AGGREGATE_WINDOW_MS));
+
+  memset(&summary, 0, sizeof(summary));
+  sv_aggregate_summary(&aggregate, &summary);
+  SV_CHECK_EQ(summary.mean.present, SV_FIELD_BIT(SV_FIELD_AIR_PRES));
+  SV_CHECK_EQ(summary.samples[SV_FIELD_AIR_PRES], 255);
+  SV_CHECK(fabs(summary.mean.value[SV_FIELD_AIR_PRES] - sum / 1000) < 1e-3);
+  SV_CHECK(fabs(summary.std_dev[SV_FIELD_AIR_PRES] - sqrt(squares / 999)) < 1e-3);
+  SV_CHECK(fabsf(summary.min[SV_FIELD_AIR_PRES] - 1013.0f) < 1e-3f);
+  SV_CHECK(fabsf(summary.max[SV_FIELD_AIR_PRES] - 1013.6f) < 1e-3f);
+
+  // a reading above a trigger
+  sv_field_set(&data, SV_FIELD_WIND_SPEED, SV_TRIGGER_WIND_SPEED + 0.5f);
+  SV_CHECK(sv_aggregate_add(&aggregate, &data, 2000));
+}
+
+// Wind sectors on both sides of north average to north, not to the south of their arithmetic mean,
+//  and rain counts add up
+static void test_wind_and_rain(void){
+  static const uint8_t sectors[] = {0, 7, 0, 7, 1};
+  struct all_sensors_data data;
+  struct sensors_summary summary;
+  sv_aggregate_t aggregate;
+  uint32_t i;
+
+  sv_aggregate_reset(&aggregate);
+  memset(&data, 0, sizeof(data));
+  for (i = 0; i < sizeof(sectors); i++){
+    sv_field_set(&data, SV_FIELD_WIND_DIR, sectors[i]);
+    sv_field_set(&data, SV_FIELD_RAIN, 0.25f * (i + 1));
+    sv_aggregate_add(&aggregate, &data, i);
+  }
+  memset(&summary, 0, sizeof(summary));
+  sv_aggregate_summary(&aggregate, &summary);
+  SV_CHECK_EQ(sv_field_get(&summary.mean, SV_FIELD_WIND_DIR), 0);
+  SV_CHECK(summary.std_dev[SV_FIELD_WIND_DIR] > 0.5f && summary.std_dev[SV_FIELD_WIND_DIR] < 1.5f);
+  SV_CHECK(fabsf(sv_field_get(&summary.mean, SV_FIELD_RAIN) - 3.75f) < 1e-3f);
+
+  // the same sector all along: no spread
+  sv_aggregate_reset(&aggregate);
+  sv_field_set(&data, SV_FIELD_WIND_DIR, 5);
+  for (i = 0; i < 10; i++){
+    sv_aggregate_add(&aggregate, &data, i);
+  }
+  sv_aggregate_summary(&aggregate, &summary);
+  SV_CHECK_EQ(sv_field_get(&summary.mean, SV_FIELD_WIND_DIR), 5);
+  SV_CHECK(summary.std_dev[SV_FIELD_WIND_DIR] < 1e-2f);
+}
+
+int main(){
+  test_running_stats();
+  test_wind_and_rain();
+  test_aggregate_days();
+  test_delta_days();
+  return sv_test_end("test_aggregate");
+}
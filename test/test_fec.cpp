@@ -0,0 +1,269 @@
+// Parity frames over a lossy link on the host: a node sending data and delta frames with a parity
+//  frame after each group of SV_FEC_GROUP frames, the gateway of lora_receiver.ino rebuilding one lost
+//  frame per group, for the random and bursty channels of the table below. Prints the delivery with
+//  and without parity and what the parity costs in packets, bytes and airtime. Groups of 4 unless
+//  SV_FEC_GROUP is defined on the command line
+
+#ifndef SV_FEC_GROUP
+#define SV_FEC_GROUP 4
+#endif
+
+#include "sv_test.h"
+#include "SmartVit_fec.h"
+
+#include <math.h>
+
+/* ******************** DEFINES ******************** */
+
+#define FEC_FRAMES  20000     // readings sent on each channel
+#define FEC_SF      7
+
+/* ******************** TYPES AND STRUCTS ******************** */
+
+// Gilbert-Elliott channel: every packet sent in the bad state is lost, a burst lasts burst_len packets
+//  on average and loss_pct % of the packets are lost in the long run. burst_len 1 is random loss.
+typedef struct {
+  const char *name;
+  float loss_pct;
+  float burst_len;
+} channel_t;
+
+static const channel_t channels[] = {
+  {"random",  1,  1},
+  {"random",  5,  1},
+  {"random", 10,  1},
+  {"random", 20,  1},
+  {"bursty",  5,  3},
+  {"bursty", 10,  3},
+  {"bursty", 10,  8},
+};
+
+typedef struct {
+  uint32_t sent;            // readings
+  uint32_t received;        // data and delta frames that arrived
+  uint32_t delivered;       // readings the gateway journaled, rebuilt ones included
+  uint32_t rebuilt;         // frames rebuilt from a parity frame
+  uint32_t packets;
+  uint32_t bytes;
+  uint32_t airtime_us;
+} run_t;
+
+/* ******************** HELPERS ******************** */
+
+static uint32_t rng_state;
+
+static float rng_uniform(void){
+  rng_state = rng_state * 1664525u + 1013904223u;
+  return (rng_state >> 8) / 16777216.0f;
+}
+
+// True when the packet is lost, bad holds the state of the channel
+static int channel_lost(const channel_t *channel, int *bad){
+  float loss = channel->loss_pct / 100;
+
+  if (channel->burst_len <= 1){
+    return rng_uniform() < loss;
+  }
+  // leaves the bad state after burst_len packets on average, enters it so that loss of the time is bad
+  if (*bad){
+    *bad = rng_uniform() >= 1 / channel->burst_len;
+  }
+  else{
+    *bad = rng_uniform() < loss / ((1 - loss) * channel->burst_len);
+  }
+  return *bad;
+}
+
+// Readings of node 7 drifting a little at each one, every field present
+static void reading(struct all_sensors_data *data, uint16_t seq){
+  static float drift[SV_FIELD_COUNT];
+  uint8_t field;
+
+  memset(data, 0, sizeof(*data));
+  data->node = 7;
+  data->seq = seq;
+  data->tx_power = 14;
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    drift[field] = seq == 0 ? 0 : drift[field] + (rng_uniform() - 0.5f);
+  }
+  sv_field_set(data, SV_FIELD_WIND_SPEED, 3.2f + 0.1f * fabsf(drift[SV_FIELD_WIND_SPEED]));
+  sv_field_set(data, SV_FIELD_WIND_DIR, (float)(seq % 8));
+  sv_field_set(data, SV_FIELD_RAIN, 0.25f * (seq % 3));
+  sv_field_set(data, SV_FIELD_AIR_TEMP, 18 + 0.1f * drift[SV_FIELD_AIR_TEMP]);
+  sv_field_set(data, SV_FIELD_AIR_HUMID, 70 + 0.1f * drift[SV_FIELD_AIR_HUMID]);
+  sv_field_set(data, SV_FIELD_AIR_PRES, 1013.2f + 0.1f * drift[SV_FIELD_AIR_PRES]);
+  sv_field_set(data, SV_FIELD_SOIL_PH, 6.45f);
+  sv_field_set(data, SV_FIELD_SOIL_TEMP, 12 + 0.01f * drift[SV_FIELD_SOIL_TEMP]);
+  sv_field_set(data, SV_FIELD_MOIST_1, 0.31f);
+  sv_field_set(data, SV_FIELD_MOIST_2, 0.42f);
+  sv_field_set(data, SV_FIELD_MOIST_3, 0.5f);
+}
+
+// Same scaled integers on the wire
+static int same_raw(const struct all_sensors_data *a, const struct all_sensors_data *b){
+  uint8_t field;
+
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    if (sv_field_to_raw((sv_field_t)field, sv_field_get(a, (sv_field_t)field)) != sv_field_to_raw((sv_field_t)field, sv_field_get(b, (sv_field_t)field))){
+      return 0;
+    }
+  }
+  return a->present == b->present;
+}
+
+static void air_add(run_t *run, size_t len){
+  run->packets++;
+  run->bytes += len;
+  run->airtime_us += sv_lora_airtime_us(len, FEC_SF, SV_LORA_BANDWIDTH, SV_LORA_CODING_RATE);
+}
+
+/* ******************** GATEWAY ******************** */
+
+// process_frame() and process_parity() of lora_receiver.ino for one node, the node table only adds
+//  the duplicate check and the channel has no duplicates
+typedef struct {
+  sv_fec_group_t fec;
+  sv_delta_ref_t ref;
+} gateway_t;
+
+static struct all_sensors_data readings[FEC_FRAMES];
+static uint8_t sent_frames[FEC_FRAMES][SV_FRAME_MAX_LEN];
+
+static void gateway_frame(gateway_t *gateway, run_t *run, const uint8_t *buf, size_t len){
+  struct all_sensors_data data;
+  int status;
+
+  memset(&data, 0, sizeof(data));
+  if (sv_frame_type(buf) == SV_FRAME_TYPE_DELTA){
+    status = sv_delta_decode(buf, len, NULL, &data);
+  }
+  else{
+    status = sv_frame_decode(buf, len, &data);
+  }
+  if (status != SV_FRAME_OK){
+    return;
+  }
+  sv_fec_add(&gateway->fec, buf, len, data.seq);
+  if (sv_frame_type(buf) == SV_FRAME_TYPE_DATA){
+    sv_delta_ref_set(&gateway->ref, buf);
+  }
+  else if (sv_delta_decode(buf, len, &gateway->ref, &data) != SV_FRAME_OK){
+    return;     // its keyframe was lost
+  }
+  SV_CHECK(data.seq < FEC_FRAMES && same_raw(&data, &readings[data.seq]));
+  run->delivered++;
+}
+
+static void gateway_parity(gateway_t *gateway, run_t *run, const uint8_t *buf, size_t len){
+  uint8_t frame[SV_FRAME_MAX_LEN];
+  size_t frame_len;
+
+  SV_CHECK_EQ(sv_fec_parity_check(buf, len), SV_FRAME_OK);
+  frame_len = sv_fec_recover(&gateway->fec, buf, len, frame);
+  if (frame_len != 0){
+    uint16_t seq = (uint16_t)sv_get_le(&frame[SV_FRAME_SEQ_POS], 2, 0);
+    SV_CHECK(seq < FEC_FRAMES && memcmp(frame, sent_frames[seq], frame_len) == 0);
+    run->rebuilt++;
+    gateway_frame(gateway, run, frame, frame_len);
+  }
+}
+
+/* ******************** TESTS ******************** */
+
+// LoRaSendPacket() of lora_sender.ino over the channel: keyframes and delta frames when deltas is set,
+//  a parity frame after the last frame of each group when parity is set
+static run_t run_channel(const channel_t *channel, int deltas, int parity){
+  static struct all_sensors_data data;
+  uint8_t buf[SV_PACKET_MAX_LEN];
+  sv_fec_group_t fec;
+  sv_delta_ref_t keyframe;
+  gateway_t gateway;
+  uint8_t delta_count = 0;
+  uint16_t seq;
+  int bad = 0;
+  size_t len;
+  run_t run;
+
+  memset(&run, 0, sizeof(run));
+  memset(&gateway, 0, sizeof(gateway));
+  memset(&keyframe, 0, sizeof(keyframe));
+  sv_fec_reset(&fec, 0);
+  rng_state = 11;
+  for (seq = 0; seq < FEC_FRAMES; seq++){
+    reading(&data, seq);
+    readings[seq] = data;
+    len = 0;
+    if (deltas && delta_count + 1 < SV_DELTA_KEYFRAME_INTERVAL){
+      len = sv_delta_encode(&data, &keyframe, buf, sizeof(buf));
+    }
+    if (len != 0){
+      delta_count++;
+    }
+    else{
+      len = sv_frame_encode(&data, buf, sizeof(buf));
+      sv_delta_ref_set(&keyframe, buf);
+      delta_count = 0;
+    }
+    memcpy(sent_frames[seq], buf, len);
+    run.sent++;
+    air_add(&run, len);
+    if (!channel_lost(channel, &bad)){
+      run.received++;
+      gateway_frame(&gateway, &run, buf, len);
+    }
+
+    if (parity && sv_fec_add(&fec, buf, len, seq)){
+      len = sv_fec_parity_encode(&fec, 7, buf, sizeof(buf));
+      air_add(&run, len);
+      if (!channel_lost(channel, &bad)){
+        gateway_parity(&gateway, &run, buf, len);
+      }
+    }
+  }
+  return run;
+}
+
+static void test_fec_channels(void){
+  unsigned i;
+
+  for (i = 0; i < sizeof(channels) / sizeof(channels[0]); i++){
+    const channel_t *channel = &channels[i];
+    run_t plain = run_channel(channel, 0, 0);
+    run_t fec = run_channel(channel, 0, 1);
+    run_t plain_delta = run_channel(channel, 1, 0);
+    run_t fec_delta = run_channel(channel, 1, 1);
+    float loss = channel->loss_pct / 100;
+    float lost_frames;
+
+    SV_CHECK_EQ(plain.rebuilt, 0);
+    SV_CHECK_EQ(fec.packets, FEC_FRAMES + FEC_FRAMES / SV_FEC_GROUP);
+    SV_CHECK(fec.delivered >= plain.delivered);
+    SV_CHECK(fec_delta.delivered >= plain_delta.delivered);
+    SV_CHECK_EQ(fec.delivered, fec.received + fec.rebuilt);
+    // random loss: a lost frame comes back when the other frames of its group and the parity arrive
+    if (channel->burst_len <= 1){
+      float expected = 1 - loss + loss * powf(1 - loss, SV_FEC_GROUP);
+      SV_CHECK(fabsf((float)fec.delivered / FEC_FRAMES - expected) < 0.01f);
+    }
+    lost_frames = (float)(FEC_FRAMES - fec.received);
+    printf("fec: %s %.0f%% loss (bursts of %.0f), groups of %d: %.1f%% -> %.1f%% delivered, %.1f%% -> %.1f%% with"
+           " delta frames, %.0f%% of the lost frames rebuilt\n",
+           channel->name, channel->loss_pct, channel->burst_len, SV_FEC_GROUP,
+           100.0 * plain.delivered / FEC_FRAMES, 100.0 * fec.delivered / FEC_FRAMES,
+           100.0 * plain_delta.delivered / FEC_FRAMES, 100.0 * fec_delta.delivered / FEC_FRAMES,
+           lost_frames ? 100 * fec.rebuilt / lost_frames : 0);
+    if (i == 0){
+      printf("fec: parity costs %.0f%% more packets, %.0f%% more bytes and %.0f%% more airtime at SF%d"
+             " (%.0f%%, %.0f%% and %.0f%% with delta frames)\n",
+             100.0 * fec.packets / plain.packets - 100, 100.0 * fec.bytes / plain.bytes - 100,
+             100.0 * fec.airtime_us / plain.airtime_us - 100, FEC_SF,
+             100.0 * fec_delta.packets / plain_delta.packets - 100, 100.0 * fec_delta.bytes / plain_delta.bytes - 100,
+             100.0 * fec_delta.airtime_us / plain_delta.airtime_us - 100);
+    }
+  }
+}
+
+int main(){
+  test_fec_channels();
+  return sv_test_end("test_fec");
+}
@@ -0,0 +1,625 @@
+// LoRa frames on the host: data, summary, delta, parity, diagnostics and beacon round trips,
+//  corruption (every single bit flip, truncation, wrong version, stale keyframe, frame added twice to
+//  a parity group), the size and airtime of a full frame, and the receive path of the gateway
+//  (packet copied to a buffer, decoded, serialized to json)
+
+#define SV_FEC_GROUP 4
+
+#include "sv_test.h"
+#include "SmartVit_fec.h"
+#include "SmartVit_json.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+/* ******************** DEFINES ******************** */
+
+#define BENCH_PACKETS  64       // packets of the receive benchmark, replayed BENCH_ROUNDS times
+#define BENCH_ROUNDS   4000
+#define BATCH_MAX      10       // UPLOAD_BATCH_MAX of lora_receiver.ino
+#define BATCH_BYTES    (4 * SV_JSON_SUMMARY_MAX_LEN)    // UPLOAD_BATCH_BYTES of lora_receiver.ino
+
+/* ******************** HELPERS ******************** */
+
+// Readings of node 7 that move a little at every step, every field present
+static void sample(struct all_sensors_data *data, uint16_t seq){
+  memset(data, 0, sizeof(*data));
+  data->node = 7;
+  data->seq = seq;
+  data->tx_power = 14;
+  sv_field_set(data, SV_FIELD_WIND_SPEED, 3.2f + 0.1f * seq);
+  sv_field_set(data, SV_FIELD_WIND_DIR, (float)(seq % 8));
+  sv_field_set(data, SV_FIELD_RAIN, 0.25f * (seq % 3));
+  sv_field_set(data, SV_FIELD_AIR_TEMP, (float)(seq - 3));
+  sv_field_set(data, SV_FIELD_AIR_HUMID, 81.0f);
+  sv_field_set(data, SV_FIELD_AIR_PRES, 1013.2f);
+  sv_field_set(data, SV_FIELD_SOIL_PH, 6.45f);
+  sv_field_set(data, SV_FIELD_SOIL_TEMP, -0.75f);
+  sv_field_set(data, SV_FIELD_MOIST_1, 0.31f);
+  sv_field_set(data, SV_FIELD_MOIST_2, 0.42f + 0.01f * seq);
+  sv_field_set(data, SV_FIELD_MOIST_3, 0.5f);
+}
+
+// Same scaled integers on the wire
+static int same_fields(const struct all_sensors_data *a, const struct all_sensors_data *b){
+  uint8_t field;
+
+  if (a->present != b->present || a->node != b->node || a->seq != b->seq || a->tx_power != b->tx_power){
+    return 0;
+  }
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    if ((a->present & SV_FIELD_BIT(field)) &&
+        sv_field_to_raw((sv_field_t)field, sv_field_get(a, (sv_field_t)field)) != sv_field_to_raw((sv_field_t)field, sv_field_get(b, (sv_field_t)field))){
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Number of single bit flips of buf the decoder lets through
+typedef int (*decoder_t)(const uint8_t *buf, size_t len);
+
+static int accepted_flips(const uint8_t *frame, size_t len, decoder_t decode){
+  uint8_t buf[SV_PACKET_MAX_LEN];
+  int accepted = 0;
+  size_t i;
+  int bit;
+
+  for (i = 0; i < len; i++){
+    for (bit = 0; bit < 8; bit++){
+      memcpy(buf, frame, len);
+      buf[i] ^= (uint8_t)(1 << bit);
+      if (decode(buf, len) == SV_FRAME_OK){
+        accepted++;
+      }
+    }
+  }
+  return accepted;
+}
+
+static int decode_data(const uint8_t *buf, size_t len){
+  struct all_sensors_data data;
+  memset(&data, 0, sizeof(data));
+  return sv_frame_decode(buf, len, &data);
+}
+
+static int decode_summary(const uint8_t *buf, size_t len){
+  struct sensors_summary summary;
+  memset(&summary, 0, sizeof(summary));
+  return sv_summary_decode(buf, len, &summary);
+}
+
+static int decode_delta(const uint8_t *buf, size_t len){
+  struct all_sensors_data data;
+  memset(&data, 0, sizeof(data));
+  return sv_delta_decode(buf, len, NULL, &data);
+}
+
+static int decode_diag(const uint8_t *buf, size_t len){
+  sv_diag_counters_t diag;
+  uint8_t node;
+  return sv_diag_decode(buf, len, &node, &diag);
+}
+
+static int decode_beacon(const uint8_t *buf, size_t len){
+  sv_beacon_t beacon;
+  return sv_beacon_decode(buf, len, &beacon);
+}
+
+// Heap allocations, counted while a test watches them (glibc only)
+static unsigned long heap_allocs = 0;
+static int heap_watch = 0;
+
+#ifdef __GLIBC__
+extern "C" void *__libc_malloc(size_t size);
+
+extern "C" void *malloc(size_t size){
+  if (heap_watch){
+    heap_allocs++;
+  }
+  return __libc_malloc(size);
+}
+#endif
+
+// Gateway side of one packet, as loop() does it: bytes copied from the radio, then decoded
+static uint8_t frame_buffer[SV_FRAME_MAX_LEN];
+static struct all_sensors_data total_data;
+static char json_buffer[SV_JSON_MAX_LEN];
+
+static int receive(const uint8_t *packet, size_t packet_len){
+  size_t frame_len = 0;
+  size_t i;
+
+  for (i = 0; i < packet_len; i++){
+    if (frame_len < sizeof(frame_buffer)){
+      frame_buffer[frame_len] = packet[i];
+    }
+    frame_len++;
+  }
+  if (frame_len > sizeof(frame_buffer)){
+    return SV_FRAME_ERR_LENGTH;
+  }
+  return sv_frame_decode(frame_buffer, frame_len, &total_data);
+}
+
+// Nanoseconds per call of the benchmark loops
+static double ns_per(clock_t start, clock_t end, unsigned long calls){
+  return 1e9 * (double)(end - start) / CLOCKS_PER_SEC / calls;
+}
+
+/* ******************** TESTS ******************** */
+
+static void test_data_frame(void){
+  struct all_sensors_data data;
+  struct all_sensors_data decoded;
+  uint8_t buf[SV_FRAME_MAX_LEN];
+  size_t len;
+
+  sample(&data, 3);
+  len = sv_frame_encode(&data, buf, sizeof(buf));
+  SV_CHECK_EQ(len, sv_frame_len(data.present));
+  SV_CHECK_EQ(len, SV_FRAME_HEADER_LEN + 21 + SV_FRAME_CRC_LEN);
+  SV_CHECK_EQ(sv_frame_encode(&data, buf, len - 1), 0);
+
+  memset(&decoded, 0, sizeof(decoded));
+  SV_CHECK_EQ(sv_frame_decode(buf, len, &decoded), SV_FRAME_OK);
+  SV_CHECK(same_fields(&data, &decoded));
+
+  // a subset of the fields
+  memset(&data, 0, sizeof(data));
+  sv_field_set(&data, SV_FIELD_RAIN, 12.5f);
+  len = sv_frame_encode(&data, buf, sizeof(buf));
+  SV_CHECK_EQ(len, SV_FRAME_HEADER_LEN + 2 + SV_FRAME_CRC_LEN);
+  memset(&decoded, 0, sizeof(decoded));
+  SV_CHECK_EQ(sv_frame_decode(buf, len, &decoded), SV_FRAME_OK);
+  SV_CHECK_EQ(decoded.present, SV_FIELD_BIT(SV_FIELD_RAIN));
+  SV_CHECK_EQ(sv_field_to_raw(SV_FIELD_RAIN, sv_field_get(&decoded, SV_FIELD_RAIN)), 1250);
+
+  // out of range readings saturate to the wire width instead of wrapping
+  SV_CHECK_EQ(sv_field_to_raw(SV_FIELD_AIR_TEMP, 400.0f), 32767);
+  SV_CHECK_EQ(sv_field_to_raw(SV_FIELD_AIR_TEMP, -400.0f), -32768);
+  SV_CHECK_EQ(sv_field_to_raw(SV_FIELD_RAIN, -1.0f), 0);
+  SV_CHECK_EQ(sv_field_to_raw(SV_FIELD_WIND_DIR, 300.0f), 255);
+}
+
+static void test_data_corruption(void){
+  struct all_sensors_data data;
+  struct all_sensors_data decoded;
+  uint8_t buf[SV_FRAME_MAX_LEN];
+  size_t len;
+  size_t cut;
+
+  sample(&data, 5);
+  len = sv_frame_encode(&data, buf, sizeof(buf));
+  SV_CHECK_EQ(accepted_flips(buf, len, decode_data), 0);
+  for (cut = 0; cut < len; cut++){
+    SV_CHECK(decode_data(buf, cut) != SV_FRAME_OK);
+  }
+
+  buf[0] = (uint8_t)(((SV_FRAME_VERSION + 1) << 4) | SV_FRAME_TYPE_DATA);
+  SV_CHECK_EQ(sv_frame_decode(buf, len, &decoded), SV_FRAME_ERR_VERSION);
+  buf[0] = (SV_FRAME_VERSION << 4) | SV_FRAME_TYPE_BEACON;
+  SV_CHECK_EQ(sv_frame_decode(buf, len, &decoded), SV_FRAME_ERR_TYPE);
+}
+
+static void test_summary_frame(void){
+  struct sensors_summary summary;
+  struct sensors_summary decoded;
+  uint8_t buf[SV_FRAME_MAX_LEN];
+  uint8_t field;
+  size_t len;
+
+  memset(&summary, 0, sizeof(summary));
+  sample(&summary.mean, 9);
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    summary.min[field] = sv_field_get(&summary.mean, (sv_field_t)field) - 0.5f;
+    summary.max[field] = sv_field_get(&summary.mean, (sv_field_t)field) + 0.5f;
+    summary.std_dev[field] = 0.25f;
+    summary.samples[field] = (uint8_t)(3 + field);
+  }
+  summary.min[SV_FIELD_RAIN] = 0;
+  summary.min[SV_FIELD_WIND_DIR] = 0;
+
+  // a summary of every field is the longest frame
+  len = sv_summary_encode(&summary, buf, sizeof(buf));
+  SV_CHECK_EQ(len, sv_summary_len(SV_ENABLED_FIELDS));
+  SV_CHECK(len <= SV_FRAME_MAX_LEN);
+  SV_CHECK_EQ(sv_summary_encode(&summary, buf, len - 1), 0);
+  SV_CHECK_EQ(sv_frame_type(buf), SV_FRAME_TYPE_SUMMARY);
+
+  memset(&decoded, 0, sizeof(decoded));
+  SV_CHECK_EQ(sv_summary_decode(buf, len, &decoded), SV_FRAME_OK);
+  SV_CHECK(same_fields(&summary.mean, &decoded.mean));
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    sv_field_t id = (sv_field_t)field;
+    SV_CHECK_EQ(decoded.samples[field], summary.samples[field]);
+    SV_CHECK_EQ(sv_field_to_raw(id, decoded.min[field]), sv_field_to_raw(id, summary.min[field]));
+    SV_CHECK_EQ(sv_field_to_raw(id, decoded.max[field]), sv_field_to_raw(id, summary.max[field]));
+    SV_CHECK_EQ(sv_field_to_raw(id, decoded.std_dev[field]), sv_field_to_raw(id, summary.std_dev[field]));
+  }
+
+  // each decoder only takes its own type
+  SV_CHECK_EQ(accepted_flips(buf, len, decode_summary), 0);
+  SV_CHECK(decode_data(buf, len) != SV_FRAME_OK);
+  sv_frame_encode(&summary.mean, buf, sizeof(buf));
+  SV_CHECK_EQ(decode_summary(buf, sv_frame_len(summary.mean.present)), SV_FRAME_ERR_TYPE);
+}
+
+static void test_delta_frame(void){
+  struct all_sensors_data keyframe;
+  struct all_sensors_data data;
+  struct all_sensors_data decoded;
+  uint8_t key_buf[SV_FRAME_MAX_LEN];
+  uint8_t buf[SV_FRAME_MAX_LEN];
+  sv_delta_ref_t ref;
+  sv_delta_ref_t stale;
+  size_t key_len;
+  size_t len;
+  uint16_t seq;
+
+  sample(&keyframe, 16);
+  key_len = sv_frame_encode(&keyframe, key_buf, sizeof(key_buf));
+  sv_delta_ref_set(&ref, key_buf);
+  SV_CHECK_EQ(ref.seq, 16);
+  SV_CHECK_EQ(ref.present, keyframe.present);
+
+  // the following readings against the keyframe, each one shorter than a data frame
+  for (seq = 17; seq < 24; seq++){
+    sample(&data, seq);
+    len = sv_delta_encode(&data, &ref, buf, sizeof(buf));
+    SV_CHECK(len > 0 && len < key_len);
+    memset(&decoded, 0, sizeof(decoded));
+    SV_CHECK_EQ(sv_delta_decode(buf, len, &ref, &decoded), SV_FRAME_OK);
+    SV_CHECK(same_fields(&data, &decoded));
+    SV_CHECK_EQ(accepted_flips(buf, len, decode_delta), 0);
+  }
+
+  // replayed after the next keyframe: the gateway holds another reference and must not apply it
+  sample(&data, 20);
+  len = sv_delta_encode(&data, &ref, buf, sizeof(buf));
+  sample(&keyframe, 24);
+  sv_frame_encode(&keyframe, key_buf, sizeof(key_buf));
+  sv_delta_ref_set(&stale, key_buf);
+  SV_CHECK_EQ(sv_delta_decode(buf, len, &stale, &decoded), SV_FRAME_ERR_REF);
+  SV_CHECK_EQ(sv_delta_decode(buf, len, NULL, &decoded), SV_FRAME_OK);
+  SV_CHECK_EQ(decoded.seq, 20);
+
+  // a field the keyframe does not have needs a data frame
+  ref.present &= (uint16_t)~SV_FIELD_BIT(SV_FIELD_RAIN);
+  SV_CHECK_EQ(sv_delta_encode(&data, &ref, buf, sizeof(buf)), 0);
+  ref.present = 0;
+  SV_CHECK_EQ(sv_delta_encode(&data, &ref, buf, sizeof(buf)), 0);
+
+  // zigzag varints at the limits of the widths
+  uint8_t varint[SV_VARINT_MAX_LEN];
+  uint32_t value;
+  int32_t deltas[] = {0, 1, -1, 63, -64, 64, 65535, -65536, 2147483647, (-2147483647 - 1)};
+  unsigned i;
+  for (i = 0; i < sizeof(deltas) / sizeof(deltas[0]); i++){
+    size_t n = sv_varint_put(varint, sv_zigzag_encode(deltas[i]));
+    SV_CHECK_EQ(sv_varint_get(varint, n, &value), n);
+    SV_CHECK_EQ(sv_zigzag_decode(value), deltas[i]);
+    SV_CHECK_EQ(sv_varint_get(varint, n - 1, &value), 0);
+  }
+}
+
+static void test_fec(void){
+  uint8_t frames[SV_FEC_GROUP][SV_FRAME_MAX_LEN];
+  size_t lens[SV_FEC_GROUP];
+  uint8_t parity[SV_PACKET_MAX_LEN];
+  uint8_t rebuilt[SV_FRAME_MAX_LEN];
+  struct all_sensors_data data;
+  sv_fec_group_t sender;
+  sv_fec_group_t gateway;
+  sv_delta_ref_t ref;
+  size_t parity_len;
+  uint16_t first = 32;
+  uint16_t lost;
+  uint16_t i;
+
+  // a keyframe and delta frames, of different lengths
+  sv_fec_reset(&sender, 0);
+  for (i = 0; i < SV_FEC_GROUP; i++){
+    sample(&data, (uint16_t)(first + i));
+    if (i == 0){
+      lens[i] = sv_frame_encode(&data, frames[i], SV_FRAME_MAX_LEN);
+      sv_delta_ref_set(&ref, frames[i]);
+    }
+    else{
+      lens[i] = sv_delta_encode(&data, &ref, frames[i], SV_FRAME_MAX_LEN);
+    }
+    SV_CHECK_EQ(sv_fec_add(&sender, frames[i], lens[i], (uint16_t)(first + i)), i == SV_FEC_GROUP - 1);
+  }
+  SV_CHECK(lens[0] != lens[1]);
+  parity_len = sv_fec_parity_encode(&sender, 7, parity, sizeof(parity));
+  SV_CHECK_EQ(parity_len, SV_PARITY_HEADER_LEN + lens[0] + SV_FRAME_CRC_LEN);
+  SV_CHECK_EQ(sv_fec_parity_check(parity, parity_len), SV_FRAME_OK);
+  SV_CHECK_EQ(accepted_flips(parity, parity_len, sv_fec_parity_check), 0);
+
+  // every frame of the group can be the lost one
+  for (lost = 0; lost < SV_FEC_GROUP; lost++){
+    sv_fec_reset(&gateway, 0);
+    for (i = 0; i < SV_FEC_GROUP; i++){
+      if (i != lost){
+        sv_fec_add(&gateway, frames[i], lens[i], (uint16_t)(first + i));
+      }
+    }
+    // a replayed frame must not cancel itself out of the accumulator
+    sv_fec_add(&gateway, frames[(lost + 1) % SV_FEC_GROUP], lens[(lost + 1) % SV_FEC_GROUP], (uint16_t)(first + (lost + 1) % SV_FEC_GROUP));
+    SV_CHECK_EQ(sv_fec_recover(&gateway, parity, parity_len, rebuilt), lens[lost]);
+    SV_CHECK(memcmp(rebuilt, frames[lost], lens[lost]) == 0);
+  }
+
+  // two frames lost: nothing to rebuild
+  sv_fec_reset(&gateway, 0);
+  sv_fec_add(&gateway, frames[0], lens[0], first);
+  sv_fec_add(&gateway, frames[3], lens[3], (uint16_t)(first + 3));
+  SV_CHECK_EQ(sv_fec_recover(&gateway, parity, parity_len, rebuilt), 0);
+
+  // nothing lost, or the parity of another group
+  sv_fec_reset(&gateway, 0);
+  for (i = 0; i < SV_FEC_GROUP; i++){
+    sv_fec_add(&gateway, frames[i], lens[i], (uint16_t)(first + i));
+  }
+  SV_CHECK_EQ(sv_fec_recover(&gateway, parity, parity_len, rebuilt), 0);
+  sv_fec_reset(&gateway, 0);
+  sv_fec_add(&gateway, frames[0], lens[0], (uint16_t)(first + SV_FEC_GROUP));
+  SV_CHECK_EQ(sv_fec_recover(&gateway, parity, parity_len, rebuilt), 0);
+}
+
+static void test_diag_frame(void){
+  sv_diag_counters_t diag;
+  sv_diag_counters_t decoded;
+  uint8_t buf[SV_PACKET_MAX_LEN];
+  uint8_t node = 0;
+  uint8_t i;
+  size_t len;
+
+  for (i = 0; i < SV_DIAG_COUNT; i++){
+    diag.counter[i] = 100000u * i + 7;
+  }
+  len = sv_diag_encode(&diag, 9, buf, sizeof(buf));
+  SV_CHECK_EQ(len, SV_DIAG_HEADER_LEN + 4 * SV_DIAG_COUNT + SV_FRAME_CRC_LEN);
+  SV_CHECK_EQ(sv_diag_decode(buf, len, &node, &decoded), SV_FRAME_OK);
+  SV_CHECK_EQ(node, 9);
+  SV_CHECK(memcmp(&diag, &decoded, sizeof(diag)) == 0);
+  SV_CHECK_EQ(accepted_flips(buf, len, decode_diag), 0);
+
+  // a counter count above the table, with a matching length and CRC
+  buf[SV_DIAG_COUNT_POS] = SV_DIAG_COUNT + 1;
+  len = SV_DIAG_HEADER_LEN + 4 * (SV_DIAG_COUNT + 1);
+  sv_put_le(&buf[len], sv_crc16(buf, len), SV_FRAME_CRC_LEN);
+  SV_CHECK_EQ(sv_diag_decode(buf, len + SV_FRAME_CRC_LEN, &node, &decoded), SV_FRAME_ERR_LENGTH);
+}
+
+static void test_beacon(void){
+  sv_beacon_t beacon;
+  sv_beacon_t decoded;
+  uint8_t buf[SV_BEACON_MAX_LEN];
+  int8_t power = 0;
+  size_t len;
+
+  memset(&beacon, 0, sizeof(beacon));
+  beacon.slots = SV_TDMA_SLOTS;
+  beacon.sf = 9;
+  beacon.superframe = 200;
+  beacon.slot_ms = sv_tdma_slot_ms(beacon.sf);
+  beacon.hint_count = 2;
+  beacon.hint[0].node = 3;
+  beacon.hint[0].tx_power = 5;
+  beacon.hint[1].node = 40;
+  beacon.hint[1].tx_power = 11;
+  beacon.slot_count = 1;
+  beacon.slot[0].node = 33;
+  beacon.slot[0].slot = 7;
+
+  len = sv_beacon_encode(&beacon, buf);
+  SV_CHECK_EQ(len, SV_BEACON_HEADER_LEN + 2 * SV_BEACON_HINT_LEN + SV_BEACON_SLOT_LEN + SV_FRAME_CRC_LEN);
+  memset(&decoded, 0, sizeof(decoded));
+  SV_CHECK_EQ(sv_beacon_decode(buf, len, &decoded), SV_FRAME_OK);
+  SV_CHECK_EQ(decoded.slots, SV_TDMA_SLOTS);
+  SV_CHECK_EQ(decoded.slot_ms, beacon.slot_ms);
+  SV_CHECK_EQ(decoded.sf, 9);
+  SV_CHECK_EQ(decoded.superframe, 200);
+  SV_CHECK(sv_beacon_hint(&decoded, 40, &power));
+  SV_CHECK_EQ(power, 11);
+  SV_CHECK(!sv_beacon_hint(&decoded, 4, &power));
+  SV_CHECK_EQ(accepted_flips(buf, len, decode_beacon), 0);
+  SV_CHECK_EQ(sv_beacon_decode(buf, len - 1, &decoded), SV_FRAME_ERR_LENGTH);
+
+  // node n sends in slot 1 + n % slots, after the beacon slot, unless the beacon assigns it one
+  SV_CHECK_EQ(sv_beacon_slot(&decoded, 33), 7);
+  SV_CHECK_EQ(sv_beacon_slot(&decoded, 1), 2);
+  SV_CHECK_EQ(sv_tdma_slot_offset_ms(&decoded, 0), decoded.slot_ms);
+  SV_CHECK_EQ(sv_tdma_slot_offset_ms(&decoded, 33), 7u * decoded.slot_ms);
+
+  // a slot of a full frame holds its airtime at every spreading factor
+  uint8_t sf;
+  for (sf = SV_ADR_SF_MIN; sf <= SV_ADR_SF_MAX; sf++){
+    SV_CHECK(sv_tdma_slot_ms(sf) * 1000u > sv_lora_airtime_us(SV_FRAME_MAX_LEN, sf, SV_LORA_BANDWIDTH, SV_LORA_CODING_RATE));
+  }
+}
+
+static void test_airtime(void){
+  struct all_sensors_data data;
+  uint8_t buf[SV_FRAME_MAX_LEN];
+  size_t len;
+
+  sample(&data, 1);
+  len = sv_frame_encode(&data, buf, sizeof(buf));
+  uint32_t frame_us = sv_lora_airtime_us(len, 7, SV_LORA_BANDWIDTH, SV_LORA_CODING_RATE);
+  printf("full frame: %u bytes, %.1f ms at SF7 / 125 kHz\n", (unsigned)len, frame_us / 1000.0);
+  SV_CHECK(len <= SV_FRAME_MAX_LEN);
+
+  // 10 bytes at SF7 / 125 kHz: 41.2 ms (Semtech calculator)
+  SV_CHECK(abs((int)sv_lora_airtime_us(10, 7, SV_LORA_BANDWIDTH, SV_LORA_CODING_RATE) - 41216) < 100);
+}
+
+static void test_json(void){
+  struct all_sensors_data data;
+  char buf[SV_JSON_MAX_LEN];
+
+  // scaled integers printed without float formatting
+  sv_json_put_fixed(buf, sizeof(buf), -205, 100);
+  SV_CHECK_STR(buf, "-2.05");
+  sv_json_put_fixed(buf, sizeof(buf), 10132, 10);
+  SV_CHECK_STR(buf, "1013.2");
+  sv_json_put_fixed(buf, sizeof(buf), 7, 1);
+  SV_CHECK_STR(buf, "7");
+
+  memset(&data, 0, sizeof(data));
+  data.node = 3;
+  data.seq = 41;
+  sv_field_set(&data, SV_FIELD_AIR_TEMP, -3.0f);
+  sv_field_set(&data, SV_FIELD_AIR_PRES, 1009.9f);
+  size_t len = sv_json_write(&data, buf, sizeof(buf));
+  SV_CHECK_EQ(len, strlen(buf));
+  SV_CHECK_STR(buf, "{\"node\":3,\"seq\":41,\"temp_celsius\":-3.00,\"pressure_hPa\":1009.9}");
+  SV_CHECK_EQ(sv_json_write(&data, buf, 20), 0);
+
+  // every field fits the fixed buffer
+  sample(&data, 4);
+  SV_CHECK(sv_json_write(&data, buf, sizeof(buf)) > 0);
+
+  // a summary, each field as [mean,min,max,std_dev,samples]
+  struct sensors_summary summary;
+  char summary_buf[SV_JSON_SUMMARY_MAX_LEN];
+  uint8_t field;
+  memset(&summary, 0, sizeof(summary));
+  summary.mean.node = 2;
+  summary.mean.seq = 42;
+  sv_field_set(&summary.mean, SV_FIELD_RAIN, 0.5f);
+  summary.min[SV_FIELD_RAIN] = 0.25f;
+  summary.max[SV_FIELD_RAIN] = 1.0f;
+  summary.std_dev[SV_FIELD_RAIN] = 0.35f;
+  summary.samples[SV_FIELD_RAIN] = 3;
+  len = sv_json_write_summary(&summary, summary_buf, sizeof(summary_buf));
+  SV_CHECK_EQ(len, strlen(summary_buf));
+  SV_CHECK_STR(summary_buf, "{\"node\":2,\"seq\":42,\"summary\":1,\"qtd_chuva\":[0.50,0.25,1.00,0.35,3]}");
+
+  // every field at the widest values fits SV_JSON_SUMMARY_MAX_LEN
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    sv_field_set(&summary.mean, (sv_field_t)field, -1e6f);
+    summary.min[field] = -1e6f;
+    summary.max[field] = -1e6f;
+    summary.std_dev[field] = -1e6f;
+    summary.samples[field] = 255;
+  }
+  SV_CHECK(sv_json_write_summary(&summary, summary_buf, sizeof(summary_buf)) > 0);
+}
+
+static void test_json_batch(void){
+  static char body[BATCH_BYTES];     // batch_buffer of lora_receiver.ino
+  struct all_sensors_data data;
+  sv_json_batch_t batch;
+  char small[112];
+  size_t single = 0;
+  size_t len;
+  int i;
+
+  memset(&data, 0, sizeof(data));
+  data.node = 3;
+  data.seq = 41;
+  sv_field_set(&data, SV_FIELD_AIR_TEMP, -3.5f);
+  sv_json_batch_init(&batch, small, sizeof(small));
+  SV_CHECK(sv_json_batch_add(&batch, &data, NULL));
+  sv_field_set(&data, SV_FIELD_AIR_PRES, 1009.9f);
+  SV_CHECK(sv_json_batch_add(&batch, &data, NULL));
+  len = sv_json_batch_finish(&batch);
+  SV_CHECK_EQ(len, strlen(small));
+  SV_CHECK_STR(small, "[{\"node\":3,\"seq\":41,\"temp_celsius\":-3.50},"
+                      "{\"node\":3,\"seq\":41,\"temp_celsius\":-3.50,\"pressure_hPa\":1009.9}]");
+
+  // full: the object is left out and the array stays valid
+  sv_json_batch_reset(&batch);
+  while (sv_json_batch_add(&batch, &data, NULL));
+  SV_CHECK_EQ(batch.count, 1);
+  sv_json_batch_finish(&batch);
+  SV_CHECK_STR(small, "[{\"node\":3,\"seq\":41,\"temp_celsius\":-3.50,\"pressure_hPa\":1009.9}]");
+
+  // a full batch of measurements with every field fits the receiver buffer
+  sv_json_batch_init(&batch, body, sizeof(body));
+  for (i = 0; i < BATCH_MAX; i++){
+    sample(&data, (uint16_t)i);
+    single += sv_json_write(&data, json_buffer, sizeof(json_buffer));
+    SV_CHECK(sv_json_batch_add(&batch, &data, NULL));
+  }
+  len = sv_json_batch_finish(&batch);
+  SV_CHECK_EQ(len, single + BATCH_MAX + 1);
+  printf("json batch: %d full measurements in one %u byte body, %u bytes as %d bodies\n",
+         BATCH_MAX, (unsigned)len, (unsigned)single, BATCH_MAX);
+}
+
+static void test_receive_bench(void){
+  static uint8_t packets[BENCH_PACKETS][SV_FRAME_MAX_LEN];
+  static size_t lens[BENCH_PACKETS];
+  struct all_sensors_data data;
+  unsigned long decoded = 0;
+  unsigned long written = 0;
+  uint8_t field;
+  int round;
+  int i;
+
+  // a day of readings, every fourth packet only carries the moisture sensors
+  for (i = 0; i < BENCH_PACKETS; i++){
+    sample(&data, (uint16_t)i);
+    if (i % 4 == 3){
+      data.present &= (uint16_t)(SV_FIELD_BIT(SV_FIELD_MOIST_1) | SV_FIELD_BIT(SV_FIELD_MOIST_2) | SV_FIELD_BIT(SV_FIELD_MOIST_3));
+    }
+    lens[i] = sv_frame_encode(&data, packets[i], SV_FRAME_MAX_LEN);
+  }
+  for (i = 0; i < BENCH_PACKETS; i++){
+    total_data.present = 0;
+    SV_CHECK_EQ(receive(packets[i], lens[i]), SV_FRAME_OK);
+    SV_CHECK(sv_json_write(&total_data, json_buffer, sizeof(json_buffer)) > 0);
+    for (field = 0; field < SV_FIELD_COUNT; field++){
+      SV_CHECK(!(total_data.present & SV_FIELD_BIT(field)) == !strstr(json_buffer, sv_field_json_key[field]));
+    }
+  }
+
+  // a packet longer than a frame is dropped without writing past the buffer
+  uint8_t oversized[2 * SV_FRAME_MAX_LEN];
+  memset(oversized, 0x5A, sizeof(oversized));
+  SV_CHECK_EQ(receive(oversized, sizeof(oversized)), SV_FRAME_ERR_LENGTH);
+
+  heap_allocs = 0;
+  heap_watch = 1;
+  clock_t start = clock();
+  for (round = 0; round < BENCH_ROUNDS; round++){
+    for (i = 0; i < BENCH_PACKETS; i++){
+      decoded += receive(packets[i], lens[i]) == SV_FRAME_OK;
+    }
+  }
+  clock_t middle = clock();
+  receive(packets[0], lens[0]);
+  for (round = 0; round < BENCH_ROUNDS; round++){
+    for (i = 0; i < BENCH_PACKETS; i++){
+      written += sv_json_write(&total_data, json_buffer, sizeof(json_buffer)) > 0;
+    }
+  }
+  clock_t end = clock();
+  heap_watch = 0;
+
+  SV_CHECK_EQ(decoded, (unsigned long)BENCH_ROUNDS * BENCH_PACKETS);
+  SV_CHECK_EQ(written, decoded);
+  SV_CHECK_EQ(heap_allocs, 0);
+  printf("receive: copy and decode %.0f ns per packet, json of every field %.0f ns; %lu heap allocations; "
+         "buffers %u + %u + %u bytes (frame, all_sensors_data, json)\n",
+         ns_per(start, middle, decoded), ns_per(middle, end, written), heap_allocs,
+         (unsigned)sizeof(frame_buffer), (unsigned)sizeof(total_data), (unsigned)sizeof(json_buffer));
+}
+
+int main(){
+  test_data_frame();
+  test_data_corruption();
+  test_summary_frame();
+  test_delta_frame();
+  test_fec();
+  test_diag_frame();
+  test_beacon();
+  test_airtime();
+  test_json();
+  test_json_batch();
+  test_receive_bench();
+  return sv_test_end("test_frame");
+}
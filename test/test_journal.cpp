@@ -0,0 +1,417 @@
+// Store-and-forward journal on an in-memory LittleFS: append / reboot / replay, acknowledgements,
+//  a power cut at every flash operation of an append, flush and ack sequence, damaged records, the
+//  ring overwrite, and the flash programmed per record with the RAM buffer against one commit each
+
+#include "sv_test.h"
+#include "SmartVit_journal.h"
+
+/* ******************** DEFINES ******************** */
+
+#define RECORDS_MAX     2000
+#define UPLOAD_BATCH    10      // UPLOAD_BATCH_MAX of the receiver
+#define FRAME_EVERY_MS  50000   // 6 nodes sending every 5 min
+
+/* ******************** HELPERS ******************** */
+
+// Full data frame of node 7, the sequence number tells the records apart
+static size_t make_frame(uint16_t seq, uint8_t *frame){
+  struct all_sensors_data data;
+
+  memset(&data, 0, sizeof(data));
+  data.node = 7;
+  data.seq = seq;
+  data.tx_power = 14;
+  sv_field_set(&data, SV_FIELD_WIND_SPEED, 3.5f);
+  sv_field_set(&data, SV_FIELD_WIND_DIR, (float)(seq % 8));
+  sv_field_set(&data, SV_FIELD_RAIN, 0.25f);
+  sv_field_set(&data, SV_FIELD_AIR_TEMP, 12.5f);
+  sv_field_set(&data, SV_FIELD_AIR_HUMID, 81.3f);
+  sv_field_set(&data, SV_FIELD_AIR_PRES, 1013.2f);
+  sv_field_set(&data, SV_FIELD_SOIL_PH, 6.45f);
+  sv_field_set(&data, SV_FIELD_SOIL_TEMP, 9.75f);
+  sv_field_set(&data, SV_FIELD_MOIST_1, 0.31f);
+  sv_field_set(&data, SV_FIELD_MOIST_2, 0.42f);
+  sv_field_set(&data, SV_FIELD_MOIST_3, 0.5f);
+  return sv_frame_encode(&data, frame, SV_FRAME_MAX_LEN);
+}
+
+static size_t record_len(void){
+  uint8_t frame[SV_FRAME_MAX_LEN];
+  return 1 + make_frame(0, frame);
+}
+
+static uint32_t now_ms;
+
+// Appends the records first..first+count-1, one every FRAME_EVERY_MS, while the power lasts
+//  Returns how many were appended
+static uint32_t append_records(sv_journal_t *journal, uint16_t first, uint32_t count){
+  uint8_t frame[SV_FRAME_MAX_LEN];
+  uint32_t appended = 0;
+
+  while (appended < count && LittleFS.powered()){
+    size_t len = make_frame((uint16_t)(first + appended), frame);
+    now_ms += FRAME_EVERY_MS;
+    if (!sv_journal_append(journal, frame, len, now_ms)){
+      break;
+    }
+    appended++;
+  }
+  return appended;
+}
+
+// Reads at most max records from *pos on, their sequence numbers go to seqs
+static uint32_t read_records(const sv_journal_t *journal, sv_journal_pos_t *pos, uint16_t *seqs, uint32_t max){
+  uint8_t frame[SV_FRAME_MAX_LEN];
+  struct all_sensors_data data;
+  uint32_t count = 0;
+  size_t len;
+
+  while (count < max && (len = sv_journal_read(journal, pos, frame)) != 0){
+    int decoded = sv_frame_decode(frame, len, &data);
+    SV_CHECK_EQ(decoded, SV_FRAME_OK);
+    seqs[count++] = decoded == SV_FRAME_OK ? data.seq : 0xFFFF;
+  }
+  return count;
+}
+
+// Records from the acknowledged position to the head, as the receiver would upload them
+static uint32_t read_pending(const sv_journal_t *journal, uint16_t *seqs){
+  sv_journal_pos_t pos = journal->ack;
+  return read_records(journal, &pos, seqs, RECORDS_MAX);
+}
+
+static int contiguous(const uint16_t *seqs, uint32_t count){
+  uint32_t i;
+
+  for (i = 1; i < count; i++){
+    if (seqs[i] != (uint16_t)(seqs[0] + i)){
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void reboot(sv_journal_t *journal){
+  LittleFS.reboot();
+  sv_journal_begin(journal);
+}
+
+/* ******************** TESTS ******************** */
+
+static void test_replay(void){
+  static uint16_t seqs[RECORDS_MAX];
+  sv_journal_t journal;
+  sv_journal_pos_t pos;
+  uint32_t per_segment = SV_JOURNAL_SEGMENT_SIZE / record_len();
+  uint32_t count;
+  uint32_t i;
+
+  LittleFS.format();
+  sv_journal_begin(&journal);
+  SV_CHECK_EQ(journal.pending, 0);
+  SV_CHECK_EQ(read_pending(&journal, seqs), 0);
+
+  // across a segment boundary, everything is back after a flush and a reboot
+  SV_CHECK_EQ(append_records(&journal, 0, per_segment + 20), per_segment + 20);
+  SV_CHECK_EQ(journal.pending, per_segment + 20);
+  SV_CHECK_EQ(journal.head.segment, 1);
+  SV_CHECK(sv_journal_flush(&journal));
+  reboot(&journal);
+  SV_CHECK_EQ(journal.pending, per_segment + 20);
+  SV_CHECK_EQ(journal.head.segment, 1);
+  SV_CHECK_EQ(journal.head.offset, 20 * record_len());
+  count = read_pending(&journal, seqs);
+  SV_CHECK_EQ(count, per_segment + 20);
+  SV_CHECK(seqs[0] == 0 && contiguous(seqs, count));
+
+  // a batch acknowledged, the rest replayed
+  pos = journal.ack;
+  SV_CHECK_EQ(read_records(&journal, &pos, seqs, UPLOAD_BATCH), UPLOAD_BATCH);
+  SV_CHECK(sv_journal_ack(&journal, pos, UPLOAD_BATCH));
+  SV_CHECK_EQ(journal.pending, per_segment + 20 - UPLOAD_BATCH);
+  reboot(&journal);
+  SV_CHECK_EQ(journal.pending, per_segment + 20 - UPLOAD_BATCH);
+  count = read_pending(&journal, seqs);
+  SV_CHECK_EQ(count, journal.pending);
+  SV_CHECK(seqs[0] == UPLOAD_BATCH && contiguous(seqs, count));
+
+  // acknowledged past the first segment: its file goes
+  pos = journal.ack;
+  SV_CHECK_EQ(read_records(&journal, &pos, seqs, per_segment), per_segment);
+  SV_CHECK(sv_journal_ack(&journal, pos, per_segment));
+  SV_CHECK(!LittleFS.exists(SV_JOURNAL_PREFIX "0"));
+  SV_CHECK_EQ(journal.pending, 20 - UPLOAD_BATCH);
+
+  // everything acknowledged, appends go on after the reboot
+  pos = journal.ack;
+  count = read_records(&journal, &pos, seqs, RECORDS_MAX);
+  SV_CHECK(sv_journal_ack(&journal, pos, count));
+  SV_CHECK_EQ(journal.pending, 0);
+  reboot(&journal);
+  SV_CHECK_EQ(journal.pending, 0);
+  SV_CHECK_EQ(read_pending(&journal, seqs), 0);
+  SV_CHECK_EQ(append_records(&journal, 500, 3), 3);
+  SV_CHECK(sv_journal_flush(&journal));
+  reboot(&journal);
+  count = read_pending(&journal, seqs);
+  SV_CHECK_EQ(count, 3);
+  SV_CHECK_EQ(seqs[0], 500);
+  for (i = 0; i < count; i++){
+    SV_CHECK_EQ(seqs[i], 500 + i);
+  }
+}
+
+// A power cut at each create / commit / rename / remove of: appends across a segment, a flush, then
+//  one ack. After the reboot the journal holds a contiguous run of records, starting at the old or the
+//  new ack, ending at the last flush done before the cut (the records in RAM go with the reset), and
+//  nothing behind the ack
+static void test_power_cut(void){
+  static uint16_t seqs[RECORDS_MAX];
+  sv_journal_t journal;
+  sv_journal_pos_t pos;
+  uint32_t per_segment = SV_JOURNAL_SEGMENT_SIZE / record_len();
+  uint32_t total = per_segment + 40;
+  uint32_t acked = per_segment + 10;
+  char path[SV_JOURNAL_PATH_LEN];
+  long cut;
+  int done = 0;
+  int ack_lost = 0;
+
+  for (cut = 0; !done; cut++){
+    LittleFS.format();
+    sv_journal_begin(&journal);
+    LittleFS.cut_after(cut);
+
+    uint32_t appended = append_records(&journal, 0, total);
+    if (LittleFS.powered()){
+      sv_journal_flush(&journal);
+    }
+    if (LittleFS.powered()){
+      pos = journal.ack;
+      SV_CHECK_EQ(read_records(&journal, &pos, seqs, acked), acked);
+      sv_journal_ack(&journal, pos, acked);
+    }
+    done = LittleFS.powered();
+
+    reboot(&journal);
+    uint32_t count = read_pending(&journal, seqs);
+    SV_CHECK_EQ(count, journal.pending);
+    SV_CHECK(contiguous(seqs, count));
+    if (count > 0){
+      uint32_t first = seqs[0];
+      uint32_t end = first + count;
+      SV_CHECK(first == 0 || (first == acked && appended == total));
+      SV_CHECK(end == per_segment || (end == total && appended == total));
+      ack_lost += appended == total && first == 0;
+    }
+    else{
+      SV_CHECK(appended <= per_segment + 1);
+    }
+    uint32_t segment;
+    for (segment = 0; segment < journal.ack.segment; segment++){
+      sv_journal_path(path, segment);
+      SV_CHECK(!LittleFS.exists(path));
+    }
+
+    // still usable: a new record lands after the others
+    uint8_t frame[SV_FRAME_MAX_LEN];
+    SV_CHECK(sv_journal_append(&journal, frame, make_frame(9999, frame), now_ms));
+    uint32_t again = read_pending(&journal, seqs);
+    SV_CHECK_EQ(again, count + 1);
+    SV_CHECK_EQ(seqs[again - 1], 9999);
+    SV_CHECK(sv_journal_flush(&journal));
+    reboot(&journal);
+    SV_CHECK_EQ(journal.pending, count + 1);
+  }
+  // the cuts during the ack, the last one between saving it and removing the first segment
+  SV_CHECK(ack_lost >= 1);
+  printf("test_journal: power cut at each of %ld flash operations, journal consistent after every one\n", cut - 1);
+}
+
+static void test_damaged_record(void){
+  static uint16_t seqs[RECORDS_MAX];
+  sv_journal_t journal;
+  sv_journal_pos_t pos;
+  size_t len = record_len();
+  uint32_t per_segment = SV_JOURNAL_SEGMENT_SIZE / len;
+  std::vector<uint8_t> *content;
+  uint32_t count;
+
+  LittleFS.format();
+  sv_journal_begin(&journal);
+  SV_CHECK_EQ(append_records(&journal, 0, per_segment + 20), per_segment + 20);
+  SV_CHECK(sv_journal_flush(&journal));
+
+  // record 10 of the first segment damaged: the rest of the segment is lost, the next one is read
+  content = LittleFS.content(SV_JOURNAL_PREFIX "0");
+  SV_CHECK(content != NULL);
+  (*content)[10 * len + 5] ^= 0x10;
+  reboot(&journal);
+  SV_CHECK_EQ(journal.pending, 10 + 20);
+  pos = journal.ack;
+  count = read_records(&journal, &pos, seqs, RECORDS_MAX);
+  SV_CHECK_EQ(count, 30);
+  SV_CHECK(seqs[9] == 9 && seqs[10] == per_segment && contiguous(&seqs[10], 20));
+
+  // acknowledged with every record read: nothing left pending
+  SV_CHECK(sv_journal_ack(&journal, pos, count));
+  SV_CHECK_EQ(journal.pending, 0);
+  reboot(&journal);
+  SV_CHECK_EQ(journal.pending, 0);
+
+  // damaged tail of the head segment: appends go on in a new segment, never behind it
+  SV_CHECK_EQ(append_records(&journal, 1000, 5), 5);
+  SV_CHECK(sv_journal_flush(&journal));
+  content = LittleFS.content(SV_JOURNAL_PREFIX "1");
+  content->back() ^= 0x01;
+  reboot(&journal);
+  SV_CHECK_EQ(journal.pending, 4);
+  SV_CHECK_EQ(journal.head.segment, 2);
+  SV_CHECK_EQ(append_records(&journal, 2000, 1), 1);
+  SV_CHECK(sv_journal_flush(&journal));
+  reboot(&journal);
+  count = read_pending(&journal, seqs);
+  SV_CHECK_EQ(count, 5);
+  SV_CHECK(seqs[0] == 1000 && seqs[3] == 1003 && seqs[4] == 2000);
+}
+
+static void test_ring_overwrite(void){
+  static uint16_t seqs[RECORDS_MAX];
+  sv_journal_t journal;
+  uint32_t per_segment = SV_JOURNAL_SEGMENT_SIZE / record_len();
+  uint32_t total = (SV_JOURNAL_SEGMENTS + 1) * per_segment + 3;
+  uint32_t count;
+
+  LittleFS.format();
+  sv_journal_begin(&journal);
+  SV_CHECK_EQ(append_records(&journal, 0, total), total);
+  SV_CHECK_EQ(journal.lost, 2 * per_segment);
+  SV_CHECK_EQ(journal.pending + journal.lost, total);
+  SV_CHECK(!LittleFS.exists(SV_JOURNAL_PREFIX "1"));
+
+  SV_CHECK(sv_journal_flush(&journal));
+  reboot(&journal);
+  SV_CHECK_EQ(journal.pending, total - 2 * per_segment);
+  count = read_pending(&journal, seqs);
+  SV_CHECK_EQ(count, journal.pending);
+  SV_CHECK(seqs[0] == 2 * per_segment && contiguous(seqs, count));
+}
+
+// Records in RAM: lost by a reset before their flush, never written once acknowledged, flushed when
+//  the oldest is SV_JOURNAL_FLUSH_MS old
+static void test_buffer(void){
+  static uint16_t seqs[RECORDS_MAX];
+  sv_journal_t journal;
+  sv_journal_pos_t pos;
+  uint32_t count;
+
+  LittleFS.format();
+  sv_journal_begin(&journal);
+  SV_CHECK_EQ(append_records(&journal, 0, 3), 3);
+  SV_CHECK(!LittleFS.exists(SV_JOURNAL_PREFIX "0"));
+  SV_CHECK_EQ(read_pending(&journal, seqs), 3);
+  reboot(&journal);
+  SV_CHECK_EQ(journal.pending, 0);
+  SV_CHECK_EQ(read_pending(&journal, seqs), 0);
+
+  // uploaded and acknowledged from RAM: nothing programmed, not even the ack
+  LittleFS.reset_stats();
+  SV_CHECK_EQ(append_records(&journal, 10, 3), 3);
+  pos = journal.ack;
+  count = read_records(&journal, &pos, seqs, RECORDS_MAX);
+  SV_CHECK(count == 3 && seqs[0] == 10 && contiguous(seqs, count));
+  SV_CHECK(sv_journal_ack(&journal, pos, count));
+  SV_CHECK_EQ(journal.pending, 0);
+  SV_CHECK(!sv_journal_flush_due(&journal, now_ms + SV_JOURNAL_FLUSH_MS));
+  SV_CHECK_EQ(LittleFS.stats.programmed, 0);
+  SV_CHECK_EQ(LittleFS.stats.meta_commits, 0);
+
+  // half acknowledged: the ack is saved with the flush, the rest replayed after a reboot
+  SV_CHECK_EQ(append_records(&journal, 20, 4), 4);
+  SV_CHECK(!sv_journal_flush_due(&journal, now_ms));
+  pos = journal.ack;
+  SV_CHECK_EQ(read_records(&journal, &pos, seqs, 2), 2);
+  SV_CHECK(sv_journal_ack(&journal, pos, 2));
+  SV_CHECK_EQ(LittleFS.stats.meta_commits, 0);
+  SV_CHECK(sv_journal_flush_due(&journal, now_ms - 3 * FRAME_EVERY_MS + SV_JOURNAL_FLUSH_MS));
+  SV_CHECK(sv_journal_flush(&journal));
+  reboot(&journal);
+  SV_CHECK_EQ(journal.pending, 2);
+  count = read_pending(&journal, seqs);
+  SV_CHECK(count == 2 && seqs[0] == 22 && seqs[1] == 23);
+}
+
+// Receiver loop over frames received one every FRAME_EVERY_MS: one append per frame, the journal
+//  flushed after each record (one commit per record like before the RAM buffer), when due, or only
+//  when a segment is full, and each record uploaded and acknowledged after it when the server
+//  answers (the batch age of the receiver is below FRAME_EVERY_MS)
+#define FLUSH_EACH  0
+#define FLUSH_DUE   1
+#define FLUSH_FULL  2
+
+static sv_stub_fs_stats_t run_receiver(uint32_t records, int flush, int upload){
+  static uint16_t seqs[RECORDS_MAX];
+  sv_journal_t journal;
+  sv_journal_pos_t pos;
+  uint32_t count;
+  uint32_t i;
+
+  LittleFS.format();
+  sv_journal_begin(&journal);
+  LittleFS.reset_stats();
+  for (i = 0; i < records; i++){
+    SV_CHECK_EQ(append_records(&journal, (uint16_t)i, 1), 1);
+    if (flush == FLUSH_EACH || (flush == FLUSH_DUE && sv_journal_flush_due(&journal, now_ms))){
+      SV_CHECK(sv_journal_flush(&journal));
+    }
+    if (upload){
+      pos = journal.ack;
+      count = read_records(&journal, &pos, seqs, UPLOAD_BATCH);
+      SV_CHECK(sv_journal_ack(&journal, pos, count));
+    }
+  }
+  SV_CHECK(sv_journal_flush(&journal));
+  SV_CHECK_EQ(journal.pending, upload ? 0 : records);
+  return LittleFS.stats;
+}
+
+// Flash programmed per record as the receiver drives the journal
+static void test_write_amplification(void){
+  size_t len = record_len();
+  uint32_t records = 1000;
+  sv_stub_fs_stats_t each = run_receiver(records, FLUSH_EACH, 0);
+  sv_stub_fs_stats_t due = run_receiver(records, FLUSH_DUE, 0);
+  sv_stub_fs_stats_t full = run_receiver(records, FLUSH_FULL, 0);
+  sv_stub_fs_stats_t online = run_receiver(records, FLUSH_DUE, 1);
+  uint32_t per_flush = SV_JOURNAL_FLUSH_MS / FRAME_EVERY_MS;
+  uint32_t segments = (uint32_t)(records * len / SV_JOURNAL_SEGMENT_SIZE);
+
+  SV_CHECK_EQ(each.written, records * len);
+  SV_CHECK_EQ(each.commits, records);
+  SV_CHECK_EQ(due.written, records * len);
+  SV_CHECK(due.commits <= records / per_flush + segments + 1);
+  SV_CHECK(due.programmed * 4 < each.programmed);
+  SV_CHECK_EQ(full.commits, segments + 1);
+  SV_CHECK(full.programmed < full.written * 11 / 10);
+  SV_CHECK_EQ(online.programmed, 0);
+  SV_CHECK_EQ(online.meta_commits, 0);
+
+  printf("test_journal: %u byte records, one every %d s, bytes programmed per record: %.0f with a commit"
+         " each (x%.1f), %.0f flushed every %lu s (x%.1f), %.0f flushed a segment at a time (x%.2f),"
+         " %.0f uploaded before the flush\n",
+         (unsigned)len, FRAME_EVERY_MS / 1000,
+         (double)each.programmed / records, (double)each.programmed / each.written,
+         (double)due.programmed / records, SV_JOURNAL_FLUSH_MS / 1000, (double)due.programmed / due.written,
+         (double)full.programmed / records, (double)full.programmed / full.written,
+         (double)online.programmed / records);
+}
+
+int main(){
+  test_replay();
+  test_power_cut();
+  test_damaged_record();
+  test_ring_overwrite();
+  test_buffer();
+  test_write_amplification();
+  return sv_test_end("test_journal");
+}
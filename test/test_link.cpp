@@ -0,0 +1,305 @@
+// MSP430 -> ESP32 link on the host: COBS / CRC round trips through the byte parser, corruption,
+//  truncation, resynchronization, lost and replayed frames, the parse throughput of a long byte
+//  stream, then the code SV_SENSOR_TABLE generates (frame fields, json keys, calibration)
+
+#include "sv_test.h"
+#include "SmartVit_link.h"
+#include "SmartVit_frame.h"
+#include "SmartVit_json.h"
+#include "SmartVit_calibration.h"
+#include "SmartVit_aggregate.h"
+
+#include <math.h>
+#include <time.h>
+
+/* ******************** DEFINES ******************** */
+
+#define BENCH_FRAMES  200000    // frames of the throughput benchmark
+
+/* ******************** HELPERS ******************** */
+
+// Link frame as msp/main.c sends it: seq, one record per reading, CRC, COBS and the delimiter
+static size_t link_frame(uint8_t seq, const uint8_t *ids, const sv_link_value_t *values, uint8_t count, uint8_t *out){
+  uint8_t payload[SV_LINK_MAX_PAYLOAD];
+  size_t len = 0;
+  uint8_t i;
+
+  payload[len++] = seq;
+  for (i = 0; i < count; i++){
+    len += sv_link_put_record(&payload[len], ids[i], values[i]);
+  }
+  len = sv_link_put_crc(payload, len);
+  return sv_link_cobs_encode(payload, len, out);
+}
+
+// Pushes the bytes, returns the result of the last one and the number of valid frames seen
+static int push_all(sv_link_parser_t *parser, const uint8_t *buf, size_t len, int *frames){
+  int result = SV_LINK_MORE;
+  size_t i;
+
+  for (i = 0; i < len; i++){
+    result = sv_link_parser_push(parser, buf[i]);
+    if (result == SV_LINK_FRAME && frames != NULL){
+      (*frames)++;
+    }
+  }
+  return result;
+}
+
+// One record per field of the sensor table
+static uint8_t link_ids[SV_LINK_MAX_RECORDS];
+
+static void init_link_ids(void){
+  uint8_t i;
+
+  for (i = 0; i < SV_LINK_MAX_RECORDS; i++){
+    link_ids[i] = i;
+  }
+}
+
+// The sensor table, as the tests expect the generated code to use it
+typedef struct{
+  const char *name;
+  uint8_t source;
+  uint8_t width;
+  uint8_t is_signed;
+  uint16_t scale;
+  uint8_t cal;
+  float cal_scale;
+  float cal_offset;
+  const char *key;
+} expected_field_t;
+
+#define EXPECTED_FIELD(name, source, channel, width, is_signed, scale, cal, cal_scale, cal_offset, key) \
+  {#name, source, width, is_signed, scale, cal, (float)(cal_scale), (float)(cal_offset), key},
+static const expected_field_t expected_fields[] = {
+  SV_SENSOR_TABLE(EXPECTED_FIELD)
+};
+#undef EXPECTED_FIELD
+
+/* ******************** TESTS ******************** */
+
+static void test_link_round_trip(void){
+  // raw counts with zero bytes (COBS blocks), the pH sum reaches 6 * 1023
+  sv_link_value_t values[SV_LINK_MAX_RECORDS] = {0, 12, 256, 0x8000, 700, 1023, 6 * 1023, 0, 0xFFFF, 1, 0x0100};
+  uint8_t encoded[SV_LINK_MAX_ENCODED];
+  sv_link_parser_t parser;
+  uint8_t i;
+  size_t len;
+  size_t pos;
+
+  len = link_frame(0, link_ids, values, SV_LINK_MAX_RECORDS, encoded);
+  SV_CHECK(len <= SV_LINK_MAX_ENCODED);
+  SV_CHECK_EQ(encoded[len - 1], SV_LINK_DELIMITER);
+  for (pos = 0; pos + 1 < len; pos++){
+    SV_CHECK(encoded[pos] != SV_LINK_DELIMITER);
+  }
+
+  sv_link_parser_init(&parser);
+  SV_CHECK_EQ(push_all(&parser, encoded, len, NULL), SV_LINK_FRAME);
+  SV_CHECK_EQ(sv_link_records(&parser), SV_LINK_MAX_RECORDS);
+  for (i = 0; i < SV_LINK_MAX_RECORDS; i++){
+    uint8_t id;
+    sv_link_value_t value;
+    sv_link_get_record(&parser, i, &id, &value);
+    SV_CHECK_EQ(id, link_ids[i]);
+    SV_CHECK(memcmp(&value, &values[i], sizeof(value)) == 0);
+  }
+
+  // a frame without records
+  len = link_frame(1, link_ids, values, 0, encoded);
+  SV_CHECK_EQ(push_all(&parser, encoded, len, NULL), SV_LINK_FRAME);
+  SV_CHECK_EQ(sv_link_records(&parser), 0);
+  SV_CHECK_EQ(parser.frames, 2);
+  SV_CHECK_EQ(parser.lost, 0);
+
+  // COBS splits a run of 254 non zero bytes into full blocks
+  uint8_t run[300];
+  uint8_t out[310];
+  memset(run, 0x55, sizeof(run));
+  SV_CHECK_EQ(sv_link_cobs_encode(run, sizeof(run), out), sizeof(run) + 1 + 1 + 1);
+  SV_CHECK_EQ(out[0], 0xFF);
+  SV_CHECK_EQ(out[255], sizeof(run) - 254 + 1);
+}
+
+static void test_link_corruption(void){
+  sv_link_value_t values[3] = {12, 700, 0};
+  uint8_t encoded[SV_LINK_MAX_ENCODED];
+  uint8_t damaged[SV_LINK_MAX_ENCODED];
+  sv_link_parser_t parser;
+  size_t len;
+  size_t i;
+  int bit;
+  int frames;
+
+  len = link_frame(10, link_ids, values, 3, encoded);
+
+  // every single bit flip of the frame is rejected, the next frame still goes through
+  for (i = 0; i + 1 < len; i++){
+    for (bit = 0; bit < 8; bit++){
+      memcpy(damaged, encoded, len);
+      damaged[i] ^= (uint8_t)(1 << bit);
+      sv_link_parser_init(&parser);
+      frames = 0;
+      push_all(&parser, damaged, len, &frames);
+      SV_CHECK_EQ(frames, 0);
+      SV_CHECK_EQ(push_all(&parser, encoded, len, &frames), SV_LINK_FRAME);
+    }
+  }
+
+  // truncated frames: the delimiter comes too early
+  for (i = 1; i + 1 < len; i++){
+    sv_link_parser_init(&parser);
+    memcpy(damaged, encoded, i);
+    damaged[i] = SV_LINK_DELIMITER;
+    SV_CHECK(push_all(&parser, damaged, i + 1, NULL) != SV_LINK_FRAME);
+    SV_CHECK(parser.errors > 0);
+  }
+
+  // line noise, an overlong frame without delimiter, then a valid frame
+  uint8_t noise[2 * SV_LINK_MAX_ENCODED];
+  for (i = 0; i < sizeof(noise); i++){
+    noise[i] = (uint8_t)(0x11 + i * 7);
+    if (noise[i] == SV_LINK_DELIMITER){
+      noise[i] = 1;
+    }
+  }
+  sv_link_parser_init(&parser);
+  frames = 0;
+  push_all(&parser, noise, sizeof(noise), &frames);
+  SV_CHECK_EQ(sv_link_parser_push(&parser, SV_LINK_DELIMITER), SV_LINK_ERR_FRAME);
+  SV_CHECK_EQ(push_all(&parser, encoded, len, &frames), SV_LINK_FRAME);
+  SV_CHECK_EQ(frames, 1);
+}
+
+static void test_link_sequence(void){
+  sv_link_value_t values[1] = {3};
+  uint8_t encoded[SV_LINK_MAX_ENCODED];
+  sv_link_parser_t parser;
+  size_t len;
+
+  sv_link_parser_init(&parser);
+  len = link_frame(254, link_ids, values, 1, encoded);
+  SV_CHECK_EQ(push_all(&parser, encoded, len, NULL), SV_LINK_FRAME);
+
+  // replayed: its pulses must not be counted twice
+  SV_CHECK_EQ(push_all(&parser, encoded, len, NULL), SV_LINK_ERR_REPLAY);
+  SV_CHECK_EQ(parser.lost, 0);
+  SV_CHECK_EQ(parser.frames, 1);
+
+  // 255 and 0 lost, across the wrap of the sequence number
+  len = link_frame(1, link_ids, values, 1, encoded);
+  SV_CHECK_EQ(push_all(&parser, encoded, len, NULL), SV_LINK_FRAME);
+  SV_CHECK_EQ(parser.lost, 2);
+  SV_CHECK_EQ(parser.frames, 2);
+}
+
+static void test_link_throughput(void){
+  static uint8_t stream[64 * SV_LINK_MAX_ENCODED];
+  sv_link_value_t values[SV_LINK_MAX_RECORDS];
+  sv_link_parser_t parser;
+  size_t stream_len = 0;
+  size_t frame_len = 0;
+  unsigned long pushed = 0;
+  int frames = 0;
+  int damaged = 0;
+  uint8_t seq;
+  uint8_t i;
+
+  // 64 frames of full readings, every eighth one with a flipped bit or cut short
+  for (seq = 0; seq < 64; seq++){
+    for (i = 0; i < SV_LINK_MAX_RECORDS; i++){
+      values[i] = (sv_link_value_t)(seq * 8 + i);
+    }
+    frame_len = link_frame(seq, link_ids, values, SV_LINK_MAX_RECORDS, &stream[stream_len]);
+    if (seq % 8 == 3){
+      stream[stream_len + frame_len / 2] ^= 0x10;
+      damaged++;
+    }
+    else if (seq % 8 == 6){
+      stream[stream_len + frame_len / 2] = SV_LINK_DELIMITER;
+      damaged++;
+    }
+    stream_len += frame_len;
+  }
+
+  sv_link_parser_init(&parser);
+  clock_t start = clock();
+  while (pushed < (unsigned long)BENCH_FRAMES * frame_len){
+    push_all(&parser, stream, stream_len, &frames);
+    pushed += stream_len;
+  }
+  clock_t end = clock();
+
+  unsigned long rounds = pushed / stream_len;
+  SV_CHECK_EQ(frames, rounds * (64 - damaged));
+  SV_CHECK_EQ(parser.frames, frames & 0xFFFF);
+  double seconds = (double)(end - start) / CLOCKS_PER_SEC;
+  printf("parser: %.1f MB/s, %.2f M frames/s of %u bytes, with %d of 64 frames damaged\n",
+         pushed / seconds / 1e6, frames / seconds / 1e6, (unsigned)frame_len, damaged);
+}
+
+static void test_sensor_table(void){
+  uint8_t field;
+
+  SV_CHECK_EQ(sizeof(expected_fields) / sizeof(expected_fields[0]), SV_FIELD_COUNT);
+  SV_CHECK(SV_FIELD_COUNT <= 16);     // one bit each in the present bitmap
+  SV_CHECK_EQ(SV_ENABLED_FIELDS, SV_FIELD_BIT(SV_FIELD_COUNT) - 1);
+  SV_CHECK(sv_frame_len(SV_ENABLED_FIELDS) <= SV_FRAME_MAX_LEN);
+  SV_CHECK(SV_LINK_MAX_RECORDS >= SV_FIELD_COUNT);
+
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    const expected_field_t *expected = &expected_fields[field];
+    sv_field_t id = (sv_field_t)field;
+
+    SV_CHECK_EQ(sv_field_desc[field].width, expected->width);
+    SV_CHECK_EQ(sv_field_desc[field].is_signed, expected->is_signed);
+    SV_CHECK_EQ(sv_field_desc[field].scale, expected->scale);
+    SV_CHECK_STR(sv_field_json_key[field], expected->key);
+    SV_CHECK_EQ(sv_field_aggregate[field], expected->cal == SV_CAL_WINDSOCK ? SV_AGGREGATE_DIRECTION :
+                expected->source == SV_SOURCE_PULSE_SUM ? SV_AGGREGATE_SUM : SV_AGGREGATE_MEAN);
+
+    // calibration of a raw link value
+    if (expected->cal == SV_CAL_LINEAR){
+      SV_CHECK(fabsf(sv_calibrate(id, 200) - (200 * expected->cal_scale + expected->cal_offset)) < 1e-3f);
+    }
+    else if (expected->cal == SV_CAL_NONE){
+      SV_CHECK(sv_calibrate(id, 200) == 200.0f);
+    }
+    else{
+      SV_CHECK(sv_calibrate(id, 200) < SV_WINDSOCK_SECTORS);
+    }
+
+    // one field alone goes through a data frame and back into the same slot
+    struct all_sensors_data data;
+    struct all_sensors_data decoded;
+    uint8_t buf[SV_FRAME_MAX_LEN];
+    memset(&data, 0, sizeof(data));
+    memset(&decoded, 0, sizeof(decoded));
+    sv_field_set(&data, id, 1.0f);
+    size_t len = sv_frame_encode(&data, buf, sizeof(buf));
+    SV_CHECK_EQ(len, SV_FRAME_HEADER_LEN + expected->width + SV_FRAME_CRC_LEN);
+    SV_CHECK_EQ(sv_frame_decode(buf, len, &decoded), SV_FRAME_OK);
+    SV_CHECK_EQ(decoded.present, SV_FIELD_BIT(field));
+    SV_CHECK_EQ(sv_field_to_raw(id, decoded.value[field]), expected->scale);
+  }
+
+  // vane voltages of the CV10 calibration, counts of the 10 bit ADC fed by the same 3.3 V
+  SV_CHECK_EQ(sv_calibrate(SV_FIELD_WIND_DIR, 3100 * 1023 / 3300), NORTH);
+  SV_CHECK_EQ(sv_calibrate(SV_FIELD_WIND_DIR, 2750 * 1023 / 3300), EAST);
+  SV_CHECK_EQ(sv_calibrate(SV_FIELD_WIND_DIR, 2400 * 1023 / 3300), SOUTH);
+  SV_CHECK_EQ(sv_calibrate(SV_FIELD_WIND_DIR, 2000 * 1023 / 3300), NORTHWEST);
+  // below the lowest band the nearest sector, not the NORTHEAST fallback of the threshold chain
+  SV_CHECK_EQ(sv_calibrate(SV_FIELD_WIND_DIR, 0), NORTHWEST);
+  SV_CHECK_EQ(sv_calibrate(SV_FIELD_WIND_DIR, 1023), NORTH);
+}
+
+int main(){
+  init_link_ids();
+  test_link_round_trip();
+  test_link_corruption();
+  test_link_sequence();
+  test_link_throughput();
+  test_sensor_table();
+  return sv_test_end("test_link");
+}
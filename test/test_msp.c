@@ -0,0 +1,366 @@
+// msp/main.c on the simulated MSP430G2553 of msp_sim.h: the link frames it sends through the USCI,
+//  checked with the ESP32 parser, the interrupts, wakes and low power time spent on each frame, the
+//  data ready line to the ESP32, the analog channels of the ADC10 scan, the pulses counted on port 2
+//  and a day of the sensor schedule
+
+#include "sv_test.h"
+#include "msp_sim.h"
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunknown-pragmas"
+#pragma GCC diagnostic ignored "-Wpointer-to-int-cast"
+#define main msp_main
+#include "../msp/main.c"
+#undef main
+#pragma GCC diagnostic pop
+
+/* ******************** DEFINES ******************** */
+
+#define RUN_LIMIT   (4 * 3600 * SV_SIM_NS)  // simulated time allowed to each scenario
+#define DAY         (24 * 3600 * SV_SIM_NS)
+#define MAX_FRAMES  64
+
+// Records and encoded length of a link frame, one record per sensor read by the MSP430
+#define MSP_RECORD(name, source, channel, width, is_signed, scale, cal, cal_scale, cal_offset, key) \
+  + (SV_ENABLE_##name && (source) != SV_SOURCE_LOCAL)
+#define MSP_RECORDS (0 SV_SENSOR_TABLE(MSP_RECORD))
+#define MSP_ENCODED(records) (SV_LINK_SEQ_LEN + (records) * SV_LINK_RECORD_LEN + SV_LINK_CRC_LEN + 2)
+
+/* ******************** HELPERS ******************** */
+
+// ESP32 side of the link, with the statistics of the simulation when each frame was complete
+static sv_link_parser_t parser;
+static sv_sim_t at_frame[MAX_FRAMES];
+static uint8_t seqs[MAX_FRAMES];
+static uint8_t records[MAX_FRAMES];
+static uint8_t ids[MAX_FRAMES][SV_LINK_MAX_RECORDS];
+static sv_link_value_t values[MAX_FRAMES][SV_LINK_MAX_RECORDS];
+static int frames;
+static int stop_after;
+
+// Data ready line (P2.0) seen by the ESP32: when it last rose, and the bytes sent while it was low
+static uint64_t ready_since;
+static int ready_high;
+static unsigned long ready_low_bytes;
+static unsigned long ready_low_sleeps;      // LPM3 sleeps with the line low
+static unsigned long tx_pending_sleeps;     // LPM3 sleeps with a byte still in UCA0TXBUF or shifting out
+static uint64_t ready_lead_min = ~(uint64_t)0;
+static int in_frame;
+
+static unsigned long field_frames[SV_FIELD_COUNT];    // frames that carried each field, all of them
+
+static void link_sink(unsigned char byte){
+  uint8_t i;
+
+  if (!(P2OUT & BIT0)){
+    ready_low_bytes++;
+  }
+  if (!in_frame && ready_high && sv_sim.now - ready_since < ready_lead_min){
+    ready_lead_min = sv_sim.now - ready_since;    // first byte of a frame after the line rose
+  }
+  in_frame = byte != SV_LINK_DELIMITER;
+
+  if (sv_link_parser_push(&parser, byte) != SV_LINK_FRAME){
+    return;
+  }
+  for (i = 0; i < sv_link_records(&parser); i++){
+    uint8_t id;
+    sv_link_value_t value;
+    sv_link_get_record(&parser, i, &id, &value);
+    if (id < SV_FIELD_COUNT){
+      field_frames[id]++;
+    }
+  }
+  if (frames < MAX_FRAMES){
+    at_frame[frames] = sv_sim;
+    seqs[frames] = parser.seq;
+    records[frames] = sv_link_records(&parser);
+    for (i = 0; i < records[frames]; i++){
+      sv_link_get_record(&parser, i, &ids[frames][i], &values[frames][i]);
+    }
+  }
+  if (++frames == stop_after){
+    sv_sim_stop();
+  }
+}
+
+// The data ready line at each sleep of the firmware, a long LPM3 sleep must find it low
+static void ready_watch(void){
+  int high = (P2OUT & BIT0) != 0;
+
+  if (high && !ready_high){
+    ready_since = sv_sim.now;
+  }
+  ready_high = high;
+  if (!high && (sv_sim.sr & SCG1)){
+    ready_low_sleeps++;
+  }
+  if ((sv_sim.sr & SCG1) && (sv_sim.tx_full || sv_sim.tx_shifting)){
+    tx_pending_sleeps++;      // SMCLK stops, the byte would wait for the next wake
+  }
+}
+
+// Powers the simulated MSP430 up, the tests then run it in turn like one long life of the device
+static void power_up(void){
+  sv_sim_init(msp_main);
+  sv_sim.vector[ADC10_VECTOR] = ADC10_ISR;
+  sv_sim.vector[TIMER0_A0_VECTOR] = Timer_A_CCR0_ISR;
+  sv_sim.vector[PORT2_VECTOR] = PORT2_ISR;
+  sv_sim.vector[USCIAB0TX_VECTOR] = USCI0TX_ISR;
+  sv_sim.uart_sink = link_sink;
+  sv_sim.lpm_entry = ready_watch;
+  sv_link_parser_init(&parser);
+  frames = 0;
+}
+
+// Runs the firmware until count more frames arrived, returns the index of the first one
+static int run_frames(int count){
+  int first = frames;
+
+  stop_after = frames + count;
+  sv_sim_run(RUN_LIMIT);
+  SV_CHECK_EQ(frames, stop_after);
+  return first;
+}
+
+static double ms(uint64_t ns){
+  return (double)ns / SV_SIM_MS;
+}
+
+// Value of the record id in frame, -1 if the frame has none
+static double frame_value(int frame, uint8_t id){
+  uint8_t i;
+
+  for (i = 0; i < records[frame]; i++){
+    if (ids[frame][i] == id){
+      return values[frame][i];
+    }
+  }
+  return -1;
+}
+
+// Runs the firmware frame by frame until one carries field, returns its index
+static int run_until(uint8_t field){
+  int frame;
+
+  do{
+    frame = run_frames(1);
+  } while (frames == frame + 1 && frames < MAX_FRAMES && frame_value(frame, field) < 0);
+  return frame;
+}
+
+// Analog inputs: channel * 100 + sequence of the scan, the pH probe on A4 is noisy
+static const unsigned short ph_samples[10] = {500, 900, 510, 505, 0, 495, 502, 498, 1000, 507};
+static unsigned int scan_conversions[16];
+static uint64_t first_conversion;
+static uint64_t last_conversion;
+
+static unsigned short adc_input(int channel){
+  unsigned int sequence;
+
+  if (sv_sim.now - last_conversion > SV_SIM_MS){
+    memset(scan_conversions, 0, sizeof(scan_conversions));
+    first_conversion = sv_sim.now;
+  }
+  last_conversion = sv_sim.now;
+  sequence = scan_conversions[channel]++ % 10;
+  if (channel == 4){
+    return ph_samples[sequence];
+  }
+  return (unsigned short)(channel * 100 + sequence);
+}
+
+/* ******************** TESTS ******************** */
+
+// Frames from the TX ring buffer: one interrupt per byte, the CPU only wakes when the ring is empty
+static void test_msp_uart(void){
+  int first = run_frames(3);
+  int i;
+
+  if (frames != first + 3){
+    return;
+  }
+  // every sensor is due at power up, then only the ones whose period ended
+  SV_CHECK_EQ(records[first], MSP_RECORDS);
+  for (i = first; i < frames; i++){
+    SV_CHECK_EQ(seqs[i], i);
+    SV_CHECK(records[i] > 0 && records[i] <= MSP_RECORDS);
+  }
+  SV_CHECK_EQ(parser.errors, 0);
+  SV_CHECK_EQ(sv_sim.tx_overruns, 0);
+  // the baud rate needs the DCO on its 12 MHz calibration, ACLK from LFXT1
+  SV_CHECK_EQ(BCSCTL1 & (RSEL3 + RSEL2 + RSEL1 + RSEL0), CALBC1_12MHZ & (RSEL3 + RSEL2 + RSEL1 + RSEL0));
+  SV_CHECK_EQ(BCSCTL1 & XTS, 0);
+
+  // one period of the FSM between two frames
+  const sv_sim_t *a = &at_frame[first + 1];
+  const sv_sim_t *b = &at_frame[first + 2];
+  unsigned long bytes = b->uart_bytes - a->uart_bytes;
+  unsigned long interrupts = b->isr[USCIAB0TX_VECTOR] - a->isr[USCIAB0TX_VECTOR];
+  unsigned long wakes = b->wakes[USCIAB0TX_VECTOR] - a->wakes[USCIAB0TX_VECTOR];
+  uint64_t lpm0 = b->ns_lpm0 - a->ns_lpm0;
+  uint64_t awake = b->ns_active - a->ns_active;
+  uint64_t wire = bytes * sv_sim_uart_byte_ns();
+
+  SV_CHECK_EQ(bytes, MSP_ENCODED(records[first + 2]));
+  SV_CHECK_EQ(interrupts, bytes);
+  SV_CHECK_EQ(wakes, 1);
+  // awake only for the last two bytes, in UCA0TXBUF and the shift register, that no interrupt reports
+  SV_CHECK(awake <= 2 * sv_sim_uart_byte_ns());
+  SV_CHECK(lpm0 + awake <= wire);
+
+  printf("uart: %lu byte frame, %lu TX interrupts and %lu wake, %.1f ms in LPM0, %.1f ms awake, "
+         "%lu cycles of interrupt entry and RETI (ISR bodies not timed); "
+         "a busy wait keeps the CPU on %.1f ms, %lu cycles\n",
+         bytes, interrupts, wakes, ms(lpm0), ms(awake), interrupts * SV_SIM_ISR_CYCLES,
+         ms(wire), (unsigned long)(wire * SV_SIM_DCO_HZ / SV_SIM_NS));
+}
+
+// P2.0 rises one tick before each frame so the ESP32 can wake from deep sleep, and drops once it left
+static void test_msp_data_ready(void){
+  unsigned long sleeps = ready_low_sleeps;
+  int first = run_frames(3);
+
+  if (frames != first + 3){
+    return;
+  }
+  SV_CHECK(P2DIR & BIT0);
+  SV_CHECK_EQ(ready_low_bytes, 0);
+  SV_CHECK_EQ(tx_pending_sleeps, 0);
+  SV_CHECK(ready_lead_min >= SV_SIM_NS - SV_SIM_MS && ready_lead_min <= 2 * SV_SIM_NS);
+  // the line is low in the sleep between frames
+  SV_CHECK(ready_low_sleeps - sleeps >= 2);
+  printf("data ready: high %.0f ms before the first byte of a frame, 0 bytes sent with it low\n", ms(ready_lead_min));
+}
+
+// One wake converts phSamples sequences of A7..A0, each reading comes from its own channel
+static void test_msp_adc(void){
+  int channel;
+  int frame;
+
+  // the first frame with every analog sensor due after the inputs are set
+  sv_sim.adc_input = adc_input;
+  frame = run_frames(1);
+  frame = run_until(SV_FIELD_SOIL_PH);
+  if (frame_value(frame, SV_FIELD_SOIL_PH) < 0){
+    return;
+  }
+
+  SV_CHECK_EQ(ADC10AE0, BIT0 + BIT3 + BIT4 + BIT5 + BIT6 + BIT7);
+  SV_CHECK_EQ(frame_value(frame, SV_FIELD_WIND_DIR), 0);
+  SV_CHECK_EQ(frame_value(frame, SV_FIELD_SOIL_TEMP), 300);
+  SV_CHECK_EQ(frame_value(frame, SV_FIELD_MOIST_1), 500);
+  SV_CHECK_EQ(frame_value(frame, SV_FIELD_MOIST_2), 600);
+  SV_CHECK_EQ(frame_value(frame, SV_FIELD_MOIST_3), 700);
+  // the two highest and two lowest samples are dropped
+  SV_CHECK_EQ(frame_value(frame, SV_FIELD_SOIL_PH), 510 + 507 + 505 + 502 + 500 + 498);
+
+  // every channel of every sequence, in a single ADC10 wake per frame
+  for (channel = 0; channel < 8; channel++){
+    SV_CHECK_EQ(scan_conversions[channel], 10);
+  }
+  SV_CHECK_EQ(at_frame[frame].adc_conversions - at_frame[frame - 1].adc_conversions, 80);
+  SV_CHECK_EQ(records[frame], MSP_RECORDS);
+  SV_CHECK_EQ(at_frame[frame].isr[ADC10_VECTOR] - at_frame[frame - 1].isr[ADC10_VECTOR], 1);
+  SV_CHECK_EQ(at_frame[frame].wakes[ADC10_VECTOR] - at_frame[frame - 1].wakes[ADC10_VECTOR], 1);
+
+  // 64 clocks of sample and hold and 13 of conversion at ADC10OSC
+  uint64_t conversion = sv_sim_adc_conversion_ns();
+  SV_CHECK_EQ(conversion, (64 + 13) * SV_SIM_NS / SV_SIM_ADC10OSC_HZ);
+  SV_CHECK_EQ(last_conversion - first_conversion, 79 * conversion);
+  printf("adc: 80 conversions in 1 wake, scan %.2f ms in LPM3 at 5 MHz ADC10OSC (%.2f to %.2f ms over 3.7 to 6.3 MHz)\n",
+         ms(80 * conversion), 80 * 77 / 6.3e3, 80 * 77 / 3.7e3);
+}
+
+// Anemometer at 1 kHz, the top of the 16 bit window count, and rain tips while the MSP430 sleeps
+static void test_msp_pulses(void){
+  unsigned long tips = 0;
+  int first;
+  int frame;
+  int i;
+
+  // the frame that was being flushed holds no pulses, the next ones count them
+  sv_sim_pulses(3, sv_sim.now, SV_SIM_MS, 3000000);
+  sv_sim_pulses(4, sv_sim.now + SV_SIM_NS, SV_SIM_NS, 3);
+  first = run_frames(1);
+  frame = run_until(SV_FIELD_RAIN);
+  for (i = first; i <= frame; i++){
+    tips += frame_value(i, SV_FIELD_RAIN) > 0 ? (unsigned long)frame_value(i, SV_FIELD_RAIN) : 0;
+  }
+  frame = run_frames(2);
+  if (frames != frame + 2){
+    return;
+  }
+
+  const sv_sim_t *a = &at_frame[frame];
+  const sv_sim_t *b = &at_frame[frame + 1];
+  double window = frame_value(frame + 1, SV_FIELD_WIND_SPEED);
+  unsigned long interrupts = b->isr[PORT2_VECTOR] - a->isr[PORT2_VECTOR];
+
+  // every tip, all of them came during the sleep with the window pins off
+  SV_CHECK_EQ(tips, 3);
+  SV_CHECK_EQ(sv_sim.pulses[4].pulses, 3);
+  // 60 s at 512 Hz (ACLK / 8, ID_3), the first count comes up to one 512 Hz period after the start
+  SV_CHECK(window >= 59998 && window <= 60000);
+  // the counter never wakes the CPU, one interrupt per pulse of the window
+  SV_CHECK_EQ(b->wakes[PORT2_VECTOR], 0);
+  SV_CHECK_EQ(interrupts, (unsigned long)window);
+
+  printf("pulses: %.0f wind pulses at 1 kHz in the window, %lu of %lu rain tips counted across sleep, "
+         "%lu PORT2 interrupts a frame and 0 wakes, %lu cycles of entry and RETI\n",
+         window, tips, sv_sim.pulses[4].pulses, interrupts, interrupts * SV_SIM_ISR_CYCLES);
+}
+
+// A day of the default SV_PERIOD_ schedule: wakes by cause, time in each mode and readings sent
+static void test_msp_day(void){
+  unsigned long fields_before[SV_FIELD_COUNT];
+  sv_sim_t before = sv_sim;
+  int frames_before = frames;
+  unsigned long wakes = 0;
+  int vector;
+  int field;
+
+  memcpy(fields_before, field_frames, sizeof(fields_before));
+  stop_after = -1;
+  sv_sim_run(DAY);
+
+  unsigned long day_frames = (unsigned long)(frames - frames_before);
+  unsigned long timer = sv_sim.wakes[TIMER0_A0_VECTOR] - before.wakes[TIMER0_A0_VECTOR];
+  unsigned long uart = sv_sim.wakes[USCIAB0TX_VECTOR] - before.wakes[USCIAB0TX_VECTOR];
+  unsigned long adc = sv_sim.wakes[ADC10_VECTOR] - before.wakes[ADC10_VECTOR];
+  for (vector = 0; vector < SV_MSP_VECTORS; vector++){
+    wakes += sv_sim.wakes[vector] - before.wakes[vector];
+  }
+
+  // the wind sensors set the pace, every 300 s, the others come along on their own period
+  SV_CHECK(day_frames >= 24 * 3600 / SV_PERIOD_WIND_SPEED - 1 && day_frames <= 24 * 3600 / SV_PERIOD_WIND_SPEED);
+  SV_CHECK_EQ(adc, day_frames);
+  for (field = 0; field < SV_FIELD_COUNT; field++){
+    unsigned long sent = field_frames[field] - fields_before[field];
+    if (field == SV_FIELD_AIR_TEMP || field == SV_FIELD_AIR_HUMID || field == SV_FIELD_AIR_PRES){
+      SV_CHECK_EQ(sent, 0);
+    }
+  }
+  SV_CHECK(field_frames[SV_FIELD_SOIL_PH] - fields_before[SV_FIELD_SOIL_PH] >= 23);
+  SV_CHECK(field_frames[SV_FIELD_SOIL_PH] - fields_before[SV_FIELD_SOIL_PH] <= 24);
+  SV_CHECK(sv_sim.ns_active - before.ns_active <= day_frames * 2 * sv_sim_uart_byte_ns());
+  SV_CHECK_EQ(tx_pending_sleeps, 0);
+
+  printf("day: %lu frames, %lu wind, %lu rain and soil temperature, %lu pH and moisture readings; "
+         "%lu wakes (%lu timer, %lu ADC, %lu UART), %.0f ms in LPM0, %.1f s with SMCLK off in LPM3, %.0f ms awake\n",
+         day_frames, field_frames[SV_FIELD_WIND_SPEED] - fields_before[SV_FIELD_WIND_SPEED],
+         field_frames[SV_FIELD_RAIN] - fields_before[SV_FIELD_RAIN],
+         field_frames[SV_FIELD_SOIL_PH] - fields_before[SV_FIELD_SOIL_PH],
+         wakes, timer, adc, uart, ms(sv_sim.ns_lpm0 - before.ns_lpm0),
+         (double)(sv_sim.ns_lpm3 - before.ns_lpm3) / SV_SIM_NS, ms(sv_sim.ns_active - before.ns_active));
+}
+
+int main(){
+  power_up();
+  test_msp_uart();
+  test_msp_data_ready();
+  test_msp_adc();
+  test_msp_pulses();
+  test_msp_day();
+  return sv_test_end("test_msp");
+}
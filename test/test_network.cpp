@@ -0,0 +1,571 @@
+// Gateway side of the network on the host: duplicate / late / restarted frames in the node table,
+//  the receive queue between the DIO0 interrupt and the uploader, the packets it drops in a burst
+//  while the uploader is busy, the steps of the ADR and the slot assignments, then a day of several
+//  nodes under TDMA and ADR: collisions with and without the slot assignments of the beacon, the
+//  spreading factor and TX powers it settles on, and the step up when the weakest node fades. Last,
+//  the collision rate and the delivered frames as the network grows from 1 to 200 nodes
+
+#include "sv_test.h"
+#include "SmartVit_adr.h"
+#include "SmartVit_queue.h"
+
+/* ******************** DEFINES ******************** */
+
+#define BURST_PACKETS  40
+#define UPLOAD_US      1000000UL    // one HTTP POST of the uploader
+
+#define SIM_NODES       6
+#define SIM_NODES_MAX   200
+#define SIM_READING_MS  300000UL    // one frame per node every 5 min, as the senders
+#define SIM_WARMUP_MS   (2 * 3600000UL)
+#define SIM_DAY_MS      (24 * 3600000UL)
+
+/* ******************** TYPES AND STRUCTS ******************** */
+
+// Receive queue of a burst and the uploader draining it
+typedef struct {
+  sv_rx_queue_t queue;
+  uint32_t arrival[BURST_PACKETS];
+  uint32_t free_at;                 // end of the upload in progress
+  uint32_t max_wait;
+  int uploaded;
+  int last;                         // packet of the last upload
+} burst_t;
+
+typedef struct {
+  uint8_t  id;
+  int16_t  snr_max;         // SNR at the gateway at full power, 0.1 dB
+  int8_t   tx_power;
+  uint16_t seq;
+  uint32_t next_reading;    // a frame waits for its slot from then on
+  uint32_t sent;
+  uint32_t delivered;
+} sim_node_t;
+
+typedef struct {
+  sv_node_table_t table;
+  sv_beacon_t beacon;
+  uint32_t raised;
+  uint32_t now;
+  uint32_t collisions;      // frames lost because another node sent in the same slot
+  uint8_t  assign;          // slot assignments sent in the beacon
+} sim_t;
+
+/* ******************** HELPERS ******************** */
+
+// process_packet(): peek, decode, release, then the upload of UPLOAD_US
+static void burst_upload(burst_t *burst, uint32_t now){
+  const sv_rx_packet_t *packet = sv_rx_queue_peek(&burst->queue);
+  uint32_t wait = now - burst->arrival[packet->buf[0]];
+
+  SV_CHECK(packet->buf[0] > burst->last);     // oldest first
+  burst->last = packet->buf[0];
+  if (wait > burst->max_wait){
+    burst->max_wait = wait;
+  }
+  sv_rx_queue_release(&burst->queue);
+  burst->free_at = now + UPLOAD_US;
+  burst->uploaded++;
+}
+
+// Entry of node in the table, NULL when it is not tracked
+static const sv_node_stats_t *table_entry(const sv_node_table_t *table, uint8_t node){
+  uint8_t i;
+
+  for (i = 0; i < SV_NODE_TABLE_LEN; i++){
+    if (table->entry[i].used && table->entry[i].node == node){
+      return &table->entry[i];
+    }
+  }
+  return NULL;
+}
+
+static void sim_init(sim_t *sim, sim_node_t *nodes, const uint8_t *ids, const int16_t *snr, const uint32_t *first_reading, uint8_t count, uint8_t assign){
+  uint8_t i;
+
+  memset(sim, 0, sizeof(*sim));
+  sv_node_table_init(&sim->table);
+  sim->beacon.slots = SV_TDMA_SLOTS;
+  sim->beacon.sf = SV_ADR_SF_MAX;
+  sim->assign = assign;
+  for (i = 0; i < count; i++){
+    memset(&nodes[i], 0, sizeof(nodes[i]));
+    nodes[i].id = ids[i];
+    nodes[i].snr_max = snr[i];
+    nodes[i].tx_power = SV_ADR_POWER_MAX;
+    nodes[i].next_reading = first_reading[i];
+  }
+}
+
+// One superframe: beacon on the wire, then every node with a frame ready sends in its slot
+static void sim_superframe(sim_t *sim, sim_node_t *nodes, uint8_t count){
+  uint8_t buf[SV_BEACON_MAX_LEN];
+  sv_beacon_t heard;
+  uint8_t slot[SIM_NODES_MAX];
+  uint8_t sending[SIM_NODES_MAX];
+  uint8_t senders[256];     // nodes sending in each slot
+  uint8_t i;
+
+  // gateway, as send_beacon() of the receiver
+  sim->beacon.superframe++;
+  sim->beacon.sf = sv_adr_network_sf(&sim->table, sim->beacon.sf, &sim->raised, sim->now);
+  sim->beacon.slot_ms = sv_tdma_slot_ms(sim->beacon.sf);
+  sv_adr_hints(&sim->table, &sim->beacon, sim->now);
+  sv_adr_slots(&sim->table, &sim->beacon, sim->now);
+  if (!sim->assign){
+    sim->beacon.slot_count = 0;
+  }
+  size_t len = sv_beacon_encode(&sim->beacon, buf);
+  int decoded = sv_beacon_decode(buf, len, &heard);
+  SV_CHECK_EQ(decoded, SV_FRAME_OK);
+  if (decoded != SV_FRAME_OK){
+    return;
+  }
+
+  // nodes, as get_beacon() of the sender
+  for (i = 0; i < count; i++){
+    int8_t power;
+    if (sv_beacon_hint(&heard, nodes[i].id, &power)){
+      nodes[i].tx_power = power;
+    }
+    slot[i] = sv_beacon_slot(&heard, nodes[i].id);
+    sending[i] = sim->now >= nodes[i].next_reading;
+  }
+  memset(senders, 0, sizeof(senders));
+  for (i = 0; i < count; i++){
+    senders[slot[i]] += sending[i];
+  }
+
+  for (i = 0; i < count; i++){
+    sim_node_t *node = &nodes[i];
+    if (!sending[i]){
+      continue;
+    }
+    node->sent++;
+    node->next_reading += SIM_READING_MS;
+    uint16_t seq = node->seq++;
+    if (senders[slot[i]] > 1){
+      sim->collisions++;
+      continue;
+    }
+    int16_t snr = (int16_t)(node->snr_max - 10 * (SV_ADR_POWER_MAX - node->tx_power));
+    if (snr < sv_adr_required_snr(heard.sf)){
+      continue;
+    }
+    // gateway, as process_packet() of the receiver
+    uint32_t at = sim->now + sv_tdma_slot_offset_ms(&heard, node->id);
+    sv_node_stats_t *entry = sv_node_lookup(&sim->table, node->id, at);
+    if (sv_node_update(entry, seq, -100, at) == SV_NODE_NEW){
+      sv_adr_update(entry, snr, node->tx_power);
+      node->delivered++;
+    }
+  }
+  sim->now += sv_tdma_superframe_ms(heard.slots, heard.slot_ms);
+}
+
+/* ******************** TESTS ******************** */
+
+static void test_node_table(void){
+  sv_node_table_t table;
+  sv_node_stats_t *entry;
+  uint32_t lost;
+
+  sv_node_table_init(&table);
+  SV_CHECK(table_entry(&table, 5) == NULL);
+  entry = sv_node_lookup(&table, 5, 0);
+  SV_CHECK_EQ(sv_node_update(entry, 10, -90, 0), SV_NODE_NEW);
+  SV_CHECK(table_entry(&table, 5) == entry);
+
+  SV_CHECK_EQ(sv_node_update(entry, 11, -90, 1), SV_NODE_NEW);
+  SV_CHECK_EQ(sv_node_update(entry, 11, -90, 2), SV_NODE_DUPLICATE);     // replay of the last one
+  SV_CHECK_EQ(sv_node_update(entry, 14, -90, 3), SV_NODE_NEW);
+  SV_CHECK_EQ(entry->lost, 2);
+  SV_CHECK_EQ(sv_node_update(entry, 12, -90, 4), SV_NODE_NEW);           // late, given back
+  SV_CHECK_EQ(entry->lost, 1);
+  SV_CHECK_EQ(sv_node_update(entry, 12, -90, 5), SV_NODE_DUPLICATE);     // replay inside the window
+  SV_CHECK_EQ(sv_node_update(entry, 10, -90, 6), SV_NODE_DUPLICATE);
+  SV_CHECK_EQ(entry->received, 4);
+  SV_CHECK_EQ(entry->duplicates, 3);
+  SV_CHECK_EQ(entry->last_rssi, -90);
+
+  // far behind the window: the node restarted its sequence
+  SV_CHECK_EQ(sv_node_update(entry, 40000, -90, 7), SV_NODE_NEW);
+  SV_CHECK_EQ(sv_node_update(entry, 3, -90, 8), SV_NODE_NEW);
+  SV_CHECK_EQ(entry->last_seq, 3);
+
+  // reboot of the node before SV_NODE_WINDOW frames: its new frames are not replays of the old ones
+  SV_CHECK_EQ(sv_node_update(entry, 4, -90, 8), SV_NODE_NEW);
+  SV_CHECK_EQ(sv_node_update(entry, 20, -90, 8), SV_NODE_NEW);
+  lost = entry->lost;
+  SV_CHECK_EQ(sv_node_update(entry, 0, -90, 8), SV_NODE_NEW);
+  SV_CHECK_EQ(sv_node_update(entry, 0, -90, 8), SV_NODE_DUPLICATE);
+  SV_CHECK_EQ(sv_node_update(entry, 1, -90, 8), SV_NODE_NEW);
+  SV_CHECK_EQ(sv_node_update(entry, 2, -90, 8), SV_NODE_NEW);
+  SV_CHECK_EQ(entry->last_seq, 2);
+  SV_CHECK_EQ(entry->lost, lost);
+  // and from past half the sequence, 0 is not 25535 frames ahead
+  SV_CHECK_EQ(sv_node_update(entry, 40000, -90, 8), SV_NODE_NEW);
+  SV_CHECK_EQ(sv_node_update(entry, 0, -90, 8), SV_NODE_NEW);
+  SV_CHECK_EQ(entry->lost, lost);
+
+  // across the wrap of the sequence number
+  SV_CHECK_EQ(sv_node_update(entry, 30000, -90, 9), SV_NODE_NEW);
+  SV_CHECK_EQ(sv_node_update(entry, 60000, -90, 10), SV_NODE_NEW);
+  SV_CHECK_EQ(sv_node_update(entry, 65535, -90, 11), SV_NODE_NEW);
+  lost = entry->lost;
+  SV_CHECK_EQ(sv_node_update(entry, 0, -90, 12), SV_NODE_NEW);
+  SV_CHECK_EQ(entry->lost, lost);
+  SV_CHECK_EQ(sv_node_update(entry, 65535, -90, 13), SV_NODE_DUPLICATE);
+
+  // a full table gives the stalest entry to a new node
+  uint8_t node;
+  for (node = 100; node < 100 + SV_NODE_TABLE_LEN - 1; node++){
+    sv_node_update(sv_node_lookup(&table, node, 1000 + node), 0, -90, 1000 + node);
+  }
+  SV_CHECK(table_entry(&table, 5) == entry);
+  entry = sv_node_lookup(&table, 200, 5000);
+  SV_CHECK(table_entry(&table, 5) == NULL);
+  SV_CHECK_EQ(entry->node, 200);
+  SV_CHECK_EQ(entry->received, 0);
+}
+
+static void test_rx_queue(void){
+  static sv_rx_queue_t queue;
+  sv_rx_packet_t *packet;
+  const sv_rx_packet_t *peeked;
+  int i;
+
+  sv_rx_queue_init(&queue);
+  SV_CHECK(sv_rx_queue_peek(&queue) == NULL);
+  for (i = 0; i < SV_RX_QUEUE_LEN + 2; i++){
+    packet = sv_rx_queue_reserve(&queue);
+    if (packet != NULL){
+      packet->len = (uint8_t)i;
+      sv_rx_queue_commit(&queue);
+    }
+  }
+  SV_CHECK_EQ(sv_rx_queue_dropped(&queue), 2);
+  for (i = 0; i < SV_RX_QUEUE_LEN; i++){
+    peeked = sv_rx_queue_peek(&queue);
+    SV_CHECK(peeked != NULL && peeked->len == i);
+    sv_rx_queue_release(&queue);
+  }
+  SV_CHECK(sv_rx_queue_peek(&queue) == NULL);
+
+  // the free running indexes wrap
+  for (i = 0; i < 300; i++){
+    packet = sv_rx_queue_reserve(&queue);
+    packet->len = (uint8_t)i;
+    sv_rx_queue_commit(&queue);
+    SV_CHECK_EQ(sv_rx_queue_peek(&queue)->len, (uint8_t)i);
+    sv_rx_queue_release(&queue);
+  }
+  SV_CHECK_EQ(sv_rx_queue_dropped(&queue), 2);
+}
+
+// Full frames back to back while the uploader is slower than the radio
+static void test_rx_burst(void){
+  static burst_t burst;
+  uint32_t airtime = sv_lora_airtime_us(sv_frame_len(SV_ENABLED_FIELDS), 7, SV_LORA_BANDWIDTH, SV_LORA_CODING_RATE);
+  int next = 0;
+
+  memset(&burst, 0, sizeof(burst));
+  burst.last = -1;
+  sv_rx_queue_init(&burst.queue);
+  while (next < BURST_PACKETS || sv_rx_queue_peek(&burst.queue) != NULL){
+    uint32_t arrive = next < BURST_PACKETS ? (uint32_t)next * airtime : UINT32_MAX;
+
+    // the upload in progress ends first, the uploader goes on with the oldest packet
+    if (sv_rx_queue_peek(&burst.queue) != NULL && burst.free_at < arrive){
+      burst_upload(&burst, burst.free_at);
+      continue;
+    }
+
+    // on_receive(), an arrival at the same time as the end of an upload comes first
+    sv_rx_packet_t *packet = sv_rx_queue_reserve(&burst.queue);
+    if (packet != NULL){
+      packet->buf[0] = (uint8_t)next;
+      packet->len = 1;
+      burst.arrival[next] = arrive;
+      sv_rx_queue_commit(&burst.queue);
+    }
+    if (burst.free_at <= arrive && sv_rx_queue_peek(&burst.queue) != NULL){
+      burst_upload(&burst, arrive);     // the uploader was idle
+    }
+    next++;
+  }
+
+  // one packet in the uploader, SV_RX_QUEUE_LEN waiting, then one more each time an upload starts
+  uint32_t starts = (BURST_PACKETS - 1) * airtime / UPLOAD_US;
+  SV_CHECK(UPLOAD_US > SV_RX_QUEUE_LEN * airtime);     // the queue is full before the first upload ends
+  SV_CHECK_EQ(burst.uploaded, 1 + SV_RX_QUEUE_LEN + starts);
+  SV_CHECK_EQ(sv_rx_queue_dropped(&burst.queue), BURST_PACKETS - burst.uploaded);
+  printf("rx queue: burst of %d frames %.1f ms apart, %lu ms uploads, %u slots: %d uploaded, %u dropped, "
+         "longest wait in the queue %.1f s\n",
+         BURST_PACKETS, airtime / 1000.0, UPLOAD_US / 1000, SV_RX_QUEUE_LEN, burst.uploaded,
+         (unsigned)sv_rx_queue_dropped(&burst.queue), burst.max_wait / 1e6);
+}
+
+// Nodes 1, 33 and 65 share the default slot 2 of a 32 slot superframe, 1 and 33 read 2 s apart.
+//  Node 3 is the weakest, node 2 the strongest.
+static const uint8_t sim_ids[SIM_NODES] = {1, 33, 65, 2, 3, 40};
+static const int16_t sim_snr[SIM_NODES] = {50, -20, 20, 80, -40, 0};
+static const uint32_t sim_first_reading[SIM_NODES] = {0, 2000, 150000, 1000, 60000, 200000};
+
+// Steps of the network spreading factor for one node on the table
+static void test_adr_steps(void){
+  sv_node_table_t table;
+  sv_node_stats_t *entry;
+  sv_node_stats_t *weak;
+  uint32_t raised = 0;
+  uint32_t now = 1000;
+  uint8_t sf;
+
+  // nobody heard: the slowest spreading factor
+  sv_node_table_init(&table);
+  SV_CHECK_EQ(sv_adr_network_sf(&table, SV_ADR_SF_MIN, &raised, now), SV_ADR_SF_MAX);
+
+  // a strong node: one step down per superframe once the hold is over
+  entry = sv_node_lookup(&table, 5, now);
+  sv_node_update(entry, 0, -90, now);
+  sv_adr_update(entry, 100, SV_ADR_POWER_MAX);
+  sf = sv_adr_network_sf(&table, SV_ADR_SF_MAX, &raised, now);
+  SV_CHECK_EQ(sf, SV_ADR_SF_MAX);
+  now += SV_ADR_HOLD_MS;
+  sf = sv_adr_network_sf(&table, sf, &raised, now);
+  SV_CHECK_EQ(sf, SV_ADR_SF_MAX - 1);
+  sf = sv_adr_network_sf(&table, sf, &raised, now);
+  SV_CHECK_EQ(sf, SV_ADR_SF_MAX - 2);
+
+  // new losses of a node heard well above the floor: collisions, the step down goes on
+  sv_node_update(entry, 3, -90, now);
+  SV_CHECK_EQ(entry->lost, 2);
+  sf = sv_adr_network_sf(&table, sf, &raised, now);
+  SV_CHECK_EQ(sf, SV_ADR_SF_MAX - 3);
+
+  // new losses of a node 4 dB above the floor: one step up, then no other one nor a step down before
+  //  the hold is over
+  weak = sv_node_lookup(&table, 6, now);
+  sv_node_update(weak, 0, -90, now);
+  sv_adr_update(weak, sv_adr_required_snr(sf) + 40, SV_ADR_POWER_MAX - 2 * SV_ADR_POWER_STEP);
+  SV_CHECK_EQ(sv_adr_network_sf(&table, sf, &raised, now), sf);
+  sv_node_update(weak, 3, -90, now);
+  sf = sv_adr_network_sf(&table, sf, &raised, now);
+  SV_CHECK_EQ(sf, SV_ADR_SF_MAX - 2);
+  sv_node_update(weak, 6, -90, now + 1);
+  sf = sv_adr_network_sf(&table, sf, &raised, now + 1);
+  SV_CHECK_EQ(sf, SV_ADR_SF_MAX - 2);
+  sf = sv_adr_network_sf(&table, sf, &raised, now + SV_ADR_HOLD_MS - 1);
+  SV_CHECK_EQ(sf, SV_ADR_SF_MAX - 2);
+
+  // silent for SV_ADR_SILENT_MS: up again
+  now += SV_ADR_SILENT_MS + 2;
+  sf = sv_adr_network_sf(&table, sf, &raised, now);
+  SV_CHECK_EQ(sf, SV_ADR_SF_MAX - 1);
+}
+
+// Free slots of a 4 slot superframe for the nodes above it and the ones that share a slot
+static void test_slot_assignment(void){
+  static const uint8_t ids[] = {1, 5, 2, 9};
+  sv_node_table_t table;
+  sv_beacon_t beacon;
+  uint8_t superframe;
+  uint8_t node;
+  unsigned i;
+
+  sv_node_table_init(&table);
+  memset(&beacon, 0, sizeof(beacon));
+  beacon.slots = 4;
+
+  // 1 and 2 keep slots 2 and 3, 5 and 9 get the free ones
+  for (i = 0; i < sizeof(ids); i++){
+    sv_node_update(sv_node_lookup(&table, ids[i], 0), 0, -90, 0);
+  }
+  SV_CHECK_EQ(sv_adr_slots(&table, &beacon, 1), 0);
+  SV_CHECK_EQ(beacon.slot_count, 2);
+  SV_CHECK_EQ(sv_beacon_slot(&beacon, 1), 2);
+  SV_CHECK_EQ(sv_beacon_slot(&beacon, 2), 3);
+  SV_CHECK_EQ(sv_beacon_slot(&beacon, 5), 1);
+  SV_CHECK_EQ(sv_beacon_slot(&beacon, 9), 4);
+
+  // a fifth node: no free slot left
+  sv_node_update(sv_node_lookup(&table, 13, 0), 0, -90, 0);
+  SV_CHECK_EQ(sv_adr_slots(&table, &beacon, 1), 1);
+
+  // silent nodes give their slot back
+  sv_node_update(sv_node_lookup(&table, 6, SV_ADR_NODE_TIMEOUT_MS), 0, -90, SV_ADR_NODE_TIMEOUT_MS);
+  SV_CHECK_EQ(sv_adr_slots(&table, &beacon, SV_ADR_NODE_TIMEOUT_MS + 1), 0);
+  SV_CHECK_EQ(beacon.slot_count, 1);
+  SV_CHECK_EQ(sv_beacon_slot(&beacon, 6), 1);
+  for (node = 0; node < 4; node++){
+    SV_CHECK_EQ(sv_beacon_slot(&beacon, node), 1 + node);
+  }
+
+  // unassigned nodes sharing a default slot only meet once every slots superframes
+  int meetings = 0;
+  int fixed = 0;
+  for (superframe = 0; superframe < SV_TDMA_SLOTS; superframe++){
+    meetings += sv_tdma_default_slot(33, SV_TDMA_SLOTS, superframe) == sv_tdma_default_slot(65, SV_TDMA_SLOTS, superframe);
+    fixed += sv_tdma_default_slot(33, SV_TDMA_SLOTS, superframe) == sv_tdma_default_slot(1, SV_TDMA_SLOTS, superframe);
+    SV_CHECK_EQ(sv_tdma_default_slot(1, SV_TDMA_SLOTS, superframe), 2);
+  }
+  SV_CHECK_EQ(meetings, 1);
+  SV_CHECK_EQ(fixed, 1);
+}
+
+static void sim_run(sim_t *sim, sim_node_t *nodes, uint8_t count, uint32_t until){
+  while (sim->now < until){
+    sim_superframe(sim, nodes, count);
+  }
+}
+
+static void sim_reset_counts(sim_t *sim, sim_node_t *nodes, uint8_t count){
+  uint8_t i;
+
+  sim->collisions = 0;
+  for (i = 0; i < count; i++){
+    nodes[i].sent = 0;
+    nodes[i].delivered = 0;
+  }
+}
+
+static void test_network_simulation(void){
+  static sim_t sim;
+  sim_node_t nodes[SIM_NODES];
+  uint32_t lost = 0;
+  uint8_t i;
+
+  // default slots only: 33 and 65 move across the slots and meet the others now and then, the table
+  //  counts their losses
+  sim_init(&sim, nodes, sim_ids, sim_snr, sim_first_reading, SIM_NODES, 0);
+  SV_CHECK_EQ(sim.beacon.sf, SV_ADR_SF_MAX);
+  sim_run(&sim, nodes, SIM_NODES, SIM_DAY_MS);
+  uint32_t default_collisions = sim.collisions;
+  SV_CHECK(default_collisions > 0);
+  for (i = 0; i < SIM_NODES; i++){
+    const sv_node_stats_t *entry = table_entry(&sim.table, nodes[i].id);
+    SV_CHECK(nodes[i].sent >= SIM_DAY_MS / SIM_READING_MS - 1);
+    SV_CHECK(entry != NULL && entry->received == nodes[i].delivered);
+    lost += nodes[i].sent - nodes[i].delivered;
+  }
+  SV_CHECK_EQ(lost, default_collisions);
+
+  // with the assignments, no collision once both were heard
+  sim_init(&sim, nodes, sim_ids, sim_snr, sim_first_reading, SIM_NODES, 1);
+  sim_run(&sim, nodes, SIM_NODES, SIM_WARMUP_MS);
+  sim_reset_counts(&sim, nodes, SIM_NODES);
+  sim_run(&sim, nodes, SIM_NODES, SIM_DAY_MS);
+  SV_CHECK_EQ(sim.collisions, 0);
+  for (i = 0; i < SIM_NODES; i++){
+    SV_CHECK(nodes[i].sent >= (SIM_DAY_MS - SIM_WARMUP_MS) / SIM_READING_MS - 1);
+    SV_CHECK_EQ(nodes[i].delivered, nodes[i].sent);
+  }
+
+  // down from SF12 to SF11, node 3 (-4 dB at full power) keeps the 10 dB margin at SF10 but not the
+  //  3 dB hysteresis on top of it. Every node gets the lowest power that keeps the margin
+  SV_CHECK_EQ(sim.beacon.sf, 11);
+  SV_CHECK_EQ(nodes[4].tx_power, SV_ADR_POWER_MAX - SV_ADR_POWER_STEP);
+  for (i = 0; i < SIM_NODES; i++){
+    int16_t margin = (int16_t)(nodes[i].snr_max - 10 * (SV_ADR_POWER_MAX - nodes[i].tx_power) - sv_adr_required_snr(11));
+    SV_CHECK(margin >= 10 * SV_ADR_MARGIN_DB);
+    SV_CHECK(nodes[i].tx_power - SV_ADR_POWER_STEP < SV_ADR_POWER_MIN || margin - 10 * SV_ADR_POWER_STEP < 10 * SV_ADR_MARGIN_DB);
+  }
+  printf("network: %d nodes a day in %u slots, %lu collisions on default slots, none assigned; %u ms slots at SF%u, powers",
+         SIM_NODES, sim.beacon.slots, (unsigned long)default_collisions, sim.beacon.slot_ms, sim.beacon.sf);
+  for (i = 0; i < SIM_NODES; i++){
+    printf(" %u:%d", nodes[i].id, nodes[i].tx_power);
+  }
+  printf(" dBm\n");
+
+  // node 3 fades below the SF11 floor: silence, full power and SF12, then heard again
+  nodes[4].snr_max = -190;
+  uint32_t fade = sim.now;
+  sim_run(&sim, nodes, SIM_NODES, fade + SV_ADR_SILENT_MS + 2 * SIM_READING_MS);
+  SV_CHECK_EQ(sim.beacon.sf, SV_ADR_SF_MAX);
+  SV_CHECK_EQ(nodes[4].tx_power, SV_ADR_POWER_MAX);
+  sim_reset_counts(&sim, nodes, SIM_NODES);
+  sim_run(&sim, nodes, SIM_NODES, sim.now + 6 * SIM_READING_MS);
+  SV_CHECK(nodes[4].sent > 0);
+  SV_CHECK_EQ(nodes[4].delivered, nodes[4].sent);
+  SV_CHECK_EQ(sim.collisions, 0);
+}
+
+// Day of count nodes with spread IDs and link budgets, reading at random phases, after the warm-up
+static void sweep_run(sim_t *sim, sim_node_t *nodes, uint8_t count, uint8_t assign, uint32_t *sent, uint32_t *delivered){
+  static uint8_t ids[SIM_NODES_MAX];
+  static int16_t snr[SIM_NODES_MAX];
+  static uint32_t first_reading[SIM_NODES_MAX];
+  uint32_t rng = 7;
+  uint8_t i;
+
+  for (i = 0; i < count; i++){
+    rng = rng * 1664525u + 1013904223u;
+    ids[i] = (uint8_t)(1 + (i * 97) % 254);      // all different, below and above the slot count
+    snr[i] = (int16_t)(20 + (i * 37) % 80);
+    first_reading[i] = (rng >> 8) % SIM_READING_MS;
+  }
+  sim_init(sim, nodes, ids, snr, first_reading, count, assign);
+  sim_run(sim, nodes, count, SIM_WARMUP_MS);
+  sim_reset_counts(sim, nodes, count);
+  sim_run(sim, nodes, count, SIM_DAY_MS);
+  *sent = 0;
+  *delivered = 0;
+  for (i = 0; i < count; i++){
+    *sent += nodes[i].sent;
+    *delivered += nodes[i].delivered;
+  }
+}
+
+// Collision rate and delivered frames from 1 to 200 nodes, on default slots and with the assignments
+//  The table tracks SV_NODE_TABLE_LEN nodes and a beacon assigns SV_BEACON_MAX_SLOTS slots of
+//  SV_TDMA_SLOTS: past that the other nodes stay on their default slots
+static void test_network_sweep(void){
+  static const uint8_t counts[] = {1, 2, 5, 8, 10, 20, 32, 50, 100, 150, 200};
+  static sim_t sim;
+  static sim_node_t nodes[SIM_NODES_MAX];
+  uint32_t previous = 0;
+  unsigned n;
+
+  for (n = 0; n < sizeof(counts); n++){
+    uint8_t count = counts[n];
+    uint32_t sent;
+    uint32_t delivered;
+    uint32_t collisions;
+    uint32_t assigned_sent;
+    uint32_t assigned_delivered;
+
+    sweep_run(&sim, nodes, count, 0, &sent, &delivered);
+    collisions = sim.collisions;
+    SV_CHECK(sent >= count * ((SIM_DAY_MS - SIM_WARMUP_MS) / SIM_READING_MS - 1));
+    SV_CHECK(delivered + collisions <= sent);
+    sweep_run(&sim, nodes, count, 1, &assigned_sent, &assigned_delivered);
+    SV_CHECK(assigned_delivered + sim.collisions <= assigned_sent);
+    if (count <= SV_BEACON_MAX_SLOTS){
+      SV_CHECK_EQ(sim.collisions, 0);
+      SV_CHECK_EQ(assigned_delivered, assigned_sent);
+    }
+    if (count <= SV_TDMA_SLOTS){
+      SV_CHECK(sim.collisions <= collisions);
+    }
+    // the collisions do not slow the network down: the weakest node, 2 dB at full power, needs SF9
+    SV_CHECK(sim.beacon.sf <= 9);
+    SV_CHECK(assigned_delivered > previous);
+    previous = assigned_delivered;
+    printf("network: %3u nodes, %5.2f%% of the frames collide and %6.1f frames/h are delivered on default slots,"
+           " %5.2f%% and %6.1f frames/h with the assignments at SF%u\n",
+           count, 100.0 * collisions / sent, delivered / ((SIM_DAY_MS - SIM_WARMUP_MS) / 3600000.0),
+           100.0 * sim.collisions / assigned_sent, assigned_delivered / ((SIM_DAY_MS - SIM_WARMUP_MS) / 3600000.0),
+           sim.beacon.sf);
+  }
+}
+
+int main(){
+  test_node_table();
+  test_rx_queue();
+  test_rx_burst();
+  test_adr_steps();
+  test_slot_assignment();
+  test_network_simulation();
+  test_network_sweep();
+  return sv_test_end("test_network");
+}
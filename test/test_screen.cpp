@@ -0,0 +1,217 @@
+// Status screen on the host: an SSD1306 model behind the I2C stub checks that the panel always
+//  matches the framebuffer after a flush, that changed fields redraw the same pixels as a full
+//  redraw, and counts the I2C bytes of the dirty updates against display()
+
+#include "sv_test.h"
+
+#include <Wire.h>
+#include <Adafruit_SSD1306.h>
+#include "SmartVit_screen.h"
+
+#include <stdlib.h>
+
+/* ******************** DEFINES ******************** */
+
+#define PACKETS       1000
+
+/* ******************** TYPES AND STRUCTS ******************** */
+
+// GDDRAM of the controller in horizontal addressing mode, as set by begin() of the library
+typedef struct {
+  uint8_t gddram[SCREEN_WIDTH * SV_SCREEN_PAGES];
+  uint8_t col_start;
+  uint8_t col_end;
+  uint8_t page_start;
+  uint8_t page_end;
+  uint8_t col;
+  uint8_t page;
+  uint8_t command;          // command waiting for its parameters, 0 when none
+  uint8_t params[2];
+  uint8_t param_count;
+} panel_t;
+
+/* ******************** HELPERS ******************** */
+
+static void panel_init(panel_t *panel){
+  memset(panel, 0, sizeof(*panel));
+  panel->col_end = SCREEN_WIDTH - 1;
+  panel->page_end = SV_SCREEN_PAGES - 1;
+}
+
+static void panel_command(panel_t *panel, uint8_t byte){
+  if (panel->command == 0){
+    if (byte == SV_SSD1306_COLUMNADDR || byte == SV_SSD1306_PAGEADDR){
+      panel->command = byte;
+      panel->param_count = 0;
+    }
+    return;
+  }
+  panel->params[panel->param_count++] = byte;
+  if (panel->param_count < 2){
+    return;
+  }
+  if (panel->command == SV_SSD1306_COLUMNADDR){
+    panel->col_start = panel->params[0] & (SCREEN_WIDTH - 1);
+    panel->col_end = panel->params[1] & (SCREEN_WIDTH - 1);
+    panel->col = panel->col_start;
+  }
+  else{
+    panel->page_start = panel->params[0] & (SV_SCREEN_PAGES - 1);
+    panel->page_end = panel->params[1] & (SV_SCREEN_PAGES - 1);
+    panel->page = panel->page_start;
+  }
+  panel->command = 0;
+}
+
+static void panel_data(panel_t *panel, uint8_t byte){
+  panel->gddram[panel->page * SCREEN_WIDTH + panel->col] = byte;
+  if (panel->col++ == panel->col_end){
+    panel->col = panel->col_start;
+    panel->page = panel->page == panel->page_end ? panel->page_start : panel->page + 1;
+  }
+}
+
+// One I2C transaction: control byte, then commands or data
+static void panel_receive(void *context, const uint8_t *data, size_t len){
+  panel_t *panel = (panel_t *)context;
+  size_t i;
+
+  if (len == 0){
+    return;
+  }
+  for (i = 1; i < len; i++){
+    if (data[0] == SV_SSD1306_CONTROL_DATA){
+      panel_data(panel, data[i]);
+    }
+    else{
+      panel_command(panel, data[i]);
+    }
+  }
+}
+
+// Title and field names of the receiver
+static void draw_labels(sv_screen_t *screen){
+  static const char *labels[] = {"Packets:", "Bytes:", "RSSI:", "SNR:", "Dropped:", "Pending:"};
+  uint8_t i;
+
+  sv_screen_label(screen, 0, 0, "LORA RECEIVER");
+  for (i = 0; i < 6; i++){
+    sv_screen_label(screen, 0, (uint8_t)(2 + i), labels[i]);
+  }
+}
+
+static void init_fields(sv_screen_field_t *fields){
+  uint8_t i;
+
+  for (i = 0; i < 6; i++){
+    sv_screen_field_t field = SV_SCREEN_FIELD(54, (uint8_t)(2 + i), 12);
+    fields[i] = field;
+  }
+}
+
+// Framebuffer of a screen drawn at once with the texts of fields
+static int same_as_redraw(Adafruit_SSD1306 *display, const sv_screen_field_t *fields){
+  static TwoWire wire;
+  Adafruit_SSD1306 reference(SCREEN_WIDTH, SCREEN_HEIGHT, &wire);
+  sv_screen_t screen;
+  sv_screen_field_t redrawn[6];
+  uint8_t i;
+
+  sv_screen_begin(&screen, &reference, &wire, OLED_ADDRESS);
+  draw_labels(&screen);
+  init_fields(redrawn);
+  for (i = 0; i < 6; i++){
+    sv_screen_set(&screen, &redrawn[i], fields[i].text);
+  }
+  return memcmp(reference.getBuffer(), display->getBuffer(), SCREEN_WIDTH * SV_SCREEN_PAGES) == 0;
+}
+
+/* ******************** TESTS ******************** */
+
+static void test_receiver_screen(void){
+  static panel_t panel;
+  Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire);
+  sv_screen_t screen;
+  sv_screen_field_t fields[6];
+  unsigned long total = 0;
+  unsigned long most = 0;
+  unsigned long full;
+  int packet;
+
+  panel_init(&panel);
+  memset(panel.gddram, 0xA5, sizeof(panel.gddram));      // whatever the panel held before
+  Wire.device = panel_receive;
+  Wire.context = &panel;
+
+  display.begin(SSD1306_SWITCHCAPVCC, OLED_ADDRESS, false, false);
+  sv_screen_begin(&screen, &display, &Wire, OLED_ADDRESS);
+  draw_labels(&screen);
+  init_fields(fields);
+  SV_CHECK(sv_screen_flush(&screen, 0));
+  SV_CHECK(memcmp(panel.gddram, display.getBuffer(), sizeof(panel.gddram)) == 0);
+  SV_CHECK_EQ(Wire.clock, SV_SCREEN_I2C_CLOCK_AFTER);
+  SV_CHECK(!sv_screen_flush(&screen, 0));
+
+  // what display() costs for the same screen
+  Wire.bytes = 0;
+  display.display();
+  full = Wire.bytes;
+
+  // per received packet, as process_packet() and update_screen() of the receiver
+  srand(1);
+  for (packet = 1; packet <= PACKETS; packet++){
+    Wire.bytes = 0;
+    sv_screen_set_int(&screen, &fields[0], packet);
+    sv_screen_set_int(&screen, &fields[1], rand() % 2 ? 30 : 22);
+    sv_screen_set_int(&screen, &fields[2], -80 - rand() % 30);
+    sv_screen_set_int(&screen, &fields[3], (rand() % 200 - 100) / 10);
+    sv_screen_set_int(&screen, &fields[4], packet / 300);
+    sv_screen_set_int(&screen, &fields[5], packet % 10);
+    sv_screen_flush(&screen, (unsigned long)packet * 1000);
+    SV_CHECK(memcmp(panel.gddram, display.getBuffer(), sizeof(panel.gddram)) == 0);
+    total += Wire.bytes;
+    if (Wire.bytes > most){
+      most = Wire.bytes;
+    }
+  }
+  SV_CHECK(same_as_redraw(&display, fields));
+  SV_CHECK_EQ(Wire.overflows, 0);
+  SV_CHECK(total / PACKETS * 5 < full);
+  SV_CHECK(most < full);
+  printf("test_screen: %lu I2C bytes per packet on average, %lu at most, display() sends %lu\n",
+         total / PACKETS, most, full);
+
+  // a shorter text blanks the end of the old one
+  sv_screen_set(&screen, &fields[0], "123456789");
+  sv_screen_flush(&screen, 0);
+  Wire.bytes = 0;
+  SV_CHECK(sv_screen_set(&screen, &fields[0], "7"));
+  SV_CHECK(!sv_screen_set(&screen, &fields[0], "7"));
+  sv_screen_flush(&screen, 0);
+  SV_CHECK(Wire.bytes > 0);
+  SV_CHECK(same_as_redraw(&display, fields));
+  SV_CHECK(memcmp(panel.gddram, display.getBuffer(), sizeof(panel.gddram)) == 0);
+
+  // the refresh waits SV_SCREEN_REFRESH_MS after a flush, the changes stay in the framebuffer
+  sv_screen_set(&screen, &fields[5], "41");
+  SV_CHECK(sv_screen_flush(&screen, 10000));
+  sv_screen_set(&screen, &fields[5], "42");
+  SV_CHECK(!sv_screen_refresh(&screen, 10000 + SV_SCREEN_REFRESH_MS - 1));
+  SV_CHECK(memcmp(panel.gddram, display.getBuffer(), sizeof(panel.gddram)) != 0);
+  SV_CHECK(sv_screen_refresh(&screen, 10000 + SV_SCREEN_REFRESH_MS));
+  SV_CHECK(memcmp(panel.gddram, display.getBuffer(), sizeof(panel.gddram)) == 0);
+
+  // a field running off the right edge is clipped
+  sv_screen_field_t edge = SV_SCREEN_FIELD(SCREEN_WIDTH - 8, 1, 12);
+  SV_CHECK(sv_screen_set(&screen, &edge, "ABCDEF"));
+  sv_screen_flush(&screen, 20000);
+  SV_CHECK(memcmp(panel.gddram, display.getBuffer(), sizeof(panel.gddram)) == 0);
+  SV_CHECK_EQ(Wire.overflows, 0);
+
+  Wire.device = NULL;
+}
+
+int main(){
+  test_receiver_screen();
+  return sv_test_end("test_screen");
+}
@@ -0,0 +1,322 @@
+// Time series store of the gateway on the host: query parsing and status codes, the json answers
+//  as serve_query() of the receiver writes them, the tier chosen for a range, ten days of readings
+//  aggregated against a brute force sum, then the memory and query time for 1 to 16 nodes. The
+//  Makefile builds it twice, with the default tiers and with the longer ones of test_series_long
+
+#define SV_SERIES_NODES 16
+
+#include "sv_test.h"
+#include "SmartVit_series.h"
+
+#include <time.h>
+
+/* ******************** DEFINES ******************** */
+
+#ifndef TEST_NAME
+#define TEST_NAME "test_series"
+#endif
+
+#define ANSWER_LEN 4096
+#define BENCH_QUERIES 200000    // aggregate queries timed for each node count and range
+
+/* ******************** HELPERS ******************** */
+
+static void reading(struct all_sensors_data *data, uint8_t node, float temp){
+  memset(data, 0, sizeof(*data));
+  data->node = node;
+  sv_field_set(data, SV_FIELD_AIR_TEMP, temp);
+}
+
+static void add_temp(sv_series_t *series, uint8_t node, float temp, uint32_t now){
+  struct all_sensors_data data;
+
+  reading(&data, node, temp);
+  sv_series_add(series, &data, NULL, now);
+}
+
+// Body of the answer to request, as serve_query() of the receiver; returns the status
+static int answer(const sv_series_t *series, const char *request, uint32_t now, char *out){
+  char line[SV_SERIES_LINE_LEN];
+  sv_series_query_t query;
+  sv_series_cell_t cell;
+  size_t len;
+
+  out[0] = '\0';
+  int status = sv_series_query_parse(request, &query);
+  const sv_series_node_t *entry = status == SV_SERIES_OK ? sv_series_lookup((sv_series_t *)series, query.node, false) : NULL;
+  if (status == SV_SERIES_OK && entry == NULL){
+    status = SV_SERIES_NOT_FOUND;
+  }
+  if (status != SV_SERIES_OK){
+    return status;
+  }
+
+  len = sv_series_json_head(line, sizeof(line), &query, now);
+  strncat(out, line, len);
+  if (query.kind == SV_SERIES_QUERY_AGGREGATE){
+    if (sv_series_aggregate(entry, query.field, now, query.from, query.to, &cell)){
+      len = sv_series_json_cell(line, sizeof(line), query.field, &cell, false);
+      strncat(out, line, len);
+    }
+    else{
+      strcat(out, "\"count\":0");
+    }
+  }
+  else{
+    uint8_t tier = sv_series_tier(now, query.from);
+    uint32_t step = sv_series_step[tier];
+    uint32_t bucket;
+    uint32_t last;
+    bool first = true;
+
+    len = snprintf(line, sizeof(line), "\"step\":%lu,\"rows\":[", (unsigned long)step);
+    strncat(out, line, len);
+    sv_series_range(tier, now, query.from, query.to, &bucket, &last);
+    for (; bucket <= last; bucket++){
+      if (!sv_series_cell(entry, tier, query.field, bucket, &cell)){
+        continue;
+      }
+      len = snprintf(line, sizeof(line), "%s[%lu,", first ? "" : ",", (unsigned long)(now - bucket * step));
+      len += sv_series_json_cell(&line[len], sizeof(line) - len - 1, query.field, &cell, true);
+      line[len++] = ']';
+      line[len] = '\0';
+      strcat(out, line);
+      first = false;
+    }
+    strcat(out, "]");
+  }
+  strcat(out, "}");
+  return status;
+}
+
+/* ******************** TESTS ******************** */
+
+static void test_query_parse(void){
+  sv_series_query_t query;
+
+  SV_CHECK_EQ(sv_series_query_parse("GET /series?node=1&field=temp_celsius&from=3600&to=600 HTTP/1.1", &query), SV_SERIES_OK);
+  SV_CHECK_EQ(query.kind, SV_SERIES_QUERY_ROWS);
+  SV_CHECK_EQ(query.node, 1);
+  SV_CHECK_EQ(query.field, SV_FIELD_AIR_TEMP);
+  SV_CHECK_EQ(query.from, 3600);
+  SV_CHECK_EQ(query.to, 600);
+
+  SV_CHECK_EQ(sv_series_query_parse("GET /aggregate?field=qtd_chuva&from=86400&node=255 HTTP/1.1", &query), SV_SERIES_OK);
+  SV_CHECK_EQ(query.kind, SV_SERIES_QUERY_AGGREGATE);
+  SV_CHECK_EQ(query.node, 255);
+  SV_CHECK_EQ(query.field, SV_FIELD_RAIN);
+  SV_CHECK_EQ(query.to, 0);
+
+  // a key is only matched whole
+  SV_CHECK_EQ(sv_series_query_parse("GET /series?xnode=3&node=2&field=temp_celsius&from=60", &query), SV_SERIES_OK);
+  SV_CHECK_EQ(query.node, 2);
+
+  SV_CHECK_EQ(sv_series_query_parse("GET /series?node=1&from=3600", &query), SV_SERIES_BAD_REQUEST);
+  SV_CHECK_EQ(sv_series_query_parse("GET /series?node=1&field=temp&from=3600", &query), SV_SERIES_BAD_REQUEST);
+  SV_CHECK_EQ(sv_series_query_parse("GET /series?node=256&field=temp_celsius&from=3600", &query), SV_SERIES_BAD_REQUEST);
+  SV_CHECK_EQ(sv_series_query_parse("GET /series?node=1&field=temp_celsius&from=36x0", &query), SV_SERIES_BAD_REQUEST);
+  SV_CHECK_EQ(sv_series_query_parse("GET /series?node=1&field=temp_celsius&from=600&to=3600", &query), SV_SERIES_BAD_REQUEST);
+  SV_CHECK_EQ(sv_series_query_parse("GET /series?node=1&field=temp_celsius", &query), SV_SERIES_BAD_REQUEST);
+  SV_CHECK_EQ(sv_series_query_parse("GET /other?node=1 HTTP/1.1", &query), SV_SERIES_NOT_FOUND);
+  SV_CHECK_EQ(sv_series_query_parse("POST /series?node=1&field=temp_celsius&from=60", &query), SV_SERIES_NOT_FOUND);
+  SV_CHECK_EQ(sv_series_query_parse("", &query), SV_SERIES_NOT_FOUND);
+}
+
+static void test_json(void){
+  sv_series_query_t query;
+  sv_series_cell_t cell;
+  char buf[SV_SERIES_LINE_LEN];
+
+  query.kind = SV_SERIES_QUERY_AGGREGATE;
+  query.node = 1;
+  query.field = SV_FIELD_AIR_TEMP;
+  size_t len = sv_series_json_head(buf, sizeof(buf), &query, 123456);
+  SV_CHECK_EQ(len, strlen(buf));
+  SV_CHECK_STR(buf, "{\"node\":1,\"field\":\"temp_celsius\",\"now\":123456,");
+  SV_CHECK_EQ(sv_series_json_head(buf, 10, &query, 123456), 0);
+
+  // mean rounded away from zero, scaled values as fixed point
+  cell.count = 3;
+  cell.sum = -751;
+  cell.min = -300;
+  cell.max = -200;
+  len = sv_series_json_cell(buf, sizeof(buf), SV_FIELD_AIR_TEMP, &cell, false);
+  SV_CHECK_EQ(len, strlen(buf));
+  SV_CHECK_STR(buf, "\"mean\":-2.50,\"min\":-3.00,\"max\":-2.00,\"count\":3");
+  len = sv_series_json_cell(buf, sizeof(buf), SV_FIELD_AIR_TEMP, &cell, true);
+  SV_CHECK_EQ(len, strlen(buf));
+  SV_CHECK_STR(buf, "-2.50,-3.00,-2.00,3");
+  cell.count = 2;
+  cell.sum = 25;
+  cell.min = 12;
+  cell.max = 13;
+  sv_series_json_cell(buf, sizeof(buf), SV_FIELD_AIR_PRES, &cell, true);
+  SV_CHECK_STR(buf, "1.3,1.2,1.3,2");
+  SV_CHECK_EQ(sv_series_json_cell(buf, 12, SV_FIELD_AIR_TEMP, &cell, false), 0);
+}
+
+static void test_answers(void){
+  static sv_series_t series;
+  static char out[ANSWER_LEN];
+  struct all_sensors_data data;
+  struct sensors_summary summary;
+
+  sv_series_init(&series);
+  SV_CHECK_EQ(answer(&series, "GET /series?node=1&field=temp_celsius&from=900", 3000, out), SV_SERIES_NOT_FOUND);
+
+  // four 5 min buckets, two readings in the last one
+  add_temp(&series, 1, 20.0f, 2100);
+  add_temp(&series, 1, 21.0f, 2400);
+  add_temp(&series, 1, -1.5f, 2700);
+  add_temp(&series, 1, 22.0f, 3000);
+  add_temp(&series, 1, 23.0f, 3299);
+  SV_CHECK_EQ(answer(&series, "GET /series?node=1&field=temp_celsius&from=900 HTTP/1.1", 3000, out), SV_SERIES_OK);
+  SV_CHECK_STR(out, "{\"node\":1,\"field\":\"temp_celsius\",\"now\":3000,\"step\":300,\"rows\":["
+                    "[900,20.00,20.00,20.00,1],[600,21.00,21.00,21.00,1],[300,-1.50,-1.50,-1.50,1],"
+                    "[0,22.50,22.00,23.00,2]]}");
+  SV_CHECK_EQ(answer(&series, "GET /series?node=1&field=temp_celsius&from=900&to=600", 3000, out), SV_SERIES_OK);
+  SV_CHECK_STR(out, "{\"node\":1,\"field\":\"temp_celsius\",\"now\":3000,\"step\":300,\"rows\":["
+                    "[900,20.00,20.00,20.00,1],[600,21.00,21.00,21.00,1]]}");
+  SV_CHECK_EQ(answer(&series, "GET /aggregate?node=1&field=temp_celsius&from=900", 3000, out), SV_SERIES_OK);
+  SV_CHECK_STR(out, "{\"node\":1,\"field\":\"temp_celsius\",\"now\":3000,\"mean\":16.90,\"min\":-1.50,\"max\":23.00,\"count\":5}");
+
+  // a field never received, and a node never heard
+  SV_CHECK_EQ(answer(&series, "GET /aggregate?node=1&field=qtd_chuva&from=900", 3000, out), SV_SERIES_OK);
+  SV_CHECK_STR(out, "{\"node\":1,\"field\":\"qtd_chuva\",\"now\":3000,\"count\":0}");
+  SV_CHECK_EQ(answer(&series, "GET /series?node=1&field=qtd_chuva&from=900", 3000, out), SV_SERIES_OK);
+  SV_CHECK_STR(out, "{\"node\":1,\"field\":\"qtd_chuva\",\"now\":3000,\"step\":300,\"rows\":[]}");
+  SV_CHECK_EQ(answer(&series, "GET /series?node=9&field=temp_celsius&from=900", 3000, out), SV_SERIES_NOT_FOUND);
+
+  // a summary frame brings the extremes of its window and counts as its 3 readings
+  reading(&data, 1, 10.0f);
+  memset(&summary, 0, sizeof(summary));
+  summary.min[SV_FIELD_AIR_TEMP] = 5.0f;
+  summary.max[SV_FIELD_AIR_TEMP] = 31.25f;
+  summary.samples[SV_FIELD_AIR_TEMP] = 3;
+  sv_series_add(&series, &data, &summary, 3600);
+  SV_CHECK_EQ(answer(&series, "GET /series?node=1&field=temp_celsius&from=0", 3600, out), SV_SERIES_OK);
+  SV_CHECK_STR(out, "{\"node\":1,\"field\":\"temp_celsius\",\"now\":3600,\"step\":300,\"rows\":[[0,10.00,5.00,31.25,3]]}");
+  // one more reading: the mean of the 4 readings, not of the 2 frames
+  add_temp(&series, 1, 14.0f, 3660);
+  SV_CHECK_EQ(answer(&series, "GET /aggregate?node=1&field=temp_celsius&from=0", 3660, out), SV_SERIES_OK);
+  SV_CHECK_STR(out, "{\"node\":1,\"field\":\"temp_celsius\",\"now\":3660,\"mean\":11.00,\"min\":5.00,\"max\":31.25,\"count\":4}");
+
+  // a row reused one lap later no longer shows the old bucket
+  add_temp(&series, 1, 30.0f, 2100 + SV_SERIES_ROWS_0 * SV_SERIES_STEP_0);
+  sv_series_cell_t cell;
+  const sv_series_node_t *entry = sv_series_lookup(&series, 1, false);
+  SV_CHECK(!sv_series_cell(entry, 0, SV_FIELD_AIR_TEMP, 2100 / SV_SERIES_STEP_0, &cell));
+  SV_CHECK(sv_series_cell(entry, 0, SV_FIELD_AIR_TEMP, 2100 / SV_SERIES_STEP_0 + SV_SERIES_ROWS_0, &cell));
+  SV_CHECK_EQ(cell.sum, 3000);
+  SV_CHECK(sv_series_cell(entry, 1, SV_FIELD_AIR_TEMP, 0, &cell));     // the 1 h bucket is kept longer
+  SV_CHECK_EQ(cell.count, 5);
+
+  // the store is full: a node after the first SV_SERIES_NODES is not kept
+  for (uint8_t node = 2; node <= SV_SERIES_NODES + 1; node++){
+    add_temp(&series, node, 1.0f, 3000);
+  }
+  SV_CHECK(sv_series_lookup(&series, SV_SERIES_NODES, false) != NULL);
+  SV_CHECK(sv_series_lookup(&series, SV_SERIES_NODES + 1, false) == NULL);
+}
+
+// Ten days of readings every 5 min, each range answered by the finest tier keeping all its buckets
+static void test_ranges(void){
+  static sv_series_t series;
+  static const uint32_t from[] = {3600, 3 * 3600, 47 * SV_SERIES_STEP_0, 47 * SV_SERIES_STEP_1, 27 * SV_SERIES_STEP_2};
+  static const uint8_t tier[] = {0, 0, 0, 1, 27 * SV_SERIES_STEP_2 < SV_SERIES_ROWS_1 * SV_SERIES_STEP_1 ? 1 : 2};
+  const uint32_t end = 10 * 86400;
+  uint8_t i;
+
+  sv_series_init(&series);
+  for (uint32_t t = 0; t <= end; t += 300){
+    add_temp(&series, 1, (float)((int)(t / 300 * 37 % 2000) - 1000) / 100, t);
+  }
+  const sv_series_node_t *entry = sv_series_lookup(&series, 1, false);
+
+  for (i = 0; i < sizeof(from) / sizeof(from[0]); i++){
+    sv_series_cell_t cell;
+    uint32_t step = sv_series_step[tier[i]];
+    uint32_t start = (end - from[i]) / step * step;     // whole buckets at the ends
+    uint32_t count = 0;
+    int32_t sum = 0;
+    int32_t min = INT32_MAX;
+    int32_t max = INT32_MIN;
+
+    for (uint32_t t = start; t <= end; t += 300){
+      int32_t raw = (int32_t)(t / 300 * 37 % 2000) - 1000;
+      count++;
+      sum += raw;
+      min = raw < min ? raw : min;
+      max = raw > max ? raw : max;
+    }
+    SV_CHECK_EQ(sv_series_tier(end, from[i]), tier[i]);
+    SV_CHECK(sv_series_aggregate(entry, SV_FIELD_AIR_TEMP, end, from[i], 0, &cell));
+    SV_CHECK_EQ(cell.count, count);
+    SV_CHECK_EQ(cell.sum, sum);
+    SV_CHECK_EQ(cell.min, min);
+    SV_CHECK_EQ(cell.max, max);
+  }
+  // older than the coarsest tier: what is left of the range
+  sv_series_cell_t cell;
+  SV_CHECK_EQ(sv_series_tier(end, 30 * 86400), SV_SERIES_TIERS - 1);
+  SV_CHECK(sv_series_aggregate(entry, SV_FIELD_AIR_TEMP, end, 30 * 86400, 0, &cell));
+  SV_CHECK(cell.count <= SV_SERIES_ROWS_2 * SV_SERIES_STEP_2 / 300);
+  if (end > SV_SERIES_ROWS_2 * SV_SERIES_STEP_2){
+    SV_CHECK(!sv_series_aggregate(entry, SV_FIELD_AIR_TEMP, end, 30 * 86400, 29 * 86400, &cell));
+  }
+}
+
+// Memory and time of /aggregate for 1 to SV_SERIES_NODES nodes, ten days of readings of every field
+//  every 5 min, the node queried is the last one found by sv_series_lookup()
+static void test_bench(void){
+  static sv_series_t series;
+  static const uint8_t nodes[] = {1, 4, 16};
+  static const uint32_t from[] = {3600, 2 * 86400 - SV_SERIES_STEP_1, 7 * 86400 - SV_SERIES_STEP_2};
+  struct all_sensors_data data;
+  const uint32_t end = 10 * 86400;
+  volatile int32_t sink = 0;
+  uint8_t field;
+  uint8_t i;
+  uint8_t j;
+
+  sv_series_init(&series);
+  for (uint32_t t = 0; t <= end; t += 300){
+    memset(&data, 0, sizeof(data));
+    for (field = 0; field < SV_FIELD_COUNT; field++){
+      sv_field_set(&data, (sv_field_t)field, sv_field_from_raw((sv_field_t)field, (int32_t)(t / 300 * 37 % 200)));
+    }
+    for (data.node = 1; data.node <= SV_SERIES_NODES; data.node++){
+      sv_series_add(&series, &data, NULL, t);
+    }
+  }
+
+  for (i = 0; i < sizeof(nodes) / sizeof(nodes[0]); i++){
+    double ns[sizeof(from) / sizeof(from[0])];
+    for (j = 0; j < sizeof(from) / sizeof(from[0]); j++){
+      sv_series_cell_t cell;
+      memset(&cell, 0, sizeof(cell));
+      clock_t start = clock();
+      for (uint32_t q = 0; q < BENCH_QUERIES; q++){
+        const sv_series_node_t *entry = sv_series_lookup(&series, nodes[i], false);
+        sv_series_aggregate(entry, (sv_field_t)(q % SV_FIELD_COUNT), end, from[j], 0, &cell);
+        sink += cell.sum;
+      }
+      ns[j] = (double)(clock() - start) * 1e9 / CLOCKS_PER_SEC / BENCH_QUERIES;
+      SV_CHECK(cell.count > 0);
+    }
+    printf("series: %2u nodes, tiers %u x %u s / %u x %u s / %u x %u s, %.1f KB, aggregate 1 h / 2 d / 7 d: %.0f / %.0f / %.0f ns\n",
+           (unsigned)nodes[i], SV_SERIES_ROWS_0, SV_SERIES_STEP_0, SV_SERIES_ROWS_1, SV_SERIES_STEP_1,
+           SV_SERIES_ROWS_2, SV_SERIES_STEP_2, nodes[i] * sizeof(sv_series_node_t) / 1024.0, ns[0], ns[1], ns[2]);
+  }
+  SV_CHECK_EQ(sizeof(sv_series_node_t) % 4, 0);
+  SV_CHECK(sizeof(sv_series_node_t) >= SV_SERIES_ROWS * (4 + SV_FIELD_COUNT * (2 + 2 + 2 + 4)));
+}
+
+int main(){
+  test_query_parse();
+  test_json();
+  test_answers();
+  test_ranges();
+  test_bench();
+  return sv_test_end(TEST_NAME);
+}